@@ -34,18 +34,75 @@
 #define PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED        ( 1 )
 #define PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED    ( 1 )
 #define PETITMODBUS_READ_INPUT_REGISTERS_ENABLED        ( 1 )
+// Extra function codes appended to the built-in function table
+// each entry is { code, length predictor, handler }
+// #define PETIT_USER_FUNCTIONS { 0x41U, PetitFnLenFixed, MyHandler },
+// Set to 1 to build the asynchronous master in PetitMaster.c
+// #define PETITMODBUS_MASTER_ENABLED                   ( 1 )
+// Set to 1 to build the Modbus TCP gateway in PetitGateway.c on the master
+// #define PETITMODBUS_GATEWAY_ENABLED                  ( 1 )
+// Set to 1 to build the typed points in PetitPoint.c.  C51 has no 64-bit
+// double, so only 32-bit points are available.
+// #define PETITMODBUS_POINTS_ENABLED                   ( 1 )
 // Where to process our modbus message
 // 0 for processing in its own cycle
 // 1 for processing in the same cycle as TX CRC calculation
+// 2 for processing and TX CRC calculation in the RX interrupt on the last
+//   byte, so only the turnaround is left to the main loop.  Registers and
+//   coils are then read and written from the interrupt.
 #define PETITMODBUS_PROCESS_POSITION                    ( 0 )
 // Cycles to delay TX once the CRC finishes calculation
 // this can either be a define as stated here or an integer changed by the
 // application code
 // #define PETITMODBUS_DLY_TOP (0)
+// Or a turnaround in PetitPortClock ticks from the end of the request instead
+// of the loop counter.  PETIT_T35_US(baud) is t3.5 for a microsecond clock.
+// #define PETITMODBUS_TURNAROUND PETIT_T35_US(19200)
+// Or set to 1 if a one-shot timer armed in PetitPortTimerStop calls
+// PetitTxTurnaround when the turnaround is over
+// #define PETITMODBUS_TURNAROUND_TIMER (1)
 // Address of this device
 // this can either be a define as stated here or an integer changed by the
 // application code
 // #define PETITMODBUS_SLAVE_ADDRESS (1)
+// Set to 1 to trace state transitions and keep latency histograms
+// this requires PetitPortClock.  the histograms take 816 bytes of XRAM with
+// the default 17 codes and 8 bins, 168 bytes with the two below
+// #define PETIT_TRACE (1)
+// #define PETIT_TRACE_CODES (7)
+// #define PETIT_TRACE_BINS (4)
+// Set to 1 to stream read register responses from the registers as they are
+// sent, so reads of up to 125 registers fit the small buffer above.  The
+// register read callbacks are then called from PetitTxBufferPop.
+// #define PETIT_STREAM (1)
+// Set to 1 to stage the data of functions 15 and 16 in a shadow bank as it is
+// received, so writes of up to 123 registers fit the small buffer above too.
+// The bank is as big as the largest write the configuration accepts.
+// #define PETIT_SHADOW (1)
+// Set to 1 to let a master switch to jumbo frames, whose 16-bit byte counts
+// only pay off with a buffer far bigger than the one above
+// #define PETIT_JUMBO (1)
+// Set to 1 to build the bus monitor of PetitSniff.c, which needs
+// PetitPortClock and PETIT_SNIFF_SIZE bytes of XRAM for its capture ring
+// #define PETIT_SNIFF (1)
+// Set to 1 to let the UART interrupt only push bytes into the receive ring
+// of PetitRxRing.c with PETIT_RXRING_PUSH, drained by PETIT_MODBUS_Process.
+// It needs PetitPortClock and three bytes of XRAM per byte of
+// PETIT_RXRING_SIZE.
+// #define PETIT_RXRING (1)
+// Set to 1 to persist the registers written by functions 6 and 16 in the
+// journal of PetitJournal.c, which needs PetitPortFlashRead, Write and Erase
+// over two flash pages of PETIT_JOURNAL_SECTOR bytes
+// #define PETIT_JOURNAL (1)
+// Set to 1 to count the reads and writes of every register and block of
+// coils in PetitHeat.c, two bytes of XRAM per register and block and table
+// #define PETIT_HEAT (1)
+// Set to 1 to log the registers written by functions 6 and 16 for the delta
+// reads of PetitDelta.c, two bytes of XRAM per entry of PETIT_DELTA_LOG
+// #define PETIT_DELTA (1)
+// Set to 1 to build PETIT_MODBUS_ProcessBatch for frames that arrive
+// already delimited, as in gateways and replay tools
+// #define PETIT_BATCH (1)
 // Allow LED functions to be specified by the user
 // 0 to leave blank functions
 // 1 to allow user-defined functions
@@ -64,6 +121,30 @@
 #define PETIT_REG PETIT_EXTERNAL
 
 #define PETIT_INPUT_REG PETIT_INTERNAL
+
+// byte order of PetitRegisters and PetitInputRegisters
+// PETIT_REG_NATIVE as the CPU stores a pu16_t
+// PETIT_REG_WIRE big-endian as in a frame, so functions 3, 4 and 16 copy
+//     internal registers as one block.  access them with PETIT_REG_LOAD and
+//     PETIT_REG_STORE.  C51 is big-endian already, so setting PETIT_SWAP to
+//     PETIT_SWAP_COPY gets the block copy without changing the order.
+// #define PETIT_REG_ORDER PETIT_REG_NATIVE
+
+// read-only registers the application defines in code memory as
+// PETIT_CODE const pu16_t PetitConstRegisters[] and PetitConstInputRegisters[].
+// they take no RAM and no callback, and follow the RAM registers unless a
+// base is given
+// #define NUMBER_OF_CONST_PETITREGISTERS (4)
+// #define PETIT_CONST_REG_BASE (0x100)
+// #define NUMBER_OF_CONST_INPUT_PETITREGISTERS (4)
+// #define PETIT_CONST_INPUT_REG_BASE (0x100)
+
+// where the frame buffer lives
+// PETIT_INTERNAL in every instance, sized from NUMBER_OF_REGISTERS_IN_BUFFER
+// PETIT_EXTERNAL set by PETIT_MODBUS_Set_Buffer or borrowed from a pool set
+//     by PETIT_MODBUS_Set_Pool; then define PETIT_ENTER_CRITICAL() and
+//     PETIT_EXIT_CRITICAL() to guard the pool
+// #define PETIT_BUFFER PETIT_INTERNAL
 /*****************************************************************************
  */
 // define this to let the CRC table reside in code memory rather than RAM
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Builds PetitBench for every CRC and storage mode and runs it, then for
+# every way of converting internal registers to and from a frame, with
+# streamed responses, with staged writes, with the tables in a shared
+# register file, with a receive ring, with the access heatmap and with jumbo
+# frames built in, though the cases use standard frames.  Last it runs
+# PetitTraceCheck with the default and with small histograms, PetitLoopback
+# without and with the cache of the gateway, and PetitCxxCheck with either
+# CRC.
+#
+# usage: exam/host/bench.sh [iterations]
+# CC, CFLAGS, CXX and CXXFLAGS are taken from the environment, CXXFLAGS
+# defaults to CFLAGS.
+
+HOST=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HOST/../.." && pwd)
+OUT=${TMPDIR:-/tmp}/petit-bench.$$
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:-$CFLAGS}
+mkdir -p "$OUT" || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+status=0
+for crc in PETIT_CRC_TABULAR PETIT_CRC_BITWISE PETIT_CRC_EXTERNAL; do
+	for reg in PETIT_INTERNAL PETIT_EXTERNAL PETIT_BOTH; do
+		for coil in PETIT_INTERNAL PETIT_EXTERNAL PETIT_BOTH; do
+			$CC $CFLAGS -I"$HOST/inc" -I"$ROOT/inc" \
+				-DPETIT_CRC=$crc -DPETIT_REG=$reg -DPETIT_COIL=$coil \
+				-o "$OUT/PetitBench" "$HOST/src/PetitBench.c" \
+				"$HOST/src/PetitModbusPort.c" "$ROOT"/src/*.c || exit 1
+			"$OUT/PetitBench" "$@" || status=1
+		done
+	done
+done
+for variant in "-DPETIT_SWAP=PETIT_SWAP_SCALAR" "" \
+		"-DPETIT_REG_ORDER=PETIT_REG_WIRE" "-DPETIT_STREAM=1" \
+		"-DPETIT_SHADOW=1" "-DPETIT_SHM=1" "-DPETIT_RXRING=1" \
+		"-DPETIT_HEAT=1" "-DPETIT_JUMBO=1" "-DPETIT_DELTA=1"; do
+	$CC $CFLAGS -I"$HOST/inc" -I"$ROOT/inc" $variant \
+		-o "$OUT/PetitBench" "$HOST/src/PetitBench.c" \
+		"$HOST/src/PetitModbusPort.c" "$ROOT"/src/*.c || exit 1
+	"$OUT/PetitBench" "$@" || status=1
+done
+for variant in "" "-DPETIT_TRACE_CODES=7 -DPETIT_TRACE_BINS=4"; do
+	$CC $CFLAGS -I"$HOST/inc" -I"$ROOT/inc" -DPETIT_TRACE=1 $variant \
+		-o "$OUT/PetitTraceCheck" "$HOST/src/PetitTraceCheck.c" \
+		"$HOST/src/PetitModbusPort.c" "$ROOT"/src/*.c || exit 1
+	"$OUT/PetitTraceCheck" || status=1
+done
+for variant in "" "-DPETITGW_CACHE_TTL=50"; do
+	$CC $CFLAGS -I"$HOST/inc" -I"$ROOT/inc" -DPETITMODBUS_MASTER_ENABLED=1 \
+		-DPETITMODBUS_GATEWAY_ENABLED=1 $variant \
+		-o "$OUT/PetitLoopback" "$HOST/src/PetitLoopback.c" \
+		"$HOST/src/PetitModbusPort.c" "$ROOT"/src/*.c || exit 1
+	"$OUT/PetitLoopback" || status=1
+done
+for variant in "" "-DPETIT_CRC=PETIT_CRC_BITWISE"; do
+	rm -f "$OUT"/*.o
+	for src in "$HOST/src/PetitModbusPort.c" "$ROOT"/src/*.c; do
+		$CC $CFLAGS -I"$HOST/inc" -I"$ROOT/inc" $variant -c \
+			-o "$OUT/$(basename "$src" .c).o" "$src" || exit 1
+	done
+	$CXX -std=c++11 $CXXFLAGS -I"$HOST/inc" -I"$ROOT/inc" $variant \
+		-o "$OUT/PetitCxxCheck" "$HOST/src/PetitCxxCheck.cpp" \
+		"$OUT"/*.o || exit 1
+	"$OUT/PetitCxxCheck" "$@" || status=1
+done
+exit $status
@@ -0,0 +1,35 @@
+/*******************************************************************************
+ * @file PetitModbusHost.h
+ * This file declares what the host port offers to the host tools on top of
+ * the regular porting functions.
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#ifndef INC_PETITMODBUSHOST_H_
+#define INC_PETITMODBUSHOST_H_
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int PetitHostTxTake(void);
+void PetitHostClock(pu16_t (*Clock)(void));
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+int PetitHostFlash(const char *Path);
+void PetitHostFlashCut(long Bytes);
+void PetitHostFlashStats(unsigned long *Written, unsigned long *Erases);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* INC_PETITMODBUSHOST_H_ */
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * PetitModbusUserPort.h
+ *
+ *  Configuration of PetitModbus for host builds (Linux, macOS) used by the
+ *  benchmark and the host tools.  The CRC and storage modes may be overridden
+ *  on the compiler command line, for example
+ *  -DPETIT_CRC=PETIT_CRC_BITWISE -DPETIT_REG=PETIT_EXTERNAL
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#ifndef INC_PETITMODBUSUSERPORT_H_
+#define INC_PETITMODBUSUSERPORT_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#define NUMBER_OF_PETITCOILS                            ( 2000 )
+#define NUMBER_OF_PETITDISCRETES                        ( 2000 )
+// Petit Modbus RTU Slave Output Register Number
+// Have to put a number of registers here
+// It has to be bigger than 0 (zero)!!
+#ifndef NUMBER_OF_PETITREGISTERS
+#define NUMBER_OF_PETITREGISTERS                        ( 256 )
+#endif
+#ifndef NUMBER_OF_INPUT_PETITREGISTERS
+#define NUMBER_OF_INPUT_PETITREGISTERS                  ( 256 )
+#endif
+#ifndef NUMBER_OF_REGISTERS_IN_BUFFER
+#define NUMBER_OF_REGISTERS_IN_BUFFER                   ( 125 )
+#endif
+// -DNUMBER_OF_CONST_PETITREGISTERS=4 and the like add the read-only tables
+// of PetitModbusPort.c after the RAM registers
+// -DPETIT_SHM=1 keeps the RAM tables in the shared register file of
+// PetitShm.c, for PetitShmSim
+// -DPETIT_HEAT=1 builds the access heatmap of PetitHeat.c, for PetitHeatMap
+// -DPETIT_DELTA=1 builds the delta reads of PetitDelta.c, for PetitDeltaSim
+// -DPETIT_JUMBO=1 with a larger NUMBER_OF_REGISTERS_IN_BUFFER and
+// NUMBER_OF_PETITREGISTERS builds the jumbo frames PetitJumbo measures
+// -DPETIT_RXRING=1 feeds the slaves of PetitBench and PetitBusSim through
+// the receive ring of PetitRxRing.c
+
+#define PETITMODBUS_READ_COILS_ENABLED                  ( 1 )
+#define PETITMODBUS_READ_DISCRETES_ENABLED              ( 1 )
+#define PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED      ( 1 )
+#define PETITMODBUS_WRITE_SINGLE_COIL_ENABLED           ( 1 )
+#define PETITMODBUS_WRITE_SINGLE_REGISTER_ENABLED       ( 1 )
+#define PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED        ( 1 )
+#define PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED    ( 1 )
+#define PETITMODBUS_READ_INPUT_REGISTERS_ENABLED        ( 1 )
+// PETIT_MODBUS_ProcessBatch for delimited frames
+#ifndef PETIT_BATCH
+#define PETIT_BATCH                                     ( 1 )
+#endif
+// bus monitor in PetitSniff.c
+#ifndef PETIT_SNIFF
+#define PETIT_SNIFF                                     ( 1 )
+#endif
+// typed points in PetitPoint.c
+#ifndef PETITMODBUS_POINTS_ENABLED
+#define PETITMODBUS_POINTS_ENABLED                      ( 1 )
+#endif
+// Where to process our modbus message
+// 0 for processing in its own cycle
+// 1 for processing in the same cycle as TX CRC calculation
+// 2 for processing in the RX interrupt on the last byte
+#ifndef PETITMODBUS_PROCESS_POSITION
+#define PETITMODBUS_PROCESS_POSITION                    ( 0 )
+#endif
+// Cycles to delay TX once the CRC finishes calculation
+// an integer so the host tools can change it
+extern uint16_t PETITMODBUS_DLY_TOP;
+// Address of this device
+// an integer so the host tools can run several slaves, one per thread with
+// -DPETIT_HOST_TLS=__thread
+#ifndef PETIT_HOST_TLS
+#define PETIT_HOST_TLS
+#endif
+extern PETIT_HOST_TLS uint8_t PETITMODBUS_SLAVE_ADDRESS;
+// Allow LED functions to be specified by the user
+#define PETIT_USER_LED PETIT_USER_LED_NONE
+
+// how to process the CRC
+#ifndef PETIT_CRC
+#define PETIT_CRC PETIT_CRC_TABULAR
+#endif
+
+#ifndef PETIT_COIL
+#define PETIT_COIL PETIT_INTERNAL
+#endif
+#ifndef PETIT_DISCRETE
+#define PETIT_DISCRETE PETIT_COIL
+#endif
+#ifndef PETIT_REG
+#define PETIT_REG PETIT_INTERNAL
+#endif
+#ifndef PETIT_INPUT_REG
+#define PETIT_INPUT_REG PETIT_REG
+#endif
+/*****************************************************************************
+ */
+// there is no separate code memory on the host
+#define PETIT_CODE
+#define PETIT_FLASH_ATTR
+// define this for booleans
+#define pb_t bool
+// define this for unsigned octets
+#define pu8_t uint8_t
+// define this for 16-bit unsigned
+#define pu16_t uint16_t
+// define these for 32-bit and 64-bit integers of typed points
+#define pu32_t uint32_t
+#define ps32_t int32_t
+#define pu64_t uint64_t
+#ifdef __cplusplus
+}
+#endif
+#endif /* INC_PETITMODBUSUSERPORT_H_ */
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
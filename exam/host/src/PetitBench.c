@@ -0,0 +1,439 @@
+/*******************************************************************************
+ * @file PetitBench.c
+ * Host benchmark of the cost of one frame for every function code.
+ *
+ * Every case feeds a synthetic request through PetitRxBufferInsert, runs
+ * PETIT_MODBUS_Process until the response starts and drains it with
+ * PetitTxBufferPop, timing the three parts separately, and then the same
+ * request in batches through PETIT_MODBUS_ProcessBatch.  The CRC and storage
+ * modes are fixed at compile time; bench.sh builds and runs every
+ * combination of them.  Built with PETIT_RXRING the request is pushed into a
+ * receive ring instead, so the RX time is what the interrupt spends and the
+ * drain counts as processing.
+ *
+ * usage: PetitBench [iterations]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC (1)
+#endif
+
+#include "PetitModbusHost.h"
+#if PETIT_RXRING > 0
+#include "PetitRxRing.h"
+#endif
+
+// +1 slave address; +1 function; +4 fields; +1 byte count; +2 CRC16
+#define C_BENCH_FRAME_SIZE (C_PETITMODBUS_RXTX_BUFFER_SIZE)
+#if defined(PETIT_SHM) && PETIT_SHM > 0
+#define BENCH_SHM ", shared"
+#else
+#define BENCH_SHM ""
+#endif
+#if defined(PETIT_HEAT) && PETIT_HEAT > 0
+#define BENCH_HEAT ", heatmap"
+#else
+#define BENCH_HEAT ""
+#endif
+#if defined(PETIT_DELTA) && PETIT_DELTA > 0
+#define BENCH_DELTA ", delta log"
+#else
+#define BENCH_DELTA ""
+#endif
+
+typedef struct
+{
+	pu8_t Function;
+	pu16_t Count;
+} T_BENCH_CASE;
+
+static const T_BENCH_CASE bench_cases[] =
+{
+	{ C_FCODE_READ_COILS, 1 },
+	{ C_FCODE_READ_COILS, 256 },
+	{ C_FCODE_READ_COILS, 2000 },
+	{ C_FCODE_READ_DISCRETES, 1 },
+	{ C_FCODE_READ_DISCRETES, 2000 },
+	{ C_FCODE_READ_HOLDING_REGISTERS, 1 },
+	{ C_FCODE_READ_HOLDING_REGISTERS, 8 },
+	{ C_FCODE_READ_HOLDING_REGISTERS, 32 },
+	{ C_FCODE_READ_HOLDING_REGISTERS, 125 },
+	{ C_FCODE_READ_INPUT_REGISTERS, 1 },
+	{ C_FCODE_READ_INPUT_REGISTERS, 125 },
+	{ C_FCODE_WRITE_SINGLE_COIL, 1 },
+	{ C_FCODE_WRITE_SINGLE_REGISTER, 1 },
+	{ C_FCODE_WRITE_MULTIPLE_COILS, 1 },
+	{ C_FCODE_WRITE_MULTIPLE_COILS, 256 },
+	{ C_FCODE_WRITE_MULTIPLE_COILS, 1968 },
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, 1 },
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, 8 },
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, 32 },
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, 123 },
+};
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @return the cost of one call to bench_ns in nanoseconds
+ */
+static double bench_overhead(void)
+{
+	uint64_t start = bench_ns();
+	int i;
+
+	for (i = 0; i < 100000; i++)
+	{
+		bench_ns();
+	}
+	return (double) (bench_ns() - start) / 100000.0;
+}
+
+/**
+ * @return time stamp counter ticks per nanosecond, 0 without a counter
+ */
+static double bench_tsc_rate(void)
+{
+#if defined(BENCH_HAVE_TSC)
+	uint64_t ns = bench_ns();
+	uint64_t tsc = __rdtsc();
+	while (bench_ns() - ns < 50000000U)
+		;
+	return (double) (__rdtsc() - tsc) / (double) (bench_ns() - ns);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Builds the request ADU of a case for this slave.
+ * @return the length of the request, CRC included
+ */
+static pu16_t bench_request(const T_BENCH_CASE *Case, pu8_t *Adu)
+{
+	static T_PETIT_MODBUS crc;
+	pu16_t len = 6U;
+	pu16_t i;
+
+	Adu[0] = PETITMODBUS_SLAVE_ADDRESS;
+	Adu[1] = Case->Function;
+	Adu[2] = 0;
+	Adu[3] = 0;
+	Adu[4] = Case->Count >> 8;
+	Adu[5] = Case->Count;
+	switch (Case->Function)
+	{
+	case C_FCODE_WRITE_SINGLE_COIL:
+		Adu[4] = 0xFF;
+		Adu[5] = 0;
+		break;
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		Adu[4] = 0x12;
+		Adu[5] = 0x34;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		Adu[len++] = (Case->Count + 7U) >> 3;
+		for (i = 0; i < Adu[6]; i++)
+			Adu[len++] = 0xA5 ^ i;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		Adu[len++] = 2U * Case->Count;
+		for (i = 0; i < Adu[6]; i++)
+			Adu[len++] = i;
+		break;
+	default:
+		break;
+	}
+	PetitCRC16(&crc, Adu, len);
+	Adu[len++] = crc.CRC16;
+	Adu[len++] = crc.CRC16 >> 8;
+	return len;
+}
+
+/**
+ * Runs one frame through the slave.
+ * @param[out] Ns the time spent in RX, process and TX
+ * @return the length of the response, 0 if the slave did not answer
+ */
+static pu16_t bench_frame(T_PETIT_MODBUS *Petit, const pu8_t *Req,
+		pu16_t Len, pu8_t *Rsp, uint64_t Ns[3])
+{
+	uint64_t t0, t1, t2, t3;
+	pu16_t n = 0;
+	pu16_t i;
+	int first = -1;
+
+#if PETIT_RXRING > 0
+	// the main loop drains the ring whenever it would fill up
+	t1 = 0;
+	for (i = 0; i < Len; )
+	{
+		pu16_t end = (unsigned) (Len - i) > PETIT_RXRING_SIZE
+				? i + PETIT_RXRING_SIZE : Len;
+		t0 = bench_ns();
+		for (; i < end; i++)
+		{
+			PETIT_RXRING_PUSH(Petit->Rx_Ring, Req[i]);
+		}
+		t2 = bench_ns();
+		PETIT_RXRING_Drain(Petit);
+		t3 = bench_ns();
+		Ns[0] += t2 - t0;
+		t1 += t3 - t2;
+	}
+	Ns[1] += t1;
+	t1 = bench_ns();
+#else
+	t0 = bench_ns();
+	for (i = 0; i < Len; i++)
+	{
+		PetitRxBufferInsert(Petit, Req[i]);
+	}
+	t1 = bench_ns();
+#endif
+	for (i = 0; i < 16U && first < 0; i++)
+	{
+		PETIT_MODBUS_Process(Petit);
+		first = PetitHostTxTake();
+	}
+	t2 = bench_ns();
+	if (first < 0)
+	{
+		PetitRxBufferReset(Petit);
+		return 0;
+	}
+	Rsp[n++] = first;
+	while (PetitTxBufferPop(Petit, &Rsp[n]))
+	{
+		n++;
+	}
+	t3 = bench_ns();
+#if PETIT_RXRING == 0
+	Ns[0] += t1 - t0;
+#endif
+	Ns[1] += t2 - t1;
+	Ns[2] += t3 - t2;
+	return n;
+}
+
+#if PETIT_RXRING > 0
+/**
+ * A clock as cheap to read as the timer register of a target, rather than
+ * the clock of the host, which would cost more than the rest of the push.
+ * It only has to move for the framing to work.
+ */
+static pu16_t bench_clock(void)
+{
+	static pu16_t ticks;
+	return ticks++;
+}
+#endif
+
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+// requests per call of PETIT_MODBUS_ProcessBatch
+#define C_BENCH_BATCH (16U)
+
+/**
+ * Runs a frame through PETIT_MODBUS_ProcessBatch.
+ * @return the time per frame in nanoseconds, negative if a response differs
+ *   from Rsp
+ */
+static double bench_batch(T_PETIT_MODBUS *Petit, const pu8_t *Req, pu16_t Len,
+		const pu8_t *Rsp, pu16_t Rsp_Len, long Iterations)
+{
+	static T_PETIT_ADU adus[C_BENCH_BATCH];
+	static pu8_t arena[C_BENCH_BATCH * C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	long rounds = Iterations / C_BENCH_BATCH + 1;
+	uint64_t t0;
+	long r;
+	unsigned i;
+
+	for (i = 0; i < C_BENCH_BATCH; i++)
+	{
+		adus[i].Req = Req;
+		adus[i].Req_Len = Len;
+	}
+	if (PETIT_MODBUS_ProcessBatch(Petit, adus, C_BENCH_BATCH, arena,
+			sizeof(arena)) != C_BENCH_BATCH)
+	{
+		return -1;
+	}
+	for (i = 0; i < C_BENCH_BATCH; i++)
+	{
+		if (adus[i].Rsp_Len != Rsp_Len
+				|| memcmp(adus[i].Rsp, Rsp, Rsp_Len) != 0)
+		{
+			return -1;
+		}
+	}
+	t0 = bench_ns();
+	for (r = 0; r < rounds; r++)
+	{
+		PETIT_MODBUS_ProcessBatch(Petit, adus, C_BENCH_BATCH, arena,
+				sizeof(arena));
+	}
+	return (double) (bench_ns() - t0) / (double) (rounds * C_BENCH_BATCH);
+}
+#endif
+
+static const char *crc_name(void)
+{
+#if PETIT_CRC == PETIT_CRC_TABULAR
+	return "tabular";
+#elif PETIT_CRC == PETIT_CRC_BITWISE
+	return "bitwise";
+#else
+	return "external";
+#endif
+}
+
+static const char *swap_name(void)
+{
+#if PETIT_REG_ORDER == PETIT_REG_WIRE
+	return "wire order";
+#elif PETIT_SWAP == PETIT_SWAP_COPY
+	return "native order, copy";
+#elif PETIT_SWAP == PETIT_SWAP_SSE2
+	return "native order, sse2";
+#elif PETIT_SWAP == PETIT_SWAP_NEON
+	return "native order, neon";
+#else
+	return "native order, scalar";
+#endif
+}
+
+static const char *storage_name(int Mode)
+{
+	return Mode == PETIT_INTERNAL ? "internal" :
+			Mode == PETIT_EXTERNAL ? "external" : "both";
+}
+
+int main(int argc, char **argv)
+{
+	static T_PETIT_MODBUS petit;
+	static pu8_t req[C_BENCH_FRAME_SIZE];
+	static pu8_t rsp[C_BENCH_FRAME_SIZE];
+	long iterations = argc > 1 ? atol(argv[1]) : 20000;
+	double overhead = bench_overhead();
+	double rate = bench_tsc_rate();
+	unsigned c;
+	int failed = 0;
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+#if PETIT_RXRING > 0
+	{
+		static T_PETIT_RXRING ring;
+		PetitHostClock(bench_clock);
+		PETIT_RXRING_Init(&ring, PETIT_T35_US(19200));
+		PETIT_MODBUS_Set_RxRing(&petit, &ring);
+	}
+#endif
+
+	printf("# crc %s, registers %s (%s), coils %s, process position %d"
+			"%s%s%s%s%s%s%s\n", crc_name(), storage_name(PETIT_REG), swap_name(),
+			storage_name(PETIT_COIL), PETITMODBUS_PROCESS_POSITION,
+			PETIT_STREAM > 0 ? ", streamed" : "",
+			PETIT_SHADOW > 0 ? ", staged" : "", BENCH_SHM,
+			PETIT_RXRING > 0 ? ", rx ring" : "", BENCH_HEAT,
+			PETIT_JUMBO > 0 ? ", jumbo built in" : "", BENCH_DELTA);
+	printf("# %-4s %5s %5s %10s %8s %9s %9s %9s %9s\n", "fc", "count",
+			"bytes", "ns/frame", "cyc/B", "rx ns", "proc ns", "tx ns",
+			"batch ns");
+
+	for (c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++)
+	{
+		const T_BENCH_CASE *bc = &bench_cases[c];
+		pu16_t len = bench_request(bc, req);
+		uint64_t ns[3] = { 0, 0, 0 };
+		double part[3];
+		double total;
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+		double batch;
+#endif
+		pu16_t n = 0;
+		long i;
+		int k;
+
+		// one checked frame first, it also warms up the caches
+		n = bench_frame(&petit, req, len, rsp, ns);
+		if (n < 5U || (rsp[1] & 0x80U)
+				|| PetitCRC16(&petit, rsp, n) != 0)
+		{
+			printf("  %-4u %5u  FAILED\n", bc->Function, bc->Count);
+			failed = 1;
+			continue;
+		}
+		ns[0] = ns[1] = ns[2] = 0;
+		for (i = 0; i < iterations; i++)
+		{
+			bench_frame(&petit, req, len, rsp, ns);
+		}
+
+		total = 0;
+		for (k = 0; k < 3; k++)
+		{
+			part[k] = (double) ns[k] / (double) iterations - overhead;
+			if (part[k] < 0)
+				part[k] = 0;
+			total += part[k];
+		}
+		if (rate > 0)
+		{
+			printf("  %-4u %5u %5u %10.1f %8.2f %9.1f %9.1f %9.1f",
+					bc->Function, bc->Count, len + n, total,
+					total * rate / (double) (len + n), part[0], part[1],
+					part[2]);
+		}
+		else
+		{
+			printf("  %-4u %5u %5u %10.1f %8s %9.1f %9.1f %9.1f",
+					bc->Function, bc->Count, len + n, total, "-", part[0],
+					part[1], part[2]);
+		}
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+		batch = bench_batch(&petit, req, len, rsp, n, iterations);
+		if (batch < 0)
+		{
+			printf(" %9s\n", "FAILED");
+			failed = 1;
+		}
+		else
+		{
+			printf(" %9.1f\n", batch);
+		}
+#else
+		printf(" %9s\n", "-");
+#endif
+	}
+	return failed;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,824 @@
+/*******************************************************************************
+ * @file PetitBusSim.c
+ * Simulated RS-485 multi-drop bus for capacity planning.
+ *
+ * Runs several petitmodbus slaves on one virtual half-duplex bus.  Every
+ * character takes 11 bit times on the wire, the inter-frame timer fires after
+ * t3.5 of silence and every slave runs PETIT_MODBUS_Process once per main
+ * loop, so PETITMODBUS_DLY_TOP delays the response by whole loops as it does
+ * on a target.  Built with PETITMODBUS_TURNAROUND the slaves wait on the
+ * simulated clock instead, and built with PETITMODBUS_TURNAROUND_TIMER a
+ * one-shot timer of t3.5 armed at the end of the request sends the response.
+ * A scripted master polls the slaves back to back and the
+ * simulator reports bus occupancy, the response latency of every slave and
+ * the poll rate the segment can sustain.
+ *
+ * The script has one poll per line, "slave function address count", and
+ * lines starting with '#' are comments.  Without a script every slave is
+ * asked for ten holding registers.
+ *
+ * Built with PETIT_BUFFER PETIT_EXTERNAL the slaves borrow their buffers from
+ * a pool of -p buffers shared by all of them.
+ *
+ * With -w one more node monitors the bus and writes its capture to a file,
+ * for PetitSniffDump.
+ *
+ * Built with PETIT_RXRING the RX interrupt of every slave only pushes into a
+ * receive ring and wakes its main loop, which frames the requests from the
+ * stamps of the bytes.
+ *
+ * usage: PetitBusSim [-b baud] [-n slaves] [-l loop us] [-d dly top]
+ *                    [-c cycles] [-t timeout ms] [-w capture] [script]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "PetitModbusHost.h"
+#if PETIT_SNIFF > 0
+#include "PetitSniff.h"
+#endif
+#if PETIT_RXRING > 0
+#include "PetitRxRing.h"
+#endif
+
+#define SIM_MAX_SLAVES (247U)
+#define SIM_MAX_POLLS (256U)
+#define SIM_NEVER (UINT64_MAX)
+// start, 8 data bits, parity or second stop bit, stop
+#define SIM_CHAR_BITS (11U)
+
+typedef struct
+{
+	pu8_t Slave;
+	pu8_t Function;
+	pu16_t Address;
+	pu16_t Count;
+} T_SIM_POLL;
+
+typedef struct
+{
+	T_PETIT_MODBUS Petit;
+	pu8_t Address;
+	// next call to PETIT_MODBUS_Process, SIM_NEVER while it sleeps
+	uint64_t Loop;
+	unsigned long Calls;
+	// offset of the main loop of this slave within the loop period
+	uint64_t Phase;
+	// inter-frame timer deadline, SIM_NEVER while stopped
+	uint64_t Timer;
+	// turnaround timer deadline, SIM_NEVER while stopped
+	uint64_t Shot;
+#if PETIT_RXRING > 0
+	T_PETIT_RXRING Ring;
+#endif
+	unsigned long Polls;
+	unsigned long Answers;
+	unsigned long Timeouts;
+	// responses that started less than t3.5 after the request
+	unsigned long Early;
+	unsigned long Lat_Cnt;
+	uint64_t Lat_Sum;
+	uint64_t Lat_Min;
+	uint64_t Lat_Max;
+} T_SIM_SLAVE;
+
+typedef enum
+{
+	E_SIM_IDLE = 0,
+	E_SIM_SEND,
+	E_SIM_WAIT
+} T_SIM_MASTER_STATE;
+
+typedef struct
+{
+	T_SIM_MASTER_STATE State;
+	pu8_t Adu[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu16_t Len;
+	pu16_t Pos;
+	pu8_t Rsp[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu16_t Rsp_Len;
+	pu16_t Expected;
+	// when the master may send next, or gives up waiting
+	uint64_t Deadline;
+	// when the last byte of the request left the wire
+	uint64_t Req_End;
+	unsigned Poll;
+	// cycles started so far and when the last one started
+	unsigned long Starts;
+	uint64_t Cycle_Start;
+	uint64_t Cycle_Min;
+	uint64_t Cycle_Max;
+	unsigned long Bad_Frames;
+} T_SIM_MASTER;
+
+// node index 0 is the master, slave i is node i + 1
+typedef struct
+{
+	int Node;
+	pu8_t Byte;
+	// when the byte on the wire has been received completely
+	uint64_t Done;
+	// when the last byte was received completely
+	uint64_t Quiet;
+	uint64_t Busy;
+	unsigned long Collisions;
+} T_SIM_BUS;
+
+static T_SIM_SLAVE slaves[SIM_MAX_SLAVES];
+static unsigned slave_cnt = 4;
+static T_SIM_POLL polls[SIM_MAX_POLLS];
+static unsigned poll_cnt;
+static T_SIM_MASTER master;
+static T_SIM_BUS bus;
+#if PETIT_BUFFER == PETIT_EXTERNAL
+#define SIM_MAX_POOL (16U)
+static T_PETIT_POOL pool;
+static pu8_t pool_data[SIM_MAX_POOL][C_PETITMODBUS_RXTX_BUFFER_SIZE];
+static unsigned pool_cnt = 1;
+#endif
+static uint64_t now;
+static uint64_t char_ns;
+static uint64_t t35_ns;
+static uint64_t loop_ns = 100000U;
+static uint64_t timeout_ns = 100000000U;
+// slave the library is currently called for
+static T_SIM_SLAVE *current;
+#if PETIT_SNIFF > 0
+// the monitor, only its timer is used
+static T_SIM_SLAVE monitor;
+static T_PETIT_SNIFF sniff;
+static FILE *capture;
+#endif
+
+/**
+ * Selects the slave the next library call is made for.
+ */
+static void sim_select(T_SIM_SLAVE *Slave)
+{
+	current = Slave;
+	PETITMODBUS_SLAVE_ADDRESS = Slave->Address;
+}
+
+static void sim_timer_start(void)
+{
+	current->Timer = now + t35_ns;
+}
+
+#if PETIT_RXRING > 0
+/**
+ * The slaves on a receive ring need no inter-frame timer.
+ */
+static void sim_timer_none(void)
+{
+	return;
+}
+#endif
+
+/**
+ * Wakes the main loop of the current slave up on its next loop period.
+ * @param[in] After the earliest time of the next loop
+ */
+static void sim_wake(uint64_t After)
+{
+	uint64_t at = After + loop_ns - 1U;
+	at -= (at - current->Phase) % loop_ns;
+	if (at < current->Loop)
+		current->Loop = at;
+}
+
+/**
+ * Stops the inter-frame timer.  The slave only stops it once a frame is
+ * complete, which is the RX interrupt that wakes its main loop up.
+ */
+static void sim_timer_stop(void)
+{
+	current->Timer = SIM_NEVER;
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+	current->Shot = now + t35_ns;
+#endif
+	sim_wake(now);
+}
+
+/**
+ * @return the simulated time in microseconds
+ */
+static pu16_t sim_clock(void)
+{
+	return (pu16_t) (now / 1000U);
+}
+
+/**
+ * Starts the response of the current slave.
+ */
+static void sim_tx_begin(pu8_t tx)
+{
+	const T_SIM_POLL *poll = &polls[master.Poll];
+	uint64_t lat;
+
+	if (bus.Node >= 0)
+	{
+		bus.Collisions++;
+		return;
+	}
+	bus.Node = (int) (current - slaves) + 1;
+	bus.Byte = tx;
+	bus.Done = now + char_ns;
+
+	if (master.State == E_SIM_WAIT && poll->Slave == current->Address)
+	{
+		lat = now - master.Req_End;
+		current->Lat_Cnt++;
+		current->Lat_Sum += lat;
+		if (lat < current->Lat_Min)
+			current->Lat_Min = lat;
+		if (lat > current->Lat_Max)
+			current->Lat_Max = lat;
+		if (lat < t35_ns)
+			current->Early++;
+	}
+}
+
+/**
+ * Builds the request ADU of a poll.
+ * @return the length of the request, CRC included
+ */
+static pu16_t sim_request(const T_SIM_POLL *Poll, pu8_t *Adu)
+{
+	static T_PETIT_MODBUS crc;
+	pu16_t len = 6U;
+	pu16_t i;
+
+	Adu[0] = Poll->Slave;
+	Adu[1] = Poll->Function;
+	Adu[2] = Poll->Address >> 8;
+	Adu[3] = Poll->Address;
+	Adu[4] = Poll->Count >> 8;
+	Adu[5] = Poll->Count;
+	switch (Poll->Function)
+	{
+	case C_FCODE_WRITE_SINGLE_COIL:
+		Adu[4] = 0xFF;
+		Adu[5] = 0;
+		break;
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		Adu[4] = 0x12;
+		Adu[5] = 0x34;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		Adu[len++] = (Poll->Count + 7U) >> 3;
+		for (i = 0; i < Adu[6]; i++)
+			Adu[len++] = 0xA5 ^ i;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		Adu[len++] = 2U * Poll->Count;
+		for (i = 0; i < Adu[6]; i++)
+			Adu[len++] = i;
+		break;
+	default:
+		break;
+	}
+	PetitCRC16(&crc, Adu, len);
+	Adu[len++] = crc.CRC16;
+	Adu[len++] = crc.CRC16 >> 8;
+	return len;
+}
+
+/**
+ * @return the length of the normal response to a poll
+ */
+static pu16_t sim_response_len(const T_SIM_POLL *Poll)
+{
+	switch (Poll->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		return 5U + ((Poll->Count + 7U) >> 3);
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		return 5U + 2U * Poll->Count;
+	default:
+		return 8U;
+	}
+}
+
+/**
+ * Moves the master on to the next poll once the bus has been quiet for t3.5.
+ */
+static void sim_master_next(void)
+{
+	slaves[master.Adu[0] - 1U].Polls++;
+	master.State = E_SIM_IDLE;
+	master.Deadline = now + t35_ns;
+	if (++master.Poll == poll_cnt)
+		master.Poll = 0;
+}
+
+#if PETIT_SNIFF > 0
+/**
+ * Writes what the monitor captured to the capture file.
+ */
+static void sim_capture(void)
+{
+	const pu8_t *data;
+	pu16_t len;
+
+	while ((len = PETIT_SNIFF_Peek(&sniff, &data)) != 0)
+	{
+		fwrite(data, 1, len, capture);
+		PETIT_SNIFF_Consume(&sniff, len);
+	}
+}
+#endif
+
+/**
+ * Hands a byte off the wire to every node but the one that sent it.
+ */
+static void sim_deliver(int From, pu8_t Byte)
+{
+	static T_PETIT_MODBUS crc;
+	unsigned i;
+
+	for (i = 0; i < slave_cnt; i++)
+	{
+		if ((int) i + 1 == From)
+			continue;
+		sim_select(&slaves[i]);
+#if PETIT_RXRING > 0
+		PETIT_RXRING_PUSH(&slaves[i].Ring, Byte);
+		sim_wake(now);
+#else
+		PetitRxBufferInsert(&slaves[i].Petit, Byte);
+#endif
+	}
+#if PETIT_SNIFF > 0
+	if (capture != NULL)
+	{
+		sim_select(&monitor);
+		PetitRxBufferInsert(&monitor.Petit, Byte);
+	}
+#endif
+
+	if (From == 0 || master.State != E_SIM_WAIT
+			|| master.Rsp_Len >= sizeof(master.Rsp))
+		return;
+	master.Rsp[master.Rsp_Len++] = Byte;
+	if (master.Rsp_Len == 2U && (Byte & 0x80U))
+		master.Expected = 5U;
+	if (master.Rsp_Len == master.Expected)
+	{
+		if (master.Rsp[0] != master.Adu[0]
+				|| PetitCRC16(&crc, master.Rsp, master.Rsp_Len))
+			master.Bad_Frames++;
+		else
+			slaves[master.Adu[0] - 1U].Answers++;
+		sim_master_next();
+	}
+}
+
+/**
+ * Completes the byte on the wire and puts the next one of the same sender on.
+ */
+static void sim_bus_done(void)
+{
+	int from = bus.Node;
+	pu8_t next;
+
+	bus.Busy += char_ns;
+	bus.Quiet = now;
+	bus.Node = -1;
+	// the master waits before the last byte is delivered, a slave processing
+	// in its RX interrupt may answer right away
+	if (from == 0 && master.Pos == master.Len)
+	{
+		master.State = E_SIM_WAIT;
+		master.Req_End = now;
+		master.Deadline = now + timeout_ns;
+	}
+	sim_deliver(from, bus.Byte);
+
+	if (from == 0)
+	{
+		if (master.State == E_SIM_SEND)
+		{
+			bus.Node = 0;
+			bus.Byte = master.Adu[master.Pos++];
+			bus.Done = now + char_ns;
+		}
+	}
+	else
+	{
+		sim_select(&slaves[from - 1]);
+		if (PetitTxBufferPop(&slaves[from - 1].Petit, &next))
+		{
+			bus.Node = from;
+			bus.Byte = next;
+			bus.Done = now + char_ns;
+		}
+	}
+}
+
+/**
+ * Runs the master when its deadline has come.
+ */
+static void sim_master_run(void)
+{
+	const T_SIM_POLL *poll;
+
+	if (master.State == E_SIM_WAIT)
+	{
+		slaves[master.Adu[0] - 1U].Timeouts++;
+		sim_master_next();
+		return;
+	}
+	if (bus.Node >= 0)
+	{
+		// someone is still talking, wait for t3.5 of silence after it
+		master.Deadline = bus.Done + t35_ns;
+		return;
+	}
+	if (now < bus.Quiet + t35_ns)
+	{
+		master.Deadline = bus.Quiet + t35_ns;
+		return;
+	}
+
+	poll = &polls[master.Poll];
+	if (master.Poll == 0)
+	{
+		if (++master.Starts > 2U)
+		{
+			if (now - master.Cycle_Start < master.Cycle_Min)
+				master.Cycle_Min = now - master.Cycle_Start;
+			if (now - master.Cycle_Start > master.Cycle_Max)
+				master.Cycle_Max = now - master.Cycle_Start;
+		}
+		master.Cycle_Start = now;
+	}
+	master.Len = sim_request(poll, master.Adu);
+	master.Expected = sim_response_len(poll);
+	master.Rsp_Len = 0;
+	master.Pos = 1;
+	master.State = E_SIM_SEND;
+	master.Deadline = SIM_NEVER;
+	bus.Node = 0;
+	bus.Byte = master.Adu[0];
+	bus.Done = now + char_ns;
+}
+
+/**
+ * Advances the simulation to the next event and handles everything due then.
+ * Timers go first so a frame that starts exactly t3.5 after the previous one
+ * is seen as a new frame.
+ */
+static void sim_step(void)
+{
+	uint64_t next = master.Deadline;
+	unsigned i;
+
+	if (bus.Node >= 0 && bus.Done < next)
+		next = bus.Done;
+	for (i = 0; i < slave_cnt; i++)
+	{
+		if (slaves[i].Timer < next)
+			next = slaves[i].Timer;
+		if (slaves[i].Shot < next)
+			next = slaves[i].Shot;
+		if (slaves[i].Loop < next)
+			next = slaves[i].Loop;
+	}
+#if PETIT_SNIFF > 0
+	if (monitor.Timer < next)
+		next = monitor.Timer;
+#endif
+	now = next;
+
+	for (i = 0; i < slave_cnt; i++)
+	{
+		if (slaves[i].Timer == now)
+		{
+			slaves[i].Timer = SIM_NEVER;
+			PetitRxBufferReset(&slaves[i].Petit);
+		}
+	}
+#if PETIT_SNIFF > 0
+	if (monitor.Timer == now)
+	{
+		monitor.Timer = SIM_NEVER;
+		PetitRxBufferReset(&monitor.Petit);
+		sim_capture();
+	}
+#endif
+	if (bus.Node >= 0 && bus.Done == now)
+		sim_bus_done();
+	for (i = 0; i < slave_cnt; i++)
+	{
+		if (slaves[i].Shot == now)
+		{
+			slaves[i].Shot = SIM_NEVER;
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+			sim_select(&slaves[i]);
+			PetitTxTurnaround(&slaves[i].Petit);
+#endif
+		}
+	}
+	if (master.Deadline == now)
+		sim_master_run();
+	for (i = 0; i < slave_cnt; i++)
+	{
+		if (slaves[i].Loop == now)
+		{
+			pu16_t sleep;
+			sim_select(&slaves[i]);
+			slaves[i].Loop = SIM_NEVER;
+			slaves[i].Calls++;
+			// the slave sleeps for as long as it says, or until woken up
+			sleep = PETIT_MODBUS_Process(&slaves[i].Petit);
+			if (sleep != PETIT_PROCESS_IDLE)
+				sim_wake(now + 1U + sleep * 1000ULL);
+		}
+	}
+}
+
+/**
+ * Reads the poll script.
+ * @return 0 on success
+ */
+/**
+ * @return 0 if the request of a write would not be a valid one, or would not
+ *   fit the frame of the master
+ */
+static int sim_poll_fits(unsigned Function, unsigned Count)
+{
+	switch (Function)
+	{
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		return Count >= 1U && Count <= 1968U
+				&& 9U + ((Count + 7U) >> 3) <= sizeof(master.Adu);
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		return Count >= 1U && Count <= 123U
+				&& 9U + 2U * Count <= sizeof(master.Adu);
+	default:
+		return 1;
+	}
+}
+
+static int sim_script(const char *Path)
+{
+	FILE *f = fopen(Path, "r");
+	char line[128];
+	unsigned s, fc, addr, cnt;
+
+	if (f == NULL)
+	{
+		perror(Path);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%u %u %u %u", &s, &fc, &addr,
+				&cnt) != 4)
+			continue;
+		if (s == 0 || s > slave_cnt || poll_cnt == SIM_MAX_POLLS
+				|| fc > 0xFFU || addr > 0xFFFFU || cnt > 0xFFFFU
+				|| !sim_poll_fits(fc, cnt))
+		{
+			fprintf(stderr, "%s: bad poll: %s", Path, line);
+			fclose(f);
+			return 1;
+		}
+		polls[poll_cnt].Slave = s;
+		polls[poll_cnt].Function = fc;
+		polls[poll_cnt].Address = addr;
+		polls[poll_cnt].Count = cnt;
+		poll_cnt++;
+	}
+	fclose(f);
+	return poll_cnt == 0;
+}
+
+static double sim_ms(uint64_t Ns)
+{
+	return (double) Ns / 1e6;
+}
+
+static const char *turnaround_name(void)
+{
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+	return "one-shot timer";
+#elif defined(PETITMODBUS_TURNAROUND)
+	static char name[32];
+	snprintf(name, sizeof(name), "%lu us",
+			(unsigned long) (PETITMODBUS_TURNAROUND));
+	return name;
+#else
+	return "loop counter";
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long baud = 19200;
+	unsigned long cycles = 100;
+	unsigned long calls;
+	uint64_t start;
+	unsigned i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:l:d:c:t:p:w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			baud = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			slave_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loop_ns = strtoull(optarg, NULL, 0) * 1000U;
+			break;
+		case 'd':
+			PETITMODBUS_DLY_TOP = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout_ns = strtoull(optarg, NULL, 0) * 1000000U;
+			break;
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		case 'p':
+			pool_cnt = strtoul(optarg, NULL, 0);
+			break;
+#endif
+#if PETIT_SNIFF > 0
+		case 'w':
+			capture = fopen(optarg, "wb");
+			if (capture == NULL)
+			{
+				perror(optarg);
+				return 1;
+			}
+			break;
+#endif
+		default:
+			fprintf(stderr, "usage: %s [-b baud] [-n slaves] [-l loop us] "
+					"[-d dly top] [-c cycles] [-t timeout ms] [-w capture] "
+					"[script]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (baud == 0 || slave_cnt == 0 || slave_cnt > SIM_MAX_SLAVES
+			|| loop_ns == 0 || cycles == 0
+#if PETIT_BUFFER == PETIT_EXTERNAL
+			|| pool_cnt > SIM_MAX_POOL
+#endif
+			)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (optind < argc)
+	{
+		if (sim_script(argv[optind]))
+			return 2;
+	}
+	else
+	{
+		for (i = 0; i < slave_cnt; i++)
+		{
+			polls[i].Slave = i + 1U;
+			polls[i].Function = C_FCODE_READ_HOLDING_REGISTERS;
+			polls[i].Address = 0;
+			polls[i].Count = 10;
+		}
+		poll_cnt = slave_cnt;
+	}
+
+	// above 19200 baud the specification fixes t3.5 at 1.75 ms
+	char_ns = SIM_CHAR_BITS * 1000000000ULL / baud;
+	t35_ns = baud > 19200U ? 1750000U : 7U * char_ns / 2U;
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	PETIT_POOL_Init(&pool, pool_data[0], sizeof(pool_data[0]), pool_cnt);
+#endif
+	for (i = 0; i < slave_cnt; i++)
+	{
+		T_SIM_SLAVE *s = &slaves[i];
+		s->Address = i + 1U;
+		s->Petit.Timer_Start = sim_timer_start;
+		s->Petit.Timer_Stop = sim_timer_stop;
+		s->Petit.Tx_Begin = sim_tx_begin;
+		s->Timer = SIM_NEVER;
+		s->Shot = SIM_NEVER;
+		// spread the main loops of the slaves over one loop period
+		s->Phase = loop_ns * i / slave_cnt;
+		s->Loop = SIM_NEVER;
+		s->Lat_Min = SIM_NEVER;
+		sim_select(s);
+		PETIT_MODBUS_Init(&s->Petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		PETIT_MODBUS_Set_Pool(&s->Petit, &pool);
+#endif
+#if PETIT_RXRING > 0
+		s->Petit.Timer_Start = sim_timer_none;
+		PETIT_RXRING_Init(&s->Ring, (pu16_t) ((t35_ns + 999U) / 1000U));
+		PETIT_MODBUS_Set_RxRing(&s->Petit, &s->Ring);
+#endif
+	}
+#if PETIT_SNIFF > 0
+	monitor.Petit.Timer_Start = sim_timer_start;
+	monitor.Petit.Timer_Stop = sim_timer_stop;
+	monitor.Timer = SIM_NEVER;
+	monitor.Loop = SIM_NEVER;
+	PETIT_MODBUS_Init(&monitor.Petit);
+	PETIT_SNIFF_Init(&sniff);
+	PETIT_MODBUS_Set_Monitor(&monitor.Petit, &sniff);
+#endif
+	PetitHostClock(sim_clock);
+	bus.Node = -1;
+	master.State = E_SIM_IDLE;
+	master.Deadline = t35_ns;
+	master.Cycle_Min = SIM_NEVER;
+
+	// the first cycle starts from a quiet bus and is not measured
+	while (master.Starts < 2U)
+		sim_step();
+	start = now;
+	bus.Busy = 0;
+	for (i = 0; i < slave_cnt; i++)
+	{
+		T_SIM_SLAVE *s = &slaves[i];
+		s->Polls = s->Answers = s->Timeouts = s->Early = s->Lat_Cnt = 0;
+		s->Calls = 0;
+		s->Lat_Sum = s->Lat_Max = 0;
+		s->Lat_Min = SIM_NEVER;
+	}
+	while (master.Starts < cycles + 2U)
+		sim_step();
+
+	printf("# %lu baud, %u slaves, %u polls, loop %.3f ms, "
+			"PETITMODBUS_DLY_TOP %u, process position %d\n", baud, slave_cnt,
+			poll_cnt, sim_ms(loop_ns), (unsigned) PETITMODBUS_DLY_TOP,
+			PETITMODBUS_PROCESS_POSITION);
+	printf("# character %.3f ms, t3.5 %.3f ms, turnaround %s\n",
+			sim_ms(char_ns), sim_ms(t35_ns), turnaround_name());
+	printf("bus occupancy   %.1f %%\n",
+			100.0 * (double) bus.Busy / (double) (now - start));
+	printf("poll cycle      min %.3f ms, max %.3f ms, avg %.3f ms\n",
+			sim_ms(master.Cycle_Min), sim_ms(master.Cycle_Max),
+			sim_ms((now - start) / cycles));
+	printf("poll rate       %.1f polls/s, %.2f cycles/s worst case\n",
+			(double) (poll_cnt * cycles) * 1e9 / (double) (now - start),
+			1e3 / sim_ms(master.Cycle_Max));
+	for (i = 0, calls = 0; i < slave_cnt; i++)
+		calls += slaves[i].Calls;
+	printf("process calls   %.0f per slave and second, %.0f busy polling\n",
+			(double) calls * 1e9 / (double) (now - start) / slave_cnt,
+			1e9 / (double) loop_ns);
+	printf("bad frames      %lu, collisions %lu\n", master.Bad_Frames,
+			bus.Collisions);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	printf("buffer pool     %u of %u buffers used at most, %u frames dropped\n",
+			pool.Peak, pool_cnt, pool.Misses);
+#endif
+#if PETIT_RXRING > 0
+	for (i = 0, calls = 0; i < slave_cnt; i++)
+		calls += slaves[i].Ring.Overruns;
+	printf("rx rings        %u bytes each, %lu bytes lost\n",
+			(unsigned) PETIT_RXRING_SIZE, calls);
+#endif
+#if PETIT_SNIFF > 0
+	if (capture != NULL)
+	{
+		fclose(capture);
+		printf("monitor         %u frames, %u bad CRCs, %u dropped\n",
+				sniff.Frames, sniff.Crc_Errors, sniff.Drops);
+	}
+#endif
+	printf("# %5s %8s %8s %8s %8s %10s %10s %10s\n", "slave", "polls",
+			"answers", "timeouts", "early", "lat min", "lat avg", "lat max");
+	for (i = 0; i < slave_cnt; i++)
+	{
+		const T_SIM_SLAVE *s = &slaves[i];
+		if (s->Polls == 0)
+			continue;
+		printf("  %5u %8lu %8lu %8lu %8lu %10.3f %10.3f %10.3f\n", s->Address,
+				s->Polls, s->Answers, s->Timeouts, s->Early,
+				sim_ms(s->Lat_Min == SIM_NEVER ? 0 : s->Lat_Min),
+				sim_ms(s->Lat_Cnt ? s->Lat_Sum / s->Lat_Cnt : 0),
+				sim_ms(s->Lat_Max));
+	}
+	return 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
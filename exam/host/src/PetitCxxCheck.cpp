@@ -0,0 +1,449 @@
+/*******************************************************************************
+ * @file PetitCxxCheck.cpp
+ * Checks petit::Slave of PetitModbus.hpp against the C core.
+ *
+ * The same requests go byte by byte to a slave of the C core, wrapped in
+ * petit::CoreSlave, and to a petit::Slave answering the same function codes.
+ * Both serve the same tables, which are put back between the two, so every
+ * response must be the same, exceptions included, and so must the tables and
+ * PetitRegChange after it.  A request one of them does not answer, for its
+ * address, its CRC or its function code, the other must not answer either.
+ * The requests are every function code with addresses and counts around the
+ * limits, and then random ones.  Last a frame of a few function codes is
+ * timed on both.
+ *
+ * The exit status is 1 if a response or a table differs.
+ *
+ * usage: PetitCxxCheck [iterations]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "PetitModbusHost.h"
+#include "PetitModbus.hpp"
+
+#if PETIT_REG != PETIT_INTERNAL || PETIT_INPUT_REG != PETIT_INTERNAL \
+	|| PETIT_COIL != PETIT_INTERNAL || PETIT_DISCRETE != PETIT_INTERNAL
+#error "PetitCxxCheck needs the internal tables."
+#endif
+#if PETITMODBUS_PROCESS_POSITION != 0 || defined(PETITMODBUS_TURNAROUND) \
+	|| defined(PETITMODBUS_TURNAROUND_TIMER)
+#error "PetitCxxCheck expects process position 0 and no turnaround."
+#endif
+
+#define CHECK_FRAME_SIZE (C_PETITMODBUS_RXTX_BUFFER_SIZE + 8U)
+#define CHECK_RANDOM (20000U)
+
+/**
+ * The port of the C core, the hooks of the host port.
+ */
+struct CorePort
+{
+	static void timer_start()
+	{
+		PetitPortTimerStart();
+	}
+	static void timer_stop()
+	{
+		PetitPortTimerStop();
+	}
+	static void tx_begin(pu8_t Tx)
+	{
+		PetitPortTxBegin(Tx);
+	}
+};
+
+/**
+ * The port of petit::Slave, which keeps the first byte of the response.
+ */
+static int cxx_first = -1;
+
+struct CxxPort
+{
+	static void timer_start()
+	{
+	}
+	static void timer_stop()
+	{
+	}
+	static void tx_begin(pu8_t Tx)
+	{
+		cxx_first = Tx;
+	}
+};
+
+static int cxx_take(void)
+{
+	int tx = cxx_first;
+	cxx_first = -1;
+	return tx;
+}
+
+typedef petit::Functions<C_FCODE_READ_COILS, C_FCODE_READ_DISCRETES,
+		C_FCODE_READ_HOLDING_REGISTERS, C_FCODE_READ_INPUT_REGISTERS,
+		C_FCODE_WRITE_SINGLE_COIL, C_FCODE_WRITE_SINGLE_REGISTER,
+		C_FCODE_WRITE_MULTIPLE_COILS, C_FCODE_WRITE_MULTIPLE_REGISTERS>
+		CoreFunctions;
+
+struct CxxConfig : petit::Config<CxxPort, C_FCODE_READ_COILS,
+		C_FCODE_READ_DISCRETES, C_FCODE_READ_HOLDING_REGISTERS,
+		C_FCODE_READ_INPUT_REGISTERS, C_FCODE_WRITE_SINGLE_COIL,
+		C_FCODE_WRITE_SINGLE_REGISTER, C_FCODE_WRITE_MULTIPLE_COILS,
+		C_FCODE_WRITE_MULTIPLE_REGISTERS>
+{
+#if PETIT_CRC == PETIT_CRC_BITWISE
+	typedef petit::CrcBitwise Crc;
+#endif
+};
+
+static_assert(petit::Slave<CxxConfig>::buffer_size
+		== C_PETITMODBUS_RXTX_BUFFER_SIZE, "the buffers differ");
+
+static petit::CoreSlave<CorePort, CoreFunctions> core;
+static petit::Slave<CxxConfig> cxx;
+static unsigned long seed = 1U;
+
+/**
+ * The tables both slaves serve.
+ */
+typedef struct
+{
+	pu16_t Registers[NUMBER_OF_PETITREGISTERS];
+	pu16_t InputRegisters[NUMBER_OF_INPUT_PETITREGISTERS];
+	pu8_t Coils[(NUMBER_OF_PETITCOILS + 7) >> 3];
+	pu8_t Discretes[(NUMBER_OF_PETITDISCRETES + 7) >> 3];
+	pu8_t RegChange;
+} T_CHECK_TABLES;
+
+static void tables_save(T_CHECK_TABLES *T)
+{
+	memcpy(T->Registers, PetitRegisters, sizeof(T->Registers));
+	memcpy(T->InputRegisters, PetitInputRegisters, sizeof(T->InputRegisters));
+	memcpy(T->Coils, PetitCoils, sizeof(T->Coils));
+	memcpy(T->Discretes, PetitDiscretes, sizeof(T->Discretes));
+	T->RegChange = PetitRegChange;
+}
+
+static void tables_load(const T_CHECK_TABLES *T)
+{
+	memcpy(PetitRegisters, T->Registers, sizeof(T->Registers));
+	memcpy(PetitInputRegisters, T->InputRegisters, sizeof(T->InputRegisters));
+	memcpy(PetitCoils, T->Coils, sizeof(T->Coils));
+	memcpy(PetitDiscretes, T->Discretes, sizeof(T->Discretes));
+	PetitRegChange = T->RegChange;
+}
+
+/**
+ * @return the next pseudo-random number, 15 bits
+ */
+static unsigned check_rand(void)
+{
+	seed = seed * 1103515245UL + 12345UL;
+	return (unsigned) (seed >> 16) & 0x7FFFU;
+}
+
+/**
+ * Builds a request of function Fn with the fields A and B, the byte count
+ * and data of functions 15 and 16 following B.
+ * @return the length of the request, CRC included
+ */
+static pu16_t check_request(pu8_t *Adu, pu8_t Slave, pu8_t Fn, pu16_t A,
+		pu16_t B, pu8_t Byte_Cnt)
+{
+	pu16_t len = 6U;
+	pu16_t crc;
+	pu16_t i;
+
+	Adu[0] = Slave;
+	Adu[1] = Fn;
+	Adu[2] = (pu8_t) (A >> 8);
+	Adu[3] = (pu8_t) A;
+	Adu[4] = (pu8_t) (B >> 8);
+	Adu[5] = (pu8_t) B;
+	if (Fn == C_FCODE_WRITE_MULTIPLE_COILS
+			|| Fn == C_FCODE_WRITE_MULTIPLE_REGISTERS)
+	{
+		Adu[len++] = Byte_Cnt;
+		for (i = 0; i < Byte_Cnt && len < CHECK_FRAME_SIZE - 2U; i++)
+			Adu[len++] = (pu8_t) check_rand();
+	}
+	crc = petit::CrcTable::calc(Adu, len);
+	Adu[len++] = (pu8_t) crc;
+	Adu[len++] = (pu8_t) (crc >> 8);
+	return len;
+}
+
+/**
+ * Sends a request to a slave as the RX interrupt would and takes its
+ * response as the TX interrupt would.
+ * @return the length of the response, 0 if there is none
+ */
+template <class S>
+static pu16_t check_answer(S &Slave, int (*Take)(void), const pu8_t *Req,
+		pu16_t Len, pu8_t *Rsp)
+{
+	pu16_t n = 0;
+	pu8_t tx;
+	pu16_t i;
+	int first;
+
+	for (i = 0; i < Len; i++)
+		Slave.receive(Req[i]);
+	// the C core takes two calls, to answer and to start sending
+	for (i = 0; i < 4U; i++)
+		Slave.process();
+	first = Take();
+	if (first < 0)
+	{
+		Slave.timeout();
+		return 0;
+	}
+	Rsp[n++] = (pu8_t) first;
+	while (n < CHECK_FRAME_SIZE && Slave.transmit(tx))
+		Rsp[n++] = tx;
+	return n;
+}
+
+static void check_print(const char *What, const pu8_t *Frame, pu16_t Len)
+{
+	pu16_t i;
+
+	printf("    %-5s", What);
+	for (i = 0; i < Len && i < 16U; i++)
+		printf(" %02X", Frame[i]);
+	printf("%s\n", Len > 16U ? " ..." : "");
+}
+
+/**
+ * Sends a request to both slaves from the same tables.
+ * @return 1 if the responses or the tables after them differ
+ */
+static int check_one(const pu8_t *Req, pu16_t Len)
+{
+	static T_CHECK_TABLES before;
+	static T_CHECK_TABLES after;
+	pu8_t rsp_core[CHECK_FRAME_SIZE];
+	pu8_t rsp_cxx[CHECK_FRAME_SIZE];
+	pu16_t n_core;
+	pu16_t n_cxx;
+
+	PetitRegChange = 0;
+	tables_save(&before);
+	n_core = check_answer(core, PetitHostTxTake, Req, Len, rsp_core);
+	tables_save(&after);
+	tables_load(&before);
+	n_cxx = check_answer(cxx, cxx_take, Req, Len, rsp_cxx);
+	if (n_core == n_cxx && memcmp(rsp_core, rsp_cxx, n_core) == 0)
+	{
+		tables_save(&before);
+		if (memcmp(&before, &after, sizeof(before)) == 0)
+			return 0;
+	}
+	check_print("req", Req, Len);
+	check_print("core", rsp_core, n_core);
+	check_print("c++", rsp_cxx, n_cxx);
+	return 1;
+}
+
+/**
+ * Every function code with addresses and counts around the limits.
+ * @return the number of requests that differ
+ */
+static unsigned check_limits(unsigned *Cnt)
+{
+	static const pu8_t fns[] =
+	{
+		C_FCODE_READ_COILS, C_FCODE_READ_DISCRETES,
+		C_FCODE_READ_HOLDING_REGISTERS, C_FCODE_READ_INPUT_REGISTERS,
+		C_FCODE_WRITE_SINGLE_COIL, C_FCODE_WRITE_SINGLE_REGISTER,
+		C_FCODE_WRITE_MULTIPLE_COILS, C_FCODE_WRITE_MULTIPLE_REGISTERS,
+		7U, 0x83U
+	};
+	static const pu16_t edges[] =
+	{
+		0, 1U, 7U, 8U, 9U, 123U, 124U, 125U, 126U, 131U, 255U, 256U, 1968U,
+		1969U, 1999U, 2000U, 2001U, 0xFF00U, 0xFFFFU
+	};
+	pu8_t req[CHECK_FRAME_SIZE];
+	unsigned failed = 0;
+	pu16_t f;
+	pu16_t a;
+	pu16_t b;
+
+	for (f = 0; f < sizeof(fns); f++)
+	{
+		for (a = 0; a < sizeof(edges) / sizeof(edges[0]); a++)
+		{
+			for (b = 0; b < sizeof(edges) / sizeof(edges[0]); b++)
+			{
+				unsigned bytes = fns[f] == C_FCODE_WRITE_MULTIPLE_COILS
+						? (edges[b] + 7U) >> 3 : 2U * edges[b];
+				pu16_t len;
+
+				bytes = bytes > 255U ? 255U : bytes;
+				len = check_request(req, PETITMODBUS_SLAVE_ADDRESS, fns[f],
+						edges[a], edges[b], (pu8_t) bytes);
+				failed += check_one(req, len);
+				// and one byte short of the data
+				if (bytes != 0 && (fns[f] == C_FCODE_WRITE_MULTIPLE_COILS
+						|| fns[f] == C_FCODE_WRITE_MULTIPLE_REGISTERS))
+				{
+					len = check_request(req, PETITMODBUS_SLAVE_ADDRESS,
+							fns[f], edges[a], edges[b], (pu8_t) (bytes - 1U));
+					failed += check_one(req, len);
+					(*Cnt)++;
+				}
+				(*Cnt)++;
+			}
+		}
+	}
+	return failed;
+}
+
+/**
+ * Random requests, some of them for another slave or with a bad CRC.
+ * @return the number of requests that differ
+ */
+static unsigned check_random(unsigned Cnt)
+{
+	static const pu8_t fns[] =
+	{
+		C_FCODE_READ_COILS, C_FCODE_READ_DISCRETES,
+		C_FCODE_READ_HOLDING_REGISTERS, C_FCODE_READ_INPUT_REGISTERS,
+		C_FCODE_WRITE_SINGLE_COIL, C_FCODE_WRITE_SINGLE_REGISTER,
+		C_FCODE_WRITE_MULTIPLE_COILS, C_FCODE_WRITE_MULTIPLE_REGISTERS, 8U
+	};
+	pu8_t req[CHECK_FRAME_SIZE];
+	unsigned failed = 0;
+	unsigned i;
+
+	for (i = 0; i < Cnt; i++)
+	{
+		pu8_t fn = fns[check_rand() % sizeof(fns)];
+		pu8_t slave = check_rand() % 16U == 0 ? PETITMODBUS_SLAVE_ADDRESS + 1U
+				: PETITMODBUS_SLAVE_ADDRESS;
+		pu16_t a = (pu16_t) (check_rand() % (NUMBER_OF_PETITCOILS + 16U));
+		pu16_t b = (pu16_t) (check_rand() % 150U);
+		unsigned bytes;
+		pu16_t len;
+
+		if (fn == C_FCODE_READ_HOLDING_REGISTERS
+				|| fn == C_FCODE_READ_INPUT_REGISTERS
+				|| fn == C_FCODE_WRITE_SINGLE_REGISTER
+				|| fn == C_FCODE_WRITE_MULTIPLE_REGISTERS)
+			a = (pu16_t) (a % (NUMBER_OF_PETITREGISTERS + 16U));
+		if (fn == C_FCODE_WRITE_SINGLE_COIL)
+			b = check_rand() % 4U == 0 ? (pu16_t) check_rand()
+					: check_rand() % 2U ? 0xFF00U : 0;
+		else if (fn == C_FCODE_WRITE_SINGLE_REGISTER)
+			b = (pu16_t) check_rand();
+		else if (fn == C_FCODE_READ_COILS || fn == C_FCODE_READ_DISCRETES
+				|| fn == C_FCODE_WRITE_MULTIPLE_COILS)
+			b = (pu16_t) (check_rand() % 2100U);
+		bytes = fn == C_FCODE_WRITE_MULTIPLE_COILS ? (b + 7U) >> 3 : 2U * b;
+		if (check_rand() % 8U == 0)
+			bytes = check_rand() % 256U;
+		len = check_request(req, slave, fn, a, b,
+				(pu8_t) (bytes > 255U ? 255U : bytes));
+		if (check_rand() % 16U == 0)
+			req[len - 1U] ^= 0x01U;
+		failed += check_one(req, len);
+	}
+	return failed;
+}
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+static double check_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+/**
+ * @return the time of a frame on a slave in nanoseconds
+ */
+template <class S>
+static double check_time(S &Slave, int (*Take)(void), const pu8_t *Req,
+		pu16_t Len, long Iterations)
+{
+	pu8_t rsp[CHECK_FRAME_SIZE];
+	double start = check_ns();
+	long i;
+
+	for (i = 0; i < Iterations; i++)
+		check_answer(Slave, Take, Req, Len, rsp);
+	return (check_ns() - start) / (double) Iterations;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		pu8_t Function;
+		pu16_t Count;
+	} timed[] =
+	{
+		{ C_FCODE_READ_COILS, 2000U },
+		{ C_FCODE_READ_HOLDING_REGISTERS, 1U },
+		{ C_FCODE_READ_HOLDING_REGISTERS, 125U },
+		{ C_FCODE_WRITE_SINGLE_REGISTER, 1U },
+		{ C_FCODE_WRITE_MULTIPLE_REGISTERS, 123U },
+	};
+	long iterations = argc > 1 ? atol(argv[1]) : 20000L;
+	pu8_t req[CHECK_FRAME_SIZE];
+	unsigned failed;
+	unsigned cnt = 0;
+	unsigned n;
+	pu16_t i;
+
+	if (iterations < 1)
+		iterations = 1;
+	for (i = 0; i < NUMBER_OF_PETITREGISTERS; i++)
+		PetitRegisters[i] = (pu16_t) check_rand();
+	for (i = 0; i < NUMBER_OF_INPUT_PETITREGISTERS; i++)
+		PetitInputRegisters[i] = (pu16_t) check_rand();
+	for (i = 0; i < sizeof(PetitCoils); i++)
+		PetitCoils[i] = (pu8_t) check_rand();
+	for (i = 0; i < sizeof(PetitDiscretes); i++)
+		PetitDiscretes[i] = (pu8_t) check_rand();
+
+	printf("# petit::Slave against the C core, %u bytes against %u\n",
+			(unsigned) sizeof(cxx), (unsigned) sizeof(*core.c()));
+	n = check_limits(&cnt);
+	printf("  %-34s %5u requests %s\n", "limits", cnt, n ? "FAILED" : "ok");
+	failed = n;
+	n = check_random(CHECK_RANDOM);
+	printf("  %-34s %5u requests %s\n", "random", CHECK_RANDOM,
+			n ? "FAILED" : "ok");
+	failed += n;
+
+	printf("# %-4s %5s %10s %10s\n", "fc", "count", "core ns", "c++ ns");
+	for (i = 0; i < sizeof(timed) / sizeof(timed[0]); i++)
+	{
+		pu16_t bytes = timed[i].Function == C_FCODE_WRITE_MULTIPLE_REGISTERS
+				? 2U * timed[i].Count : 0;
+		pu16_t len = check_request(req, PETITMODBUS_SLAVE_ADDRESS,
+				timed[i].Function, 0, timed[i].Count, (pu8_t) bytes);
+		double t_core = check_time(core, PetitHostTxTake, req, len,
+				iterations);
+		double t_cxx = check_time(cxx, cxx_take, req, len, iterations);
+
+		printf("  %-4u %5u %10.1f %10.1f\n", timed[i].Function,
+				timed[i].Count, t_core, t_cxx);
+	}
+	return failed != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,370 @@
+/*******************************************************************************
+ * @file PetitDeltaSim.c
+ * Polling bandwidth of delta reads against full reads of a mostly static map.
+ *
+ * Every cycle a few random holding registers change, half of them written
+ * with function 6 by another master and half, with the registers in RAM,
+ * stored by the application and logged with PETIT_DELTA_Mark.  Every so many
+ * cycles a burst written with function 16 overflows the change log.  One
+ * master then reads the whole table with function 3 as masters do today,
+ * and another keeps a copy of it up to date with C_FCODE_DELTA, paging
+ * through snapshots when its token is lost.  The copy is checked against the
+ * full read after every cycle, and the report gives the frames and bytes each
+ * master needs per cycle.
+ *
+ * Build it like PetitBench with -DPETIT_DELTA=1, and -DPETIT_DELTA_LOG=...
+ * for another log size.
+ *
+ * usage: PetitDeltaSim [-c cycles] [-k changes per cycle] [-b burst]
+ *                      [-e burst every] [-s seed]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "PetitModbusHost.h"
+#include "PetitDelta.h"
+
+#if !defined(PETIT_DELTA) || PETIT_DELTA == 0 || \
+	!defined(PETIT_BATCH) || PETIT_BATCH == 0
+#error "PetitDeltaSim needs -DPETIT_DELTA=1 and PETIT_BATCH."
+#endif
+
+typedef struct
+{
+	unsigned long Frames;
+	unsigned long Bytes;
+} T_DELTA_TRAFFIC;
+
+static T_PETIT_MODBUS petit;
+static pu8_t req[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+static pu8_t arena[2U * C_PETITMODBUS_RXTX_BUFFER_SIZE + 5U + 2U * 125U];
+static pu16_t copy[NUMBER_OF_PETITREGISTERS];
+static uint32_t rnd = 1;
+
+/**
+ * @return a pseudo-random number, xorshift32
+ */
+static uint32_t delta_rand(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+/**
+ * Runs one request through the slave, counting it in Traffic if it is not 0.
+ * @param[in] Len the request without its CRC, which is appended
+ * @return the response, or 0 if there is none or it is an exception
+ */
+static const T_PETIT_ADU *delta_send(pu16_t Len, T_DELTA_TRAFFIC *Traffic)
+{
+	static T_PETIT_ADU adu;
+	pu16_t crc;
+
+	req[0] = PETITMODBUS_SLAVE_ADDRESS;
+	crc = PetitCRC16(&petit, req, Len);
+	req[Len] = (pu8_t) crc;
+	req[Len + 1U] = (pu8_t) (crc >> 8U);
+	adu.Req = req;
+	adu.Req_Len = Len + 2U;
+	if (PETIT_MODBUS_ProcessBatch(&petit, &adu, 1U, arena, sizeof(arena))
+			!= 1U || adu.Rsp_Len < 5U || (adu.Rsp[1] & 0x80U) != 0)
+	{
+		return 0;
+	}
+	if (Traffic != 0)
+	{
+		Traffic->Frames++;
+		Traffic->Bytes += adu.Req_Len + adu.Rsp_Len;
+	}
+	return &adu;
+}
+
+/**
+ * Builds a request of a function code and two fields.
+ */
+static void delta_fields(pu8_t Function, pu16_t A, pu16_t B)
+{
+	req[1] = Function;
+	req[2] = (pu8_t) (A >> 8U);
+	req[3] = (pu8_t) A;
+	req[4] = (pu8_t) (B >> 8U);
+	req[5] = (pu8_t) B;
+}
+
+/**
+ * @return the register at Buf, big-endian
+ */
+static pu16_t delta_get(const pu8_t *Buf)
+{
+	return (pu16_t) ((Buf[0] << 8U) | Buf[1]);
+}
+
+/**
+ * Writes registers as the other master or the application does.
+ */
+static void delta_write(pu16_t Addr, pu16_t Cnt, pb_t App)
+{
+	pu16_t i;
+
+#if PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH
+	if (App)
+	{
+		for (i = 0; i < Cnt; i++)
+		{
+			PETIT_REG_STORE(PetitRegisters[Addr + i], (pu16_t) delta_rand());
+		}
+		PETIT_DELTA_Mark(Addr, Cnt);
+		return;
+	}
+#else
+	(void) App;
+#endif
+	if (Cnt == 1U)
+	{
+		delta_fields(C_FCODE_WRITE_SINGLE_REGISTER, Addr,
+				(pu16_t) delta_rand());
+		delta_send(6U, 0);
+		return;
+	}
+	delta_fields(C_FCODE_WRITE_MULTIPLE_REGISTERS, Addr, Cnt);
+	req[6] = (pu8_t) (2U * Cnt);
+	for (i = 0; i < 2U * Cnt; i++)
+	{
+		req[7U + i] = (pu8_t) delta_rand();
+	}
+	delta_send(7U + 2U * Cnt, 0);
+}
+
+/**
+ * Reads the whole table with function 3.
+ * @param[out] Regs the registers, or 0 to only count the traffic
+ * @return 0 if a response was missing
+ */
+static pb_t delta_full(pu16_t *Regs, T_DELTA_TRAFFIC *Traffic)
+{
+	const T_PETIT_ADU *adu;
+	pu16_t addr;
+	pu16_t cnt;
+	pu16_t i;
+
+	for (addr = 0; addr < NUMBER_OF_PETITREGISTERS; addr += cnt)
+	{
+		cnt = (pu16_t) (NUMBER_OF_PETITREGISTERS - addr);
+		if (cnt > 125U)
+		{
+			cnt = 125U;
+		}
+		if (cnt > NUMBER_OF_REGISTERS_IN_BUFFER)
+		{
+			cnt = NUMBER_OF_REGISTERS_IN_BUFFER;
+		}
+		delta_fields(C_FCODE_READ_HOLDING_REGISTERS, addr, cnt);
+		adu = delta_send(6U, Traffic);
+		if (adu == 0 || adu->Rsp[2] != 2U * cnt)
+		{
+			return 0;
+		}
+		for (i = 0; Regs != 0 && i < cnt; i++)
+		{
+			Regs[addr + i] = delta_get(&adu->Rsp[3U + 2U * i]);
+		}
+	}
+	return 1;
+}
+
+/**
+ * Brings the copy up to date with delta reads.
+ * @param[in,out] Token the token of the copy
+ * @param[in] Start PETIT_DELTA_CHANGES, or 0 for a snapshot
+ * @param[out] Snapshots counts the snapshots taken
+ * @return 0 if a response was missing or wrong
+ */
+static pb_t delta_sync(pu16_t *Token, pu16_t Start, T_DELTA_TRAFFIC *Traffic,
+		unsigned long *Snapshots)
+{
+	const T_PETIT_ADU *adu;
+	pu8_t flags;
+	pu16_t cnt;
+	pu16_t first;
+	pu16_t i;
+
+	do
+	{
+		delta_fields(C_FCODE_DELTA, *Token, Start);
+		adu = delta_send(6U, Traffic);
+		if (adu == 0)
+		{
+			return 0;
+		}
+		flags = adu->Rsp[2];
+		*Token = delta_get(&adu->Rsp[3]);
+		cnt = adu->Rsp[5];
+		if (flags & PETIT_DELTA_SNAPSHOT)
+		{
+			first = delta_get(&adu->Rsp[6]);
+			if (adu->Rsp_Len != 10U + 2U * cnt
+					|| first + cnt > NUMBER_OF_PETITREGISTERS)
+			{
+				return 0;
+			}
+			if (first == 0)
+			{
+				(*Snapshots)++;
+			}
+			for (i = 0; i < cnt; i++)
+			{
+				copy[first + i] = delta_get(&adu->Rsp[8U + 2U * i]);
+			}
+			Start = (flags & PETIT_DELTA_MORE) ? first + cnt
+					: PETIT_DELTA_CHANGES;
+			continue;
+		}
+		if (adu->Rsp_Len != 8U + 4U * cnt)
+		{
+			return 0;
+		}
+		for (i = 0; i < cnt; i++)
+		{
+			pu16_t addr = delta_get(&adu->Rsp[6U + 4U * i]);
+
+			if (addr >= NUMBER_OF_PETITREGISTERS)
+			{
+				return 0;
+			}
+			copy[addr] = delta_get(&adu->Rsp[8U + 4U * i]);
+		}
+		Start = PETIT_DELTA_CHANGES;
+	} while (flags & PETIT_DELTA_MORE);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static pu16_t regs[NUMBER_OF_PETITREGISTERS];
+	T_DELTA_TRAFFIC full = { 0, 0 };
+	T_DELTA_TRAFFIC delta = { 0, 0 };
+	T_DELTA_TRAFFIC start = { 0, 0 };
+	unsigned long cycles = 1000;
+	unsigned long changes = 4;
+	unsigned long burst = 100;
+	unsigned long every = 100;
+	unsigned long snapshots = 0;
+	unsigned long mismatches = 0;
+	unsigned long c;
+	unsigned long k;
+	pu16_t token = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:k:b:e:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			changes = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			every = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			rnd = (uint32_t) strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c cycles] [-k changes per cycle] "
+					"[-b burst] [-e burst every] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (cycles == 0 || rnd == 0 || burst > 123U
+			|| burst > NUMBER_OF_PETITREGISTERS
+			|| burst > NUMBER_OF_REGISTERS_IN_BUFFER)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+	PETIT_DELTA_Init((pu16_t) delta_rand());
+
+	// the first snapshot is not part of the steady state
+	if (!delta_sync(&token, 0, &start, &snapshots))
+	{
+		fprintf(stderr, "%s: no snapshot\n", argv[0]);
+		return 1;
+	}
+	snapshots = 0;
+	// marks past the table are not logged, the next delta read must not
+	// carry them
+	PETIT_DELTA_Mark(NUMBER_OF_PETITREGISTERS - 1U, 3U);
+	PETIT_DELTA_Mark(0xFFFFU, 1U);
+
+	for (c = 0; c < cycles; c++)
+	{
+		for (k = 0; k < changes; k++)
+		{
+			delta_write((pu16_t) (delta_rand() % NUMBER_OF_PETITREGISTERS),
+					1U, (k & 1U) != 0);
+		}
+		if (burst != 0 && every != 0 && c % every == every - 1U)
+		{
+			delta_write((pu16_t) (delta_rand()
+					% (NUMBER_OF_PETITREGISTERS - burst + 1U)),
+					(pu16_t) burst, 0);
+		}
+
+		if (!delta_full(0, &full)
+				|| !delta_sync(&token, PETIT_DELTA_CHANGES, &delta,
+						&snapshots)
+				|| !delta_full(regs, 0))
+		{
+			fprintf(stderr, "%s: cycle %lu: bad response\n", argv[0], c);
+			return 1;
+		}
+		if (memcmp(copy, regs, sizeof(copy)) != 0)
+		{
+			mismatches++;
+		}
+	}
+
+	printf("# %u registers, log %u, %lu changes per cycle, a burst of %lu "
+			"every %lu cycles, %lu cycles\n", NUMBER_OF_PETITREGISTERS,
+			PETIT_DELTA_LOG, changes, burst, every, cycles);
+	printf("# %-10s %12s %12s\n", "poll", "frames/cycle", "bytes/cycle");
+	printf("  %-10s %12.2f %12.1f\n", "full", (double) full.Frames / cycles,
+			(double) full.Bytes / cycles);
+	printf("  %-10s %12.2f %12.1f\n", "delta", (double) delta.Frames / cycles,
+			(double) delta.Bytes / cycles);
+	printf("# delta reads take %.1fx fewer bytes, %lu snapshots, %lu "
+			"cycles with the copy out of date\n", delta.Bytes != 0
+			? (double) full.Bytes / (double) delta.Bytes : 0.0, snapshots,
+			mismatches);
+	return mismatches != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,942 @@
+/*******************************************************************************
+ * @file PetitFarm.c
+ * Farm of simulated slaves for load testing masters.
+ *
+ * Thousands of devices answer on a few endpoints, each a TCP port and or a
+ * pseudo terminal carrying up to 247 unit IDs, served by a few threads.  A
+ * device is not a T_PETIT_MODBUS of its own: every thread runs one instance
+ * over whole frames with PETIT_MODBUS_ProcessBatch, and points the external
+ * storage callbacks at the device the frame is addressed to before it does.
+ *
+ * Devices share template banks of registers and coils.  A device only holds
+ * a table of page pointers, and a page is copied out of its template the
+ * first time a write makes the device differ from it, so a device costs a
+ * hundred bytes or so until the master writes to it.  Every endpoint belongs
+ * to one thread, so its devices and their pages need no lock.
+ *
+ * Frames on a pseudo terminal are split by the length their function code
+ * gives, or by what one read returns for other functions.  TCP takes MBAP
+ * frames, turned into RTU ADUs for the core and back.
+ *
+ * -s runs the farm without endpoints: every thread sends random requests to
+ * its own devices, a tenth of which (-w) are written to, checks every
+ * response against a model of the device and reports the requests per second
+ * and the memory per device.
+ *
+ * Build it with the storage external and the slave address per thread:
+ *   -DPETIT_REG=PETIT_EXTERNAL -DPETIT_COIL=PETIT_EXTERNAL
+ *   -DPETIT_HOST_TLS=__thread
+ * from PetitFarm.c and the library sources, without PetitModbusPort.c, and
+ * link it with -lpthread.
+ *
+ * usage: PetitFarm [-n devices] [-u units per endpoint] [-t threads]
+ *                  [-T templates] [-p first tcp port] [-y] [-s requests]
+ *                  [-w percent written]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+// pseudo terminals and cfmakeraw
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "PetitModbus.h"
+
+#if PETIT_REG != PETIT_EXTERNAL || PETIT_COIL != PETIT_EXTERNAL || \
+	PETIT_INPUT_REG != PETIT_EXTERNAL || PETIT_DISCRETE != PETIT_EXTERNAL
+#error "PetitFarm keeps the tables of its devices, build it with -DPETIT_REG=PETIT_EXTERNAL -DPETIT_COIL=PETIT_EXTERNAL."
+#endif
+#if !defined(PETIT_BATCH) || PETIT_BATCH == 0
+#error "PetitFarm needs PETIT_MODBUS_ProcessBatch, build it with PETIT_BATCH."
+#endif
+#if !defined(PETIT_HOST_TLS)
+#error "PetitFarm answers on several threads, build it with -DPETIT_HOST_TLS=__thread."
+#endif
+
+// registers and coils of a page, 64 bytes either way
+#define FARM_PAGE_REGS (32U)
+#define FARM_PAGE_COILS (512U)
+#define FARM_PAGE_BYTES (64U)
+#define FARM_REG_PAGES \
+	((NUMBER_OF_PETITREGISTERS + FARM_PAGE_REGS - 1U) / FARM_PAGE_REGS)
+#define FARM_COIL_PAGES \
+	((NUMBER_OF_PETITCOILS + FARM_PAGE_COILS - 1U) / FARM_PAGE_COILS)
+// pages taken from the heap at once
+#define FARM_SLAB (1024U)
+#define FARM_MAX_UNITS (247U)
+#define FARM_MAX_TEMPLATES (64U)
+#define FARM_MAX_THREADS (64U)
+// bytes a connection buffers, a few frames
+#define FARM_IN_SIZE (2048U)
+#define FARM_ARENA_SIZE (2U * C_PETITMODBUS_RXTX_BUFFER_SIZE + 256U)
+#define FARM_MBAP (7U)
+
+/**
+ * the tables a device starts from, and keeps until it is written
+ */
+typedef struct
+{
+	pu16_t Regs[FARM_REG_PAGES * FARM_PAGE_REGS];
+	pu16_t Inputs[NUMBER_OF_INPUT_PETITREGISTERS];
+	pu8_t Coils[FARM_COIL_PAGES * FARM_PAGE_BYTES];
+	pu8_t Discretes[(NUMBER_OF_PETITDISCRETES + 7) >> 3];
+} T_FARM_TEMPLATE;
+
+typedef struct
+{
+	const T_FARM_TEMPLATE *Template;
+	// pages that differ from the template, 0 while shared
+	pu16_t *Reg_Pages[FARM_REG_PAGES];
+	pu8_t *Coil_Pages[FARM_COIL_PAGES];
+} T_FARM_DEVICE;
+
+struct FARM_WORKER_S;
+
+/**
+ * up to 247 devices behind a TCP port, a pseudo terminal or both
+ */
+typedef struct
+{
+	T_FARM_DEVICE *Devices;
+	pu8_t Cnt;
+	int Listen;
+	int Pty;
+	char Pty_Name[64];
+	struct FARM_WORKER_S *Worker;
+} T_FARM_ENDPOINT;
+
+/**
+ * something a worker waits on
+ */
+typedef struct
+{
+	T_FARM_ENDPOINT *Endpoint;
+	int Fd;
+	// 1 for a listening socket, 2 for a TCP connection, 3 for a terminal
+	int Kind;
+	size_t Have;
+	pu8_t In[FARM_IN_SIZE];
+} T_FARM_CONN;
+
+#define FARM_LISTEN (1)
+#define FARM_TCP (2)
+#define FARM_PTY (3)
+
+typedef struct FARM_WORKER_S
+{
+	pthread_t Thread;
+	unsigned Id;
+	T_PETIT_MODBUS Petit;
+	T_PETIT_MODBUS Crc;
+	pu8_t Arena[FARM_ARENA_SIZE];
+	int Epoll;
+	// pages left in the slab
+	pu8_t *Slab;
+	unsigned Slab_Left;
+	unsigned long Pages;
+	unsigned long Requests;
+	unsigned long Errors;
+	// -s: the endpoints of this worker are every Stride-th from First
+	unsigned First;
+	double Seconds;
+} T_FARM_WORKER;
+
+PETIT_HOST_TLS uint8_t PETITMODBUS_SLAVE_ADDRESS = 1;
+uint16_t PETITMODBUS_DLY_TOP = 0;
+
+// the device and the worker of the frame being processed on this thread
+static PETIT_HOST_TLS T_FARM_DEVICE *farm_device;
+static PETIT_HOST_TLS T_FARM_WORKER *farm_worker;
+
+static T_FARM_TEMPLATE *templates;
+static unsigned template_cnt = 4U;
+static T_FARM_ENDPOINT *endpoints;
+static unsigned endpoint_cnt;
+static T_FARM_WORKER workers[FARM_MAX_THREADS];
+static unsigned worker_cnt = 4U;
+static volatile sig_atomic_t stop;
+
+// -s: requests per worker, percentage of devices written to and the model
+static unsigned long self_requests;
+static unsigned self_written = 10U;
+static pu16_t *model_regs;
+static pu8_t *model_coils;
+
+static uint64_t farm_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/******************************************************************************/
+// the port, the tables of farm_device
+
+static void farm_no_timer(void)
+{
+}
+
+static void farm_no_tx(pu8_t Tx)
+{
+	(void) Tx;
+}
+
+pu16_t PetitPortClock(void)
+{
+	return (pu16_t) (farm_ns() / 1000U);
+}
+
+/**
+ * @return a page from the slab of this thread, 0 if memory ran out
+ */
+static void *farm_page(void)
+{
+	T_FARM_WORKER *w = farm_worker;
+
+	if (w->Slab_Left == 0)
+	{
+		w->Slab = malloc((size_t) FARM_SLAB * FARM_PAGE_BYTES);
+		if (w->Slab == NULL)
+			return NULL;
+		w->Slab_Left = FARM_SLAB;
+	}
+	w->Slab_Left--;
+	w->Pages++;
+	return &w->Slab[(size_t) w->Slab_Left * FARM_PAGE_BYTES];
+}
+
+pb_t PetitPortRegRead(pu16_t Addr, pu16_t* Data)
+{
+	const pu16_t *page = farm_device->Reg_Pages[Addr / FARM_PAGE_REGS];
+
+	*Data = page ? page[Addr % FARM_PAGE_REGS] :
+			farm_device->Template->Regs[Addr];
+	return 1;
+}
+
+/**
+ * writes a register, copying its page out of the template first unless the
+ * value is the one of the template
+ * @return 0 if there was no memory for the page
+ */
+pb_t PetitPortRegWrite(pu16_t Addr, pu16_t Data)
+{
+	T_FARM_DEVICE *dev = farm_device;
+	pu16_t **page = &dev->Reg_Pages[Addr / FARM_PAGE_REGS];
+
+	if (*page == 0)
+	{
+		const pu16_t *shared =
+				&dev->Template->Regs[Addr - Addr % FARM_PAGE_REGS];
+		if (shared[Addr % FARM_PAGE_REGS] == Data)
+			return 1;
+		if ((*page = farm_page()) == 0)
+			return 0;
+		memcpy(*page, shared, FARM_PAGE_BYTES);
+	}
+	(*page)[Addr % FARM_PAGE_REGS] = Data;
+	return 1;
+}
+
+pb_t PetitPortInputRegRead(pu16_t Addr, pu16_t* Data)
+{
+	*Data = farm_device->Template->Inputs[Addr];
+	return 1;
+}
+
+pb_t PetitPortCoilRead(pu16_t Addr, pu8_t* Data)
+{
+	const pu8_t *page = farm_device->Coil_Pages[Addr / FARM_PAGE_COILS];
+
+	if (page == 0)
+		page = &farm_device->Template->Coils[Addr / FARM_PAGE_COILS
+				* FARM_PAGE_BYTES];
+	*Data = (page[Addr % FARM_PAGE_COILS >> 3] >> (Addr & 7U)) & 1U;
+	return 1;
+}
+
+pb_t PetitPortCoilWrite(pu16_t Addr, pu16_t Data)
+{
+	T_FARM_DEVICE *dev = farm_device;
+	pu8_t **page = &dev->Coil_Pages[Addr / FARM_PAGE_COILS];
+	pu16_t byte = Addr % FARM_PAGE_COILS >> 3;
+	pu8_t bit = (pu8_t) (1U << (Addr & 7U));
+
+	if (*page == 0)
+	{
+		const pu8_t *shared = &dev->Template->Coils[Addr / FARM_PAGE_COILS
+				* FARM_PAGE_BYTES];
+		if (((shared[byte] & bit) != 0) == (Data != 0))
+			return 1;
+		if ((*page = farm_page()) == 0)
+			return 0;
+		memcpy(*page, shared, FARM_PAGE_BYTES);
+	}
+	if (Data)
+		(*page)[byte] |= bit;
+	else
+		(*page)[byte] &= (pu8_t) ~bit;
+	return 1;
+}
+
+pb_t PetitPortDiscreteRead(pu16_t Addr, pu8_t* Data)
+{
+	*Data = (farm_device->Template->Discretes[Addr >> 3] >> (Addr & 7U)) & 1U;
+	return 1;
+}
+
+/******************************************************************************/
+
+/**
+ * Answers one RTU ADU on an endpoint.
+ * @param[out] Rsp the response in the arena of the worker, CRC included
+ * @return the length of the response, 0 if there is none
+ */
+static pu16_t farm_adu(T_FARM_WORKER *W, T_FARM_ENDPOINT *E, const pu8_t *Req,
+		pu16_t Len, pu8_t **Rsp)
+{
+	T_PETIT_ADU adu;
+
+	if (Len < 4U || Req[0] == 0 || Req[0] > E->Cnt)
+		return 0;
+	farm_device = &E->Devices[Req[0] - 1U];
+	PETITMODBUS_SLAVE_ADDRESS = Req[0];
+	adu.Req = Req;
+	adu.Req_Len = Len;
+	if (PETIT_MODBUS_ProcessBatch(&W->Petit, &adu, 1U, W->Arena,
+			sizeof(W->Arena)) != 1U || adu.Rsp_Len == 0)
+		return 0;
+	W->Requests++;
+	if (adu.Rsp[1] & 0x80U)
+		W->Errors++;
+	*Rsp = adu.Rsp;
+	return adu.Rsp_Len;
+}
+
+static int farm_send(int Fd, const pu8_t *Data, size_t Len)
+{
+	ssize_t n;
+
+	while (Len > 0)
+	{
+		n = send(Fd, Data, Len, MSG_NOSIGNAL);
+		if (n < 0 && errno == ENOTSOCK)
+			n = write(Fd, Data, Len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		Data += n;
+		Len -= (size_t) n;
+	}
+	return 0;
+}
+
+/**
+ * @return the length of the RTU request starting at Buf, 0 if more bytes are
+ *   needed to tell, or Have if its function code does not tell
+ */
+static size_t farm_rtu_len(const pu8_t *Buf, size_t Have)
+{
+	if (Have < 2U)
+		return 0;
+	switch (Buf[1])
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+	case C_FCODE_WRITE_SINGLE_COIL:
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		return 8U;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		return Have < 7U ? 0 : 9U + Buf[6];
+	default:
+		return Have;
+	}
+}
+
+/**
+ * Answers the complete frames a connection has buffered.
+ * @return -1 if the connection is to be closed
+ */
+static int farm_frames(T_FARM_WORKER *W, T_FARM_CONN *C)
+{
+	pu8_t rtu[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu8_t out[FARM_MBAP + C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	size_t pos = 0;
+	size_t len;
+	pu8_t *rsp;
+	pu16_t n;
+
+	while (pos < C->Have)
+	{
+		const pu8_t *in = &C->In[pos];
+		size_t have = C->Have - pos;
+
+		if (C->Kind == FARM_PTY)
+		{
+			len = farm_rtu_len(in, have);
+			if (len == 0 || len > have)
+				break;
+			n = farm_adu(W, C->Endpoint, in, (pu16_t) len, &rsp);
+			if (n != 0 && farm_send(C->Fd, rsp, n) != 0)
+				return -1;
+			pos += len;
+			continue;
+		}
+
+		// MBAP: transaction, protocol, length of unit and PDU, unit
+		if (have < FARM_MBAP)
+			break;
+		len = (size_t) in[4] << 8 | in[5];
+		if (in[2] != 0 || in[3] != 0 || len < 2U
+				|| len + 1U > sizeof(rtu))
+			return -1;
+		if (have < 6U + len)
+			break;
+		memcpy(rtu, &in[6], len);
+		PetitCRC16(&W->Crc, rtu, (pu16_t) len);
+		rtu[len] = (pu8_t) W->Crc.CRC16;
+		rtu[len + 1U] = (pu8_t) (W->Crc.CRC16 >> 8);
+		n = farm_adu(W, C->Endpoint, rtu, (pu16_t) (len + 2U), &rsp);
+		if (n != 0)
+		{
+			memcpy(out, in, 4U);
+			out[4] = (pu8_t) ((n - 2U) >> 8);
+			out[5] = (pu8_t) (n - 2U);
+			memcpy(&out[6], rsp, n - 2U);
+			if (farm_send(C->Fd, out, 6U + n - 2U) != 0)
+				return -1;
+		}
+		pos += 6U + len;
+	}
+	// a terminal drops what it cannot frame
+	if (C->Kind == FARM_PTY && pos == 0 && C->Have == sizeof(C->In))
+		pos = C->Have;
+	memmove(C->In, &C->In[pos], C->Have - pos);
+	C->Have -= pos;
+	return 0;
+}
+
+static int farm_watch(T_FARM_WORKER *W, T_FARM_ENDPOINT *E, int Fd, int Kind)
+{
+	struct epoll_event ev;
+	T_FARM_CONN *c = calloc(1, sizeof(T_FARM_CONN));
+
+	if (c == NULL)
+		return -1;
+	c->Endpoint = E;
+	c->Fd = Fd;
+	c->Kind = Kind;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(W->Epoll, EPOLL_CTL_ADD, Fd, &ev) != 0)
+	{
+		free(c);
+		return -1;
+	}
+	return 0;
+}
+
+static void *farm_serve(void *Arg)
+{
+	T_FARM_WORKER *w = Arg;
+	struct epoll_event ev[32];
+	int n;
+	int i;
+
+	farm_worker = w;
+	while (!stop)
+	{
+		n = epoll_wait(w->Epoll, ev, 32, 200);
+		for (i = 0; i < n; i++)
+		{
+			T_FARM_CONN *c = ev[i].data.ptr;
+			ssize_t got;
+
+			if (c->Kind == FARM_LISTEN)
+			{
+				int fd = accept(c->Fd, NULL, NULL);
+				if (fd >= 0 && farm_watch(w, c->Endpoint, fd, FARM_TCP) != 0)
+					close(fd);
+				continue;
+			}
+			got = read(c->Fd, &c->In[c->Have], sizeof(c->In) - c->Have);
+			if (got > 0)
+			{
+				c->Have += (size_t) got;
+				if (farm_frames(w, c) == 0)
+					continue;
+			}
+			else if (got < 0 && (errno == EINTR || errno == EAGAIN))
+			{
+				continue;
+			}
+			// a terminal keeps its slave side open and never hangs up
+			epoll_ctl(w->Epoll, EPOLL_CTL_DEL, c->Fd, NULL);
+			close(c->Fd);
+			free(c);
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************/
+// -s
+
+/**
+ * Builds a request with its CRC.
+ */
+static pu16_t self_request(T_FARM_WORKER *W, pu8_t *Adu, pu8_t Unit,
+		pu8_t Function, pu16_t Addr, pu16_t Cnt, const pu8_t *Data,
+		pu8_t Bytes)
+{
+	pu16_t len = 0;
+
+	Adu[len++] = Unit;
+	Adu[len++] = Function;
+	Adu[len++] = (pu8_t) (Addr >> 8);
+	Adu[len++] = (pu8_t) Addr;
+	Adu[len++] = (pu8_t) (Cnt >> 8);
+	Adu[len++] = (pu8_t) Cnt;
+	if (Data != NULL)
+	{
+		Adu[len++] = Bytes;
+		memcpy(&Adu[len], Data, Bytes);
+		len += Bytes;
+	}
+	PetitCRC16(&W->Crc, Adu, len);
+	Adu[len++] = (pu8_t) W->Crc.CRC16;
+	Adu[len++] = (pu8_t) (W->Crc.CRC16 >> 8);
+	return len;
+}
+
+/**
+ * One random request to a device, checked against the model.
+ * @return 0 if the response is wrong
+ */
+static int self_one(T_FARM_WORKER *W, T_FARM_ENDPOINT *E, unsigned *Seed)
+{
+	pu8_t adu[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu8_t data[2U * 123U];
+	pu8_t unit = (pu8_t) (1U + rand_r(Seed) % E->Cnt);
+	size_t dev = (size_t) (&E->Devices[unit - 1U] - endpoints[0].Devices);
+	pu16_t *regs = &model_regs[dev * NUMBER_OF_PETITREGISTERS];
+	pu8_t *coils = &model_coils[dev * ((NUMBER_OF_PETITCOILS + 7) >> 3)];
+	const T_FARM_TEMPLATE *t = E->Devices[unit - 1U].Template;
+	// only some devices are written to, and they are the same every time
+	int writable = dev * 2654435761UL % 100U < self_written;
+	unsigned op = rand_r(Seed) % 8U;
+	pu16_t cnt = (pu16_t) (1U + rand_r(Seed) % 32U);
+	pu16_t addr;
+	pu16_t len;
+	pu16_t n;
+	pu16_t i;
+	pu8_t *rsp;
+
+	if (!writable || op < 4U)
+	{
+		// read holding registers
+		addr = (pu16_t) (rand_r(Seed) % (NUMBER_OF_PETITREGISTERS - cnt));
+		len = self_request(W, adu, unit, C_FCODE_READ_HOLDING_REGISTERS,
+				addr, cnt, NULL, 0);
+		n = farm_adu(W, E, adu, len, &rsp);
+		if (n != 5U + 2U * cnt)
+			return 0;
+		for (i = 0; i < cnt; i++)
+			if ((pu16_t) (rsp[3U + 2U * i] << 8 | rsp[4U + 2U * i])
+					!= regs[addr + i])
+				return 0;
+		return 1;
+	}
+	if (op == 4U)
+	{
+		// read input registers, always the template
+		addr = (pu16_t) (rand_r(Seed)
+				% (NUMBER_OF_INPUT_PETITREGISTERS - cnt));
+		len = self_request(W, adu, unit, C_FCODE_READ_INPUT_REGISTERS,
+				addr, cnt, NULL, 0);
+		n = farm_adu(W, E, adu, len, &rsp);
+		if (n != 5U + 2U * cnt)
+			return 0;
+		for (i = 0; i < cnt; i++)
+			if ((pu16_t) (rsp[3U + 2U * i] << 8 | rsp[4U + 2U * i])
+					!= t->Inputs[addr + i])
+				return 0;
+		return 1;
+	}
+	if (op == 5U)
+	{
+		// read coils
+		cnt = (pu16_t) (cnt * 8U);
+		addr = (pu16_t) (rand_r(Seed) % (NUMBER_OF_PETITCOILS - cnt));
+		len = self_request(W, adu, unit, C_FCODE_READ_COILS, addr, cnt,
+				NULL, 0);
+		n = farm_adu(W, E, adu, len, &rsp);
+		if (n != 5U + (cnt + 7U) / 8U)
+			return 0;
+		for (i = 0; i < cnt; i++)
+			if (((rsp[3U + i / 8U] >> (i & 7U)) & 1U)
+					!= ((coils[(addr + i) >> 3] >> ((addr + i) & 7U)) & 1U))
+				return 0;
+		return 1;
+	}
+	if (op == 6U)
+	{
+		// write coils, half of them as they are
+		cnt = (pu16_t) (cnt * 8U);
+		addr = (pu16_t) (rand_r(Seed) % (NUMBER_OF_PETITCOILS - cnt));
+		memset(data, 0, (cnt + 7U) / 8U);
+		for (i = 0; i < cnt; i++)
+		{
+			pu8_t bit = (coils[(addr + i) >> 3] >> ((addr + i) & 7U)) & 1U;
+			if (rand_r(Seed) % 16U == 0)
+				bit ^= 1U;
+			data[i >> 3] |= (pu8_t) (bit << (i & 7U));
+		}
+		len = self_request(W, adu, unit, C_FCODE_WRITE_MULTIPLE_COILS, addr,
+				cnt, data, (pu8_t) ((cnt + 7U) / 8U));
+		if (farm_adu(W, E, adu, len, &rsp) != 8U || rsp[1] & 0x80U)
+			return 0;
+		for (i = 0; i < cnt; i++)
+		{
+			pu8_t bit = (pu8_t) (1U << ((addr + i) & 7U));
+			if (data[i >> 3] & (1U << (i & 7U)))
+				coils[(addr + i) >> 3] |= bit;
+			else
+				coils[(addr + i) >> 3] &= (pu8_t) ~bit;
+		}
+		return 1;
+	}
+	// write registers, some of them back to their template value
+	addr = (pu16_t) (rand_r(Seed) % (NUMBER_OF_PETITREGISTERS - cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		pu16_t v = rand_r(Seed) % 4U == 0 ? t->Regs[addr + i] :
+				(pu16_t) rand_r(Seed);
+		data[2U * i] = (pu8_t) (v >> 8);
+		data[2U * i + 1U] = (pu8_t) v;
+	}
+	len = self_request(W, adu, unit, C_FCODE_WRITE_MULTIPLE_REGISTERS, addr,
+			cnt, data, (pu8_t) (2U * cnt));
+	if (farm_adu(W, E, adu, len, &rsp) != 8U || rsp[1] & 0x80U)
+		return 0;
+	for (i = 0; i < cnt; i++)
+		regs[addr + i] = (pu16_t) (data[2U * i] << 8 | data[2U * i + 1U]);
+	return 1;
+}
+
+static void *farm_self(void *Arg)
+{
+	T_FARM_WORKER *w = Arg;
+	unsigned seed = 1U + w->Id;
+	unsigned long r;
+	unsigned mine = 0;
+	uint64_t t0;
+	unsigned e;
+
+	farm_worker = w;
+	for (e = w->First; e < endpoint_cnt; e += worker_cnt)
+		mine++;
+	if (mine == 0)
+		return NULL;
+	t0 = farm_ns();
+	for (r = 0; r < self_requests; r++)
+	{
+		e = w->First + worker_cnt * (rand_r(&seed) % mine);
+		if (!self_one(w, &endpoints[e], &seed))
+			w->Errors++;
+	}
+	w->Seconds = (double) (farm_ns() - t0) / 1e9;
+	return NULL;
+}
+
+/******************************************************************************/
+
+static void farm_templates(void)
+{
+	unsigned t;
+	unsigned i;
+
+	for (t = 0; t < template_cnt; t++)
+	{
+		T_FARM_TEMPLATE *tp = &templates[t];
+		for (i = 0; i < FARM_REG_PAGES * FARM_PAGE_REGS; i++)
+			tp->Regs[i] = (pu16_t) (t << 12 | i);
+		for (i = 0; i < NUMBER_OF_INPUT_PETITREGISTERS; i++)
+			tp->Inputs[i] = (pu16_t) (0x8000U | t << 12 | i);
+		for (i = 0; i < sizeof(tp->Coils); i++)
+			tp->Coils[i] = (pu8_t) (i * 37U + t);
+		for (i = 0; i < sizeof(tp->Discretes); i++)
+			tp->Discretes[i] = (pu8_t) (i * 11U + t);
+	}
+}
+
+/**
+ * Opens a pseudo terminal in raw mode, keeping its slave side open.
+ * @return the master side, -1 on failure
+ */
+static int farm_pty(char *Name, size_t Size)
+{
+	struct termios tio;
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	int slave;
+
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0
+			|| ptsname(fd) == NULL)
+	{
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	snprintf(Name, Size, "%s", ptsname(fd));
+	slave = open(Name, O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	// slave stays open, so the master does not see a hang-up between clients
+	return fd;
+}
+
+static int farm_listen(unsigned Port)
+{
+	struct sockaddr_in sa;
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons((uint16_t) Port);
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0
+			|| listen(fd, 64) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void farm_stop(int Sig)
+{
+	(void) Sig;
+	stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	T_FARM_DEVICE *devices;
+	unsigned long device_cnt = 5000UL;
+	unsigned units = FARM_MAX_UNITS;
+	unsigned port = 0;
+	int pty = 0;
+	unsigned long pages = 0;
+	unsigned long requests = 0;
+	unsigned long errors = 0;
+	double seconds = 0;
+	double shared;
+	unsigned long d;
+	unsigned i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:u:t:T:p:ys:w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			device_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			units = (unsigned) atoi(optarg);
+			break;
+		case 't':
+			worker_cnt = (unsigned) atoi(optarg);
+			break;
+		case 'T':
+			template_cnt = (unsigned) atoi(optarg);
+			break;
+		case 'p':
+			port = (unsigned) atoi(optarg);
+			break;
+		case 'y':
+			pty = 1;
+			break;
+		case 's':
+			self_requests = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			self_written = (unsigned) atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n devices] [-u units per endpoint] "
+					"[-t threads] [-T templates] [-p first tcp port] [-y] "
+					"[-s requests] [-w percent written]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (device_cnt == 0 || units == 0 || units > FARM_MAX_UNITS
+			|| worker_cnt == 0 || worker_cnt > FARM_MAX_THREADS
+			|| template_cnt == 0 || template_cnt > FARM_MAX_TEMPLATES
+			|| port > 65535U || (self_requests == 0 && port == 0 && !pty))
+	{
+		fprintf(stderr, "%s: bad option, or neither -p, -y nor -s\n",
+				argv[0]);
+		return 2;
+	}
+
+	endpoint_cnt = (unsigned) ((device_cnt + units - 1U) / units);
+	templates = calloc(template_cnt, sizeof(T_FARM_TEMPLATE));
+	endpoints = calloc(endpoint_cnt, sizeof(T_FARM_ENDPOINT));
+	devices = calloc(device_cnt, sizeof(T_FARM_DEVICE));
+	if (templates == NULL || endpoints == NULL || devices == NULL)
+	{
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 1;
+	}
+	farm_templates();
+	for (d = 0; d < device_cnt; d++)
+		devices[d].Template = &templates[d % template_cnt];
+
+	for (i = 0; i < worker_cnt; i++)
+	{
+		T_FARM_WORKER *w = &workers[i];
+		w->Id = i;
+		w->First = i;
+		w->Petit.Timer_Start = farm_no_timer;
+		w->Petit.Timer_Stop = farm_no_timer;
+		w->Petit.Tx_Begin = farm_no_tx;
+		PETIT_MODBUS_Init(&w->Petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		PETIT_MODBUS_Set_Buffer(&w->Petit, w->Arena,
+				C_PETITMODBUS_RXTX_BUFFER_SIZE);
+#endif
+		w->Epoll = epoll_create1(0);
+		if (w->Epoll < 0)
+		{
+			perror("epoll_create1");
+			return 1;
+		}
+	}
+	for (i = 0; i < endpoint_cnt; i++)
+	{
+		T_FARM_ENDPOINT *e = &endpoints[i];
+		e->Devices = &devices[(unsigned long) i * units];
+		e->Cnt = (pu8_t) (device_cnt - (unsigned long) i * units < units ?
+				device_cnt - (unsigned long) i * units : units);
+		e->Worker = &workers[i % worker_cnt];
+		e->Listen = -1;
+		e->Pty = -1;
+		if (port != 0)
+		{
+			e->Listen = farm_listen(port + i);
+			if (e->Listen < 0
+					|| farm_watch(e->Worker, e, e->Listen, FARM_LISTEN) != 0)
+			{
+				fprintf(stderr, "%s: tcp port %u: %s\n", argv[0], port + i,
+						strerror(errno));
+				return 1;
+			}
+		}
+		if (pty)
+		{
+			e->Pty = farm_pty(e->Pty_Name, sizeof(e->Pty_Name));
+			if (e->Pty < 0 || farm_watch(e->Worker, e, e->Pty, FARM_PTY) != 0)
+			{
+				fprintf(stderr, "%s: pty: %s\n", argv[0], strerror(errno));
+				return 1;
+			}
+		}
+		if (port != 0 || pty)
+			printf("endpoint %u: units 1-%u%s%.0u%s%s\n", i, e->Cnt,
+					port != 0 ? ", tcp port " : "", port != 0 ? port + i : 0,
+					pty ? ", " : "", pty ? e->Pty_Name : "");
+	}
+	fflush(stdout);
+
+	if (self_requests != 0)
+	{
+		size_t coil_bytes = (NUMBER_OF_PETITCOILS + 7) >> 3;
+		model_regs = malloc(device_cnt * NUMBER_OF_PETITREGISTERS
+				* sizeof(pu16_t));
+		model_coils = malloc(device_cnt * coil_bytes);
+		if (model_regs == NULL || model_coils == NULL)
+		{
+			fprintf(stderr, "%s: out of memory for the model\n", argv[0]);
+			return 1;
+		}
+		for (d = 0; d < device_cnt; d++)
+		{
+			memcpy(&model_regs[d * NUMBER_OF_PETITREGISTERS],
+					devices[d].Template->Regs,
+					NUMBER_OF_PETITREGISTERS * sizeof(pu16_t));
+			memcpy(&model_coils[d * coil_bytes], devices[d].Template->Coils,
+					coil_bytes);
+		}
+		for (i = 0; i < worker_cnt; i++)
+			pthread_create(&workers[i].Thread, NULL, farm_self, &workers[i]);
+	}
+	else
+	{
+		signal(SIGINT, farm_stop);
+		signal(SIGTERM, farm_stop);
+		for (i = 0; i < worker_cnt; i++)
+			pthread_create(&workers[i].Thread, NULL, farm_serve, &workers[i]);
+	}
+	for (i = 0; i < worker_cnt; i++)
+	{
+		pthread_join(workers[i].Thread, NULL);
+		pages += workers[i].Pages;
+		requests += workers[i].Requests;
+		errors += workers[i].Errors;
+		if (workers[i].Seconds > seconds)
+			seconds = workers[i].Seconds;
+	}
+
+	// what a device costs, with the templates and endpoints shared out
+	shared = (double) (template_cnt * sizeof(T_FARM_TEMPLATE)
+			+ endpoint_cnt * sizeof(T_FARM_ENDPOINT)) / (double) device_cnt;
+	printf("%lu devices on %u endpoints and %u threads, %lu pages copied\n",
+			device_cnt, endpoint_cnt, worker_cnt, pages);
+	printf("%.0f bytes per device, %.0f with a bank and an instance each\n",
+			(double) sizeof(T_FARM_DEVICE) + shared
+			+ (double) pages * FARM_PAGE_BYTES / (double) device_cnt,
+			(double) sizeof(T_FARM_TEMPLATE) + sizeof(T_PETIT_MODBUS));
+	if (self_requests != 0)
+	{
+		printf("%lu requests in %.3f s, %.0f per second, %lu wrong\n",
+				requests, seconds, seconds > 0 ? requests / seconds : 0.0,
+				errors);
+		return errors != 0;
+	}
+	printf("%lu requests, %lu exceptions\n", requests, errors);
+	return 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,250 @@
+/*******************************************************************************
+ * @file PetitHeatMap.c
+ * Prints the hottest register and coil ranges of a bus capture.
+ *
+ * The capture is the byte stream taken out of a T_PETIT_SNIFF ring, as
+ * PetitSniffDump reads it.  Every request in it with a good CRC is answered
+ * by a slave built with PETIT_HEAT, through PETIT_MODBUS_ProcessBatch, in
+ * the place of the unit it was sent to, so the heatmap counts what masters
+ * asked of the registers and coils the host port has.  Responses, broadcasts
+ * and requests the slave answers with an exception are not counted.
+ *
+ * For every table the report gives the accesses and how many registers or
+ * blocks were touched, then the hottest ranges over all tables: consecutive
+ * registers or blocks with the same count, hottest first.
+ *
+ * usage: PetitHeatMap [-n ranges] [-u unit] [capture]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "PetitModbusHost.h"
+#include "PetitSniff.h"
+#include "PetitHeat.h"
+
+#if !defined(PETIT_HEAT) || PETIT_HEAT == 0 || \
+	!defined(PETIT_BATCH) || PETIT_BATCH == 0
+#error "PetitHeatMap needs -DPETIT_HEAT=1 and PETIT_BATCH."
+#endif
+
+// capture bytes read at once, more than one record
+#define HEAT_CHUNK (1U << 16)
+#define HEAT_MAX_RANGES (8192U)
+
+typedef struct
+{
+	pu8_t Table;
+	pu16_t First;
+	pu16_t Last;
+	unsigned long Count;
+} T_HEAT_RANGE;
+
+static const char *const heat_names[PETIT_HEAT_TABLES] =
+{
+	"holding read", "holding write", "input read", "coil read",
+	"coil write", "discrete read"
+};
+
+static T_PETIT_MODBUS petit;
+static int unit = -1;
+static unsigned long requests;
+static unsigned long answered;
+static unsigned long refused;
+
+/**
+ * Runs one request of the capture through the slave.
+ * @param[in] Rec the record header followed by the frame
+ */
+static void heat_record(const pu8_t *Rec)
+{
+	static pu8_t arena[C_PETITMODBUS_RXTX_BUFFER_SIZE + 5U + 2U * 125U];
+	T_PETIT_ADU adu;
+	pu8_t flags = Rec[0];
+	pu16_t len = Rec[1];
+
+	if ((flags & (PETIT_SNIFF_CRC_OK | PETIT_SNIFF_RESPONSE
+			| PETIT_SNIFF_TRUNCATED)) != PETIT_SNIFF_CRC_OK || len < 4U
+			|| Rec[PETIT_SNIFF_HDR] == 0
+			|| (unit >= 0 && Rec[PETIT_SNIFF_HDR] != unit))
+		return;
+	requests++;
+	PETITMODBUS_SLAVE_ADDRESS = Rec[PETIT_SNIFF_HDR];
+	adu.Req = &Rec[PETIT_SNIFF_HDR];
+	adu.Req_Len = len;
+	if (PETIT_MODBUS_ProcessBatch(&petit, &adu, 1U, arena, sizeof(arena))
+			!= 1U || adu.Rsp_Len < 2U)
+		return;
+	if (adu.Rsp[1] & 0x80U)
+		refused++;
+	else
+		answered++;
+}
+
+/**
+ * @return the first register, coil or discrete input of entry I of a table
+ */
+static unsigned long heat_addr(pu8_t Table, unsigned long I)
+{
+	return Table >= PETIT_HEAT_COIL_READ ? I * PETIT_HEAT_BLOCK : I;
+}
+
+static int heat_cmp(const void *A, const void *B)
+{
+	const T_HEAT_RANGE *a = A;
+	const T_HEAT_RANGE *b = B;
+
+	if (a->Count != b->Count)
+		return a->Count < b->Count ? 1 : -1;
+	if (a->Table != b->Table)
+		return a->Table < b->Table ? -1 : 1;
+	return a->First < b->First ? -1 : a->First > b->First;
+}
+
+int main(int argc, char **argv)
+{
+	static pu8_t in[HEAT_CHUNK];
+	static T_PETIT_HEAT_CNT counts[NUMBER_OF_PETITREGISTERS
+			+ NUMBER_OF_INPUT_PETITREGISTERS + NUMBER_OF_PETITCOILS];
+	static T_HEAT_RANGE ranges[HEAT_MAX_RANGES];
+	static const unsigned long sizes[PETIT_HEAT_TABLES] =
+	{
+		NUMBER_OF_PETITREGISTERS, NUMBER_OF_PETITREGISTERS,
+		NUMBER_OF_INPUT_PETITREGISTERS, NUMBER_OF_PETITCOILS,
+		NUMBER_OF_PETITCOILS, NUMBER_OF_PETITDISCRETES
+	};
+	unsigned long total[PETIT_HEAT_TABLES];
+	unsigned range_cnt = 0;
+	unsigned top = 10;
+	FILE *f = stdin;
+	size_t have = 0;
+	size_t pos;
+	size_t n;
+	pu8_t t;
+	pu16_t len;
+	pu16_t i;
+	unsigned r;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:u:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			top = (unsigned) strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			unit = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ranges] [-u unit] [capture]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+	if (unit == 0 || unit > 247)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (optind < argc && (f = fopen(argv[optind], "rb")) == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+	PETIT_HEAT_Reset();
+
+	while ((n = fread(&in[have], 1, sizeof(in) - have, f)) > 0)
+	{
+		have += n;
+		pos = 0;
+		while (have - pos >= PETIT_SNIFF_HDR
+				&& have - pos >= PETIT_SNIFF_HDR + in[pos + 1U])
+		{
+			heat_record(&in[pos]);
+			pos += PETIT_SNIFF_HDR + in[pos + 1U];
+		}
+		memmove(in, &in[pos], have - pos);
+		have -= pos;
+	}
+	if (have != 0)
+		fprintf(stderr, "%s: capture ends in a record\n", argv[0]);
+
+	printf("# %lu requests, %lu answered, %lu refused, %lu without a "
+			"response\n", requests, answered, refused,
+			requests - answered - refused);
+	printf("# %-14s %10s %16s\n", "table", "accesses", "touched");
+	for (t = 0; t < PETIT_HEAT_TABLES; t++)
+	{
+		unsigned long touched = 0;
+
+		len = PETIT_HEAT_Snapshot_Clear(t, counts,
+				sizeof(counts) / sizeof(counts[0]));
+		total[t] = 0;
+		for (i = 0; i < len; i++)
+		{
+			T_HEAT_RANGE *last = range_cnt ? &ranges[range_cnt - 1U] : NULL;
+
+			total[t] += counts[i];
+			if (counts[i] == 0)
+				continue;
+			touched++;
+			// a range goes on while the count stays the same
+			if (last != NULL && last->Table == t && last->Last + 1U == i
+					&& last->Count == counts[i])
+			{
+				last->Last = i;
+				continue;
+			}
+			if (range_cnt == HEAT_MAX_RANGES)
+				continue;
+			ranges[range_cnt].Table = t;
+			ranges[range_cnt].First = i;
+			ranges[range_cnt].Last = i;
+			ranges[range_cnt].Count = counts[i];
+			range_cnt++;
+		}
+		printf("  %-14s %10lu %8lu of %5u%s\n", heat_names[t], total[t],
+				touched, len, t >= PETIT_HEAT_COIL_READ ? " blocks" : "");
+	}
+
+	qsort(ranges, range_cnt, sizeof(ranges[0]), heat_cmp);
+	printf("# %-14s %13s %10s %8s\n", "hottest", "range", "accesses",
+			"share");
+	for (r = 0; r < range_cnt && r < top; r++)
+	{
+		const T_HEAT_RANGE *h = &ranges[r];
+		unsigned long first = heat_addr(h->Table, h->First);
+		unsigned long last = heat_addr(h->Table, h->Last + 1U) - 1U;
+
+		if (last >= sizes[h->Table])
+			last = sizes[h->Table] - 1U;
+		printf("  %-14s %6lu-%-6lu %10lu %7.1f%%\n", heat_names[h->Table],
+				first, last, h->Count,
+				100.0 * (double) h->Count * (h->Last - h->First + 1U)
+				/ (double) total[h->Table]);
+	}
+	return ferror(f) || have != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
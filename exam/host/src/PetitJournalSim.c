@@ -0,0 +1,324 @@
+/*******************************************************************************
+ * @file PetitJournalSim.c
+ * Exercises the persistence journal against the file-backed flash of the
+ * host port.
+ *
+ * A master writes random registers with functions 6 and 16 through the
+ * slave, PETIT_JOURNAL_Poll runs between the requests as it would in a main
+ * loop, and every value written to a register is larger than the one before,
+ * so recovered values can be placed in its history.  From time to time the
+ * device reboots: the registers are cleared and PETIT_JOURNAL_Init rebuilds
+ * them.  A clean reboot lets the journal catch up first and must restore
+ * every register exactly.  A power cut stops the flash after a random number
+ * of bytes, possibly in the middle of a record, a checkpoint or a header, and
+ * every register must come back with a value between the one it had when the
+ * journal last caught up and the one it had at the cut.
+ *
+ * The report compares the flash written per register write with saving the
+ * whole bank on every change, and gives the erases and the longest boot.
+ * The exit status is 1 if a register came back wrong.
+ *
+ * usage: PetitJournalSim [-w writes] [-r reboots] [-s seed] [flash file]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PetitModbusHost.h"
+#include "PetitJournal.h"
+
+// the most registers one function 16 writes here
+#define SIM_BLOCK (16U)
+// calls of PETIT_JOURNAL_Poll between two requests
+#define SIM_POLLS (2U)
+
+// what the master wrote last, and what was in flash when the journal last
+// caught up
+static pu16_t written[NUMBER_OF_PETITREGISTERS];
+static pu16_t persisted[NUMBER_OF_PETITREGISTERS];
+static unsigned long reg_writes;
+static unsigned long requests;
+
+static uint64_t sim_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Runs one request through the slave.
+ * @return 1 if the slave answered without an exception
+ */
+static int sim_request(T_PETIT_MODBUS *Petit, pu8_t *Adu, pu16_t Len)
+{
+	static T_PETIT_MODBUS crc;
+	pu8_t rsp[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu16_t n = 0;
+	pu16_t i;
+	int first = -1;
+
+	PetitCRC16(&crc, Adu, Len);
+	Adu[Len++] = crc.CRC16;
+	Adu[Len++] = crc.CRC16 >> 8;
+	for (i = 0; i < Len; i++)
+		PetitRxBufferInsert(Petit, Adu[i]);
+	for (i = 0; i < 16U && first < 0; i++)
+	{
+		PETIT_MODBUS_Process(Petit);
+		first = PetitHostTxTake();
+	}
+	if (first < 0)
+	{
+		PetitRxBufferReset(Petit);
+		return 0;
+	}
+	rsp[n++] = first;
+	while (n < sizeof(rsp) && PetitTxBufferPop(Petit, &rsp[n]))
+		n++;
+	requests++;
+	return n > 2U && !(rsp[1] & 0x80U);
+}
+
+/**
+ * Writes random registers with function 6 or 16, each one more than before.
+ */
+static int sim_write(T_PETIT_MODBUS *Petit)
+{
+	pu8_t adu[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu16_t addr = (pu16_t) (rand() % NUMBER_OF_PETITREGISTERS);
+	pu16_t cnt = 1U;
+	pu16_t len = 0;
+	pu16_t value;
+	pu16_t i;
+
+	adu[len++] = PETITMODBUS_SLAVE_ADDRESS;
+	if (rand() % 4 != 0)
+	{
+		value = (pu16_t) (written[addr] + 1U);
+		adu[len++] = C_FCODE_WRITE_SINGLE_REGISTER;
+		adu[len++] = addr >> 8;
+		adu[len++] = addr;
+		adu[len++] = value >> 8;
+		adu[len++] = value;
+	}
+	else
+	{
+		cnt = (pu16_t) (1 + rand() % SIM_BLOCK);
+		if (addr + cnt > NUMBER_OF_PETITREGISTERS)
+			addr = NUMBER_OF_PETITREGISTERS - cnt;
+		adu[len++] = C_FCODE_WRITE_MULTIPLE_REGISTERS;
+		adu[len++] = addr >> 8;
+		adu[len++] = addr;
+		adu[len++] = cnt >> 8;
+		adu[len++] = cnt;
+		adu[len++] = 2U * cnt;
+		for (i = 0; i < cnt; i++)
+		{
+			value = (pu16_t) (written[addr + i] + 1U);
+			adu[len++] = value >> 8;
+			adu[len++] = value;
+		}
+	}
+	if (!sim_request(Petit, adu, len))
+	{
+		fprintf(stderr, "write of %u registers at %u failed\n", cnt, addr);
+		return 0;
+	}
+	for (i = 0; i < cnt; i++)
+		written[addr + i]++;
+	reg_writes += cnt;
+	return 1;
+}
+
+/**
+ * Lets the journal catch up, then takes what it persisted as the baseline.
+ */
+static void sim_settle(void)
+{
+	unsigned long n = 0;
+
+	while (PETIT_JOURNAL_Poll() && ++n < 1000000UL)
+		;
+	memcpy(persisted, written, sizeof(written));
+}
+
+/**
+ * Clears the registers as a reset does and rebuilds them from the journal.
+ * @param[in] Exact the registers must come back as written, not only as
+ *   persisted
+ * @return the registers that came back wrong
+ */
+static unsigned sim_reboot(int Exact, uint64_t *Ns)
+{
+	uint64_t t0;
+	unsigned bad = 0;
+	pu16_t got;
+	pu16_t i;
+
+	memset(PetitRegisters, 0, sizeof(PetitRegisters));
+	t0 = sim_ns();
+	PETIT_JOURNAL_Init();
+	*Ns = sim_ns() - t0;
+	for (i = 0; i < NUMBER_OF_PETITREGISTERS; i++)
+	{
+		got = PETIT_REG_LOAD(PetitRegisters[i]);
+		if (Exact ? got != written[i] :
+				got < persisted[i] || got > written[i])
+		{
+			if (bad++ < 8U)
+				fprintf(stderr, "register %u: %u, written %u, persisted %u\n",
+						i, got, written[i], persisted[i]);
+		}
+		// the device goes on from what it recovered
+		written[i] = got;
+	}
+	memcpy(persisted, written, sizeof(written));
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	static T_PETIT_MODBUS petit;
+	const char *path = NULL;
+	char tmp[64];
+	long writes = 20000;
+	long reboots = 200;
+	unsigned seed = 1U;
+	unsigned long flash_bytes;
+	unsigned long erases;
+	unsigned long cuts = 0;
+	unsigned long bad = 0;
+	uint64_t boot_ns = 0;
+	uint64_t ns;
+	long every;
+	long w;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:r:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			writes = atol(optarg);
+			break;
+		case 'r':
+			reboots = atol(optarg);
+			break;
+		case 's':
+			seed = (unsigned) strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-w writes] [-r reboots] [-s seed] "
+					"[flash file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (writes <= 0 || reboots < 0)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (optind < argc)
+	{
+		path = argv[optind];
+	}
+	else
+	{
+		snprintf(tmp, sizeof(tmp), "/tmp/petit-journal.%ld", (long) getpid());
+		path = tmp;
+		remove(path);
+	}
+	if (PetitHostFlash(path) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+	srand(seed);
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+	// a file left by an earlier run is where the history starts
+	PETIT_JOURNAL_Init();
+	for (w = 0; w < NUMBER_OF_PETITREGISTERS; w++)
+		written[w] = PETIT_REG_LOAD(PetitRegisters[w]);
+	memcpy(persisted, written, sizeof(written));
+
+	every = reboots > 0 ? writes / (reboots + 1) : writes + 1;
+	if (every == 0)
+		every = 1;
+	for (w = 1; w <= writes; w++)
+	{
+		unsigned k;
+		if (!sim_write(&petit))
+			return 1;
+		for (k = 0; k < SIM_POLLS; k++)
+			PETIT_JOURNAL_Poll();
+		if (w % every != 0)
+			continue;
+		if (rand() % 2 == 0)
+		{
+			sim_settle();
+			bad += sim_reboot(1, &ns);
+			if (ns > boot_ns)
+				boot_ns = ns;
+			continue;
+		}
+		// the power fails somewhere in the next writes
+		PetitHostFlashCut(rand() % (4 * PETIT_JOURNAL_REC * SIM_BLOCK));
+		for (k = (unsigned) (rand() % 8); k != 0; k--)
+		{
+			if (!sim_write(&petit))
+				return 1;
+			PETIT_JOURNAL_Poll();
+		}
+		PetitHostFlashCut(-1);
+		cuts++;
+		bad += sim_reboot(0, &ns);
+		if (ns > boot_ns)
+			boot_ns = ns;
+	}
+
+	sim_settle();
+	PetitHostFlashStats(&flash_bytes, &erases);
+	bad += sim_reboot(1, &ns);
+	if (ns > boot_ns)
+		boot_ns = ns;
+
+	printf("%lu requests, %lu register writes, %ld reboots with %lu power "
+			"cuts\n", requests, reg_writes, reboots, cuts);
+	printf("flash %.2f bytes per register write, %.0f saving %u registers "
+			"on every change, %lu erases\n",
+			(double) flash_bytes / (double) reg_writes,
+			2.0 * NUMBER_OF_PETITREGISTERS, NUMBER_OF_PETITREGISTERS, erases);
+	printf("longest boot %.1f us for %u registers\n", (double) boot_ns / 1e3,
+			NUMBER_OF_PETITREGISTERS);
+	if (bad != 0)
+	{
+		printf("%lu registers came back wrong\n", bad);
+		return 1;
+	}
+	if (optind >= argc)
+		remove(path);
+	return 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
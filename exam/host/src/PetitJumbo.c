@@ -0,0 +1,315 @@
+/*******************************************************************************
+ * @file PetitJumbo.c
+ * Register throughput of jumbo frames against standard frames on one link.
+ *
+ * A master on a point-to-point link reads, then writes, the whole table of
+ * holding registers in frames of a given size: 125 and 123 registers in
+ * standard frames, then bigger jumbo frames switched on with C_FCODE_JUMBO.
+ * Every frame goes through a slave with PETIT_MODBUS_ProcessBatch, whose
+ * time is measured, and its response is checked.  On the wire a frame costs
+ * 11 bits per character at the baud rate and a gap after the request and
+ * after the response; the report gives the registers per second that leaves
+ * and how much faster the jumbo frames are.
+ *
+ * Above 19200 baud the gap is 1750 us by the specification, which is what
+ * jumbo frames save the most of.  -g sets a shorter one for links whose ends
+ * agree on it.
+ *
+ * Build it like PetitBench with a buffer and a table for the biggest frame:
+ *   -DPETIT_JUMBO=1 -DNUMBER_OF_REGISTERS_IN_BUFFER=4096
+ *   -DNUMBER_OF_PETITREGISTERS=4096
+ *
+ * usage: PetitJumbo [-b baud] [-g gap us] [-i iterations]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PetitModbusHost.h"
+
+#if PETIT_JUMBO == 0 || !defined(PETIT_BATCH) || PETIT_BATCH == 0
+#error "PetitJumbo needs -DPETIT_JUMBO=1 and PETIT_BATCH."
+#endif
+
+// start, 8 data bits, parity or second stop bit, stop
+#define JUMBO_CHAR_BITS (11U)
+
+static const pu16_t jumbo_sizes[] = { 250, 500, 1000, 2000, 4000, 8000 };
+
+static T_PETIT_MODBUS petit;
+static pu8_t req[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+// room for a response and for the check of PETIT_MODBUS_ProcessBatch
+static pu8_t arena[2U * C_PETITMODBUS_RXTX_BUFFER_SIZE + 5U + 2U * 125U];
+static unsigned long baud = 4000000UL;
+static unsigned long gap_us;
+static double std_rate[2];
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+static uint64_t jumbo_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Runs one request through the slave.
+ * @param[in] Len the request without its CRC, which is appended
+ * @return the response, CRC checked, or 0
+ */
+static const T_PETIT_ADU *jumbo_send(pu16_t Len)
+{
+	static T_PETIT_ADU adu;
+	pu16_t crc = PetitCRC16(&petit, req, Len);
+
+	req[Len] = (pu8_t) crc;
+	req[Len + 1U] = (pu8_t) (crc >> 8U);
+	adu.Req = req;
+	adu.Req_Len = Len + 2U;
+	if (PETIT_MODBUS_ProcessBatch(&petit, &adu, 1U, arena, sizeof(arena))
+			!= 1U || adu.Rsp_Len < 4U
+			|| PetitCRC16(&petit, adu.Rsp, adu.Rsp_Len) != 0)
+	{
+		return 0;
+	}
+	return &adu;
+}
+
+/**
+ * Switches the slave to jumbo frames of Regs registers, or back to
+ * standard frames with 0.
+ * @return the registers granted
+ */
+static pu16_t jumbo_negotiate(pu16_t Regs)
+{
+	const T_PETIT_ADU *adu;
+
+	req[0] = PETITMODBUS_SLAVE_ADDRESS;
+	req[1] = C_FCODE_JUMBO;
+	req[2] = (pu8_t) (Regs >> 8U);
+	req[3] = (pu8_t) Regs;
+	adu = jumbo_send(4U);
+	if (adu == 0 || adu->Rsp_Len != 6U || adu->Rsp[1] != C_FCODE_JUMBO)
+	{
+		return 0;
+	}
+	return (pu16_t) ((adu->Rsp[2] << 8U) | adu->Rsp[3]);
+}
+
+/**
+ * Builds the request of one frame.
+ * @return its length without the CRC
+ */
+static pu16_t jumbo_request(pu8_t Function, pb_t Jumbo, pu16_t Addr,
+		pu16_t Cnt)
+{
+	pu16_t len = 6U;
+	pu16_t i;
+
+	req[0] = PETITMODBUS_SLAVE_ADDRESS;
+	req[1] = Function;
+	req[2] = (pu8_t) (Addr >> 8U);
+	req[3] = (pu8_t) Addr;
+	req[4] = (pu8_t) (Cnt >> 8U);
+	req[5] = (pu8_t) Cnt;
+	if (Function == C_FCODE_WRITE_MULTIPLE_REGISTERS)
+	{
+		if (Jumbo)
+		{
+			req[len++] = (pu8_t) ((2U * Cnt) >> 8U);
+		}
+		req[len++] = (pu8_t) (2U * Cnt);
+		for (i = 0; i < Cnt; i++)
+		{
+			req[len++] = (pu8_t) ((Addr + i) >> 8U);
+			req[len++] = (pu8_t) (Addr + i);
+		}
+	}
+	return len;
+}
+
+/**
+ * Checks the response to a frame of Cnt registers.
+ */
+static pb_t jumbo_check(const T_PETIT_ADU *Adu, pu8_t Function, pb_t Jumbo,
+		pu16_t Cnt)
+{
+	pu16_t bytes;
+
+	if (Adu == 0 || Adu->Rsp[1] != Function)
+	{
+		return 0;
+	}
+	if (Function == C_FCODE_WRITE_MULTIPLE_REGISTERS)
+	{
+		return Adu->Rsp_Len == 8U;
+	}
+	bytes = Jumbo ? (pu16_t) ((Adu->Rsp[2] << 8U) | Adu->Rsp[3])
+			: Adu->Rsp[2];
+	return bytes == 2U * Cnt && Adu->Rsp_Len == (Jumbo ? 6U : 5U) + bytes;
+}
+
+/**
+ * Reads or writes the whole table in frames of Size registers and prints
+ * one line of the report.
+ * @return 0 if a response was wrong
+ */
+static int jumbo_run(pu8_t Function, pb_t Jumbo, pu16_t Size,
+		unsigned Iterations)
+{
+	const unsigned long regs = NUMBER_OF_PETITREGISTERS;
+	unsigned long frames = 0;
+	unsigned long bytes = 0;
+	uint64_t proc_ns = 0;
+	double wire_us;
+	double cycle_us;
+	double rate;
+	unsigned it;
+	pu16_t addr;
+	pu16_t cnt;
+	pu16_t len;
+
+	for (it = 0; it < Iterations; it++)
+	{
+		for (addr = 0; addr < regs; addr += cnt)
+		{
+			const T_PETIT_ADU *adu;
+			uint64_t start;
+
+			cnt = regs - addr < Size ? (pu16_t) (regs - addr) : Size;
+			len = jumbo_request(Function, Jumbo, addr, cnt);
+			start = jumbo_ns();
+			adu = jumbo_send(len);
+			proc_ns += jumbo_ns() - start;
+			if (!jumbo_check(adu, Function, Jumbo, cnt))
+			{
+				fprintf(stderr, "function %u, %u registers at %u: bad "
+						"response\n", Function, cnt, addr);
+				return 0;
+			}
+			if (it == 0)
+			{
+				frames++;
+				bytes += len + 2U + adu->Rsp_Len;
+			}
+		}
+	}
+
+	wire_us = (double) bytes * JUMBO_CHAR_BITS * 1e6 / (double) baud
+			+ 2.0 * (double) frames * (double) gap_us;
+	cycle_us = wire_us + (double) proc_ns / 1e3 / (double) Iterations;
+	rate = (double) regs * 1e6 / cycle_us;
+	if (!Jumbo)
+	{
+		std_rate[Function == C_FCODE_WRITE_MULTIPLE_REGISTERS] = rate;
+	}
+	printf("  %2u %-8s %6u %7lu %8lu %10.1f %9.1f %11.0f %7.2fx\n",
+			Function, Jumbo ? "jumbo" : "standard", Size, frames, bytes,
+			wire_us, (double) proc_ns / 1e3 / (double) Iterations, rate,
+			rate / std_rate[Function == C_FCODE_WRITE_MULTIPLE_REGISTERS]);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const pu8_t functions[] =
+	{
+		C_FCODE_READ_HOLDING_REGISTERS, C_FCODE_WRITE_MULTIPLE_REGISTERS
+	};
+	unsigned iterations = 100;
+	pu16_t granted;
+	unsigned f;
+	unsigned s;
+	int opt;
+	int ok = 1;
+
+	gap_us = 0;
+	while ((opt = getopt(argc, argv, "b:g:i:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			baud = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			gap_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iterations = (unsigned) strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b baud] [-g gap us] "
+					"[-i iterations]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (baud == 0 || iterations == 0)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (gap_us == 0)
+	{
+		gap_us = PETIT_T35_US(baud);
+	}
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+
+	granted = jumbo_negotiate(0xFFFFU);
+	printf("# %lu baud, gap %lu us, %u registers, jumbo frames of up to %u "
+			"registers\n", baud, gap_us, NUMBER_OF_PETITREGISTERS, granted);
+	printf("# fc mode       regs  frames    bytes    wire us   proc us "
+			"     regs/s speedup\n");
+	for (f = 0; f < sizeof(functions) && ok; f++)
+	{
+		pu16_t std_size = functions[f] == C_FCODE_WRITE_MULTIPLE_REGISTERS
+				? 123U : 125U;
+
+		if (jumbo_negotiate(0) != 0)
+		{
+			fprintf(stderr, "%s: no way back to standard frames\n", argv[0]);
+			return 1;
+		}
+		ok = jumbo_run(functions[f], 0, std_size, iterations);
+		for (s = 0; s < sizeof(jumbo_sizes) / sizeof(jumbo_sizes[0]) && ok;
+				s++)
+		{
+			if (jumbo_sizes[s] > granted
+					|| jumbo_sizes[s] > NUMBER_OF_PETITREGISTERS)
+			{
+				break;
+			}
+			if (jumbo_negotiate(jumbo_sizes[s]) != jumbo_sizes[s])
+			{
+				fprintf(stderr, "%s: %u registers not granted\n", argv[0],
+						jumbo_sizes[s]);
+				return 1;
+			}
+			ok = jumbo_run(functions[f], 1, jumbo_sizes[s], iterations);
+		}
+	}
+	return !ok;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
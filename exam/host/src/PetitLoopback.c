@@ -0,0 +1,579 @@
+/*******************************************************************************
+ * @file PetitLoopback.c
+ * Loopback of the master and the gateway against host slaves.
+ *
+ * A master and several slaves, at addresses 1 and up, share one virtual
+ * line.  Every request the master sends reaches every slave, the answer of
+ * the addressed slave goes back to the master, and one pass of the loop is
+ * one tick of the master.  The master reads and writes every function code
+ * on every slave and the values it gets must be those of the tables, a read
+ * past the table must come back as exception 2 and a request to an address
+ * nobody answers must time out.  Then Modbus TCP clients go through the
+ * gateway, whose replies must carry the same data, and its statistics must
+ * show the reads it merged.  Built with PETITGW_CACHE_TTL above 0, reads are
+ * answered from the cache too, which a write or a malformed request in
+ * between must not corrupt, until the results expire.
+ *
+ * The exit status is 1 if a check failed.
+ *
+ * usage: PetitLoopback [slaves]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PetitModbusHost.h"
+#include "PetitGateway.h"
+
+#if !defined(PETITMODBUS_MASTER_ENABLED) || PETITMODBUS_MASTER_ENABLED == 0 \
+	|| !defined(PETITMODBUS_GATEWAY_ENABLED) \
+	|| PETITMODBUS_GATEWAY_ENABLED == 0
+#error "PetitLoopback needs PETITMODBUS_MASTER_ENABLED and the gateway."
+#endif
+// the values are checked against the internal tables
+#if PETIT_REG != PETIT_INTERNAL || PETIT_INPUT_REG != PETIT_INTERNAL \
+	|| PETIT_COIL != PETIT_INTERNAL || PETIT_DISCRETE != PETIT_INTERNAL
+#error "PetitLoopback needs the registers and coils internal."
+#endif
+
+// the cached results must outlive the few transactions that fill the slots
+#if PETITGW_CACHE_TTL > 0 && PETITGW_CACHE_TTL < 50
+#error "PetitLoopback needs PETITGW_CACHE_TTL 0 or at least 50."
+#endif
+
+#define LOOP_MAX_SLAVES (16U)
+// response timeout of the master in ticks, and the most ticks of a request
+#define LOOP_TIMEOUT (10U)
+#define LOOP_STEPS (200U)
+// MBAP header and the largest PDU
+#define LOOP_ADU_SIZE (7U + 253U)
+
+typedef struct
+{
+	pu8_t Adu[LOOP_ADU_SIZE];
+	pu16_t Len;
+} T_LOOP_CLIENT;
+
+static T_PETIT_MODBUS slaves[LOOP_MAX_SLAVES];
+static unsigned slave_cnt = 3;
+static T_PETIT_MASTER master;
+static T_PETIT_GATEWAY gateway;
+// first byte of the frame the master is sending, -1 if none
+static int master_first = -1;
+// slaves that answered the last request
+static unsigned answers;
+static unsigned failed;
+
+/**
+ * Selects the slave the next library call is made for.
+ */
+static void loop_select(unsigned Slave)
+{
+	PETITMODBUS_SLAVE_ADDRESS = (pu8_t) (Slave + 1U);
+}
+
+static void loop_master_tx(pu8_t tx)
+{
+	master_first = tx;
+}
+
+/**
+ * Gateway reply callback, keeps the last reply of a client.
+ */
+static void loop_reply(void *Client, const pu8_t *Adu, pu16_t Len)
+{
+	T_LOOP_CLIENT *client = Client;
+
+	if (Len > sizeof(client->Adu))
+		Len = 0;
+	memcpy(client->Adu, Adu, Len);
+	client->Len = Len;
+}
+
+/**
+ * One pass of the main loop and one tick.  A frame of the master reaches
+ * every slave at once and the answer of a slave the master, so the frames
+ * are delimited without a t3.5 timer.
+ */
+static void loop_step(void)
+{
+	unsigned i;
+	pu8_t b;
+	int first;
+
+	PETIT_GATEWAY_Process(&gateway);
+	if (master_first >= 0)
+	{
+		for (i = 0; i < slave_cnt; i++)
+		{
+			loop_select(i);
+			PetitRxBufferReset(&slaves[i]);
+			PetitRxBufferInsert(&slaves[i], (pu8_t) master_first);
+		}
+		master_first = -1;
+		while (PetitTxBufferPop(&master.Link, &b))
+		{
+			for (i = 0; i < slave_cnt; i++)
+			{
+				loop_select(i);
+				PetitRxBufferInsert(&slaves[i], b);
+			}
+		}
+	}
+	for (i = 0; i < slave_cnt; i++)
+	{
+		loop_select(i);
+		PETIT_MODBUS_Process(&slaves[i]);
+		first = PetitHostTxTake();
+		if (first < 0)
+			continue;
+		answers++;
+		PetitMasterRxBufferInsert(&master, (pu8_t) first);
+		while (PetitTxBufferPop(&slaves[i], &b))
+			PetitMasterRxBufferInsert(&master, b);
+	}
+	PETIT_GATEWAY_Tick(&gateway);
+}
+
+/**
+ * Prints the outcome of one check.
+ */
+static void loop_check(int Ok, const char *What, unsigned Slave)
+{
+	printf("  %-40s %3u %s\n", What, Slave, Ok ? "ok" : "FAILED");
+	failed += !Ok;
+}
+
+/**
+ * Runs one request of the master to the end.
+ * @return its status, or 0xFF if it never completed
+ */
+static pu8_t loop_run(pu8_t Slave, pu8_t Function, pu16_t Address,
+		pu16_t Count, pu16_t *Data)
+{
+	T_PETIT_MASTER_REQ req;
+	unsigned n;
+
+	memset(&req, 0, sizeof(req));
+	req.Slave = Slave;
+	req.Function = Function;
+	req.Address = Address;
+	req.Count = Count;
+	req.Timeout = LOOP_TIMEOUT;
+	req.Data = Data;
+	answers = 0;
+	if (!PETIT_MASTER_Request(&master, &req))
+		return 0xFFU;
+	for (n = 0; n < LOOP_STEPS && req.Pending; n++)
+		loop_step();
+	return req.Pending ? 0xFFU : req.Status;
+}
+
+static int loop_bit(const pu8_t *Bits, pu16_t Idx)
+{
+	return (Bits[Idx >> 3] >> (Idx & 7U)) & 1U;
+}
+
+/**
+ * @return 1 if Count packed coils of the master match a table from Address
+ */
+static int loop_same_bits(const pu16_t *Data, const pu8_t *Bits,
+		pu16_t Address, pu16_t Count)
+{
+	pu16_t i;
+
+	for (i = 0; i < Count; i++)
+	{
+		if ((int) ((Data[i >> 4] >> (i & 15U)) & 1U)
+				!= loop_bit(Bits, Address + i))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Every function code of the master against one slave.
+ */
+static void loop_master(unsigned Slave)
+{
+	pu8_t unit = (pu8_t) (Slave + 1U);
+	pu16_t base = (pu16_t) (16U * Slave);
+	pu16_t data[8];
+	pu16_t words[5];
+	pu16_t i;
+	int ok;
+
+	ok = loop_run(unit, C_FCODE_READ_HOLDING_REGISTERS, base, 8U, data) == 0
+			&& memcmp(data, &PetitRegisters[base], sizeof(data)) == 0
+			&& answers == 1U;
+	loop_check(ok, "read holding registers", unit);
+	ok = loop_run(unit, C_FCODE_READ_INPUT_REGISTERS, base, 8U, data) == 0
+			&& memcmp(data, &PetitInputRegisters[base], sizeof(data)) == 0;
+	loop_check(ok, "read input registers", unit);
+	ok = loop_run(unit, C_FCODE_READ_COILS, base + 3U, 20U, data) == 0
+			&& loop_same_bits(data, PetitCoils, base + 3U, 20U);
+	loop_check(ok, "read coils", unit);
+	ok = loop_run(unit, C_FCODE_READ_DISCRETES, base + 5U, 20U, data) == 0
+			&& loop_same_bits(data, PetitDiscretes, base + 5U, 20U);
+	loop_check(ok, "read discrete inputs", unit);
+
+	data[0] = (pu16_t) (0xA500U + unit);
+	ok = loop_run(unit, C_FCODE_WRITE_SINGLE_REGISTER, 100U + unit, 1U, data)
+			== 0 && PetitRegisters[100U + unit] == data[0];
+	loop_check(ok, "write single register", unit);
+	for (i = 0; i < 5U; i++)
+		words[i] = (pu16_t) (0x1111U * (i + 1U) + unit);
+	ok = loop_run(unit, C_FCODE_WRITE_MULTIPLE_REGISTERS, 120U + 5U * unit,
+			5U, words) == 0
+			&& memcmp(&PetitRegisters[120U + 5U * unit], words,
+					sizeof(words)) == 0
+			&& loop_run(unit, C_FCODE_READ_HOLDING_REGISTERS,
+					120U + 5U * unit, 5U, data) == 0
+			&& memcmp(data, words, sizeof(words)) == 0;
+	loop_check(ok, "write multiple registers, read back", unit);
+
+	data[0] = !loop_bit(PetitCoils, 500U + unit);
+	ok = loop_run(unit, C_FCODE_WRITE_SINGLE_COIL, 500U + unit, 1U, data) == 0
+			&& loop_bit(PetitCoils, 500U + unit) == data[0];
+	loop_check(ok, "write single coil", unit);
+	words[0] = (pu16_t) (0x1A5BU ^ unit);
+	ok = loop_run(unit, C_FCODE_WRITE_MULTIPLE_COILS, 600U + 16U * unit, 13U,
+			words) == 0
+			&& loop_same_bits(words, PetitCoils, 600U + 16U * unit, 13U)
+			&& loop_run(unit, C_FCODE_READ_COILS, 600U + 16U * unit, 13U,
+					data) == 0
+			&& ((data[0] ^ words[0]) & 0x1FFFU) == 0;
+	loop_check(ok, "write multiple coils, read back", unit);
+
+	ok = loop_run(unit, C_FCODE_READ_HOLDING_REGISTERS,
+			NUMBER_OF_PETITREGISTERS - 1U, 2U, data) == PETIT_ERROR_CODE_02;
+	loop_check(ok, "read past the table is exception 2", unit);
+}
+
+/**
+ * Builds the MBAP request of a client to read or write Count values.
+ * @return the length of the request
+ */
+static pu16_t loop_mbap(pu8_t *Adu, pu16_t Transaction, pu8_t Unit,
+		pu8_t Function, pu16_t Address, pu16_t Count)
+{
+	Adu[0] = (pu8_t) (Transaction >> 8U);
+	Adu[1] = (pu8_t) Transaction;
+	Adu[2] = 0;
+	Adu[3] = 0;
+	Adu[4] = 0;
+	Adu[5] = 6U;
+	Adu[6] = Unit;
+	Adu[7] = Function;
+	Adu[8] = (pu8_t) (Address >> 8U);
+	Adu[9] = (pu8_t) Address;
+	Adu[10] = (pu8_t) (Count >> 8U);
+	Adu[11] = (pu8_t) Count;
+	return 12U;
+}
+
+/**
+ * @return 1 if a reply answers Transaction of Unit with the Len bytes of Pdu
+ */
+static int loop_same_reply(const T_LOOP_CLIENT *Client, pu16_t Transaction,
+		pu8_t Unit, const pu8_t *Pdu, pu16_t Len)
+{
+	return Client->Len == 7U + Len
+			&& Client->Adu[0] == (pu8_t) (Transaction >> 8U)
+			&& Client->Adu[1] == (pu8_t) Transaction
+			&& Client->Adu[2] == 0 && Client->Adu[3] == 0
+			&& Client->Adu[4] == (pu8_t) ((Len + 1U) >> 8U)
+			&& Client->Adu[5] == (pu8_t) (Len + 1U)
+			&& Client->Adu[6] == Unit
+			&& memcmp(&Client->Adu[7], Pdu, Len) == 0;
+}
+
+/**
+ * Modbus TCP clients through the gateway.
+ */
+static void loop_gateway(void)
+{
+	static T_LOOP_CLIENT clients[4];
+	pu8_t unit = (pu8_t) slave_cnt;
+	pu8_t adu[12];
+	pu8_t pdu[2U + 2U * 8U];
+	pu16_t len;
+	unsigned i;
+	unsigned n;
+	int ok;
+
+	memset(clients, 0, sizeof(clients));
+	PETIT_GATEWAY_Init(&gateway, &master, loop_reply);
+
+	// three clients read overlapping ranges of one slave at once
+	pdu[0] = C_FCODE_READ_HOLDING_REGISTERS;
+	pdu[1] = 2U * 8U;
+	for (i = 0; i < 8U; i++)
+	{
+		pdu[2U + 2U * i] = (pu8_t) (PetitRegisters[40U + i] >> 8U);
+		pdu[3U + 2U * i] = (pu8_t) PetitRegisters[40U + i];
+	}
+	for (i = 0; i < 3U; i++)
+	{
+		len = loop_mbap(adu, (pu16_t) (0x100U + i), unit,
+				C_FCODE_READ_HOLDING_REGISTERS, 40U, 8U);
+		PETIT_GATEWAY_Request(&gateway, &clients[i], adu, len);
+	}
+	// and the last one writes another
+	len = loop_mbap(adu, 0x200U, 1U, C_FCODE_WRITE_SINGLE_REGISTER, 7U,
+			0x5AA5U);
+	PETIT_GATEWAY_Request(&gateway, &clients[3], adu, len);
+	for (n = 0; n < LOOP_STEPS; n++)
+		loop_step();
+	ok = 1;
+	for (i = 0; i < 3U; i++)
+	{
+		ok = ok && loop_same_reply(&clients[i], (pu16_t) (0x100U + i), unit,
+				pdu, sizeof(pdu));
+	}
+	loop_check(ok, "gateway read", unit);
+	pdu[0] = C_FCODE_WRITE_SINGLE_REGISTER;
+	pdu[1] = 0;
+	pdu[2] = 7U;
+	pdu[3] = 0x5AU;
+	pdu[4] = 0xA5U;
+	ok = loop_same_reply(&clients[3], 0x200U, 1U, pdu, 5U)
+			&& PetitRegisters[7] == 0x5AA5U;
+	loop_check(ok, "gateway write", 1U);
+	ok = gateway.Stats.Requests == 4U && gateway.Stats.Transactions == 2U
+			&& gateway.Stats.Merged == 2U && gateway.Stats.Rejected == 0;
+	loop_check(ok, "gateway merges the reads", unit);
+
+	// exceptions of the slave and timeouts go back to the client
+	len = loop_mbap(adu, 0x300U, unit, C_FCODE_READ_INPUT_REGISTERS,
+			NUMBER_OF_INPUT_PETITREGISTERS, 1U);
+	PETIT_GATEWAY_Request(&gateway, &clients[0], adu, len);
+	len = loop_mbap(adu, 0x301U, (pu8_t) (slave_cnt + 1U),
+			C_FCODE_READ_INPUT_REGISTERS, 0, 1U);
+	PETIT_GATEWAY_Request(&gateway, &clients[1], adu, len);
+	for (n = 0; n < LOOP_STEPS + PETITGW_TIMEOUT; n++)
+		loop_step();
+	pdu[0] = C_FCODE_READ_INPUT_REGISTERS | 0x80U;
+	pdu[1] = PETIT_ERROR_CODE_02;
+	loop_check(loop_same_reply(&clients[0], 0x300U, unit, pdu, 2U),
+			"gateway passes exceptions on", unit);
+	pdu[1] = PETIT_ERROR_CODE_0B;
+	loop_check(loop_same_reply(&clients[1], 0x301U, (pu8_t) (slave_cnt + 1U),
+			pdu, 2U), "gateway answers timeouts with exception 11",
+			slave_cnt + 1U);
+}
+
+#if PETITGW_CACHE_TTL > 0
+/**
+ * Sends the request of a client through the gateway, forgetting its last
+ * reply first.
+ */
+static void loop_send(T_LOOP_CLIENT *Client, const pu8_t *Adu, pu16_t Len)
+{
+	Client->Len = 0;
+	PETIT_GATEWAY_Request(&gateway, Client, Adu, Len);
+}
+
+/**
+ * Runs the loop until a client has its reply.
+ */
+static void loop_wait(const T_LOOP_CLIENT *Client)
+{
+	unsigned n;
+
+	for (n = 0; n < LOOP_STEPS && Client->Len == 0; n++)
+		loop_step();
+}
+
+/**
+ * Builds the PDU of a read of Count holding registers from Address.
+ * @return its length
+ */
+static pu16_t loop_read_pdu(pu8_t *Pdu, pu16_t Address, pu8_t Count)
+{
+	pu8_t i;
+
+	Pdu[0] = C_FCODE_READ_HOLDING_REGISTERS;
+	Pdu[1] = 2U * Count;
+	for (i = 0; i < Count; i++)
+	{
+		Pdu[2U + 2U * i] = (pu8_t) (PetitRegisters[Address + i] >> 8U);
+		Pdu[3U + 2U * i] = (pu8_t) PetitRegisters[Address + i];
+	}
+	return 2U + 2U * Count;
+}
+
+/**
+ * Reads answered from the cache of the gateway, the writes and malformed
+ * requests in between, and the expiry of the cache.
+ */
+static void loop_cache(void)
+{
+	static T_LOOP_CLIENT client;
+	pu8_t unit = (pu8_t) slave_cnt;
+	pu8_t adu[12];
+	pu8_t pdu[2U + 2U * 8U];
+	pu16_t len;
+	pu16_t transactions;
+	unsigned n;
+	int ok;
+
+	PETIT_GATEWAY_Init(&gateway, &master, loop_reply);
+
+	// the first read goes to the bus, a part of it comes from the cache
+	len = loop_mbap(adu, 0x400U, unit, C_FCODE_READ_HOLDING_REGISTERS, 40U,
+			8U);
+	loop_send(&client, adu, len);
+	loop_wait(&client);
+	ok = loop_same_reply(&client, 0x400U, unit, pdu,
+			loop_read_pdu(pdu, 40U, 8U));
+	len = loop_mbap(adu, 0x401U, unit, C_FCODE_READ_HOLDING_REGISTERS, 42U,
+			4U);
+	loop_send(&client, adu, len);
+	ok = ok && loop_same_reply(&client, 0x401U, unit, pdu,
+			loop_read_pdu(pdu, 42U, 4U))
+			&& gateway.Stats.Transactions == 1U && gateway.Stats.Cached == 1U;
+	loop_check(ok, "gateway cache hit", unit);
+
+	// with every slot cached, a malformed request is refused and leaves the
+	// slot it would have taken as it was
+	for (n = 1; n < PETITGW_SLOTS; n++)
+	{
+		len = loop_mbap(adu, 0x480U + n, unit,
+				C_FCODE_READ_HOLDING_REGISTERS, 40U + 16U * n, 8U);
+		loop_send(&client, adu, len);
+		loop_wait(&client);
+	}
+	len = loop_mbap(adu, 0x402U, unit, C_FCODE_READ_HOLDING_REGISTERS, 120U,
+			0xFFFFU);
+	loop_send(&client, adu, len);
+	pdu[0] = C_FCODE_READ_HOLDING_REGISTERS | 0x80U;
+	pdu[1] = PETIT_ERROR_CODE_03;
+	ok = loop_same_reply(&client, 0x402U, unit, pdu, 2U)
+			&& gateway.Stats.Rejected == 1U;
+	len = loop_mbap(adu, 0x403U, unit, C_FCODE_READ_HOLDING_REGISTERS, 40U,
+			8U);
+	loop_send(&client, adu, len);
+	ok = ok && loop_same_reply(&client, 0x403U, unit, pdu,
+			loop_read_pdu(pdu, 40U, 8U)) && gateway.Stats.Cached == 2U;
+	// and a read outside of it still goes to the slave
+	len = loop_mbap(adu, 0x404U, unit, C_FCODE_READ_HOLDING_REGISTERS, 5000U,
+			1U);
+	loop_send(&client, adu, len);
+	loop_wait(&client);
+	pdu[0] = C_FCODE_READ_HOLDING_REGISTERS | 0x80U;
+	pdu[1] = PETIT_ERROR_CODE_02;
+	ok = ok && loop_same_reply(&client, 0x404U, unit, pdu, 2U)
+			&& gateway.Stats.Cached == 2U;
+	loop_check(ok, "gateway cache survives a malformed request", unit);
+
+	// a write drops the cached reads of its unit
+	len = loop_mbap(adu, 0x405U, unit, C_FCODE_WRITE_SINGLE_REGISTER, 43U,
+			0xBEEFU);
+	loop_send(&client, adu, len);
+	loop_wait(&client);
+	len = loop_mbap(adu, 0x406U, unit, C_FCODE_READ_HOLDING_REGISTERS, 40U,
+			8U);
+	loop_send(&client, adu, len);
+	loop_wait(&client);
+	ok = PetitRegisters[43] == 0xBEEFU
+			&& loop_same_reply(&client, 0x406U, unit, pdu,
+					loop_read_pdu(pdu, 40U, 8U))
+			&& gateway.Stats.Cached == 2U;
+	loop_check(ok, "gateway cache is not stale after a write", unit);
+
+	// and a result is not served once its time is up
+	transactions = gateway.Stats.Transactions;
+	for (n = 0; n <= PETITGW_CACHE_TTL; n++)
+		loop_step();
+	len = loop_mbap(adu, 0x407U, unit, C_FCODE_READ_HOLDING_REGISTERS, 40U,
+			8U);
+	loop_send(&client, adu, len);
+	ok = client.Len == 0;
+	loop_wait(&client);
+	ok = ok && loop_same_reply(&client, 0x407U, unit, pdu,
+			loop_read_pdu(pdu, 40U, 8U)) && gateway.Stats.Cached == 2U
+			&& gateway.Stats.Transactions == transactions + 1U;
+	loop_check(ok, "gateway cache expires", unit);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	pu16_t data[1];
+	unsigned i;
+	pu8_t status;
+
+	if (argc > 1)
+		slave_cnt = (unsigned) strtoul(argv[1], 0, 0);
+	if (argc > 2 || slave_cnt == 0 || slave_cnt > LOOP_MAX_SLAVES)
+	{
+		fprintf(stderr, "usage: %s [slaves], 1 to %u slaves\n", argv[0],
+				LOOP_MAX_SLAVES);
+		return 2;
+	}
+
+	for (i = 0; i < NUMBER_OF_PETITREGISTERS; i++)
+		PetitRegisters[i] = (pu16_t) (0x1000U + 7U * i);
+	for (i = 0; i < NUMBER_OF_INPUT_PETITREGISTERS; i++)
+		PetitInputRegisters[i] = (pu16_t) (0x8000U ^ (i * 0x0101U));
+	for (i = 0; i < sizeof(PetitCoils); i++)
+		PetitCoils[i] = (pu8_t) (0x5AU ^ i);
+	for (i = 0; i < sizeof(PetitDiscretes); i++)
+		PetitDiscretes[i] = (pu8_t) (0xC3U + i);
+
+	for (i = 0; i < slave_cnt; i++)
+	{
+		slaves[i].Timer_Start = PetitPortTimerStart;
+		slaves[i].Timer_Stop = PetitPortTimerStop;
+		slaves[i].Tx_Begin = PetitPortTxBegin;
+		loop_select(i);
+		PETIT_MODBUS_Init(&slaves[i]);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		{
+			static pu8_t buffers[LOOP_MAX_SLAVES]
+					[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+			PETIT_MODBUS_Set_Buffer(&slaves[i], buffers[i],
+					sizeof(buffers[i]));
+		}
+#endif
+	}
+	PETIT_MASTER_Init(&master);
+	master.Link.Timer_Start = PetitPortTimerStart;
+	master.Link.Timer_Stop = PetitPortTimerStop;
+	master.Link.Tx_Begin = loop_master_tx;
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&master.Link, buffer, sizeof(buffer));
+	}
+#endif
+	// the gateway runs the master for the direct requests too
+	PETIT_GATEWAY_Init(&gateway, &master, loop_reply);
+
+	printf("# %-40s %3s\n", "check", "id");
+	for (i = 0; i < slave_cnt; i++)
+		loop_master(i);
+	status = loop_run((pu8_t) (slave_cnt + 1U),
+			C_FCODE_READ_HOLDING_REGISTERS, 0, 1U, data);
+	loop_check(status == PETITMASTER_TIMEOUT && answers == 0,
+			"absent slave times out", slave_cnt + 1U);
+	data[0] = 0x1234U;
+	status = loop_run(0, C_FCODE_WRITE_SINGLE_REGISTER, 1U, 1U, data);
+	loop_check(status == PETITMASTER_OK && answers == 0,
+			"broadcast is not answered", 0);
+	loop_gateway();
+#if PETITGW_CACHE_TTL > 0
+	loop_cache();
+#endif
+	return failed != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,315 @@
+/*******************************************************************************
+ * @file PetitModbusPort.c
+ * This file contains the functions that are supposed to be defined to port
+ * PetitModbus to a host computer.  There is no UART here; the host tools move
+ * the bytes themselves and read back what the port hooks recorded.
+ ******************************************************************************/
+
+/**
+ * @defgroup Petit_Modbus_Host_Port Petit Modbus Host Port
+ * This section contains the functions necessary to make Petit Modbus run on
+ * a host computer, for benchmarks and simulation.
+ * @{
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// Necessary Petit Modbus Includes
+#include "PetitModbusPort.h"
+#include "PetitJournal.h"
+// User Includes
+#include "PetitModbusHost.h"
+
+PETIT_HOST_TLS uint8_t PETITMODBUS_SLAVE_ADDRESS = 1;
+uint16_t PETITMODBUS_DLY_TOP = 0;
+
+/**
+ * the first byte handed over by PetitPortTxBegin, -1 if none since the last
+ * call to PetitHostTxTake
+ */
+static int tx_first = -1;
+
+/**
+ * the clock behind PetitPortClock, 0 for the monotonic clock of the host
+ */
+static pu16_t (*host_clock)(void);
+
+/**
+ * the external storage behind the PETIT_EXTERNAL and PETIT_BOTH modes
+ */
+#if PETIT_REG != PETIT_INTERNAL || PETIT_INPUT_REG != PETIT_INTERNAL
+static pu16_t host_regs[NUMBER_OF_PETITREGISTERS];
+#endif
+#if PETIT_COIL != PETIT_INTERNAL || PETIT_DISCRETE != PETIT_INTERNAL
+static pu8_t host_coils[(NUMBER_OF_PETITCOILS + 7) >> 3];
+#endif
+
+/**
+ * read-only registers, numbered so a read shows where it came from
+ */
+#ifdef NUMBER_OF_CONST_PETITREGISTERS
+PETIT_CODE const pu16_t PetitConstRegisters[NUMBER_OF_CONST_PETITREGISTERS]
+	PETIT_FLASH_ATTR = { 0xC000, 0xC001, 0xC002, 0xC003 };
+#endif
+#ifdef NUMBER_OF_CONST_INPUT_PETITREGISTERS
+PETIT_CODE const pu16_t
+	PetitConstInputRegisters[NUMBER_OF_CONST_INPUT_PETITREGISTERS]
+	PETIT_FLASH_ATTR = { 0xD000, 0xD001, 0xD002, 0xD003 };
+#endif
+
+/**
+ *  starts the inter-byte timer.  the host tools frame by hand, so no timer
+ */
+void PetitPortTimerStart(void)
+{
+	return;
+}
+
+/**
+ *   stops the inter-byte timer.
+ */
+void PetitPortTimerStop(void)
+{
+	return;
+}
+
+/**
+ * records the first byte of the response
+ */
+void PetitPortTxBegin(pu8_t tx)
+{
+	tx_first = tx;
+	return;
+}
+
+/**
+ * @return the first byte of the response, -1 if transmission has not begun
+ */
+int PetitHostTxTake(void)
+{
+	int tx = tx_first;
+	tx_first = -1;
+	return tx;
+}
+
+/**
+ * Replaces the clock behind PetitPortClock, for simulated time.
+ * @param[in] Clock the new clock in microseconds, 0 for the host clock
+ */
+void PetitHostClock(pu16_t (*Clock)(void))
+{
+	host_clock = Clock;
+}
+
+/**
+ * free running clock in microseconds
+ */
+pu16_t PetitPortClock(void)
+{
+	struct timespec ts;
+	if (host_clock)
+		return host_clock();
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (pu16_t) (ts.tv_sec * 1000000L + ts.tv_nsec / 1000L);
+}
+
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+/**
+ * flash emulated in a file, the two sectors of the journal.  As in NOR flash
+ * a write only clears bits and an erase sets a whole sector to 0xFF.  The
+ * image is kept in memory and written through to the file.
+ */
+static FILE *host_flash;
+static pu8_t host_flash_data[2UL * PETIT_JOURNAL_SECTOR];
+// bytes that may still be written before the power fails, -1 for no limit
+static long host_flash_budget = -1;
+static unsigned long host_flash_written;
+static unsigned long host_flash_erases;
+
+/**
+ * Opens the file behind the emulated flash, creating it erased.
+ * @return 0 on success
+ */
+int PetitHostFlash(const char *Path)
+{
+	host_flash = fopen(Path, "r+b");
+	if (host_flash == NULL)
+	{
+		host_flash = fopen(Path, "w+b");
+		if (host_flash == NULL)
+			return -1;
+		memset(host_flash_data, 0xFF, sizeof(host_flash_data));
+		if (fwrite(host_flash_data, 1, sizeof(host_flash_data), host_flash)
+				!= sizeof(host_flash_data))
+			return -1;
+		return 0;
+	}
+	if (fread(host_flash_data, 1, sizeof(host_flash_data), host_flash)
+			!= sizeof(host_flash_data))
+		memset(host_flash_data, 0xFF, sizeof(host_flash_data));
+	return 0;
+}
+
+/**
+ * Cuts the power of the emulated flash after Bytes more bytes are written.
+ * The write that crosses the limit is left half done, and every access after
+ * it fails until it is called again with -1.
+ */
+void PetitHostFlashCut(long Bytes)
+{
+	host_flash_budget = Bytes;
+}
+
+/**
+ * @param[out] Written bytes written to the emulated flash so far
+ * @param[out] Erases sector erases so far
+ */
+void PetitHostFlashStats(unsigned long *Written, unsigned long *Erases)
+{
+	*Written = host_flash_written;
+	*Erases = host_flash_erases;
+}
+
+/**
+ * writes part of the image through to the file
+ */
+static void host_flash_sync(pu32_t Addr, pu16_t Len)
+{
+	if (host_flash == NULL)
+		return;
+	fseek(host_flash, (long) Addr, SEEK_SET);
+	fwrite(&host_flash_data[Addr], 1, Len, host_flash);
+}
+
+pb_t PetitPortFlashRead(pu32_t Addr, pu8_t* Data, pu16_t Len)
+{
+	if (host_flash_budget == 0 || Addr + Len > sizeof(host_flash_data))
+		return 0;
+	memcpy(Data, &host_flash_data[Addr], Len);
+	return 1;
+}
+
+pb_t PetitPortFlashWrite(pu32_t Addr, const pu8_t* Data, pu16_t Len)
+{
+	pu16_t i;
+	pu16_t n = Len;
+
+	if (host_flash_budget == 0 || Addr + Len > sizeof(host_flash_data))
+		return 0;
+	if (host_flash_budget > 0 && (long) n > host_flash_budget)
+		n = (pu16_t) host_flash_budget;
+	for (i = 0; i < n; i++)
+		host_flash_data[Addr + i] &= Data[i];
+	host_flash_sync(Addr, n);
+	host_flash_written += n;
+	if (host_flash_budget > 0)
+		host_flash_budget -= n;
+	return n == Len;
+}
+
+pb_t PetitPortFlashErase(pu32_t Addr)
+{
+	if (host_flash_budget == 0 || Addr % PETIT_JOURNAL_SECTOR != 0
+			|| Addr >= sizeof(host_flash_data))
+		return 0;
+	memset(&host_flash_data[Addr], 0xFF, PETIT_JOURNAL_SECTOR);
+	host_flash_sync(Addr, PETIT_JOURNAL_SECTOR);
+	host_flash_erases++;
+	return 1;
+}
+#endif
+
+#if PETIT_CRC == PETIT_CRC_EXTERNAL
+/**
+ * CRC16 with a sixteen entry table, a middle ground between the tabular and
+ * the bitwise calculation built into petitmodbus.
+ */
+void PetitPortCRC16Calc(pu8_t Data, pu16_t* CRC)
+{
+	static const pu16_t nibble[16] = {
+		0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+		0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+	};
+	pu16_t crc = *CRC ^ Data;
+	crc = (crc >> 4) ^ nibble[crc & 0x0F];
+	crc = (crc >> 4) ^ nibble[crc & 0x0F];
+	*CRC = crc;
+}
+#endif
+
+#if PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH
+/**
+ * writes to the registers
+ * @return 1 always, every register is writable
+ */
+pb_t PetitPortRegWrite(pu16_t Addr, pu16_t Data)
+{
+	host_regs[Addr] = Data;
+	return 1;
+}
+
+/**
+ * reads the registers
+ * @return 1 always, every register is readable
+ */
+pb_t PetitPortRegRead(pu16_t Addr, pu16_t* Data)
+{
+	*Data = host_regs[Addr];
+	return 1;
+}
+#endif
+
+#if PETIT_INPUT_REG == PETIT_EXTERNAL || PETIT_INPUT_REG == PETIT_BOTH
+/**
+ * reads input registers, which mirror the holding registers here
+ * @return 1 always
+ */
+pb_t PetitPortInputRegRead(pu16_t Addr, pu16_t* Data)
+{
+	*Data = host_regs[Addr];
+	return 1;
+}
+#endif
+
+#if PETIT_COIL == PETIT_EXTERNAL || PETIT_COIL == PETIT_BOTH
+/**
+ * reads coils
+ * @return 1 always
+ */
+pb_t PetitPortCoilRead(pu16_t Addr, pu8_t* Data)
+{
+	*Data = (host_coils[Addr >> 3] >> (Addr & 7U)) & 1U;
+	return 1;
+}
+
+/**
+ * writes coils
+ * @return 1 always
+ */
+pb_t PetitPortCoilWrite(pu16_t Addr, pu16_t Data)
+{
+	if (Data)
+		host_coils[Addr >> 3] |= 1U << (Addr & 7U);
+	else
+		host_coils[Addr >> 3] &= ~(1U << (Addr & 7U));
+	return 1;
+}
+#endif
+
+#if PETIT_DISCRETE == PETIT_EXTERNAL || PETIT_DISCRETE == PETIT_BOTH
+/**
+ * reads discrete inputs, which mirror the coils here
+ * @return 1 always
+ */
+pb_t PetitPortDiscreteRead(pu16_t Addr, pu8_t* Data)
+{
+	*Data = (host_coils[Addr >> 3] >> (Addr & 7U)) & 1U;
+	return 1;
+}
+#endif
+
+// group Petit Modbus Host Port
+/**
+ * @}
+ */
@@ -0,0 +1,283 @@
+/*******************************************************************************
+ * @file PetitPointCheck.c
+ * Round trip of typed points in every word and byte order.
+ *
+ * For every type and order, a point in the holding registers and one in the
+ * input registers are written with PETIT_POINT_Write and read by a master
+ * with functions 3 and 4, whose data must come in the order the point names.
+ * The master then writes other bytes into the holding point with function
+ * 16, and PETIT_POINT_Read must give back the value they stand for.  Every
+ * frame goes through a slave with PETIT_MODBUS_ProcessBatch, so the check
+ * holds for whatever PETIT_REG_ORDER and PETIT_SWAP it is built with.
+ *
+ * The exit status is 1 if a point did not come back as it went.
+ *
+ * usage: PetitPointCheck
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "PetitModbusHost.h"
+#include "PetitPoint.h"
+
+#if !defined(PETITMODBUS_POINTS_ENABLED) || PETITMODBUS_POINTS_ENABLED == 0 \
+	|| !defined(PETIT_BATCH) || PETIT_BATCH == 0
+#error "PetitPointCheck needs PETITMODBUS_POINTS_ENABLED and PETIT_BATCH."
+#endif
+// points live in the internal tables, which the master reads only then
+#if PETIT_REG != PETIT_INTERNAL || PETIT_INPUT_REG != PETIT_INTERNAL
+#error "PetitPointCheck needs the registers internal."
+#endif
+
+// the register of the points, and the value written by the master
+#define CHECK_ADDR (10U)
+#define CHECK_FLIP (0x5AU)
+
+typedef struct
+{
+	const char *Name;
+	pu8_t Order;
+	// where byte i of the value, most significant first, goes on the wire
+	pu8_t Pos32[4];
+	pu8_t Pos64[8];
+} T_CHECK_ORDER;
+
+static const T_CHECK_ORDER check_orders[] =
+{
+	{ "ABCD", PETIT_POINT_ABCD, { 0, 1, 2, 3 }, { 0, 1, 2, 3, 4, 5, 6, 7 } },
+	{ "CDAB", PETIT_POINT_CDAB, { 2, 3, 0, 1 }, { 6, 7, 4, 5, 2, 3, 0, 1 } },
+	{ "BADC", PETIT_POINT_BADC, { 1, 0, 3, 2 }, { 1, 0, 3, 2, 5, 4, 7, 6 } },
+	{ "DCBA", PETIT_POINT_DCBA, { 3, 2, 1, 0 }, { 7, 6, 5, 4, 3, 2, 1, 0 } },
+};
+
+static const char *const check_types[] = { "u32", "i32", "f32", "f64" };
+
+static T_PETIT_MODBUS petit;
+static pu8_t req[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+static pu8_t arena[2U * C_PETITMODBUS_RXTX_BUFFER_SIZE + 5U + 2U * 125U];
+
+/**
+ * Runs one request through the slave.
+ * @param[in] Len the request without its CRC, which is appended
+ * @return the response, CRC checked, or 0
+ */
+static const T_PETIT_ADU *check_send(pu16_t Len)
+{
+	static T_PETIT_ADU adu;
+	pu16_t crc = PetitCRC16(&petit, req, Len);
+
+	req[Len] = (pu8_t) crc;
+	req[Len + 1U] = (pu8_t) (crc >> 8U);
+	adu.Req = req;
+	adu.Req_Len = Len + 2U;
+	if (PETIT_MODBUS_ProcessBatch(&petit, &adu, 1U, arena, sizeof(arena))
+			!= 1U || adu.Rsp_Len < 4U
+			|| PetitCRC16(&petit, adu.Rsp, adu.Rsp_Len) != 0
+			|| (adu.Rsp[1] & 0x80U))
+	{
+		return 0;
+	}
+	return &adu;
+}
+
+/**
+ * Reads the data of Words registers from Addr with Function.
+ * @return the data bytes, or 0
+ */
+static const pu8_t *check_read(pu8_t Function, pu16_t Addr, pu8_t Words)
+{
+	const T_PETIT_ADU *adu;
+
+	req[0] = PETITMODBUS_SLAVE_ADDRESS;
+	req[1] = Function;
+	req[2] = (pu8_t) (Addr >> 8U);
+	req[3] = (pu8_t) Addr;
+	req[4] = 0;
+	req[5] = Words;
+	adu = check_send(6U);
+	if (adu == 0 || adu->Rsp_Len != 5U + 2U * Words
+			|| adu->Rsp[2] != 2U * Words)
+	{
+		return 0;
+	}
+	return &adu->Rsp[3];
+}
+
+/**
+ * Writes Words registers of Data from Addr with function 16.
+ */
+static int check_write(pu16_t Addr, const pu8_t *Data, pu8_t Words)
+{
+	req[0] = PETITMODBUS_SLAVE_ADDRESS;
+	req[1] = C_FCODE_WRITE_MULTIPLE_REGISTERS;
+	req[2] = (pu8_t) (Addr >> 8U);
+	req[3] = (pu8_t) Addr;
+	req[4] = 0;
+	req[5] = Words;
+	req[6] = 2U * Words;
+	memcpy(&req[7], Data, 2U * Words);
+	return check_send(7U + 2U * Words) != 0;
+}
+
+/**
+ * Puts the bytes of a value into Bytes, most significant first.
+ */
+static void check_bytes(pu8_t Type, const T_PETIT_VALUE *Value, pu8_t *Bytes)
+{
+	pu8_t i;
+
+#if PETIT_POINT_F64 > 0
+	if (Type == E_PETIT_POINT_F64)
+	{
+		for (i = 0; i < 8U; i++)
+			Bytes[i] = (pu8_t) (Value->U64 >> (56U - 8U * i));
+		return;
+	}
+#endif
+	(void) Type;
+	for (i = 0; i < 4U; i++)
+		Bytes[i] = (pu8_t) (Value->U32 >> (24U - 8U * i));
+}
+
+/**
+ * @return 1 if two values of a type are the same
+ */
+static int check_same(pu8_t Type, const T_PETIT_VALUE *A,
+		const T_PETIT_VALUE *B)
+{
+	switch (Type)
+	{
+	case E_PETIT_POINT_I32:
+		return A->I32 == B->I32;
+	case E_PETIT_POINT_F32:
+		return A->F32 == B->F32;
+#if PETIT_POINT_F64 > 0
+	case E_PETIT_POINT_F64:
+		return A->F64 == B->F64;
+#endif
+	default:
+		return A->U32 == B->U32;
+	}
+}
+
+/**
+ * Checks one type in one order.
+ * @return 1 if both points came back as they went
+ */
+static int check_point(pu8_t Type, const T_PETIT_VALUE *Value,
+		const T_CHECK_ORDER *Order)
+{
+	T_PETIT_POINT points[2];
+	T_PETIT_VALUE values[2];
+	T_PETIT_VALUE got;
+	pu8_t words = Type == E_PETIT_POINT_F64 ? 4U : 2U;
+	const pu8_t *pos = words == 4U ? Order->Pos64 : Order->Pos32;
+	pu8_t bytes[8];
+	pu8_t wire[8];
+	const pu8_t *data;
+	pu8_t bank;
+	pu8_t i;
+
+	for (bank = 0; bank < 2U; bank++)
+	{
+		points[bank].Address = CHECK_ADDR;
+		points[bank].Type = Type;
+		points[bank].Order = Order->Order;
+		points[bank].Bank = bank == 0 ? PETIT_POINT_HOLDING
+				: PETIT_POINT_INPUT;
+		values[bank] = *Value;
+	}
+	if (!PETIT_POINT_Write(points, values, 2U))
+		return 0;
+
+	// the slave sends the bytes where the order puts them
+	check_bytes(Type, Value, bytes);
+	for (i = 0; i < 2U * words; i++)
+		wire[pos[i]] = bytes[i];
+	data = check_read(C_FCODE_READ_HOLDING_REGISTERS, CHECK_ADDR, words);
+	if (data == 0 || memcmp(data, wire, 2U * words) != 0)
+		return 0;
+	data = check_read(C_FCODE_READ_INPUT_REGISTERS, CHECK_ADDR, words);
+	if (data == 0 || memcmp(data, wire, 2U * words) != 0)
+		return 0;
+
+	// and takes bytes in that order from the master
+	for (i = 0; i < 2U * words; i++)
+		wire[pos[i]] = bytes[i] ^ CHECK_FLIP;
+	if (!check_write(CHECK_ADDR, wire, words)
+			|| !PETIT_POINT_Read(points, &got, 1U))
+		return 0;
+	check_bytes(Type, &got, wire);
+	for (i = 0; i < 2U * words; i++)
+	{
+		if (wire[i] != (bytes[i] ^ CHECK_FLIP))
+			return 0;
+	}
+
+	// the bytes the slave sent make the value again
+	for (i = 0; i < 2U * words; i++)
+		wire[pos[i]] = bytes[i];
+	if (!check_write(CHECK_ADDR, wire, words)
+			|| !PETIT_POINT_Read(points, &got, 1U))
+		return 0;
+	return check_same(Type, Value, &got);
+}
+
+int main(void)
+{
+	T_PETIT_VALUE values[4];
+	unsigned failed = 0;
+	unsigned o;
+	pu8_t t;
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+
+	memset(values, 0, sizeof(values));
+	values[E_PETIT_POINT_U32].U32 = 0xAABBCCDDUL;
+	values[E_PETIT_POINT_I32].I32 = -123456789L;
+	values[E_PETIT_POINT_F32].F32 = -1.5e-3f;
+#if PETIT_POINT_F64 > 0
+	values[E_PETIT_POINT_F64].F64 = 3.141592653589793;
+#endif
+
+	printf("# %-4s", "type");
+	for (o = 0; o < sizeof(check_orders) / sizeof(check_orders[0]); o++)
+		printf(" %6s", check_orders[o].Name);
+	printf("\n");
+	for (t = 0; t < sizeof(check_types) / sizeof(check_types[0]); t++)
+	{
+#if PETIT_POINT_F64 == 0
+		if (t == E_PETIT_POINT_F64)
+			break;
+#endif
+		printf("  %-4s", check_types[t]);
+		for (o = 0; o < sizeof(check_orders) / sizeof(check_orders[0]); o++)
+		{
+			int ok = check_point(t, &values[t], &check_orders[o]);
+
+			printf(" %6s", ok ? "ok" : "FAILED");
+			failed += !ok;
+		}
+		printf("\n");
+	}
+	return failed != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
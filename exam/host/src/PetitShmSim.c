@@ -0,0 +1,233 @@
+/*******************************************************************************
+ * @file PetitShmSim.c
+ * Checks the shared register file with readers in other processes.
+ *
+ * The slave moves its tables into a shared-memory segment and forks readers,
+ * which map the segment by its name as an HMI or a historian would.  A
+ * master then writes the first 123 holding registers with function 16, all
+ * of them the same value and a new value every time, while the readers copy
+ * the same registers with PETIT_SHM_Read as fast as they can.  A copy whose
+ * registers differ would be a torn read.  Built with the registers internal
+ * a function 16 is one write to the segment; with PETIT_REG PETIT_BOTH every
+ * register is written on its own and torn copies are expected.
+ *
+ * The report gives the writes per second of the slave and, for every reader,
+ * its copies per second and the torn ones.  The exit status is 1 if a copy
+ * was torn.
+ *
+ * usage: PetitShmSim [-w writes] [-n readers] [segment name]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "PetitModbusHost.h"
+#include "PetitShm.h"
+
+// the registers of one function 16
+#define SIM_REGS (123U)
+#define SIM_MAX_READERS (16U)
+
+static uint64_t sim_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Writes SIM_REGS registers of Value through the slave.
+ * @return 1 if the slave answered without an exception
+ */
+static int sim_write(T_PETIT_MODBUS *Petit, pu16_t Value)
+{
+	static T_PETIT_MODBUS crc;
+	pu8_t adu[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu8_t rsp[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+	pu16_t len = 0;
+	pu16_t n = 0;
+	pu16_t i;
+	int first = -1;
+
+	adu[len++] = PETITMODBUS_SLAVE_ADDRESS;
+	adu[len++] = C_FCODE_WRITE_MULTIPLE_REGISTERS;
+	adu[len++] = 0;
+	adu[len++] = 0;
+	adu[len++] = 0;
+	adu[len++] = SIM_REGS;
+	adu[len++] = 2U * SIM_REGS;
+	for (i = 0; i < SIM_REGS; i++)
+	{
+		adu[len++] = Value >> 8;
+		adu[len++] = Value;
+	}
+	PetitCRC16(&crc, adu, len);
+	adu[len++] = crc.CRC16;
+	adu[len++] = crc.CRC16 >> 8;
+
+	for (i = 0; i < len; i++)
+		PetitRxBufferInsert(Petit, adu[i]);
+	for (i = 0; i < 16U && first < 0; i++)
+	{
+		PETIT_MODBUS_Process(Petit);
+		first = PetitHostTxTake();
+	}
+	if (first < 0)
+	{
+		PetitRxBufferReset(Petit);
+		return 0;
+	}
+	rsp[n++] = first;
+	while (n < sizeof(rsp) && PetitTxBufferPop(Petit, &rsp[n]))
+		n++;
+	return n > 2U && !(rsp[1] & 0x80U);
+}
+
+/**
+ * Copies the registers until the segment is retired.
+ * @param[in] Shm the segment as mapped by PETIT_SHM_Open
+ * @return the exit status of the reader
+ */
+static int sim_reader(const T_PETIT_SHM *Shm, unsigned Id)
+{
+	pu16_t regs[SIM_REGS];
+	unsigned long copies = 0;
+	unsigned long torn = 0;
+	uint64_t t0;
+	double s;
+	pu16_t i;
+
+	t0 = sim_ns();
+	while (PETIT_SHM_Read(Shm, PETIT_SHM_REGISTERS, 0, SIM_REGS, regs))
+	{
+		copies++;
+		for (i = 1; i < SIM_REGS; i++)
+		{
+			if (regs[i] != regs[0])
+			{
+				torn++;
+				break;
+			}
+		}
+	}
+	s = (double) (sim_ns() - t0) / 1e9;
+	if (__atomic_load_n(&Shm->Magic, __ATOMIC_RELAXED) != 0)
+	{
+		fprintf(stderr, "reader %u: a write did not end\n", Id);
+		torn++;
+	}
+	printf("reader %u: %lu copies of %u registers, %.0f ns each, %lu torn\n",
+			Id, copies, SIM_REGS, copies ? s * 1e9 / (double) copies : 0.0,
+			torn);
+	fflush(stdout);
+	PETIT_SHM_Close(Shm);
+	return torn != 0;
+}
+
+int main(int argc, char **argv)
+{
+	static T_PETIT_MODBUS petit;
+	const T_PETIT_SHM *shm;
+	char name[64];
+	pid_t pids[SIM_MAX_READERS];
+	long writes = 200000;
+	unsigned readers = 2U;
+	unsigned r;
+	uint64_t t0;
+	double s;
+	int status;
+	int failed = 0;
+	long w;
+	int opt;
+
+	snprintf(name, sizeof(name), "/petit-shm-sim.%ld", (long) getpid());
+	while ((opt = getopt(argc, argv, "w:n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			writes = atol(optarg);
+			break;
+		case 'n':
+			readers = (unsigned) atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-w writes] [-n readers] "
+					"[segment name]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (writes <= 0 || readers > SIM_MAX_READERS)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (optind < argc)
+	{
+		snprintf(name, sizeof(name), "%s", argv[optind]);
+	}
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+	// mapped by name as another process would, before the writes begin
+	if (!PETIT_SHM_Create(name) || (shm = PETIT_SHM_Open(name)) == NULL)
+	{
+		perror(name);
+		return 1;
+	}
+
+	fflush(stdout);
+	for (r = 0; r < readers; r++)
+	{
+		pids[r] = fork();
+		if (pids[r] == 0)
+		{
+			_exit(sim_reader(shm, r));
+		}
+	}
+
+	t0 = sim_ns();
+	for (w = 0; w < writes; w++)
+	{
+		if (!sim_write(&petit, (pu16_t) w))
+		{
+			fprintf(stderr, "write %ld failed\n", w);
+			failed = 1;
+			break;
+		}
+	}
+	s = (double) (sim_ns() - t0) / 1e9;
+	PETIT_SHM_Destroy(name);
+	PETIT_SHM_Close(shm);
+
+	for (r = 0; r < readers; r++)
+	{
+		if (pids[r] < 0 || waitpid(pids[r], &status, 0) < 0
+				|| !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	printf("slave: %ld writes of %u registers, %.0f ns each\n", w, SIM_REGS,
+			w ? s * 1e9 / (double) w : 0.0);
+	return failed;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
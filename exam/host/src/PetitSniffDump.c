@@ -0,0 +1,210 @@
+/*******************************************************************************
+ * @file PetitSniffDump.c
+ * Converts a capture of the bus monitor to text or pcap.
+ *
+ * The capture is the byte stream taken out of a T_PETIT_SNIFF ring, records
+ * back to back as described in PetitSniff.h, read from a file or stdin.  The
+ * record times are 16-bit PetitPortClock stamps of -t ticks per second, which
+ * are unwrapped on the assumption that consecutive frames are less than one
+ * wrap of the clock apart.
+ *
+ * The text has one line per frame with its time, whether it is a request or
+ * the response to the line before it, with its latency, and the frame in hex.
+ * pcap output uses the link type DLT_USER0 with the whole RTU ADU as packet.
+ * -s reports on stderr how fast the capture was converted, against what a
+ * bus at 921600 baud can carry.
+ *
+ * usage: PetitSniffDump [-p] [-s] [-t ticks per second] [capture]
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PetitSniff.h"
+
+// capture bytes read at once, more than one record
+#define DUMP_CHUNK (1U << 16)
+// link type for private use, no other fits modbus RTU
+#define DUMP_DLT_USER0 (147U)
+// characters a bus at 921600 baud carries per second, 11 bits each
+#define DUMP_LINE_RATE (921600.0 / 11.0)
+
+static const char dump_hex[] = "0123456789ABCDEF";
+static unsigned long ticks = 1000000U;
+static int pcap;
+// unwrapped time of the last record, in ticks
+static uint64_t last_time;
+static pu16_t last_stamp;
+static unsigned long records;
+
+static uint64_t dump_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static void dump_u32(unsigned char *Out, uint32_t Value)
+{
+	memcpy(Out, &Value, sizeof(Value));
+}
+
+/**
+ * Writes the pcap file header, in host byte order as readers expect.
+ */
+static void dump_pcap_header(FILE *Out)
+{
+	unsigned char h[24];
+	uint16_t version[2] = { 2U, 4U };
+
+	dump_u32(&h[0], 0xA1B2C3D4U);
+	memcpy(&h[4], version, sizeof(version));
+	dump_u32(&h[8], 0);
+	dump_u32(&h[12], 0);
+	dump_u32(&h[16], 256U);
+	dump_u32(&h[20], DUMP_DLT_USER0);
+	fwrite(h, 1, sizeof(h), Out);
+}
+
+/**
+ * Converts one record.
+ * @param[in] Rec the record header followed by the frame
+ */
+static void dump_record(FILE *Out, const pu8_t *Rec)
+{
+	pu8_t flags = Rec[0];
+	pu16_t len = Rec[1];
+	pu16_t stamp = (pu16_t) (Rec[2] | Rec[3] << 8);
+	const pu8_t *adu = &Rec[PETIT_SNIFF_HDR];
+	uint64_t time;
+	uint64_t latency;
+	char line[128 + 3U * 255U];
+	char *p = line;
+	pu16_t i;
+
+	// the first record starts the clock
+	if (records++ == 0)
+		last_stamp = stamp;
+	latency = (pu16_t) (stamp - last_stamp);
+	time = last_time + latency;
+	last_time = time;
+	last_stamp = stamp;
+
+	if (pcap)
+	{
+		unsigned char h[16];
+		dump_u32(&h[0], (uint32_t) (time / ticks));
+		dump_u32(&h[4], (uint32_t) (time % ticks * 1000000U / ticks));
+		dump_u32(&h[8], len);
+		dump_u32(&h[12], len);
+		fwrite(h, 1, sizeof(h), Out);
+		fwrite(adu, 1, len, Out);
+		return;
+	}
+
+	if (flags & PETIT_SNIFF_LOST)
+		fputs("# frames lost\n", Out);
+	p += sprintf(p, "%12.6f %-4s %3u %02X %3u ", (double) time / ticks,
+			!(flags & PETIT_SNIFF_CRC_OK) ? "bad" :
+			(flags & PETIT_SNIFF_RESPONSE) ? "rsp" : "req",
+			len > 0 ? adu[0] : 0U, len > 1 ? adu[1] : 0U, len);
+	if (flags & PETIT_SNIFF_RESPONSE)
+		p += sprintf(p, "%9.3f ms ", (double) latency * 1e3 / ticks);
+	else
+		p += sprintf(p, "%12s ", "");
+	for (i = 0; i < len; i++)
+	{
+		*p++ = ' ';
+		*p++ = dump_hex[adu[i] >> 4];
+		*p++ = dump_hex[adu[i] & 0x0F];
+	}
+	if (flags & PETIT_SNIFF_TRUNCATED)
+	{
+		memcpy(p, " ...", 4);
+		p += 4;
+	}
+	*p++ = '\n';
+	fwrite(line, 1, (size_t) (p - line), Out);
+}
+
+int main(int argc, char **argv)
+{
+	static pu8_t in[DUMP_CHUNK];
+	FILE *f = stdin;
+	size_t have = 0;
+	size_t pos;
+	size_t n;
+	unsigned long long bytes = 0;
+	uint64_t start;
+	double s;
+	int stats = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "pst:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			pcap = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 't':
+			ticks = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p] [-s] [-t ticks per second] "
+					"[capture]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (ticks == 0)
+	{
+		fprintf(stderr, "%s: bad option\n", argv[0]);
+		return 2;
+	}
+	if (optind < argc && (f = fopen(argv[optind], "rb")) == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if (pcap)
+		dump_pcap_header(stdout);
+
+	start = dump_ns();
+	while ((n = fread(&in[have], 1, sizeof(in) - have, f)) > 0)
+	{
+		bytes += n;
+		have += n;
+		pos = 0;
+		while (have - pos >= PETIT_SNIFF_HDR
+				&& have - pos >= PETIT_SNIFF_HDR + in[pos + 1U])
+		{
+			dump_record(stdout, &in[pos]);
+			pos += PETIT_SNIFF_HDR + in[pos + 1U];
+		}
+		memmove(in, &in[pos], have - pos);
+		have -= pos;
+	}
+	s = (double) (dump_ns() - start) / 1e9;
+	if (have != 0)
+		fprintf(stderr, "%s: capture ends in a record\n", argv[0]);
+	if (stats)
+		fprintf(stderr, "%lu records, %llu bytes in %.3f s, %.1f MB/s, "
+				"%.0f times a bus at 921600 baud\n", records, bytes, s,
+				(double) bytes / s / 1e6, (double) bytes / s / DUMP_LINE_RATE);
+	return ferror(f) || have != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
@@ -0,0 +1,225 @@
+/*******************************************************************************
+ * @file PetitTraceCheck.c
+ * Checks the trace ring and the latency histograms of PETIT_TRACE.
+ *
+ * A slave is fed a known sequence of requests on a simulated clock that only
+ * moves between the steps of a request: from the last request byte to the
+ * start of processing, from there to the first response byte and from there
+ * to the last one.  Every state the slave enters must be in the trace ring
+ * with the time it was entered, in order, and every latency must be counted
+ * once, in the histogram of its function code and in the bin it falls in.
+ * A second run overflows the ring, which must keep the newest records.
+ *
+ * The exit status is 1 if a record or a count is not the one expected.
+ *
+ * usage: PetitTraceCheck
+ ******************************************************************************/
+
+/**
+ * @addtogroup Petit_Modbus_Host_Port
+ * @{
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "PetitModbusHost.h"
+
+#if !defined(PETIT_TRACE) || PETIT_TRACE == 0
+#error "PetitTraceCheck needs PETIT_TRACE."
+#endif
+#if PETITMODBUS_PROCESS_POSITION != 0 || defined(PETITMODBUS_TURNAROUND) \
+	|| defined(PETITMODBUS_TURNAROUND_TIMER)
+#error "PetitTraceCheck expects process position 0 and no turnaround."
+#endif
+
+// records of one request: RX_DONE, PROCESS, TX_DATABUF, TX_DLY, TX and RX
+#define CHECK_EVENTS (6U)
+#define CHECK_MAX_RECS (16U * CHECK_EVENTS)
+
+typedef struct
+{
+	pu8_t Function;
+	pu8_t Req[8];
+	pu8_t Req_Len;
+	// the three latencies and the histogram bins they fall in, worked out
+	// by hand for a first bin of 16 ticks
+	pu16_t Dt[E_PETIT_TRACE_INTERVALS];
+	pu8_t Bin[E_PETIT_TRACE_INTERVALS];
+} T_CHECK_REQ;
+
+static const T_CHECK_REQ check_reqs[] =
+{
+	// 10 registers from 0
+	{ 3U, { 3U, 0, 0, 0, 10U }, 5U, { 5U, 20U, 100U }, { 0, 1U, 3U } },
+	// register 7 to 0x1234
+	{ 6U, { 6U, 0, 7U, 0x12U, 0x34U }, 5U, { 16U, 31U, 32U }, { 1U, 1U, 2U } },
+	// 16 coils from 8
+	{ 1U, { 1U, 0, 8U, 0, 16U }, 5U, { 0, 5000U, 15U }, { 0, 7U, 0 } },
+	// 1 register past the table, answered with exception 2
+	{ 3U, { 3U, 0xFFU, 0xFFU, 0, 1U }, 5U, { 255U, 256U, 511U },
+			{ 4U, 5U, 5U } },
+	// register 2 to 0xBEEF with function 16
+	{ 16U, { 16U, 0, 2U, 0, 1U, 2U, 0xBEU, 0xEFU }, 8U, { 64U, 1024U, 2047U },
+			{ 3U, 7U, 7U } },
+};
+#define CHECK_REQS (sizeof(check_reqs) / sizeof(check_reqs[0]))
+
+static T_PETIT_MODBUS petit;
+static pu16_t now;
+static T_PETIT_TRACE_REC expected[CHECK_MAX_RECS];
+static pu16_t expected_cnt;
+static pu16_t hist[PETIT_TRACE_CODES][E_PETIT_TRACE_INTERVALS]
+		[PETIT_TRACE_BINS];
+static unsigned failed;
+
+static pu16_t check_clock(void)
+{
+	return now;
+}
+
+static void check_expect(pu8_t Event, pu8_t Code)
+{
+	T_PETIT_TRACE_REC *rec = &expected[expected_cnt++ % CHECK_MAX_RECS];
+
+	rec->Time = now;
+	rec->Event = Event;
+	rec->Code = Code;
+}
+
+/**
+ * Runs one request through the slave, and adds what it should leave in the
+ * trace to the expected records and counts.
+ */
+static void check_request(const T_CHECK_REQ *Req)
+{
+	pu8_t code = Req->Function < PETIT_TRACE_CODES ? Req->Function : 0;
+	pu8_t frame[12];
+	pu16_t crc;
+	pu8_t tx;
+	pu8_t i;
+
+	frame[0] = PETITMODBUS_SLAVE_ADDRESS;
+	memcpy(&frame[1], Req->Req, Req->Req_Len);
+	crc = PetitCRC16(&petit, frame, Req->Req_Len + 1U);
+	frame[Req->Req_Len + 1U] = (pu8_t) crc;
+	frame[Req->Req_Len + 2U] = (pu8_t) (crc >> 8U);
+	for (i = 0; i < Req->Req_Len + 3U; i++)
+		PetitRxBufferInsert(&petit, frame[i]);
+	check_expect(PETIT_TRACE_RX_DONE, Req->Function);
+
+	now += Req->Dt[E_PETIT_TRACE_RX_PROCESS];
+	PETIT_MODBUS_Process(&petit);
+	check_expect(E_PETIT_RXTX_PROCESS, Req->Function);
+
+	now += Req->Dt[E_PETIT_TRACE_PROCESS_TX];
+	for (i = 0; i < 4U && petit.Xmit_State != E_PETIT_RXTX_TX; i++)
+		PETIT_MODBUS_Process(&petit);
+	check_expect(E_PETIT_RXTX_TX_DATABUF, Req->Function);
+	check_expect(E_PETIT_RXTX_TX_DLY, Req->Function);
+	check_expect(E_PETIT_RXTX_TX, Req->Function);
+
+	now += Req->Dt[E_PETIT_TRACE_TX];
+	while (PetitTxBufferPop(&petit, &tx))
+		;
+	(void) PetitHostTxTake();
+	check_expect(E_PETIT_RXTX_RX, Req->Function);
+
+	for (i = 0; i < E_PETIT_TRACE_INTERVALS; i++)
+	{
+		pu8_t bin = Req->Bin[i] < PETIT_TRACE_BINS ? Req->Bin[i]
+				: PETIT_TRACE_BINS - 1U;
+		hist[code][i][bin]++;
+	}
+}
+
+/**
+ * Reads the trace ring, whose records must be the newest expected ones.
+ */
+static void check_ring(const char *What)
+{
+	T_PETIT_TRACE_REC recs[CHECK_MAX_RECS];
+	pu16_t want = expected_cnt < PETIT_TRACE_SIZE ? expected_cnt
+			: PETIT_TRACE_SIZE;
+	pu16_t n = PETIT_MODBUS_Trace_Read(&petit, recs, CHECK_MAX_RECS);
+	pu16_t i;
+	int ok = n == want;
+
+	for (i = 0; ok && i < n; i++)
+	{
+		const T_PETIT_TRACE_REC *exp =
+				&expected[(expected_cnt - want + i) % CHECK_MAX_RECS];
+		ok = recs[i].Time == exp->Time && recs[i].Event == exp->Event
+				&& recs[i].Code == exp->Code;
+	}
+	printf("  %-34s %3u records %s\n", What, n, ok ? "ok" : "FAILED");
+	failed += !ok;
+	expected_cnt = 0;
+}
+
+/**
+ * Compares every histogram with the expected counts.
+ */
+static void check_hist(void)
+{
+	pu8_t code;
+	pu8_t i;
+	int ok = 1;
+
+	for (code = 0; code < PETIT_TRACE_CODES; code++)
+	{
+		for (i = 0; i < E_PETIT_TRACE_INTERVALS; i++)
+		{
+			if (memcmp(PETIT_MODBUS_Trace_Histogram(&petit, code,
+					(T_PETIT_TRACE_INTERVAL) i), hist[code][i],
+					sizeof(hist[code][i])) != 0)
+			{
+				ok = 0;
+			}
+		}
+	}
+	printf("  %-34s %3u codes   %s\n", "histograms", PETIT_TRACE_CODES,
+			ok ? "ok" : "FAILED");
+	failed += !ok;
+}
+
+int main(void)
+{
+	pu8_t i;
+
+	petit.Timer_Start = PetitPortTimerStart;
+	petit.Timer_Stop = PetitPortTimerStop;
+	petit.Tx_Begin = PetitPortTxBegin;
+	PetitHostClock(check_clock);
+	PETIT_MODBUS_Init(&petit);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	{
+		static pu8_t buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+		PETIT_MODBUS_Set_Buffer(&petit, buffer, sizeof(buffer));
+	}
+#endif
+	printf("# %u records, %u codes, %u bins, %u bytes per instance\n",
+			PETIT_TRACE_SIZE, PETIT_TRACE_CODES, PETIT_TRACE_BINS,
+			(unsigned) (sizeof(petit.Trace) + sizeof(petit.Trace_Hist)));
+
+	// every record of a few requests
+	for (i = 0; i < CHECK_REQS; i++)
+		check_request(&check_reqs[i]);
+	check_ring("ring");
+	check_hist();
+
+	// more requests than the ring holds, it keeps the newest
+	for (i = 0; i < 2U * CHECK_REQS; i++)
+		check_request(&check_reqs[i % CHECK_REQS]);
+	check_ring("ring after an overflow");
+	check_hist();
+
+	PETIT_MODBUS_Trace_Reset(&petit);
+	memset(hist, 0, sizeof(hist));
+	check_ring("ring after a reset");
+	check_hist();
+	return failed != 0;
+}
+
+// addtogroup Petit_Modbus_Host_Port
+/** @} */
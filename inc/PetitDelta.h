@@ -0,0 +1,68 @@
+/******************************************************************************
+ * @file PetitDelta.h
+ *
+ * This header file is for the delta reads of petitmodbus.
+ *
+ * Built with PETIT_DELTA, functions 6 and 16 log the address of every holding
+ * register they write in a ring, and the application logs what it writes
+ * itself with PETIT_DELTA_Mark once it has stored it.  Each entry moves a
+ * 16-bit generation on by one.  A master sends the vendor function code
+ * C_FCODE_DELTA with the generation it is up to, its token, and gets back the
+ * address and current value of the registers written since, and the new
+ * token, instead of reading the whole table again.
+ *
+ * Request PDU: function, token, start (2 bytes each, big-endian)
+ *   start PETIT_DELTA_CHANGES asks for the changes since the token, any other
+ *   start for a snapshot of the registers from there on.
+ * Response PDU: function, flags, token, count, then
+ *   count address and value pairs, or
+ *   the start and count values with PETIT_DELTA_SNAPSHOT in the flags.
+ *
+ * PETIT_DELTA_MORE says the master is to ask again right away, with the token
+ * of the response and, for a snapshot, the register after the last one.  A
+ * token the log no longer reaches back to, because more registers were
+ * written than it holds, is answered with the first snapshot page; so is a
+ * snapshot from register 0.  Both carry the generation the snapshot started
+ * at, and later pages give the token of the request back, so what is written
+ * while the master pages through comes with the next changes.
+ *****************************************************************************/
+
+#ifndef __PETIT_DELTA__H
+#define __PETIT_DELTA__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// start of a request that asks for the changes since its token
+#define PETIT_DELTA_CHANGES   (0xFFFFU)
+// flags of a response
+#define PETIT_DELTA_SNAPSHOT  (0x01U)
+#define PETIT_DELTA_MORE      (0x02U)
+
+#if defined(PETIT_DELTA) && PETIT_DELTA > 0
+// registers the change log holds, a power of two up to 4096.  Masters that
+// fall further behind read a snapshot.
+#ifndef PETIT_DELTA_LOG
+#define PETIT_DELTA_LOG (64U)
+#endif
+
+// functions defined by petit modbus delta
+void PETIT_DELTA_Init(pu16_t Seed);
+void PETIT_DELTA_Mark(pu16_t Addr, pu16_t Cnt);
+pu16_t PETIT_DELTA_Token(void);
+
+// called by the core for C_FCODE_DELTA
+pu8_t PetitDeltaRead(T_PETIT_MODBUS *Petit);
+
+#define PETIT_DELTA_MARK(Addr, Cnt) PETIT_DELTA_Mark(Addr, Cnt)
+#else
+#define PETIT_DELTA_MARK(Addr, Cnt)
+#endif /* PETIT_DELTA */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,131 @@
+/******************************************************************************
+ * @file PetitGateway.h
+ *
+ * This header file is for the Modbus TCP to RTU gateway of petitmodbus.
+ *
+ * The gateway puts many TCP clients in front of one serial line driven by the
+ * petitmodbus master.  Reads that are already on their way to the bus are
+ * shared between clients and recent results are answered from a short lived
+ * cache, so the slow bus only carries the transactions it has to.
+ *
+ * The gateway does not own any socket.  The application hands it every MBAP
+ * frame it receives together with an opaque client handle and sends whatever
+ * comes back through Reply.
+ *****************************************************************************/
+
+#ifndef __PETIT_GATEWAY__H
+#define __PETIT_GATEWAY__H
+
+#include "PetitMaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(PETITMODBUS_GATEWAY_ENABLED) && PETITMODBUS_GATEWAY_ENABLED > 0
+
+// bus transactions that can be queued, in flight or cached at once
+#ifndef PETITGW_SLOTS
+#define PETITGW_SLOTS (4U)
+#endif
+// client requests that can wait for a bus transaction at once
+#ifndef PETITGW_WAITERS
+#define PETITGW_WAITERS (8U)
+#endif
+// ticks of PETIT_GATEWAY_Tick a read result is served from the cache, 0 off
+#ifndef PETITGW_CACHE_TTL
+#define PETITGW_CACHE_TTL (0U)
+#endif
+// response timeout of the slaves in ticks
+#ifndef PETITGW_TIMEOUT
+#define PETITGW_TIMEOUT (100U)
+#endif
+
+// +2 transaction; +2 protocol; +2 length; +1 unit; +1 function; +1 byte count
+#define C_PETITGW_ADU_SIZE (2U*(C_PETITMASTER_MAX_REGS) + 9U)
+
+typedef enum
+{
+	E_PETITGW_FREE = 0,
+	E_PETITGW_QUEUED,
+	E_PETITGW_BUSY,
+	E_PETITGW_DONE,
+	E_PETITGW_CACHED
+} T_PETITGW_SLOT_STATE;
+
+/**
+ * One bus transaction.  Req comes first so the master callback can find the
+ * slot it belongs to.
+ */
+typedef struct
+{
+	T_PETIT_MASTER_REQ Req;
+	pu16_t Data[C_PETITMASTER_MAX_REGS];
+	volatile T_PETITGW_SLOT_STATE State;
+	// true while further reads may join this transaction
+	pb_t Shared;
+	// tick the result was cached at
+	pu16_t Stamp;
+} T_PETITGW_SLOT;
+
+/**
+ * One client request waiting on a slot.  Reads may only cover part of the
+ * slot they share.
+ */
+typedef struct
+{
+	void *Client;
+	pu16_t Transaction;
+	pu8_t Function;
+	pu16_t Address;
+	pu16_t Count;
+	pu8_t Slot;
+	pb_t Used;
+} T_PETITGW_WAITER;
+
+typedef struct
+{
+	// client requests received
+	pu16_t Requests;
+	// transactions put on the bus
+	pu16_t Transactions;
+	// reads joined to a transaction already queued or in flight
+	pu16_t Merged;
+	// reads answered from the cache
+	pu16_t Cached;
+	// requests answered with an exception by the gateway itself
+	pu16_t Rejected;
+} T_PETITGW_STATS;
+
+typedef struct
+{
+	T_PETIT_MASTER *Master;
+	void (*Reply)(void *Client, const pu8_t *Adu, pu16_t Len);
+	T_PETITGW_SLOT Slots[PETITGW_SLOTS];
+	T_PETITGW_WAITER Waiters[PETITGW_WAITERS];
+	// unit id served last, for round robin between units
+	pu8_t Last_Unit;
+	volatile pu16_t Now;
+	pu8_t Adu[C_PETITGW_ADU_SIZE];
+	T_PETITGW_STATS Stats;
+} T_PETIT_GATEWAY;
+
+// Initialization Function
+void PETIT_GATEWAY_Init(T_PETIT_GATEWAY *Gw, T_PETIT_MASTER *Master,
+		void (*Reply)(void *Client, const pu8_t *Adu, pu16_t Len));
+
+// Main Functions
+void PETIT_GATEWAY_Process(T_PETIT_GATEWAY *Gw);
+void PETIT_GATEWAY_Tick(T_PETIT_GATEWAY *Gw);
+
+// functions defined by petit modbus gateway
+void PETIT_GATEWAY_Request(T_PETIT_GATEWAY *Gw, void *Client,
+		const pu8_t *Adu, pu16_t Len);
+void PETIT_GATEWAY_Drop(T_PETIT_GATEWAY *Gw, void *Client);
+
+#endif /* PETITMODBUS_GATEWAY_ENABLED */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
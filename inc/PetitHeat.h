@@ -0,0 +1,67 @@
+/******************************************************************************
+ * @file PetitHeat.h
+ *
+ * This header file is for the access heatmap of petitmodbus.
+ *
+ * Built with PETIT_HEAT, every successful read or write of registers, coils
+ * or discrete inputs counts one access for each register, or for each block
+ * of PETIT_HEAT_BLOCK coils or discrete inputs, it touched.  The counters
+ * are difference arrays: a request adds one at its first entry and takes one
+ * off after its last, two updates whatever its length, and
+ * PETIT_HEAT_Snapshot turns them into counts by summing them up.  Poll plans
+ * and register layouts can then be tuned to what masters really ask for.
+ *
+ * The counts wrap at the size of T_PETIT_HEAT_CNT, so take them with
+ * PETIT_HEAT_Snapshot_Clear often enough, or make it 32 bits wide.  A
+ * snapshot keeps interrupts off for one pass over its table.
+ *****************************************************************************/
+
+#ifndef __PETIT_HEAT__H
+#define __PETIT_HEAT__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// tables of the heatmap
+#define PETIT_HEAT_REG_READ       (0U)
+#define PETIT_HEAT_REG_WRITE      (1U)
+#define PETIT_HEAT_INPUT_READ     (2U)
+#define PETIT_HEAT_COIL_READ      (3U)
+#define PETIT_HEAT_COIL_WRITE     (4U)
+#define PETIT_HEAT_DISCRETE_READ  (5U)
+#define PETIT_HEAT_TABLES         (6U)
+
+#if defined(PETIT_HEAT) && PETIT_HEAT > 0
+// coils or discrete inputs counted together
+#ifndef PETIT_HEAT_BLOCK
+#define PETIT_HEAT_BLOCK (16U)
+#endif
+#ifndef T_PETIT_HEAT_CNT
+#define T_PETIT_HEAT_CNT pu16_t
+#endif
+
+#define PETIT_HEAT_COIL_BLOCKS \
+	((NUMBER_OF_PETITCOILS + PETIT_HEAT_BLOCK - 1U) / PETIT_HEAT_BLOCK)
+#define PETIT_HEAT_DISCRETE_BLOCKS \
+	((NUMBER_OF_PETITDISCRETES + PETIT_HEAT_BLOCK - 1U) / PETIT_HEAT_BLOCK)
+
+// functions defined by petit modbus heat
+void PETIT_HEAT_Count(pu8_t Table, pu16_t Start, pu16_t Cnt);
+pu16_t PETIT_HEAT_Snapshot(pu8_t Table, T_PETIT_HEAT_CNT *Counts,
+		pu16_t Max);
+pu16_t PETIT_HEAT_Snapshot_Clear(pu8_t Table, T_PETIT_HEAT_CNT *Counts,
+		pu16_t Max);
+void PETIT_HEAT_Reset(void);
+
+#define PETIT_HEAT_COUNT(Table, Start, Cnt) PETIT_HEAT_Count(Table, Start, Cnt)
+#else
+#define PETIT_HEAT_COUNT(Table, Start, Cnt)
+#endif /* PETIT_HEAT */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
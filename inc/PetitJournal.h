@@ -0,0 +1,59 @@
+/******************************************************************************
+ * @file PetitJournal.h
+ *
+ * This header file is for the persistence journal of petitmodbus.
+ *
+ * Instead of saving all of PetitRegisters whenever PetitRegChange goes high,
+ * the journal appends a small record for every register written to a log in
+ * flash, and rebuilds the registers at boot from the last checkpoint and the
+ * records after it.  The log lives in two sectors used in turn: once one is
+ * full, the other is erased and gets a checkpoint of all registers, a step at
+ * a time from the main loop, and takes over once its checkpoint is complete.
+ *
+ * Sector layout, offsets from the start of the sector:
+ *   0   header, written last: magic, sequence, registers, check
+ *   8   checkpoint of NUMBER_OF_PETITREGISTERS registers, big-endian
+ *   ... records of address, value and check, 6 bytes each, big-endian
+ *
+ * Functions 6 and 16 mark the registers they write.  The application marks
+ * what it writes itself with PETIT_JOURNAL_Mark.
+ *****************************************************************************/
+
+#ifndef __PETIT_JOURNAL__H
+#define __PETIT_JOURNAL__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+
+// bytes in each of the two sectors, erased as a whole by PetitPortFlashErase
+#ifndef PETIT_JOURNAL_SECTOR
+#define PETIT_JOURNAL_SECTOR (4096UL)
+#endif
+// records PETIT_JOURNAL_Poll appends at most per call
+#ifndef PETIT_JOURNAL_BURST
+#define PETIT_JOURNAL_BURST (8U)
+#endif
+
+#define PETIT_JOURNAL_HDR  (8U)
+#define PETIT_JOURNAL_REC  (6U)
+#define PETIT_JOURNAL_MAGIC (0x504AU)
+// the check of a record is its address and value xor this, which neither an
+// erased nor a zeroed record has
+#define PETIT_JOURNAL_KEY  (0xA5A5U)
+
+// functions defined by petit modbus journal
+pb_t PETIT_JOURNAL_Init(void);
+pb_t PETIT_JOURNAL_Poll(void);
+void PETIT_JOURNAL_Mark(pu16_t Addr, pu16_t Cnt);
+
+#endif /* PETIT_JOURNAL */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
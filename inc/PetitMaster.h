@@ -0,0 +1,119 @@
+/******************************************************************************
+ * @file PetitMaster.h
+ *
+ * This header file is for the asynchronous RTU master of petitmodbus.
+ *
+ * Each serial line gets its own T_PETIT_MASTER.  Requests are queued without
+ * blocking and complete through a callback, so one main loop can keep several
+ * lines busy at once.  The framing, CRC and TX buffer handling are shared with
+ * the slave through the T_PETIT_MODBUS held in Link.
+ *****************************************************************************/
+
+#ifndef __PETIT_MASTER__H
+#define __PETIT_MASTER__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(PETITMODBUS_MASTER_ENABLED) && PETITMODBUS_MASTER_ENABLED > 0
+
+// requests that can wait on one serial line
+#ifndef PETITMASTER_QUEUE_SIZE
+#define PETITMASTER_QUEUE_SIZE (4U)
+#endif
+// ticks of PETIT_MASTER_Tick to leave the bus idle between transactions
+#ifndef PETITMASTER_TURNAROUND
+#define PETITMASTER_TURNAROUND (1U)
+#endif
+
+// the most registers a read fits in the buffer, capped by the modbus PDU
+// +1 slave address; +1 function; +1 number of bytes to follow; +2 CRC16
+#define C_PETITMASTER_MAX_REGS \
+	((C_PETITMODBUS_RXTX_BUFFER_SIZE - 5U) / 2U > 125U ? 125U : \
+			(C_PETITMODBUS_RXTX_BUFFER_SIZE - 5U) / 2U)
+
+// completion status beyond the modbus exception codes
+#define PETITMASTER_OK          (0x00U)
+#define PETITMASTER_TIMEOUT     (0xF0U)
+#define PETITMASTER_BAD_CRC     (0xF1U)
+#define PETITMASTER_BAD_FRAME   (0xF2U)
+
+struct PETIT_MASTER_REQ_S;
+
+/**
+ * One range of registers or coils to be polled, with its destination.
+ * PETIT_MASTER_Plan merges these into as few requests as possible.
+ */
+typedef struct
+{
+	pu8_t Slave;
+	pu8_t Function;
+	pu16_t Address;
+	pu16_t Count;
+	// response timeout of this slave in ticks
+	pu16_t Timeout;
+	pu16_t *Data;
+} T_PETIT_MASTER_POLL;
+
+/**
+ * One request to a slave.
+ *
+ * Data is the source of written values and the destination of read ones.
+ * Coils are packed sixteen to a word, lowest address in the lowest bit.
+ * Requests built by PETIT_MASTER_Plan scatter into their Poll entries instead.
+ * The request is owned by the caller and must stay valid while Pending.
+ */
+typedef struct PETIT_MASTER_REQ_S
+{
+	pu8_t Slave;
+	pu8_t Function;
+	pu16_t Address;
+	pu16_t Count;
+	// response timeout in ticks
+	pu16_t Timeout;
+	pu16_t *Data;
+	T_PETIT_MASTER_POLL *Poll;
+	pu8_t Poll_Cnt;
+	// PETITMASTER_OK, an exception code or one of the PETITMASTER errors
+	pu8_t Status;
+	volatile pb_t Pending;
+	void (*Done)(struct PETIT_MASTER_REQ_S *Req);
+} T_PETIT_MASTER_REQ;
+
+typedef struct
+{
+	// buffer, CRC and TX state shared with the slave code.  with PETIT_BUFFER
+	// PETIT_EXTERNAL give it a buffer with PETIT_MODBUS_Set_Buffer, not a pool
+	T_PETIT_MODBUS Link;
+	T_PETIT_MASTER_REQ *Queue[PETITMASTER_QUEUE_SIZE];
+	pu8_t Head;
+	pu8_t Cnt;
+	// request on the bus, 0 if idle
+	T_PETIT_MASTER_REQ *Active;
+	volatile pu16_t Timer;
+} T_PETIT_MASTER;
+
+// Initialization Function
+void PETIT_MASTER_Init(T_PETIT_MASTER *Master);
+
+// Main Functions
+void PETIT_MASTER_Process(T_PETIT_MASTER *Master);
+void PETIT_MASTER_Tick(T_PETIT_MASTER *Master);
+
+// functions defined by petit modbus master
+pb_t PETIT_MASTER_Request(T_PETIT_MASTER *Master, T_PETIT_MASTER_REQ *Req);
+pu8_t PETIT_MASTER_Plan(T_PETIT_MASTER_POLL *Polls, pu8_t Poll_Cnt,
+		T_PETIT_MASTER_REQ *Reqs, pu8_t Req_Max);
+pu8_t PETIT_MASTER_Cycle(T_PETIT_MASTER *Master, T_PETIT_MASTER_REQ *Reqs,
+		pu8_t Cnt);
+pb_t PetitMasterRxBufferInsert(T_PETIT_MASTER *Master, pu8_t rcvd);
+
+#endif /* PETITMODBUS_MASTER_ENABLED */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -11,17 +11,147 @@
 // Petit Modbus Port Header
 #include "PetitModbusPort.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /****************************Don't Touch This**********************************/
 // Buffers for Petit Modbus RTU Slave
 // sized to hold a write to all registers
 // +2 address; +2 number of registers; +1 number of bytes to follow; +2 CRC16
-// +1 slave address; +1 function
-#define C_PETITMODBUS_RXTX_BUFFER_SIZE  (2*(NUMBER_OF_REGISTERS_IN_BUFFER) + 9)
+// +1 slave address; +1 function; +1 for the 16-bit byte count of jumbo frames
+#define C_PETITMODBUS_RXTX_BUFFER_SIZE  \
+	(2*(NUMBER_OF_REGISTERS_IN_BUFFER) + 9 + C_PETIT_JUMBO_CNT)
+
+// character time and t3.5 in microseconds, 11 bits per character.
+// above 19200 baud the specification fixes t3.5 at 1750 us.
+#define PETIT_CHAR_US(Baud)  ((11000000UL + (Baud) - 1U) / (Baud))
+#define PETIT_T35_US(Baud)   ((Baud) > 19200UL ? 1750UL : \
+		(38500000UL + (Baud) - 1U) / (Baud))
+
+// where the frame buffer of an instance lives
+// PETIT_INTERNAL embeds C_PETITMODBUS_RXTX_BUFFER_SIZE bytes in every instance
+// PETIT_EXTERNAL takes it from PETIT_MODBUS_Set_Buffer, or borrows one from a
+//     T_PETIT_POOL for every frame addressed to the instance
+#ifndef PETIT_BUFFER
+#define PETIT_BUFFER PETIT_INTERNAL
+#endif
 
-#if C_PETIT_CRC == PETIT_CRC_TABULAR
+#if PETIT_BUFFER == PETIT_EXTERNAL
+#define PETIT_BUF_SIZE_M(Petit) ((Petit)->Buffer_Size)
+#else
+#define PETIT_BUF_SIZE_M(Petit) (C_PETITMODBUS_RXTX_BUFFER_SIZE)
+#endif
+// registers a request or response may carry in the buffer
+#define PETIT_BUF_REGS_M(Petit) ((PETIT_BUF_SIZE_M(Petit) - 9U) / 2U)
+
+// set to 1 to stream the data of read register responses from the registers
+// as PetitTxBufferPop sends them, so the buffer only holds the header and a
+// read may take up to 125 registers whatever its size
+#ifndef PETIT_STREAM
+#define PETIT_STREAM (0)
+#endif
+
+// set to 1 to stage the data of functions 15 and 16 in a shadow bank as it
+// arrives, committed to the coils or registers once the CRC checks out, so
+// the buffer only holds the header and a write may take up to 123 registers
+// whatever its size
+#ifndef PETIT_SHADOW
+#define PETIT_SHADOW (0)
+#endif
+
+// set to 1 to let an instance monitor the bus into a T_PETIT_SNIFF capture
+// ring instead of answering, see PetitSniff.h
+#ifndef PETIT_SNIFF
+#define PETIT_SNIFF (0)
+#endif
+
+// set to 1 to let a master switch an instance to jumbo frames with the vendor
+// function code C_FCODE_JUMBO.  Functions 3, 4 and 16 then carry 16-bit byte
+// counts and as many registers as the buffer holds, for point-to-point links
+// where the 125-register limit costs more than the bytes themselves.
+#ifndef PETIT_JUMBO
+#define PETIT_JUMBO (0)
+#endif
+#if PETIT_JUMBO > 0
+#define C_PETIT_JUMBO_CNT (1)
+#else
+#define C_PETIT_JUMBO_CNT (0)
+#endif
+
+// set to 1 to let the RX interrupt of an instance only push its bytes into a
+// T_PETIT_RXRING, framed and processed by PETIT_MODBUS_Process, see
+// PetitRxRing.h
+#ifndef PETIT_RXRING
+#define PETIT_RXRING (0)
+#endif
+
+// a buffer pool, the shadow bank and typed points are shared between
+// interrupts and the main loop.  define these to disable and restore
+// interrupts around them.
+#ifndef PETIT_ENTER_CRITICAL
+#define PETIT_ENTER_CRITICAL()
+#define PETIT_EXIT_CRITICAL()
+#endif
+
+// how PetitRegsToWire and PetitRegsFromWire convert a block of registers
+// PETIT_SWAP_COPY when the registers are already big-endian
+// PETIT_SWAP_SCALAR one register at a time
+// PETIT_SWAP_SSE2, PETIT_SWAP_NEON 8 registers at a time on little-endian
+//     hosts with those instruction sets
+#define PETIT_SWAP_COPY    (1)
+#define PETIT_SWAP_SCALAR  (2)
+#define PETIT_SWAP_SSE2    (3)
+#define PETIT_SWAP_NEON    (4)
+#if PETIT_REG_ORDER == PETIT_REG_WIRE
+#undef PETIT_SWAP
+#define PETIT_SWAP PETIT_SWAP_COPY
+#elif !defined(PETIT_SWAP)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PETIT_SWAP PETIT_SWAP_COPY
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+	&& defined(__SSE2__)
+#define PETIT_SWAP PETIT_SWAP_SSE2
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+	&& defined(__ARM_NEON)
+#define PETIT_SWAP PETIT_SWAP_NEON
+#else
+#define PETIT_SWAP PETIT_SWAP_SCALAR
+#endif
+#endif
+
+#if PETIT_CRC == PETIT_CRC_TABULAR
 extern PETIT_CODE const pu16_t PetitCRCtable[] PETIT_FLASH_ATTR;
 #endif
 
+/*******************************ModBus Functions*******************************/
+#define C_FCODE_READ_COILS                  (1U)
+#define C_FCODE_READ_DISCRETES              (2U)
+#define C_FCODE_READ_HOLDING_REGISTERS      (3U)
+#define C_FCODE_READ_INPUT_REGISTERS        (4U)
+#define C_FCODE_WRITE_SINGLE_COIL           (5U)
+#define C_FCODE_WRITE_SINGLE_REGISTER       (6U)
+#define C_FCODE_WRITE_MULTIPLE_COILS        (15U)
+#define C_FCODE_WRITE_MULTIPLE_REGISTERS    (16U)
+// vendor function code switching an instance to jumbo frames, see PETIT_JUMBO
+#ifndef C_FCODE_JUMBO
+#define C_FCODE_JUMBO                       (65U)
+#endif
+// vendor function code reading the registers written since a token, see
+// PetitDelta.h
+#ifndef C_FCODE_DELTA
+#define C_FCODE_DELTA                       (66U)
+#endif
+/****************************End of ModBus Functions***************************/
+
+/*******************************ModBus Exceptions******************************/
+#define PETIT_ERROR_CODE_01                     (0x01U)                            // Function code is not supported
+#define PETIT_ERROR_CODE_02                     (0x02U)                            // Register address is not allowed or write-protected
+#define PETIT_ERROR_CODE_03						(0X03U)                            // Third field incorrect
+#define PETIT_ERROR_CODE_04						(0x04U)                            // Fourth or subsequent field incorrect
+#define PETIT_ERROR_CODE_06                     (0x06U)                            // Device busy, retry later
+#define PETIT_ERROR_CODE_0B                     (0x0BU)                            // Gateway target device failed to respond
+
 typedef enum
 {
     E_PETIT_RXTX_RX = 0,
@@ -32,6 +162,54 @@ typedef enum
     E_PETIT_RXTX_TIMEOUT
 }  T_PETIT_XMIT_STATE;
 
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+// every instance keeps 4 * PETIT_TRACE_SIZE bytes of records and
+// 2 * 3 * PETIT_TRACE_CODES * PETIT_TRACE_BINS bytes of histograms, 944
+// bytes with the defaults.  small targets can keep fewer codes and bins.
+
+// trace records kept per instance, a power of two
+#ifndef PETIT_TRACE_SIZE
+#define PETIT_TRACE_SIZE (32U)
+#endif
+// function codes below this get their own histograms, the rest share code 0
+#ifndef PETIT_TRACE_CODES
+#define PETIT_TRACE_CODES (17U)
+#endif
+// histogram bins, each twice as wide as the one before
+#ifndef PETIT_TRACE_BINS
+#define PETIT_TRACE_BINS (8U)
+#endif
+// the first bin holds latencies below 2^PETIT_TRACE_BIN_SHIFT clock ticks
+#ifndef PETIT_TRACE_BIN_SHIFT
+#define PETIT_TRACE_BIN_SHIFT (4U)
+#endif
+
+// trace event of the last request byte, beside the T_PETIT_XMIT_STATEs
+#define PETIT_TRACE_RX_DONE (0x10U)
+
+typedef enum
+{
+	// last request byte until processing can start
+	E_PETIT_TRACE_RX_PROCESS = 0,
+	// processing start until the first response byte
+	E_PETIT_TRACE_PROCESS_TX,
+	// first until last response byte
+	E_PETIT_TRACE_TX,
+	E_PETIT_TRACE_INTERVALS
+} T_PETIT_TRACE_INTERVAL;
+
+/**
+ * One trace record: the state entered, or PETIT_TRACE_RX_DONE, stamped with
+ * PetitPortClock and the function code of the request.
+ */
+typedef struct
+{
+	pu16_t Time;
+	pu8_t Event;
+	pu8_t Code;
+} T_PETIT_TRACE_REC;
+#endif
+
 typedef enum
 {
 	E_PETIT_FALSE_FUNCTION = 0,
@@ -40,30 +218,201 @@ typedef enum
 	E_PETIT_DATA_READY
 } T_PETIT_BUFFER_STATUS;
 
+struct PETIT_MODBUS_S;
+struct PETIT_SNIFF_S;
+struct PETIT_RXRING_S;
+
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+/**
+ * One complete request ADU for PETIT_MODBUS_ProcessBatch, and where its
+ * response went.
+ */
+typedef struct
+{
+	// the request, CRC included
+	const pu8_t *Req;
+	pu16_t Req_Len;
+	// the response in the arena, CRC included; 0 if there is none
+	pu8_t *Rsp;
+	pu16_t Rsp_Len;
+} T_PETIT_ADU;
+#endif
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+// end of the free list of a T_PETIT_POOL
+#define PETIT_POOL_END (0xFFU)
+
+/**
+ * Buffers shared by many instances.  An instance borrows one on the first
+ * byte of a frame addressed to it and gives it back once the response is out
+ * or the frame is dropped, so RAM grows with the transactions in flight and
+ * not with the number of ports.
+ */
 typedef struct
+{
+	// Cnt buffers of Size bytes back to back
+	pu8_t *Data;
+	pu16_t Size;
+	pu8_t Cnt;
+	// first free buffer, each free buffer holds the index of the next
+	pu8_t Free;
+	pu8_t In_Use;
+	pu8_t Peak;
+	// frames dropped because every buffer was in use
+	pu16_t Misses;
+} T_PETIT_POOL;
+#endif
+
+/**
+ * One entry of the function code table.
+ *
+ * Length predicts the size of the request ADU (CRC included) from the bytes
+ * received so far.  It is called from the RX interrupt once the function code
+ * has arrived and returns 0 while it still needs more bytes to decide.
+ *
+ * Handler is called with the validated request in Buffer.  It writes the
+ * response PDU back into Buffer, leaves the response length in BufJ and
+ * returns 0, or returns one of the PETIT_ERROR_CODE_xx exceptions.  A null
+ * Handler answers with PETIT_ERROR_CODE_01.
+ */
+typedef struct
+{
+	pu8_t Code;
+	pu16_t (*Length)(const struct PETIT_MODBUS_S *Petit);
+	pu8_t (*Handler)(struct PETIT_MODBUS_S *Petit);
+} T_PETIT_FUNCTION;
+
+typedef struct PETIT_MODBUS_S
 {
 	T_PETIT_XMIT_STATE Xmit_State;
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	// 0 while an instance on a pool holds no buffer
+	pu8_t *Buffer;
+	pu16_t Buffer_Size;
+	T_PETIT_POOL *Pool;
+#else
 	pu8_t Buffer[C_PETITMODBUS_RXTX_BUFFER_SIZE];
+#endif
 	pu16_t CRC16;
 	pu16_t BufI;
 	pu16_t BufJ;
 	pu8_t *Ptr;
 	pu16_t Tx_Ctr;
+#if defined(PETITMODBUS_TURNAROUND) || defined(PETITMODBUS_TURNAROUND_TIMER)
+	// PetitPortClock when the request was complete
+	pu16_t Rx_Stamp;
+	// set once the turnaround is over
+	volatile pb_t Tx_Due;
+#endif
 	pu16_t Expected_RX_Cnt;
 	void (*Timer_Start)(void);
 	void (*Timer_Stop)(void);
 	void (*Tx_Begin)(pu8_t);
+	// function table entry of the frame being received or processed, kept
+	// while the same function code comes again
+	const T_PETIT_FUNCTION *Function;
+	// function table registered at init, searched before the built-in one
+	const T_PETIT_FUNCTION *User_Functions;
+	pu8_t User_Function_Cnt;
+#if PETIT_STREAM > 0
+	// register reads behind the data of a streamed response
+	pb_t (*Stream_Read)(pu16_t Addr, pu16_t *Data);
+	pu16_t Stream_Addr;
+	// data bytes still to be sent, 0 if the response is all in Buffer
+	pu16_t Stream_Cnt;
+	pu16_t Stream_Word;
+#endif
+#if PETIT_SHADOW > 0
+	// write data bytes still to be staged in the shadow bank
+	pu16_t Stage_Cnt;
+#endif
+#if PETIT_SNIFF > 0
+	// capture ring of a monitor, 0 for a slave
+	struct PETIT_SNIFF_S *Sniff;
+#endif
+#if PETIT_JUMBO > 0
+	// registers a jumbo frame may carry, 0 for standard frames
+	pu16_t Jumbo_Regs;
+#endif
+#if PETIT_RXRING > 0
+	// receive ring filled by the RX interrupt, 0 to take bytes from it directly
+	struct PETIT_RXRING_S *Rx_Ring;
+#endif
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+	T_PETIT_TRACE_REC Trace[PETIT_TRACE_SIZE];
+	// free running write and read positions of Trace
+	pu16_t Trace_Head;
+	pu16_t Trace_Tail;
+	// start of every T_PETIT_TRACE_INTERVAL of the current request
+	pu16_t Trace_Stamp[E_PETIT_TRACE_INTERVALS];
+	pu8_t Trace_Code;
+	pu8_t Trace_Last;
+	pu16_t Trace_Hist[PETIT_TRACE_CODES][E_PETIT_TRACE_INTERVALS]
+			[PETIT_TRACE_BINS];
+#endif
 } T_PETIT_MODBUS;
 
 // Initialization Function
 void PETIT_MODBUS_Init(T_PETIT_MODBUS *Petit);
+void PETIT_MODBUS_Register_Functions(T_PETIT_MODBUS *Petit,
+		const T_PETIT_FUNCTION *Functions, pu8_t Cnt);
+#if PETIT_BUFFER == PETIT_EXTERNAL
+void PETIT_MODBUS_Set_Buffer(T_PETIT_MODBUS *Petit, pu8_t *Buffer,
+		pu16_t Size);
+void PETIT_MODBUS_Set_Pool(T_PETIT_MODBUS *Petit, T_PETIT_POOL *Pool);
+void PETIT_POOL_Init(T_PETIT_POOL *Pool, pu8_t *Data, pu16_t Size,
+		pu8_t Cnt);
+#endif
+#if PETIT_SNIFF > 0
+void PETIT_MODBUS_Set_Monitor(T_PETIT_MODBUS *Petit,
+		struct PETIT_SNIFF_S *Sniff);
+#endif
+#if PETIT_RXRING > 0
+void PETIT_MODBUS_Set_RxRing(T_PETIT_MODBUS *Petit,
+		struct PETIT_RXRING_S *Ring);
+#endif
+
+// returned by PETIT_MODBUS_Process when only an RX or TX interrupt, or the
+// turnaround timer, can make progress
+#define PETIT_PROCESS_IDLE (0xFFFFU)
 
 // Main Functions
-void PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit);
+pu16_t PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit);
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+pu16_t PETIT_MODBUS_ProcessBatch(T_PETIT_MODBUS *Petit, T_PETIT_ADU *Adus,
+		pu16_t Cnt, pu8_t *Arena, pu16_t Arena_Size);
+#endif
 
 // functions defined by petit modbus
 void PetitRxBufferReset(T_PETIT_MODBUS *Petit);
 pb_t PetitRxBufferInsert(T_PETIT_MODBUS *Petit, pu8_t rcvd);
+#if PETIT_RXRING > 0
+pu16_t PetitRxBufferInsertRun(T_PETIT_MODBUS *Petit, const pu8_t *Data,
+		pu16_t Len);
+#endif
 pb_t PetitTxBufferPop(T_PETIT_MODBUS *Petit, pu8_t* tx);
+pu16_t PetitCRC16(T_PETIT_MODBUS *Petit, const pu8_t *Data, pu16_t Len);
+void PetitCRC16Add(T_PETIT_MODBUS *Petit, pu8_t Data);
+void PetitRegsToWire(pu8_t *Wire, const pu16_t *Regs, pu16_t Cnt);
+void PetitRegsFromWire(pu16_t *Regs, const pu8_t *Wire, pu16_t Cnt);
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+void PetitTxTurnaround(T_PETIT_MODBUS *Petit);
+#endif
 
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+// trace and latency histograms
+pu16_t PETIT_MODBUS_Trace_Read(T_PETIT_MODBUS *Petit, T_PETIT_TRACE_REC *Recs,
+		pu16_t Max);
+const pu16_t *PETIT_MODBUS_Trace_Histogram(const T_PETIT_MODBUS *Petit,
+		pu8_t Code, T_PETIT_TRACE_INTERVAL Interval);
+void PETIT_MODBUS_Trace_Reset(T_PETIT_MODBUS *Petit);
+#endif
+
+// request length predictors for function table entries
+pu16_t PetitFnLenFixed(const T_PETIT_MODBUS *Petit);
+pu16_t PetitFnLenByteCnt(const T_PETIT_MODBUS *Petit);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
@@ -0,0 +1,1035 @@
+/******************************************************************************
+ * @file PetitModbus.hpp
+ *
+ * This header file is a C++ front end for petitmodbus.
+ *
+ * petit::Slave<Config> is an RTU slave whose configuration is a type.  Config
+ * names the port, whose static timer_start, timer_stop and tx_begin are
+ * called directly, so the compiler inlines them instead of going through the
+ * function pointers of a T_PETIT_MODBUS.  It lists the function codes the
+ * slave answers, and only their handlers are instantiated, so a slave that
+ * answers functions 3 and 16 carries no code for coils.  It chooses the CRC,
+ * petit::CrcTable with a table generated at compile time or petit::CrcBitwise
+ * without one, the size of the frame buffer and how much of every internal
+ * table is served.  The answers are the bytes the C core gives.
+ *
+ * petit::Slave serves the internal tables only, with their default base
+ * addresses, and leaves out the read-only registers in code memory, streamed
+ * responses, staged writes, jumbo frames, the turnaround, the heatmap and
+ * the trace.  Writes are not marked for PetitJournal and PetitDelta, so
+ * functions 6 and 16 do not build with either.  petit::CoreSlave<Port> wraps
+ * an instance of the C core for all of that.
+ *
+ * The register map is described with petit::Holding, petit::Input,
+ * petit::Coil and petit::Discrete, whose addresses are checked against the
+ * C configuration by static_assert.
+ *
+ * @code
+ * struct Uart1
+ * {
+ *     static void timer_start() { ... }
+ *     static void timer_stop() { ... }
+ *     static void tx_begin(pu8_t Tx) { ... }
+ * };
+ * struct Uart1Config : petit::Config<Uart1, C_FCODE_READ_HOLDING_REGISTERS,
+ *         C_FCODE_WRITE_MULTIPLE_REGISTERS>
+ * {
+ *     static constexpr pu16_t buffer_regs = 16U;
+ * };
+ * typedef petit::Holding<0, 2> Setpoint;
+ * petit::Slave<Uart1Config> slave;
+ *
+ * void uart1_rx_isr(pu8_t Rx) { slave.receive(Rx); }
+ * void main_loop() { slave.process(); Setpoint::get<1>(); }
+ * @endcode
+ *****************************************************************************/
+
+#ifndef __PETITMODBUS__HPP
+#define __PETITMODBUS__HPP
+
+#include "PetitModbus.h"
+#include "PetitShm.h"
+
+namespace petit
+{
+
+namespace detail
+{
+// an undefined PETITMODBUS_..._ENABLED counts as 0, as in the C core
+#if PETITMODBUS_READ_COILS_ENABLED != 0
+constexpr bool fc01 = true;
+#else
+constexpr bool fc01 = false;
+#endif
+#if PETITMODBUS_READ_DISCRETES_ENABLED != 0
+constexpr bool fc02 = true;
+#else
+constexpr bool fc02 = false;
+#endif
+#if PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED != 0
+constexpr bool fc03 = true;
+#else
+constexpr bool fc03 = false;
+#endif
+#if PETITMODBUS_READ_INPUT_REGISTERS_ENABLED != 0
+constexpr bool fc04 = true;
+#else
+constexpr bool fc04 = false;
+#endif
+#if PETITMODBUS_WRITE_SINGLE_COIL_ENABLED != 0
+constexpr bool fc05 = true;
+#else
+constexpr bool fc05 = false;
+#endif
+#if PETITMODBUS_WRITE_SINGLE_REGISTER_ENABLED != 0
+constexpr bool fc06 = true;
+#else
+constexpr bool fc06 = false;
+#endif
+#if PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED != 0
+constexpr bool fc15 = true;
+#else
+constexpr bool fc15 = false;
+#endif
+#if PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED != 0
+constexpr bool fc16 = true;
+#else
+constexpr bool fc16 = false;
+#endif
+constexpr bool jumbo = PETIT_JUMBO > 0;
+#if defined(PETIT_DELTA) && PETIT_DELTA > 0
+constexpr bool delta = true;
+#else
+constexpr bool delta = false;
+#endif
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+constexpr bool journal = true;
+#else
+constexpr bool journal = false;
+#endif
+} // namespace detail
+
+/**
+ * @return true if the C build handles the function code
+ */
+constexpr bool enabled(pu8_t Code)
+{
+	return Code == C_FCODE_READ_COILS ? detail::fc01 :
+		Code == C_FCODE_READ_DISCRETES ? detail::fc02 :
+		Code == C_FCODE_READ_HOLDING_REGISTERS ? detail::fc03 :
+		Code == C_FCODE_READ_INPUT_REGISTERS ? detail::fc04 :
+		Code == C_FCODE_WRITE_SINGLE_COIL ? detail::fc05 :
+		Code == C_FCODE_WRITE_SINGLE_REGISTER ? detail::fc06 :
+		Code == C_FCODE_WRITE_MULTIPLE_COILS ? detail::fc15 :
+		Code == C_FCODE_WRITE_MULTIPLE_REGISTERS ? detail::fc16 :
+		Code == C_FCODE_JUMBO ? detail::jumbo :
+		Code == C_FCODE_DELTA ? detail::delta :
+		false;
+}
+
+/**
+ * Checks at compile time that every function code in Codes is built in.
+ * Function codes added with PETIT_USER_FUNCTIONS or at run time are not
+ * known here.
+ */
+template <pu8_t... Codes>
+struct Functions;
+
+template <>
+struct Functions<>
+{
+};
+
+template <pu8_t Code, pu8_t... Codes>
+struct Functions<Code, Codes...> : Functions<Codes...>
+{
+	static_assert(enabled(Code),
+			"function code disabled in PetitModbusUserPort.h");
+};
+
+/**
+ * The function codes a petit::Slave answers, in the order it looks them up.
+ */
+template <pu8_t... Fns>
+struct Codes
+{
+};
+
+/******************************************************************************/
+
+namespace detail
+{
+/**
+ * @return Crc after Bits more bits of the modbus CRC16
+ */
+constexpr pu16_t crc_shift(pu16_t Crc, pu8_t Bits)
+{
+	return Bits == 0 ? Crc : crc_shift((Crc & 1U) != 0
+			? (pu16_t) ((Crc >> 1) ^ 0xA001U) : (pu16_t) (Crc >> 1),
+			(pu8_t) (Bits - 1U));
+}
+
+template <unsigned... I>
+struct Seq
+{
+};
+
+template <unsigned N, unsigned... I>
+struct MakeSeq : MakeSeq<N - 1U, N - 1U, I...>
+{
+};
+
+template <unsigned... I>
+struct MakeSeq<0, I...>
+{
+	typedef Seq<I...> type;
+};
+
+template <class S>
+struct CrcTableData;
+
+// the same 256 entries as PetitCRCtable, worked out by the compiler
+template <unsigned... I>
+struct CrcTableData<Seq<I...> >
+{
+	static constexpr pu16_t value[sizeof...(I)] =
+			{ crc_shift((pu16_t) I, 8U)... };
+};
+
+template <unsigned... I>
+constexpr pu16_t CrcTableData<Seq<I...> >::value[sizeof...(I)];
+} // namespace detail
+
+/**
+ * @return the modbus CRC16 of Len bytes, for frames known at compile time
+ */
+constexpr pu16_t crc16(const pu8_t *Data, pu16_t Len, pu16_t Crc = 0xFFFFU)
+{
+	return Len == 0 ? Crc : crc16(Data + 1, (pu16_t) (Len - 1U),
+			detail::crc_shift((pu16_t) (Crc ^ *Data), 8U));
+}
+
+/**
+ * The CRC with a table of 512 bytes in code memory, as PETIT_CRC_TABULAR.
+ */
+struct CrcTable
+{
+	typedef detail::CrcTableData<detail::MakeSeq<256U>::type> Table;
+
+	static pu16_t calc(const pu8_t *Data, pu16_t Len)
+	{
+		pu16_t crc = 0xFFFFU;
+
+		while (Len--)
+		{
+			crc = (pu16_t) ((crc >> 8) ^ Table::value[(crc ^ *Data++) & 0xFFU]);
+		}
+		return crc;
+	}
+};
+
+/**
+ * The CRC a bit at a time, as PETIT_CRC_BITWISE.
+ */
+struct CrcBitwise
+{
+	static pu16_t calc(const pu8_t *Data, pu16_t Len)
+	{
+		pu16_t crc = 0xFFFFU;
+
+		while (Len--)
+		{
+			crc = detail::crc_shift((pu16_t) (crc ^ *Data++), 8U);
+		}
+		return crc;
+	}
+};
+
+namespace detail
+{
+constexpr pu8_t crc_check[] = { 1U, 3U, 0, 0, 0, 10U };
+static_assert(crc16(crc_check, sizeof(crc_check)) == 0xCDC5U,
+		"modbus CRC16 of 01 03 00 00 00 0A");
+static_assert(CrcTableData<MakeSeq<256U>::type>::value[1] == 0xC0C1U,
+		"first entry of PetitCRCtable");
+} // namespace detail
+
+/******************************************************************************/
+
+#if PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH
+/**
+ * Count holding registers from Address on, in PetitRegisters.
+ *
+ * get<I>() and set<I>() check I at compile time.  get(I) and set(Value, I)
+ * take I at run time: get returns 0 and set does nothing for an I beyond the
+ * range.
+ */
+template <pu16_t Address, pu16_t Count = 1>
+struct Holding
+{
+	static_assert(Count != 0, "empty register range");
+	static_assert((unsigned long) Address + Count <= NUMBER_OF_PETITREGISTERS,
+			"holding register beyond NUMBER_OF_PETITREGISTERS");
+	static constexpr pu16_t address = Address;
+	static constexpr pu16_t count = Count;
+
+	static pu16_t get(pu16_t I = 0)
+	{
+		if (I >= Count)
+			return 0;
+		return PETIT_REG_LOAD(PetitRegisters[Address + I]);
+	}
+	static void set(pu16_t Value, pu16_t I = 0)
+	{
+		if (I >= Count)
+			return;
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		PETIT_REG_STORE(PetitRegisters[Address + I], Value);
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+	}
+	template <pu16_t I>
+	static pu16_t get()
+	{
+		static_assert(I < Count, "register beyond the range");
+		return get(I);
+	}
+	template <pu16_t I>
+	static void set(pu16_t Value)
+	{
+		static_assert(I < Count, "register beyond the range");
+		set(Value, I);
+	}
+};
+#endif
+
+#if PETIT_INPUT_REG == PETIT_INTERNAL || PETIT_INPUT_REG == PETIT_BOTH
+/**
+ * Count input registers from Address on, in PetitInputRegisters.
+ *
+ * I is checked as in petit::Holding.
+ */
+template <pu16_t Address, pu16_t Count = 1>
+struct Input
+{
+	static_assert(Count != 0, "empty register range");
+	static_assert((unsigned long) Address + Count
+			<= NUMBER_OF_INPUT_PETITREGISTERS,
+			"input register beyond NUMBER_OF_INPUT_PETITREGISTERS");
+	static constexpr pu16_t address = Address;
+	static constexpr pu16_t count = Count;
+
+	static pu16_t get(pu16_t I = 0)
+	{
+		if (I >= Count)
+			return 0;
+		return PETIT_REG_LOAD(PetitInputRegisters[Address + I]);
+	}
+	static void set(pu16_t Value, pu16_t I = 0)
+	{
+		if (I >= Count)
+			return;
+		PETIT_SHM_BEGIN(PETIT_SHM_INPUT_REGISTERS);
+		PETIT_REG_STORE(PetitInputRegisters[Address + I], Value);
+		PETIT_SHM_END(PETIT_SHM_INPUT_REGISTERS);
+	}
+	template <pu16_t I>
+	static pu16_t get()
+	{
+		static_assert(I < Count, "register beyond the range");
+		return get(I);
+	}
+	template <pu16_t I>
+	static void set(pu16_t Value)
+	{
+		static_assert(I < Count, "register beyond the range");
+		set(Value, I);
+	}
+};
+#endif
+
+#if PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH
+/**
+ * One coil in PetitCoils.
+ */
+template <pu16_t Address>
+struct Coil
+{
+	static_assert(Address < NUMBER_OF_PETITCOILS,
+			"coil beyond NUMBER_OF_PETITCOILS");
+	static constexpr pu16_t address = Address;
+
+	static bool get()
+	{
+		return (PetitCoils[Address >> 3] >> (Address & 7U)) & 1U;
+	}
+	static void set(bool Value)
+	{
+		PETIT_SHM_BEGIN(PETIT_SHM_COILS);
+		if (Value)
+			PetitCoils[Address >> 3] |= (pu8_t) (1U << (Address & 7U));
+		else
+			PetitCoils[Address >> 3] &= (pu8_t) ~(1U << (Address & 7U));
+		PETIT_SHM_END(PETIT_SHM_COILS);
+	}
+};
+#endif
+
+#if PETIT_DISCRETE == PETIT_INTERNAL || PETIT_DISCRETE == PETIT_BOTH
+/**
+ * One discrete input in PetitDiscretes.
+ */
+template <pu16_t Address>
+struct Discrete
+{
+	static_assert(Address < NUMBER_OF_PETITDISCRETES,
+			"discrete input beyond NUMBER_OF_PETITDISCRETES");
+	static constexpr pu16_t address = Address;
+
+	static bool get()
+	{
+		return (PetitDiscretes[Address >> 3] >> (Address & 7U)) & 1U;
+	}
+	static void set(bool Value)
+	{
+		PETIT_SHM_BEGIN(PETIT_SHM_DISCRETES);
+		if (Value)
+			PetitDiscretes[Address >> 3] |= (pu8_t) (1U << (Address & 7U));
+		else
+			PetitDiscretes[Address >> 3] &= (pu8_t) ~(1U << (Address & 7U));
+		PETIT_SHM_END(PETIT_SHM_DISCRETES);
+	}
+};
+#endif
+
+/******************************************************************************/
+
+namespace detail
+{
+/**
+ * @return field Idx of the request in Buf, the address or the count
+ */
+inline pu16_t field(const pu8_t *Buf, pu8_t Idx)
+{
+	return (pu16_t) ((pu16_t) Buf[2U * Idx + 2U] << 8 | Buf[2U * Idx + 3U]);
+}
+
+/**
+ * Functions 1 and 2: Count bits of a table of Bytes bytes, which are packed
+ * a byte at a time instead of a bit at a time.
+ */
+inline pu8_t read_bits(pu8_t *Buf, pu16_t &Len, const pu8_t *Table,
+		pu16_t Count, pu16_t Bytes, pu16_t BufRegs)
+{
+	pu16_t start = field(Buf, 0);
+	pu16_t cnt = field(Buf, 1);
+	pu16_t first = start >> 3;
+	pu8_t shift = start & 7U;
+	pu16_t n = (pu16_t) ((cnt + 7U) >> 3);
+	pu16_t i;
+
+	if ((unsigned long) start + cnt > Count || n > 2U * BufRegs
+			|| cnt > 2000U || cnt == 0)
+		return PETIT_ERROR_CODE_02;
+	for (i = 0; i < n; i++)
+	{
+		pu16_t bits = Table[first + i] >> shift;
+
+		// the bits past the table are masked off below
+		if (shift != 0 && first + i + 1U < Bytes)
+			bits |= (pu16_t) (Table[first + i + 1U] << (8U - shift));
+		Buf[3U + i] = (pu8_t) bits;
+	}
+	if ((cnt & 7U) != 0)
+		Buf[2U + n] &= (pu8_t) ((1U << (cnt & 7U)) - 1U);
+	Buf[2] = (pu8_t) n;
+	Len = (pu16_t) (3U + n);
+	return 0;
+}
+
+/**
+ * Functions 3 and 4 from the registers in Table.
+ */
+inline pu8_t read_regs(pu8_t *Buf, pu16_t &Len, const pu16_t *Table,
+		pu16_t Count, pu16_t BufRegs)
+{
+	pu16_t start = field(Buf, 0);
+	pu16_t cnt = field(Buf, 1);
+
+	if ((unsigned long) start + cnt > Count
+			|| cnt > (BufRegs < 125U ? BufRegs : 125U))
+		return PETIT_ERROR_CODE_02;
+	Buf[2] = (pu8_t) (2U * cnt);
+	// see PETIT_POINT_READ_BEGIN in PetitModbus.c
+#if defined(PETITMODBUS_POINTS_ENABLED) && PETITMODBUS_POINTS_ENABLED > 0
+	PETIT_ENTER_CRITICAL();
+#endif
+	PetitRegsToWire(&Buf[3], &Table[start], cnt);
+#if defined(PETITMODBUS_POINTS_ENABLED) && PETITMODBUS_POINTS_ENABLED > 0
+	PETIT_EXIT_CRITICAL();
+#endif
+	Len = (pu16_t) (3U + 2U * cnt);
+	return 0;
+}
+
+template <pu8_t Code>
+struct Unsupported
+{
+	static constexpr bool value = false;
+};
+
+/**
+ * Holds for a build without PetitDelta and PetitJournal, checked only once a
+ * handler that writes registers is instantiated.
+ */
+template <class Cfg>
+struct Unlogged
+{
+	static constexpr bool value = !delta && !journal;
+};
+
+/**
+ * The handler of a function code, with
+ * static pu16_t length(const pu8_t *Buf, pu16_t Len)
+ *   the length of the request, 0 until it is known
+ * template <class Cfg> static pu8_t run(pu8_t *Buf, pu16_t &Len)
+ *   answers the request in Buf of Len bytes without the CRC, and leaves the
+ *   length of the response in Len.  It returns 0 or the exception code.
+ */
+template <pu8_t Code>
+struct Handler
+{
+	static_assert(Unsupported<Code>::value,
+			"petit::Slave has no handler for this function code with this "
+			"storage");
+};
+
+/**
+ * The request length of functions 1 to 6.
+ */
+struct FixedLength
+{
+	static pu16_t length(const pu8_t *, pu16_t)
+	{
+		return 8U;
+	}
+};
+
+/**
+ * The request length of functions 15 and 16.
+ */
+struct ByteCntLength
+{
+	static pu16_t length(const pu8_t *Buf, pu16_t Len)
+	{
+		return Len > 6U ? (pu16_t) (Buf[6] + 9U) : 0;
+	}
+};
+
+#if PETIT_COIL == PETIT_INTERNAL
+template <>
+struct Handler<C_FCODE_READ_COILS> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		static_assert(Cfg::coils <= NUMBER_OF_PETITCOILS,
+				"coils beyond NUMBER_OF_PETITCOILS");
+		return read_bits(Buf, Len, PetitCoils, Cfg::coils,
+				(NUMBER_OF_PETITCOILS + 7U) >> 3, Cfg::buffer_regs);
+	}
+};
+
+template <>
+struct Handler<C_FCODE_WRITE_SINGLE_COIL> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		pu16_t address = field(Buf, 0);
+		pu16_t value = field(Buf, 1);
+
+		static_assert(Cfg::coils <= NUMBER_OF_PETITCOILS,
+				"coils beyond NUMBER_OF_PETITCOILS");
+		// the response is the request
+		Len = 6U;
+		if (address >= Cfg::coils)
+			return PETIT_ERROR_CODE_02;
+		if (value != 0 && value != 0xFF00U)
+			return PETIT_ERROR_CODE_03;
+		PETIT_SHM_BEGIN(PETIT_SHM_COILS);
+		if (value)
+			PetitCoils[address >> 3] |= (pu8_t) (1U << (address & 7U));
+		else
+			PetitCoils[address >> 3] &= (pu8_t) ~(1U << (address & 7U));
+		PETIT_SHM_END(PETIT_SHM_COILS);
+		return 0;
+	}
+};
+
+template <>
+struct Handler<C_FCODE_WRITE_MULTIPLE_COILS> : ByteCntLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		pu16_t start = field(Buf, 0);
+		pu16_t cnt = field(Buf, 1);
+		const pu8_t *data = &Buf[7];
+		pu16_t i;
+
+		static_assert(Cfg::coils <= NUMBER_OF_PETITCOILS,
+				"coils beyond NUMBER_OF_PETITCOILS");
+		if ((unsigned long) start + cnt > Cfg::coils)
+			return PETIT_ERROR_CODE_02;
+		if (cnt > (255U - 9U) * 8U || cnt == 0
+				|| Buf[6] < (cnt + 7U) >> 3)
+			return PETIT_ERROR_CODE_03;
+		PETIT_ENTER_CRITICAL();
+		PETIT_SHM_BEGIN(PETIT_SHM_COILS);
+		for (i = 0; i < cnt; i++)
+		{
+			pu16_t coil = (pu16_t) (start + i);
+
+			if (data[i >> 3] & (1U << (i & 7U)))
+				PetitCoils[coil >> 3] |= (pu8_t) (1U << (coil & 7U));
+			else
+				PetitCoils[coil >> 3] &= (pu8_t) ~(1U << (coil & 7U));
+		}
+		PETIT_SHM_END(PETIT_SHM_COILS);
+		PETIT_EXIT_CRITICAL();
+		Len = 6U;
+		return 0;
+	}
+};
+#endif
+
+#if PETIT_DISCRETE == PETIT_INTERNAL
+template <>
+struct Handler<C_FCODE_READ_DISCRETES> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		static_assert(Cfg::discretes <= NUMBER_OF_PETITDISCRETES,
+				"discrete inputs beyond NUMBER_OF_PETITDISCRETES");
+		return read_bits(Buf, Len, PetitDiscretes, Cfg::discretes,
+				(NUMBER_OF_PETITDISCRETES + 7U) >> 3, Cfg::buffer_regs);
+	}
+};
+#endif
+
+#if PETIT_REG == PETIT_INTERNAL
+template <>
+struct Handler<C_FCODE_READ_HOLDING_REGISTERS> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		static_assert(Cfg::holding <= NUMBER_OF_PETITREGISTERS,
+				"holding registers beyond NUMBER_OF_PETITREGISTERS");
+		return read_regs(Buf, Len, PetitRegisters, Cfg::holding,
+				Cfg::buffer_regs);
+	}
+};
+
+template <>
+struct Handler<C_FCODE_WRITE_SINGLE_REGISTER> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		pu16_t address = field(Buf, 0);
+
+		static_assert(Cfg::holding <= NUMBER_OF_PETITREGISTERS,
+				"holding registers beyond NUMBER_OF_PETITREGISTERS");
+		static_assert(Unlogged<Cfg>::value,
+				"petit::Slave does not mark writes for PetitDelta or "
+				"PetitJournal");
+		// the response is the request
+		Len = 6U;
+		if (address >= Cfg::holding)
+			return PETIT_ERROR_CODE_02;
+		PetitRegChange = 1;
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		PETIT_REG_STORE(PetitRegisters[address], field(Buf, 1));
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+		return 0;
+	}
+};
+
+template <>
+struct Handler<C_FCODE_WRITE_MULTIPLE_REGISTERS> : ByteCntLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		pu16_t start = field(Buf, 0);
+		pu16_t cnt = field(Buf, 1);
+
+		static_assert(Cfg::holding <= NUMBER_OF_PETITREGISTERS,
+				"holding registers beyond NUMBER_OF_PETITREGISTERS");
+		static_assert(Unlogged<Cfg>::value,
+				"petit::Slave does not mark writes for PetitDelta or "
+				"PetitJournal");
+		if (cnt == 0 || cnt > 123U)
+			return PETIT_ERROR_CODE_03;
+		if ((unsigned long) start + cnt > Cfg::holding)
+			return PETIT_ERROR_CODE_02;
+		if (Buf[6] < 2U * cnt)
+			return PETIT_ERROR_CODE_03;
+		PetitRegChange = 1U;
+		PETIT_ENTER_CRITICAL();
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		PetitRegsFromWire(&PetitRegisters[start], &Buf[7], cnt);
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+		PETIT_EXIT_CRITICAL();
+		Len = 6U;
+		return 0;
+	}
+};
+#endif
+
+#if PETIT_INPUT_REG == PETIT_INTERNAL
+template <>
+struct Handler<C_FCODE_READ_INPUT_REGISTERS> : FixedLength
+{
+	template <class Cfg>
+	static pu8_t run(pu8_t *Buf, pu16_t &Len)
+	{
+		static_assert(Cfg::inputs <= NUMBER_OF_INPUT_PETITREGISTERS,
+				"input registers beyond NUMBER_OF_INPUT_PETITREGISTERS");
+		return read_regs(Buf, Len, PetitInputRegisters, Cfg::inputs,
+				Cfg::buffer_regs);
+	}
+};
+#endif
+
+/**
+ * @return the length of the request in Buf, 0 until it is known or if the
+ *   function code is not one of Fns
+ */
+inline pu16_t length(Codes<>, pu8_t, const pu8_t *, pu16_t)
+{
+	return 0;
+}
+
+template <pu8_t Fn, pu8_t... Fns>
+inline pu16_t length(Codes<Fn, Fns...>, pu8_t Code, const pu8_t *Buf,
+		pu16_t Len)
+{
+	return Code == Fn ? Handler<Fn>::length(Buf, Len)
+			: length(Codes<Fns...>(), Code, Buf, Len);
+}
+
+/**
+ * Answers the request in Buf with the handler of its function code.
+ * @return 0 or the exception code
+ */
+template <class Cfg>
+inline pu8_t run(Codes<>, pu8_t, pu8_t *, pu16_t &)
+{
+	return PETIT_ERROR_CODE_01;
+}
+
+template <class Cfg, pu8_t Fn, pu8_t... Fns>
+inline pu8_t run(Codes<Fn, Fns...>, pu8_t Code, pu8_t *Buf, pu16_t &Len)
+{
+	return Code == Fn ? Handler<Fn>::template run<Cfg>(Buf, Len)
+			: run<Cfg>(Codes<Fns...>(), Code, Buf, Len);
+}
+} // namespace detail
+
+/**
+ * The configuration of a petit::Slave: the port hooks of Port, the function
+ * codes Fns, the CRC table, a buffer of NUMBER_OF_REGISTERS_IN_BUFFER
+ * registers and the whole of every internal table, answering as
+ * PETITMODBUS_SLAVE_ADDRESS.  Derive from it to change any of them.
+ */
+template <class P, pu8_t... Fns>
+struct Config
+{
+	typedef P Port;
+	typedef petit::Codes<Fns...> Functions;
+	typedef CrcTable Crc;
+	// registers a request or response may carry
+	static constexpr pu16_t buffer_regs = NUMBER_OF_REGISTERS_IN_BUFFER;
+	// how much of each internal table is served, from address 0
+#if PETIT_REG == PETIT_INTERNAL
+	static constexpr pu16_t holding = NUMBER_OF_PETITREGISTERS;
+#else
+	static constexpr pu16_t holding = 0;
+#endif
+#if PETIT_INPUT_REG == PETIT_INTERNAL
+	static constexpr pu16_t inputs = NUMBER_OF_INPUT_PETITREGISTERS;
+#else
+	static constexpr pu16_t inputs = 0;
+#endif
+#if PETIT_COIL == PETIT_INTERNAL
+	static constexpr pu16_t coils = NUMBER_OF_PETITCOILS;
+#else
+	static constexpr pu16_t coils = 0;
+#endif
+#if PETIT_DISCRETE == PETIT_INTERNAL
+	static constexpr pu16_t discretes = NUMBER_OF_PETITDISCRETES;
+#else
+	static constexpr pu16_t discretes = 0;
+#endif
+
+	static pu8_t address()
+	{
+		return PETITMODBUS_SLAVE_ADDRESS;
+	}
+};
+
+/**
+ * An RTU slave made of Cfg, see petit::Config.
+ *
+ * The port calls receive from the RX interrupt, timeout when the
+ * inter-frame timer expires and transmit from the TX interrupt, and the main
+ * loop calls process.  A request is answered in one call of process, which
+ * hands the first byte of the response to Port::tx_begin.
+ */
+template <class Cfg>
+class Slave
+{
+public:
+	static constexpr pu16_t buffer_size = 2U * Cfg::buffer_regs + 9U;
+
+	// constexpr, so a slave with static storage needs no constructor call
+	constexpr Slave() : buffer_(), pos_(0), len_(0), state_(rx)
+	{
+	}
+
+	Slave(const Slave &) = delete;
+	Slave &operator=(const Slave &) = delete;
+
+	/**
+	 * Call from the RX interrupt.
+	 * @return true if the byte was taken
+	 */
+	bool receive(pu8_t Rx)
+	{
+		if (state_ != rx || pos_ >= buffer_size)
+			return false;
+		buffer_[pos_++] = Rx;
+		Cfg::Port::timer_start();
+		if (complete())
+		{
+			Cfg::Port::timer_stop();
+			state_ = ready;
+		}
+		return true;
+	}
+
+	/**
+	 * Answers a complete request, unless its CRC is wrong.
+	 */
+	void process()
+	{
+		pu16_t len;
+		pu16_t crc;
+		pu8_t error;
+
+		if (state_ != ready)
+			return;
+		len = (pu16_t) (len_ - 2U);
+		crc = Cfg::Crc::calc(buffer_, len);
+		if (buffer_[len] != (pu8_t) crc
+				|| buffer_[len + 1U] != (pu8_t) (crc >> 8))
+		{
+			PetitLedCrcFail();
+			reset();
+			return;
+		}
+		error = detail::run<Cfg>(typename Cfg::Functions(), buffer_[1],
+				buffer_, len);
+		if (error != 0)
+		{
+			buffer_[1] |= 0x80U;
+			buffer_[2] = error;
+			len = 3U;
+			PetitLedErrFail();
+		}
+		else
+		{
+			PetitLedSuc();
+		}
+		crc = Cfg::Crc::calc(buffer_, len);
+		buffer_[len] = (pu8_t) crc;
+		buffer_[len + 1U] = (pu8_t) (crc >> 8);
+		len_ = (pu16_t) (len + 2U);
+		pos_ = 1U;
+		state_ = tx;
+		Cfg::Port::tx_begin(buffer_[0]);
+	}
+
+	/**
+	 * Call from the TX interrupt.
+	 * @return true with the next byte in Tx, false once the response is out
+	 */
+	bool transmit(pu8_t &Tx)
+	{
+		if (state_ != tx)
+			return false;
+		if (pos_ < len_)
+		{
+			Tx = buffer_[pos_++];
+			return true;
+		}
+		PetitLedOff();
+		reset();
+		return false;
+	}
+
+	/**
+	 * Call when the inter-frame timer expires.
+	 */
+	void timeout()
+	{
+		if (state_ == rx)
+			reset();
+	}
+
+private:
+	enum State
+	{
+		rx, ready, tx
+	};
+
+	/**
+	 * @return true once the request addressed to us is complete
+	 */
+	bool complete()
+	{
+		if (buffer_[0] != Cfg::address())
+			return false;
+		if (len_ == 0 && pos_ > 1U)
+		{
+			pu16_t len = detail::length(typename Cfg::Functions(),
+					buffer_[1], buffer_, pos_);
+
+			// a request too long for the buffer is never complete
+			if (len <= buffer_size)
+				len_ = len;
+		}
+		return len_ != 0 && pos_ >= len_;
+	}
+
+	void reset()
+	{
+		pos_ = 0;
+		len_ = 0;
+		state_ = rx;
+	}
+
+	pu8_t buffer_[buffer_size];
+	pu16_t pos_;
+	// the length of the request, then of the response
+	pu16_t len_;
+	pu8_t state_;
+};
+
+/**
+ * A slave of the C core whose port hooks point to the static members
+ * timer_start, timer_stop and tx_begin of Port, relying on the function
+ * codes in Required.  The C core calls the hooks through the function
+ * pointers of the instance.
+ */
+template <class Port, class Required = Functions<> >
+class CoreSlave
+{
+	// instantiates the checks of Required
+	static_assert(sizeof(Required) != 0, "");
+
+public:
+	CoreSlave()
+	{
+		PETIT_MODBUS_Init(&petit_);
+		petit_.Timer_Start = &Port::timer_start;
+		petit_.Timer_Stop = &Port::timer_stop;
+		petit_.Tx_Begin = &Port::tx_begin;
+	}
+
+	CoreSlave(const CoreSlave &) = delete;
+	CoreSlave &operator=(const CoreSlave &) = delete;
+
+	/**
+	 * Registers a table of additional function codes, see
+	 * PETIT_MODBUS_Register_Functions.
+	 */
+	template <pu8_t Cnt>
+	void functions(const T_PETIT_FUNCTION (&Table)[Cnt])
+	{
+		PETIT_MODBUS_Register_Functions(&petit_, Table, Cnt);
+	}
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	template <pu16_t Size>
+	void buffer(pu8_t (&Buffer)[Size])
+	{
+		static_assert(Size >= 9U, "buffer too small for any frame");
+		PETIT_MODBUS_Set_Buffer(&petit_, Buffer, Size);
+	}
+
+	void pool(T_PETIT_POOL &Pool)
+	{
+		PETIT_MODBUS_Set_Pool(&petit_, &Pool);
+	}
+#endif
+
+	/**
+	 * @return see PETIT_MODBUS_Process
+	 */
+	pu16_t process()
+	{
+		return PETIT_MODBUS_Process(&petit_);
+	}
+
+	/**
+	 * Call from the RX interrupt.
+	 * @return true if the byte was taken
+	 */
+	bool receive(pu8_t Rx)
+	{
+		return PetitRxBufferInsert(&petit_, Rx) == 0;
+	}
+
+	/**
+	 * Call from the TX interrupt.
+	 * @return true with the next byte in Tx, false once the response is out
+	 */
+	bool transmit(pu8_t &Tx)
+	{
+		return PetitTxBufferPop(&petit_, &Tx) != 0;
+	}
+
+	/**
+	 * Call when the inter-frame timer expires.
+	 */
+	void timeout()
+	{
+		PetitRxBufferReset(&petit_);
+	}
+
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+	/**
+	 * Call when the turnaround timer expires.
+	 */
+	void turnaround()
+	{
+		PetitTxTurnaround(&petit_);
+	}
+#endif
+
+	T_PETIT_MODBUS *c()
+	{
+		return &petit_;
+	}
+
+private:
+	T_PETIT_MODBUS petit_;
+};
+
+} // namespace petit
+
+#endif
@@ -14,6 +14,9 @@
 #define PETIT_BOTH      (0x1222)
 #define PETIT_EXTERNAL  (0x2222)
 
+#define PETIT_REG_NATIVE (0x6161)
+#define PETIT_REG_WIRE   (0x6262)
+
 #define PETIT_USER_LED_NONE (0x7777)
 #define PETIT_USER_LED_FN   (0x5555)
 #define PETIT_USER_LED_DEF  (0x3333)
@@ -22,39 +25,143 @@
 #include "PetitModbusUserPort.h"
 /******************************User Content************************************/
 
+// placement of constant tables, for ports with a single address space
+#ifndef PETIT_CODE
+#define PETIT_CODE
+#endif
+#ifndef PETIT_FLASH_ATTR
+#define PETIT_FLASH_ATTR
+#endif
+
+// byte order of PetitRegisters and PetitInputRegisters
+#ifndef PETIT_REG_ORDER
+#define PETIT_REG_ORDER PETIT_REG_NATIVE
+#endif
+
+// read-only registers in code memory follow the RAM registers by default
+#if defined(NUMBER_OF_CONST_PETITREGISTERS) && \
+	!defined(PETIT_CONST_REG_BASE)
+#define PETIT_CONST_REG_BASE NUMBER_OF_PETITREGISTERS
+#endif
+#if defined(NUMBER_OF_CONST_INPUT_PETITREGISTERS) && \
+	!defined(PETIT_CONST_INPUT_REG_BASE)
+#define PETIT_CONST_INPUT_REG_BASE NUMBER_OF_INPUT_PETITREGISTERS
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // data defined for porting
+#if defined(PETIT_SHM) && PETIT_SHM > 0
+// the internal tables in one block, which PETIT_SHM_Create moves into a
+// shared-memory segment, see PetitShm.h.  Their names still work as arrays.
+typedef struct PETIT_SHM_TABLES_S
+{
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
+	pu16_t Registers[NUMBER_OF_PETITREGISTERS];
+#endif
+#if defined(PETIT_INPUT_REG) && \
+	(PETIT_INPUT_REG == PETIT_INTERNAL ||\
+			PETIT_INPUT_REG == PETIT_BOTH)
+	pu16_t InputRegisters[NUMBER_OF_INPUT_PETITREGISTERS];
+#endif
 #if defined(PETIT_COIL) && \
 	(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
-	pu8_t PetitCoils[(NUMBER_OF_PETITCOILS + 7) >> 3];
+	pu8_t Coils[(NUMBER_OF_PETITCOILS + 7) >> 3];
 #endif
 #if defined(PETIT_DISCRETE) && \
 	(PETIT_DISCRETE == PETIT_INTERNAL || PETIT_DISCRETE == PETIT_BOTH)
-	pu8_t PetitDiscretes[(NUMBER_OF_PETITDISCRETES + 7) >> 3];
+	pu8_t Discretes[(NUMBER_OF_PETITDISCRETES + 7) >> 3];
+#endif
+	// keeps the block from being empty when no table is internal
+	pu8_t End;
+} T_PETIT_SHM_TABLES;
+extern T_PETIT_SHM_TABLES *PetitShmTables;
+#define PetitRegisters (PetitShmTables->Registers)
+#define PetitInputRegisters (PetitShmTables->InputRegisters)
+#define PetitCoils (PetitShmTables->Coils)
+#define PetitDiscretes (PetitShmTables->Discretes)
+#else
+#if defined(PETIT_COIL) && \
+	(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
+extern pu8_t PetitCoils[(NUMBER_OF_PETITCOILS + 7) >> 3];
+#endif
+#if defined(PETIT_DISCRETE) && \
+	(PETIT_DISCRETE == PETIT_INTERNAL || PETIT_DISCRETE == PETIT_BOTH)
+extern pu8_t PetitDiscretes[(NUMBER_OF_PETITDISCRETES + 7) >> 3];
 #endif
 #if defined(PETIT_REG) && \
 	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
 extern pu16_t PetitRegisters[NUMBER_OF_PETITREGISTERS];
 #endif
-extern pu8_t PetitRegChange;
 
 #if defined(PETIT_INPUT_REG) && \
 	(PETIT_INPUT_REG == PETIT_INTERNAL ||\
 			PETIT_INPUT_REG == PETIT_BOTH)
 extern pu16_t PetitInputRegisters[NUMBER_OF_INPUT_PETITREGISTERS];
 #endif
+#endif /* PETIT_SHM */
+extern pu8_t PetitRegChange;
+
+// reads and writes one of PetitRegisters or PetitInputRegisters whatever its
+// byte order, for example PETIT_REG_STORE(PetitRegisters[3], 1000U)
+#if PETIT_REG_ORDER == PETIT_REG_WIRE
+#define PETIT_REG_LOAD(Reg) ((pu16_t) \
+	((pu16_t) ((const pu8_t *) &(Reg))[0] << 8U | ((const pu8_t *) &(Reg))[1]))
+#define PETIT_REG_STORE(Reg, Value) do { \
+		pu16_t petit_value_ = (Value); \
+		((pu8_t *) &(Reg))[0] = (pu8_t) (petit_value_ >> 8U); \
+		((pu8_t *) &(Reg))[1] = (pu8_t) (petit_value_ & 0xFFU); \
+	} while (0)
+#else
+#define PETIT_REG_LOAD(Reg) (Reg)
+#define PETIT_REG_STORE(Reg, Value) do { (Reg) = (Value); } while (0)
+#endif
+
+// read-only registers defined by the application in code memory, served
+// from PETIT_CONST_REG_BASE and PETIT_CONST_INPUT_REG_BASE on.  the access
+// heatmap does not count them.
+#ifdef NUMBER_OF_CONST_PETITREGISTERS
+extern PETIT_CODE const pu16_t
+	PetitConstRegisters[NUMBER_OF_CONST_PETITREGISTERS] PETIT_FLASH_ATTR;
+#endif
+#ifdef NUMBER_OF_CONST_INPUT_PETITREGISTERS
+extern PETIT_CODE const pu16_t
+	PetitConstInputRegisters[NUMBER_OF_CONST_INPUT_PETITREGISTERS]
+	PETIT_FLASH_ATTR;
+#endif
 
 // functions to be defined for porting
 extern void PetitPortTxBegin(pu8_t tx);
 extern void PetitPortTimerStart(void);
 extern void PetitPortTimerStop(void);
+#if (defined(PETIT_TRACE) && PETIT_TRACE > 0) || \
+	(defined(PETIT_SNIFF) && PETIT_SNIFF > 0) || \
+	(defined(PETIT_RXRING) && PETIT_RXRING > 0) || \
+	defined(PETITMODBUS_TURNAROUND)
+// free running clock, any tick rate, wrapping at 16 bits
+extern pu16_t PetitPortClock(void);
+#endif
 #if defined(PETIT_CRC) && PETIT_CRC == PETIT_CRC_EXTERNAL
 extern void PetitPortCRC16Calc(pu8_t Data, pu16_t* CRC);
 #endif
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+#ifndef pu32_t
+#define pu32_t unsigned long
+#endif
+// flash behind the journal, addressed from the start of its first sector.
+// writes only go to erased flash, an erase takes a whole sector.
+extern pb_t PetitPortFlashRead(pu32_t Addr, pu8_t* Data, pu16_t Len);
+extern pb_t PetitPortFlashWrite(pu32_t Addr, const pu8_t* Data, pu16_t Len);
+extern pb_t PetitPortFlashErase(pu32_t Addr);
+#endif
 
 #if defined(PETIT_COIL) && \
 	(PETIT_COIL == PETIT_EXTERNAL || PETIT_COIL == PETIT_BOTH)
 extern pb_t PetitPortCoilRead(pu16_t Addr, pu8_t* Data);
-extern pb_t PetitPortCoilWrite(pu16_t Addr, pu8_t Data);
+extern pb_t PetitPortCoilWrite(pu16_t Addr, pu16_t Data);
 #endif
 
 #if defined(PETIT_DISCRETE) && \
@@ -83,4 +190,8 @@ extern void PetitLedErrFail(void);
 extern void PetitLedCrcFail(void);
 extern void PetitLedOff(void);
 #endif
+
+#ifdef __cplusplus
+}
+#endif
 #endif /* __PETIT_MODBUS_PORT_H__ */
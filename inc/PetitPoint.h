@@ -0,0 +1,109 @@
+/******************************************************************************
+ * @file PetitPoint.h
+ *
+ * This header file is for typed points of petitmodbus.
+ *
+ * A point maps a 32-bit integer, a float or a double onto two or four
+ * consecutive holding or input registers, in the word and byte order the
+ * master expects.  PETIT_POINT_Write and PETIT_POINT_Read convert a whole
+ * group of points in one call, and each point is stored and loaded inside
+ * PETIT_ENTER_CRITICAL.  Functions 3 and 4 copy the internal tables inside
+ * one too, which keeps interrupts off for up to 125 registers, so a response
+ * never holds half of an update even when requests are answered from the RX
+ * interrupt.  Streamed responses (PETIT_STREAM) and registers kept by the
+ * port are read one register at a time; there the points are only safe from
+ * writers that run in the same context as PETIT_MODBUS_Process.
+ *****************************************************************************/
+
+#ifndef __PETIT_POINT__H
+#define __PETIT_POINT__H
+
+#include <stdint.h>
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(PETITMODBUS_POINTS_ENABLED) && PETITMODBUS_POINTS_ENABLED > 0
+
+// 32-bit integers, unless the port says otherwise.  long is wider than 32
+// bits on 64-bit hosts, so it is no default.
+#ifndef pu32_t
+#define pu32_t uint32_t
+#endif
+#ifndef ps32_t
+#define ps32_t int32_t
+#endif
+// set to 1 if double is 64 bits wide and pu64_t is defined
+#ifndef PETIT_POINT_F64
+#if defined(__SIZEOF_DOUBLE__) && __SIZEOF_DOUBLE__ == 8
+#define PETIT_POINT_F64 (1)
+#else
+#define PETIT_POINT_F64 (0)
+#endif
+#endif
+#if PETIT_POINT_F64 > 0 && !defined(pu64_t)
+#define pu64_t uint64_t
+#endif
+
+// order of the bytes of a point in its registers, named for a 32-bit value
+// 0xAABBCCDD.  ABCD is big-endian as in the modbus specification.
+#define PETIT_POINT_WORD_SWAP   (0x01U)
+#define PETIT_POINT_BYTE_SWAP   (0x02U)
+#define PETIT_POINT_ABCD        (0x00U)
+#define PETIT_POINT_CDAB        (PETIT_POINT_WORD_SWAP)
+#define PETIT_POINT_BADC        (PETIT_POINT_BYTE_SWAP)
+#define PETIT_POINT_DCBA        (PETIT_POINT_WORD_SWAP | PETIT_POINT_BYTE_SWAP)
+
+// which registers a point lives in
+#define PETIT_POINT_HOLDING     (0U)
+#define PETIT_POINT_INPUT       (1U)
+
+typedef enum
+{
+	E_PETIT_POINT_U32 = 0,
+	E_PETIT_POINT_I32,
+	E_PETIT_POINT_F32,
+	// only with PETIT_POINT_F64
+	E_PETIT_POINT_F64
+} T_PETIT_POINT_TYPE;
+
+typedef union
+{
+	pu32_t U32;
+	ps32_t I32;
+	float F32;
+#if PETIT_POINT_F64 > 0
+	double F64;
+	pu64_t U64;
+#endif
+} T_PETIT_VALUE;
+
+/**
+ * One point.  Tables of points are usually constant.
+ */
+typedef struct
+{
+	// first register of the point
+	pu16_t Address;
+	// T_PETIT_POINT_TYPE
+	pu8_t Type;
+	// PETIT_POINT_ABCD and the like
+	pu8_t Order;
+	// PETIT_POINT_HOLDING or PETIT_POINT_INPUT
+	pu8_t Bank;
+} T_PETIT_POINT;
+
+// functions defined by petit modbus points
+pb_t PETIT_POINT_Write(const T_PETIT_POINT *Points,
+		const T_PETIT_VALUE *Values, pu16_t Cnt);
+pb_t PETIT_POINT_Read(const T_PETIT_POINT *Points, T_PETIT_VALUE *Values,
+		pu16_t Cnt);
+
+#endif /* PETITMODBUS_POINTS_ENABLED */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,87 @@
+/******************************************************************************
+ * @file PetitRxRing.h
+ *
+ * This header file is for the receive ring of petitmodbus.
+ *
+ * An instance given a T_PETIT_RXRING with PETIT_MODBUS_Set_RxRing takes its
+ * bytes from the ring instead of from the RX interrupt.  The interrupt only
+ * stores the byte and its PetitPortClock stamp with PETIT_RXRING_PUSH, and
+ * PETIT_MODBUS_Process drains the ring into the frame buffer, so framing, the
+ * function table and the CRC run in the main loop.  The stamps frame the
+ * requests as the inter-frame timer would: a byte that comes Gap ticks or
+ * more after the one before starts a new frame, and a frame still open Gap
+ * ticks after its last byte is dropped.  The timer callbacks of the port are
+ * still called but need not time anything.
+ *
+ * The interrupt only moves Head and the drain only moves Tail, on one core,
+ * so they need no lock between them.  Both are 8 bits wide so that even an
+ * 8-bit core reads them in one access.
+ *****************************************************************************/
+
+#ifndef __PETIT_RXRING__H
+#define __PETIT_RXRING__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if PETIT_RXRING > 0
+// bytes in the ring, a power of two up to 128.  The main loop has to drain
+// it within as many character times.
+#ifndef PETIT_RXRING_SIZE
+#define PETIT_RXRING_SIZE (64U)
+#endif
+
+/**
+ * A receive ring with the framing state of the drain.
+ */
+typedef struct PETIT_RXRING_S
+{
+	pu8_t Data[PETIT_RXRING_SIZE];
+	// PetitPortClock when each byte arrived
+	pu16_t Stamp[PETIT_RXRING_SIZE];
+	// free running positions, Head moved by the interrupt, Tail by the drain
+	volatile pu8_t Head;
+	volatile pu8_t Tail;
+	// inter-frame gap in PetitPortClock ticks, t3.5 or more
+	pu16_t Gap;
+	// stamp of the last byte drained, if Open
+	pu16_t Last;
+	pb_t Open;
+	// bytes lost because the ring was full, wrapping
+	volatile pu8_t Overruns;
+} T_PETIT_RXRING;
+
+/**
+ * Stores a received byte, from the RX interrupt.  A full ring loses the byte,
+ * and the frame it belongs to fails its CRC.
+ */
+#define PETIT_RXRING_PUSH(Ring, Byte) do { \
+		pu8_t petit_head_ = (Ring)->Head; \
+		pu8_t petit_i_ = petit_head_ & (PETIT_RXRING_SIZE - 1U); \
+		if ((pu8_t) (petit_head_ - (Ring)->Tail) < PETIT_RXRING_SIZE) \
+		{ \
+			(Ring)->Data[petit_i_] = (Byte); \
+			(Ring)->Stamp[petit_i_] = PetitPortClock(); \
+			(Ring)->Head = (pu8_t) (petit_head_ + 1U); \
+		} \
+		else \
+		{ \
+			(Ring)->Overruns++; \
+		} \
+	} while (0)
+
+// functions defined by petit modbus rx ring
+void PETIT_RXRING_Init(T_PETIT_RXRING *Ring, pu16_t Gap);
+void PETIT_RXRING_Drain(T_PETIT_MODBUS *Petit);
+
+// called by the core for an instance with a ring
+pu16_t PetitRxRingWait(const T_PETIT_MODBUS *Petit, pu16_t Wait);
+#endif /* PETIT_RXRING */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
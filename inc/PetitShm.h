@@ -0,0 +1,107 @@
+/******************************************************************************
+ * @file PetitShm.h
+ *
+ * This header file is for the shared register file of petitmodbus.
+ *
+ * Built with PETIT_SHM, the internal coils, discrete inputs, holding and
+ * input registers are one T_PETIT_SHM_TABLES block instead of four arrays.
+ * PETIT_SHM_Create moves it into a named POSIX shared-memory segment, behind
+ * a header that describes it, and other processes on the same host map the
+ * segment with PETIT_SHM_Open and read the live values in place.
+ *
+ * Every table is a block with its own sequence lock.  The slave makes the
+ * sequence odd before it writes a table and even again after, so a reader
+ * that copies a range with PETIT_SHM_Read between two equal, even sequence
+ * numbers has a consistent copy, such as all registers of one function 16.
+ * The application wraps its own writes to the tables in PETIT_SHM_Begin and
+ * PETIT_SHM_End, from one thread, or the same one as the slave.
+ *
+ * Segment layout, offsets from the start of the segment:
+ *   0    header: magic, version, flags, size in bytes, writer pid
+ *   64   one 64-byte line per block: sequence, offset, count, bytes
+ *   320  the tables, where the offsets of their blocks say
+ * Registers are in the byte order of the writer, big-endian with
+ * PETIT_SHM_WIRE in the flags.  Coils and discrete inputs are packed eight
+ * to a byte, the first in the least significant bit.
+ *****************************************************************************/
+
+#ifndef __PETIT_SHM__H
+#define __PETIT_SHM__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// blocks of the segment, in the order of their header lines
+#define PETIT_SHM_COILS           (0U)
+#define PETIT_SHM_DISCRETES       (1U)
+#define PETIT_SHM_REGISTERS       (2U)
+#define PETIT_SHM_INPUT_REGISTERS (3U)
+#define PETIT_SHM_BLOCKS          (4U)
+
+#define PETIT_SHM_MAGIC   (0x4D534850UL)
+#define PETIT_SHM_VERSION (1U)
+// the registers are big-endian
+#define PETIT_SHM_WIRE    (0x0001U)
+
+#if defined(PETIT_SHM) && PETIT_SHM > 0
+// times PETIT_SHM_Read tries before it gives up on a writer that stopped in
+// the middle of a write
+#ifndef PETIT_SHM_TRIES
+#define PETIT_SHM_TRIES (100000UL)
+#endif
+
+typedef struct
+{
+	// odd while the block is written
+	volatile pu32_t Seq;
+	// from the start of the segment, 0 if the table is not internal
+	pu32_t Offset;
+	// registers, coils or inputs in the table
+	pu32_t Count;
+	pu32_t Bytes;
+	// a line of its own, so readers of one block do not slow down another
+	pu32_t Pad[12];
+} T_PETIT_SHM_BLOCK;
+
+typedef struct PETIT_SHM_S
+{
+	// PETIT_SHM_MAGIC once the segment is complete, 0 once it is retired
+	volatile pu32_t Magic;
+	pu16_t Version;
+	pu16_t Flags;
+	pu32_t Size;
+	pu32_t Pid;
+	pu32_t Pad[12];
+	T_PETIT_SHM_BLOCK Block[PETIT_SHM_BLOCKS];
+	T_PETIT_SHM_TABLES Tables;
+} T_PETIT_SHM;
+
+// functions defined by petit modbus shm, for the slave
+pb_t PETIT_SHM_Create(const char *Name);
+void PETIT_SHM_Destroy(const char *Name);
+void PETIT_SHM_Begin(pu8_t Block);
+void PETIT_SHM_End(pu8_t Block);
+
+// and for the readers
+const T_PETIT_SHM *PETIT_SHM_Open(const char *Name);
+void PETIT_SHM_Close(const T_PETIT_SHM *Shm);
+pb_t PETIT_SHM_Read(const T_PETIT_SHM *Shm, pu8_t Block, pu16_t Start,
+		pu16_t Cnt, void *Data);
+
+// the segment the tables live in, in the process or shared
+extern T_PETIT_SHM *PetitShm;
+
+#define PETIT_SHM_BEGIN(Block) PETIT_SHM_Begin(Block)
+#define PETIT_SHM_END(Block) PETIT_SHM_End(Block)
+#else
+#define PETIT_SHM_BEGIN(Block)
+#define PETIT_SHM_END(Block)
+#endif /* PETIT_SHM */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
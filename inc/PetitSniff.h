@@ -0,0 +1,89 @@
+/******************************************************************************
+ * @file PetitSniff.h
+ *
+ * This header file is for the bus monitor of petitmodbus.
+ *
+ * An instance given a T_PETIT_SNIFF with PETIT_MODBUS_Set_Monitor stops
+ * answering and frames every ADU on the wire instead, whatever its address.
+ * The frames are delimited by the inter-frame timer of the port, checked with
+ * the CRC of the library, paired with the request they answer and stored
+ * straight from the RX interrupt into a capture ring.  The application takes
+ * the capture out of the ring with PETIT_SNIFF_Peek and PETIT_SNIFF_Consume,
+ * for example to send it to a host that converts it with PetitSniffDump.
+ *
+ * The capture is a sequence of records, each a PETIT_SNIFF_HDR byte header
+ * followed by the bytes of the frame:
+ *   flags, PETIT_SNIFF_xx
+ *   length of the frame as stored, 1 to 255
+ *   PetitPortClock at the first byte of the frame, low byte first
+ *****************************************************************************/
+
+#ifndef __PETIT_SNIFF__H
+#define __PETIT_SNIFF__H
+
+#include "PetitModbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// record header and flags, also used by the host tools
+#define PETIT_SNIFF_HDR        (4U)
+// the CRC of the frame is right
+#define PETIT_SNIFF_CRC_OK     (0x01U)
+// the frame answers the frame before it
+#define PETIT_SNIFF_RESPONSE   (0x02U)
+// the frame was longer than 255 bytes, only its start is stored
+#define PETIT_SNIFF_TRUNCATED  (0x04U)
+// frames were dropped before this one because the ring was full
+#define PETIT_SNIFF_LOST       (0x08U)
+
+#if PETIT_SNIFF > 0
+// bytes in the capture ring, a power of two up to 32768
+#ifndef PETIT_SNIFF_SIZE
+#define PETIT_SNIFF_SIZE (1024U)
+#endif
+
+/**
+ * A capture ring with the state of the frame being received.
+ *
+ * The RX interrupt only moves Head and the reader only moves Tail, so they
+ * need no lock between them.  Head is moved once a record is complete.
+ */
+typedef struct PETIT_SNIFF_S
+{
+	pu8_t Ring[PETIT_SNIFF_SIZE];
+	// free running positions of the complete records
+	volatile pu16_t Head;
+	volatile pu16_t Tail;
+	// bytes of the frame being received, stored from Head + PETIT_SNIFF_HDR
+	pu16_t Len;
+	pu16_t Stamp;
+	// the frame being received does not fit the ring
+	pb_t Drop;
+	// frames were dropped since the last record
+	pb_t Lost;
+	// request awaiting its response, if Req_Open
+	pb_t Req_Open;
+	pu8_t Req_Addr;
+	pu8_t Req_Code;
+	// frames seen, with a bad CRC and dropped, wrapping
+	pu16_t Frames;
+	pu16_t Crc_Errors;
+	pu16_t Drops;
+} T_PETIT_SNIFF;
+
+// functions defined by petit modbus sniff
+void PETIT_SNIFF_Init(T_PETIT_SNIFF *Sniff);
+pu16_t PETIT_SNIFF_Peek(const T_PETIT_SNIFF *Sniff, const pu8_t **Data);
+void PETIT_SNIFF_Consume(T_PETIT_SNIFF *Sniff, pu16_t Len);
+
+// called by the core for a monitor
+void PetitSniffByte(T_PETIT_MODBUS *Petit, pu8_t Rx);
+void PetitSniffEnd(T_PETIT_MODBUS *Petit);
+#endif /* PETIT_SNIFF */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,7 +8,7 @@
 
 #include "PetitModbusPort.h"
 
-#if C_PETIT_CRC == PETIT_CRC_TABULAR
+#if PETIT_CRC == PETIT_CRC_TABULAR
 PETIT_CODE const pu16_t PetitCRCtable[256] PETIT_FLASH_ATTR = {
 	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
 	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
@@ -0,0 +1,290 @@
+/******************************************************************************
+ * @file PetitDelta.c
+ *
+ * This file contains the delta reads of PetitModbus.
+ *
+ * The log is a ring of register addresses.  Gen counts the entries ever
+ * appended, so the entry that took the generation from g to g + 1 is at
+ * g modulo the size of the ring, and a token is still covered as long as Gen
+ * is no more than Cnt, the entries kept, ahead of it.  A response takes the
+ * addresses it covers out of the ring in one critical section, then drops
+ * the duplicates and reads the values outside of it, so a register written
+ * in between is sent with its newer value now and again with the next
+ * changes.
+ *****************************************************************************/
+
+#include "PetitDelta.h"
+
+#if defined(PETIT_DELTA) && PETIT_DELTA > 0
+
+#define C_PETIT_DELTA_MASK (PETIT_DELTA_LOG - 1U)
+
+#if (PETIT_DELTA_LOG & C_PETIT_DELTA_MASK) != 0 || PETIT_DELTA_LOG > 4096U
+#error "PETIT_DELTA_LOG must be a power of two up to 4096."
+#endif
+
+// the most pairs and snapshot registers in a response, so it fits the
+// 253 bytes of a modbus PDU
+#define C_PETIT_DELTA_MAX_PAIRS  (62U)
+#define C_PETIT_DELTA_MAX_REGS   (123U)
+
+static struct
+{
+	pu16_t Log[PETIT_DELTA_LOG];
+	// generation after the newest entry
+	pu16_t Gen;
+	// entries kept, up to PETIT_DELTA_LOG
+	pu16_t Cnt;
+} delta;
+
+/**
+ * Empties the log.
+ * @param[in] Seed the first generation.  Something that changes at every
+ *   boot, a boot counter or a random number, keeps a token a master got
+ *   before a reset from being taken for a current one.
+ */
+void PETIT_DELTA_Init(pu16_t Seed)
+{
+	PETIT_ENTER_CRITICAL();
+	delta.Gen = Seed;
+	delta.Cnt = 0;
+	PETIT_EXIT_CRITICAL();
+}
+
+/**
+ * Logs registers as written, once their new values are stored.  Functions 6
+ * and 16 call it; the application calls it for what it writes itself.
+ * Registers past the table are not logged.
+ * @param[in] Addr the first holding register written
+ * @param[in] Cnt the number of registers written
+ */
+void PETIT_DELTA_Mark(pu16_t Addr, pu16_t Cnt)
+{
+	if (Addr >= NUMBER_OF_PETITREGISTERS)
+	{
+		return;
+	}
+	if (Cnt > NUMBER_OF_PETITREGISTERS - Addr)
+	{
+		Cnt = NUMBER_OF_PETITREGISTERS - Addr;
+	}
+	PETIT_ENTER_CRITICAL();
+	// older entries would be overwritten by this very call
+	if (Cnt > PETIT_DELTA_LOG)
+	{
+		Addr += Cnt - PETIT_DELTA_LOG;
+		delta.Gen += Cnt - PETIT_DELTA_LOG;
+		Cnt = PETIT_DELTA_LOG;
+	}
+	while (Cnt-- != 0)
+	{
+		delta.Log[delta.Gen & C_PETIT_DELTA_MASK] = Addr++;
+		delta.Gen++;
+		if (delta.Cnt < PETIT_DELTA_LOG)
+		{
+			delta.Cnt++;
+		}
+	}
+	PETIT_EXIT_CRITICAL();
+}
+
+/**
+ * @return the current generation, the token of a master that has just read
+ *   every register
+ */
+pu16_t PETIT_DELTA_Token(void)
+{
+	pu16_t gen;
+
+	PETIT_ENTER_CRITICAL();
+	gen = delta.Gen;
+	PETIT_EXIT_CRITICAL();
+	return gen;
+}
+
+/******************************************************************************/
+
+/**
+ * @fn delta_value
+ * Reads a holding register for a response.
+ */
+static pb_t delta_value(pu16_t Addr, pu16_t *Data)
+{
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
+	*Data = PETIT_REG_LOAD(PetitRegisters[Addr]);
+#endif
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH)
+	return PetitPortRegRead(Addr, Data);
+#else
+	return true;
+#endif
+}
+
+/**
+ * @fn delta_put
+ * Writes a 16-bit field of the response, high byte first.
+ */
+static void delta_put(pu8_t *Buf, pu16_t Data)
+{
+	Buf[0] = (pu8_t) (Data >> 8U);
+	Buf[1] = (pu8_t) (Data & 0xFFU);
+}
+
+/**
+ * @fn delta_changes
+ * Answers with the registers written since Token.
+ * @param[in] Max the most pairs the buffer takes
+ * @return 0, PETIT_ERROR_CODE_04 if a register can not be read, or
+ *   PETIT_ERROR_CODE_06 if the log no longer reaches back to Token
+ */
+static pu8_t delta_changes(T_PETIT_MODBUS *Petit, pu16_t Token, pu16_t Max)
+{
+	pu8_t *pairs = &Petit->Buffer[6U];
+	pu8_t flags = 0;
+	pu16_t taken = 0;
+	pu16_t n = 0;
+	pu16_t addr;
+	pu16_t value;
+	pu16_t i;
+	pu16_t j;
+
+	PETIT_ENTER_CRITICAL();
+	if ((pu16_t) (delta.Gen - Token) > delta.Cnt)
+	{
+		PETIT_EXIT_CRITICAL();
+		return PETIT_ERROR_CODE_06;
+	}
+	// the addresses go where their pairs will be
+	while (Token != delta.Gen && taken < Max)
+	{
+		delta_put(&pairs[4U * taken], delta.Log[Token & C_PETIT_DELTA_MASK]);
+		Token++;
+		taken++;
+	}
+	if (Token != delta.Gen)
+	{
+		flags = PETIT_DELTA_MORE;
+	}
+	PETIT_EXIT_CRITICAL();
+
+	for (i = 0; i < taken; i++)
+	{
+		addr = ((pu16_t) pairs[4U * i] << 8U) | pairs[4U * i + 1U];
+		for (j = 0; j < n; j++)
+		{
+			if (pairs[4U * j] == pairs[4U * i]
+					&& pairs[4U * j + 1U] == pairs[4U * i + 1U])
+			{
+				break;
+			}
+		}
+		if (j < n)
+		{
+			continue;
+		}
+		if (!delta_value(addr, &value))
+		{
+			return PETIT_ERROR_CODE_04;
+		}
+		delta_put(&pairs[4U * n], addr);
+		delta_put(&pairs[4U * n + 2U], value);
+		n++;
+	}
+
+	Petit->Buffer[2U] = flags;
+	delta_put(&Petit->Buffer[3U], Token);
+	Petit->Buffer[5U] = (pu8_t) n;
+	Petit->BufJ = 6U + 4U * n;
+	return 0;
+}
+
+/**
+ * @fn delta_snapshot
+ * Answers with the registers from Start on.
+ * @param[in] Max the most registers the buffer takes
+ */
+static pu8_t delta_snapshot(T_PETIT_MODBUS *Petit, pu16_t Token,
+		pu16_t Start, pu16_t Max)
+{
+	pu8_t flags = PETIT_DELTA_SNAPSHOT;
+	pu16_t n = NUMBER_OF_PETITREGISTERS - Start;
+	pu16_t value;
+	pu16_t i;
+
+	if (n > Max)
+	{
+		n = Max;
+		flags |= PETIT_DELTA_MORE;
+	}
+	// the snapshot starts here; what is written from now on is logged after
+	if (Start == 0)
+	{
+		Token = PETIT_DELTA_Token();
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (!delta_value(Start + i, &value))
+		{
+			return PETIT_ERROR_CODE_04;
+		}
+		delta_put(&Petit->Buffer[8U + 2U * i], value);
+	}
+
+	Petit->Buffer[2U] = flags;
+	delta_put(&Petit->Buffer[3U], Token);
+	Petit->Buffer[5U] = (pu8_t) n;
+	delta_put(&Petit->Buffer[6U], Start);
+	Petit->BufJ = 8U + 2U * n;
+	return 0;
+}
+
+/**
+ * Handler of C_FCODE_DELTA, see PetitDelta.h.
+ */
+pu8_t PetitDeltaRead(T_PETIT_MODBUS *Petit)
+{
+	pu16_t token = ((pu16_t) Petit->Buffer[2U] << 8U) | Petit->Buffer[3U];
+	pu16_t start = ((pu16_t) Petit->Buffer[4U] << 8U) | Petit->Buffer[5U];
+	// the response leaves room for its CRC
+	pu16_t room = PETIT_BUF_SIZE_M(Petit) - 2U;
+	pu16_t max;
+	pu8_t error;
+
+	if (start == PETIT_DELTA_CHANGES)
+	{
+		max = room >= 10U ? (room - 6U) / 4U : 0;
+		if (max > C_PETIT_DELTA_MAX_PAIRS)
+		{
+			max = C_PETIT_DELTA_MAX_PAIRS;
+		}
+		if (max == 0)
+		{
+			return PETIT_ERROR_CODE_04;
+		}
+		error = delta_changes(Petit, token, max);
+		if (error != PETIT_ERROR_CODE_06)
+		{
+			return error;
+		}
+		// the changes are lost, start over with a snapshot
+		start = 0;
+	}
+	if (start >= NUMBER_OF_PETITREGISTERS)
+	{
+		return PETIT_ERROR_CODE_02;
+	}
+	max = room >= 10U ? (room - 8U) / 2U : 0;
+	if (max > C_PETIT_DELTA_MAX_REGS)
+	{
+		max = C_PETIT_DELTA_MAX_REGS;
+	}
+	if (max == 0)
+	{
+		return PETIT_ERROR_CODE_04;
+	}
+	return delta_snapshot(Petit, token, start, max);
+}
+
+#endif /* PETIT_DELTA */
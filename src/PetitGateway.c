@@ -0,0 +1,554 @@
+/******************************************************************************
+ * @file PetitGateway.c
+ *
+ * This file contains the Modbus TCP to RTU gateway of PetitModbus.
+ *
+ * Every client request is attached to a slot, which is one transaction on the
+ * serial line.  A read joins a slot that is queued or in flight when that slot
+ * covers the same unit, function and range, and is answered straight away
+ * when a cached slot covers it.  Only one slot is on the bus at a time and the
+ * next one is picked round robin between unit ids, so a unit that does not
+ * answer can not starve the others.
+ *****************************************************************************/
+
+#include "PetitGateway.h"
+
+#if defined(PETITMODBUS_GATEWAY_ENABLED) && PETITMODBUS_GATEWAY_ENABLED > 0
+
+// +2 transaction; +2 protocol; +2 length; +1 unit
+#define C_MBAP_HDR_SIZE (7U)
+#define C_IADU_FN_CODE  (7U)
+
+/**
+ * This macro extracts the contents of the ADU at index as a 16-bit unsigned
+ * integer
+ */
+#define PETIT_ADU_DAT_M(Idx) (((pu16_t)(Adu[(Idx)]) << 8U) \
+			| (pu16_t) (Adu[(Idx) + 1U]))
+
+/******************************************************************************/
+void PETIT_GATEWAY_Init(T_PETIT_GATEWAY *Gw, T_PETIT_MASTER *Master,
+		void (*Reply)(void *Client, const pu8_t *Adu, pu16_t Len))
+{
+	pu8_t i;
+
+	Gw->Master = Master;
+	Gw->Reply = Reply;
+	for (i = 0; i < PETITGW_SLOTS; i++)
+	{
+		Gw->Slots[i].State = E_PETITGW_FREE;
+	}
+	for (i = 0; i < PETITGW_WAITERS; i++)
+	{
+		Gw->Waiters[i].Used = false;
+	}
+	Gw->Last_Unit = 0;
+	Gw->Now = 0;
+	Gw->Stats.Requests = 0;
+	Gw->Stats.Transactions = 0;
+	Gw->Stats.Merged = 0;
+	Gw->Stats.Cached = 0;
+	Gw->Stats.Rejected = 0;
+}
+
+/**
+ * Counts the cache time and the master timeouts.
+ * Call this from a periodic timer interrupt instead of PETIT_MASTER_Tick.
+ */
+void PETIT_GATEWAY_Tick(T_PETIT_GATEWAY *Gw)
+{
+	Gw->Now++;
+	PETIT_MASTER_Tick(Gw->Master);
+}
+
+/******************************************************************************/
+
+/**
+ * @fn send_adu
+ * Fills in the MBAP header of the reply and hands it to the application.
+ * @param[in] Pdu_Len the length of the PDU after the header
+ */
+static void send_adu(T_PETIT_GATEWAY *Gw, void *Client, pu16_t Transaction,
+		pu8_t Unit, pu16_t Pdu_Len)
+{
+	Gw->Adu[0] = Transaction >> 8U;
+	Gw->Adu[1] = Transaction;
+	Gw->Adu[2] = 0;
+	Gw->Adu[3] = 0;
+	Gw->Adu[4] = (Pdu_Len + 1U) >> 8U;
+	Gw->Adu[5] = Pdu_Len + 1U;
+	Gw->Adu[6] = Unit;
+	Gw->Reply(Client, Gw->Adu, C_MBAP_HDR_SIZE + Pdu_Len);
+}
+
+/**
+ * @fn send_error
+ * Answers a client request with an exception.
+ */
+static void send_error(T_PETIT_GATEWAY *Gw, void *Client, pu16_t Transaction,
+		pu8_t Unit, pu8_t Function, pu8_t ErrorCode)
+{
+	Gw->Adu[C_IADU_FN_CODE] = Function | 0x80U;
+	Gw->Adu[C_IADU_FN_CODE + 1U] = ErrorCode;
+	send_adu(Gw, Client, Transaction, Unit, 2U);
+}
+
+/**
+ * @fn send_result
+ * Answers a waiting client request from the result of its slot.
+ */
+static void send_result(T_PETIT_GATEWAY *Gw, const T_PETITGW_WAITER *Waiter,
+		const T_PETITGW_SLOT *Slot)
+{
+	pu8_t *Pdu = &Gw->Adu[C_IADU_FN_CODE];
+	pu16_t off = Waiter->Address - Slot->Req.Address;
+	pu16_t len = 0;
+	pu16_t i;
+
+	if (Slot->Req.Status != PETITMASTER_OK)
+	{
+		send_error(Gw, Waiter->Client, Waiter->Transaction, Slot->Req.Slave,
+				Waiter->Function, Slot->Req.Status > PETIT_ERROR_CODE_0B ?
+						PETIT_ERROR_CODE_0B : Slot->Req.Status);
+		return;
+	}
+
+	Pdu[len++] = Waiter->Function;
+	switch (Waiter->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		Pdu[len++] = (Waiter->Count + 7U) >> 3;
+		for (i = 0; i < Pdu[1]; i++)
+		{
+			Pdu[len + i] = 0;
+		}
+		for (i = 0; i < Waiter->Count; i++)
+		{
+			if (Slot->Data[(off + i) >> 4] & 1U << ((off + i) & 15U))
+			{
+				Pdu[len + (i >> 3)] |= 1U << (i & 7U);
+			}
+		}
+		len += Pdu[1];
+		break;
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		Pdu[len++] = 2U * Waiter->Count;
+		for (i = 0; i < Waiter->Count; i++)
+		{
+			Pdu[len++] = Slot->Data[off + i] >> 8U;
+			Pdu[len++] = Slot->Data[off + i];
+		}
+		break;
+	default:
+		// writes echo the address and the value or quantity written
+		Pdu[len++] = Waiter->Address >> 8U;
+		Pdu[len++] = Waiter->Address;
+		if (Waiter->Function == C_FCODE_WRITE_SINGLE_COIL)
+		{
+			Pdu[len++] = Slot->Data[0] ? 0xFFU : 0;
+			Pdu[len++] = 0;
+		}
+		else if (Waiter->Function == C_FCODE_WRITE_SINGLE_REGISTER)
+		{
+			Pdu[len++] = Slot->Data[0] >> 8U;
+			Pdu[len++] = Slot->Data[0];
+		}
+		else
+		{
+			Pdu[len++] = Waiter->Count >> 8U;
+			Pdu[len++] = Waiter->Count;
+		}
+		break;
+	}
+	send_adu(Gw, Waiter->Client, Waiter->Transaction, Slot->Req.Slave, len);
+}
+
+/******************************************************************************/
+
+/**
+ * @fn slot_done
+ * Master completion callback.  The answers go out from PETIT_GATEWAY_Process.
+ */
+static void slot_done(T_PETIT_MASTER_REQ *Req)
+{
+	((T_PETITGW_SLOT *) Req)->State = E_PETITGW_DONE;
+}
+
+/**
+ * @fn slot_covers
+ * @return true if the result of the slot contains the given read
+ */
+static pb_t slot_covers(const T_PETITGW_SLOT *Slot, pu8_t Unit,
+		pu8_t Function, pu16_t Address, pu16_t Count)
+{
+	return Slot->Req.Slave == Unit && Slot->Req.Function == Function
+			&& Address >= Slot->Req.Address
+			&& (pu16_t) (Address - Slot->Req.Address) <= Slot->Req.Count
+			&& Count <= Slot->Req.Count - (Address - Slot->Req.Address);
+}
+
+/**
+ * @fn slot_alloc
+ * Takes a free slot, or the oldest cached one if none is free.
+ * @return the index of the slot, PETITGW_SLOTS if all of them are in use
+ */
+static pu8_t slot_alloc(T_PETIT_GATEWAY *Gw)
+{
+	pu8_t i;
+	pu8_t oldest = PETITGW_SLOTS;
+
+	for (i = 0; i < PETITGW_SLOTS; i++)
+	{
+		if (Gw->Slots[i].State == E_PETITGW_FREE)
+		{
+			return i;
+		}
+		if (Gw->Slots[i].State == E_PETITGW_CACHED && (oldest == PETITGW_SLOTS
+				|| (pu16_t) (Gw->Now - Gw->Slots[i].Stamp) >
+						(pu16_t) (Gw->Now - Gw->Slots[oldest].Stamp)))
+		{
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+/**
+ * @fn waiter_alloc
+ * @return a free waiter, 0 if all of them are in use
+ */
+static T_PETITGW_WAITER *waiter_alloc(T_PETIT_GATEWAY *Gw)
+{
+	pu8_t i;
+
+	for (i = 0; i < PETITGW_WAITERS; i++)
+	{
+		if (!Gw->Waiters[i].Used)
+		{
+			return &Gw->Waiters[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * @fn parse_request
+ * Checks the PDU of a client request and fills in the bus request from it,
+ * all but the values to write.
+ * @return 0 if the request can be forwarded, an exception code otherwise
+ */
+static pu8_t parse_request(const pu8_t *Adu, pu16_t Len,
+		T_PETIT_MASTER_REQ *Req)
+{
+	Req->Slave = Adu[C_MBAP_HDR_SIZE - 1U];
+	Req->Function = Adu[C_IADU_FN_CODE];
+	Req->Address = PETIT_ADU_DAT_M(8U);
+	Req->Count = PETIT_ADU_DAT_M(10U);
+
+	switch (Req->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		if (Len != 12U || Req->Count == 0
+				|| Req->Count > 16U * C_PETITMASTER_MAX_REGS)
+			return PETIT_ERROR_CODE_03;
+		break;
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		if (Len != 12U || Req->Count == 0
+				|| Req->Count > C_PETITMASTER_MAX_REGS)
+			return PETIT_ERROR_CODE_03;
+		break;
+	case C_FCODE_WRITE_SINGLE_COIL:
+		if (Len != 12U || (Req->Count != 0 && Req->Count != 0xFF00U))
+			return PETIT_ERROR_CODE_03;
+		Req->Count = 1U;
+		break;
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		if (Len != 12U)
+			return PETIT_ERROR_CODE_03;
+		Req->Count = 1U;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		if (Len < 13U || Req->Count == 0
+				|| Req->Count > 16U * C_PETITMASTER_MAX_REGS
+				|| Adu[12] != (Req->Count + 7U) >> 3 || Len != 13U + Adu[12])
+			return PETIT_ERROR_CODE_03;
+		break;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		if (Len < 13U || Req->Count == 0
+				|| Req->Count > C_PETITMASTER_MAX_REGS
+				|| Adu[12] != 2U * Req->Count || Len != 13U + Adu[12])
+			return PETIT_ERROR_CODE_03;
+		break;
+	default:
+		return PETIT_ERROR_CODE_01;
+	}
+	// reads can not be broadcast
+	if (Req->Slave == 0 && Req->Function <= C_FCODE_READ_INPUT_REGISTERS)
+		return PETIT_ERROR_CODE_0B;
+	return 0;
+}
+
+/**
+ * @fn parse_data
+ * Copies the values of a write checked by parse_request into Req->Data.
+ */
+static void parse_data(const pu8_t *Adu, T_PETIT_MASTER_REQ *Req)
+{
+	pu16_t i;
+
+	switch (Req->Function)
+	{
+	case C_FCODE_WRITE_SINGLE_COIL:
+		Req->Data[0] = PETIT_ADU_DAT_M(10U) != 0;
+		break;
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		Req->Data[0] = PETIT_ADU_DAT_M(10U);
+		break;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		for (i = 0; i < Req->Count; i++)
+		{
+			if (Adu[13U + (i >> 3)] & 1U << (i & 7U))
+				Req->Data[i >> 4] |= 1U << (i & 15U);
+			else
+				Req->Data[i >> 4] &= ~(1U << (i & 15U));
+		}
+		break;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		for (i = 0; i < Req->Count; i++)
+		{
+			Req->Data[i] = PETIT_ADU_DAT_M(13U + 2U*i);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Takes one MBAP frame received from a client.
+ *
+ * The answer is sent through Reply, either from within this call when it comes
+ * from the cache or is an exception, or later from PETIT_GATEWAY_Process.
+ * @param[in] Client opaque handle passed back to Reply
+ * @param[in] Adu the MBAP header followed by the PDU
+ * @param[in] Len the length of the frame
+ */
+void PETIT_GATEWAY_Request(T_PETIT_GATEWAY *Gw, void *Client,
+		const pu8_t *Adu, pu16_t Len)
+{
+	T_PETITGW_WAITER *waiter;
+	T_PETITGW_SLOT *slot;
+	T_PETIT_MASTER_REQ req;
+	pu16_t transaction;
+	pu8_t unit;
+	pu8_t error;
+	pu8_t i;
+	pu8_t s;
+
+	// the length field counts the unit id and the PDU
+	if (Len < C_MBAP_HDR_SIZE + 5U || Adu[2] != 0 || Adu[3] != 0
+			|| PETIT_ADU_DAT_M(4U) != (pu16_t) (Len - 6U))
+	{
+		return;
+	}
+	Gw->Stats.Requests++;
+	transaction = PETIT_ADU_DAT_M(0U);
+	unit = Adu[C_MBAP_HDR_SIZE - 1U];
+
+	// checked before any slot is looked at, a cached one may be taken
+	error = parse_request(Adu, Len, &req);
+	if (error != 0)
+	{
+		Gw->Stats.Rejected++;
+		send_error(Gw, Client, transaction, unit, Adu[C_IADU_FN_CODE], error);
+		return;
+	}
+	waiter = waiter_alloc(Gw);
+	if (waiter == 0)
+	{
+		Gw->Stats.Rejected++;
+		send_error(Gw, Client, transaction, unit, req.Function,
+				PETIT_ERROR_CODE_06);
+		return;
+	}
+	waiter->Client = Client;
+	waiter->Transaction = transaction;
+	waiter->Function = req.Function;
+	waiter->Address = req.Address;
+	waiter->Count = PETIT_ADU_DAT_M(10U);
+
+	if (req.Function <= C_FCODE_READ_INPUT_REGISTERS)
+	{
+		for (i = 0; i < PETITGW_SLOTS; i++)
+		{
+			slot = &Gw->Slots[i];
+			if (!slot_covers(slot, unit, req.Function, req.Address,
+					req.Count))
+			{
+				continue;
+			}
+			if (slot->State == E_PETITGW_CACHED)
+			{
+				Gw->Stats.Cached++;
+				send_result(Gw, waiter, slot);
+				return;
+			}
+			if ((slot->State == E_PETITGW_QUEUED
+					|| slot->State == E_PETITGW_BUSY) && slot->Shared)
+			{
+				Gw->Stats.Merged++;
+				waiter->Slot = i;
+				waiter->Used = true;
+				return;
+			}
+		}
+	}
+	else
+	{
+		// reads from before the write must not be handed out afterwards
+		for (i = 0; i < PETITGW_SLOTS; i++)
+		{
+			slot = &Gw->Slots[i];
+			if (slot->Req.Slave != unit && unit != 0)
+				continue;
+			if (slot->State == E_PETITGW_CACHED)
+				slot->State = E_PETITGW_FREE;
+			slot->Shared = false;
+		}
+	}
+
+	s = slot_alloc(Gw);
+	if (s == PETITGW_SLOTS)
+	{
+		Gw->Stats.Rejected++;
+		send_error(Gw, Client, transaction, unit, req.Function,
+				PETIT_ERROR_CODE_06);
+		return;
+	}
+	slot = &Gw->Slots[s];
+	slot->Req = req;
+	slot->Req.Data = slot->Data;
+	parse_data(Adu, &slot->Req);
+	slot->Req.Timeout = PETITGW_TIMEOUT;
+	slot->Req.Poll = 0;
+	slot->Req.Poll_Cnt = 0;
+	slot->Req.Pending = false;
+	slot->Req.Done = slot_done;
+	slot->Shared = req.Function <= C_FCODE_READ_INPUT_REGISTERS;
+	slot->State = E_PETITGW_QUEUED;
+	waiter->Slot = s;
+	waiter->Used = true;
+}
+
+/**
+ * Forgets the requests of a client whose connection went away.
+ */
+void PETIT_GATEWAY_Drop(T_PETIT_GATEWAY *Gw, void *Client)
+{
+	pu8_t i;
+
+	for (i = 0; i < PETITGW_WAITERS; i++)
+	{
+		if (Gw->Waiters[i].Client == Client)
+		{
+			Gw->Waiters[i].Used = false;
+		}
+	}
+}
+
+/******************************************************************************/
+
+/**
+ * @fn finish_slot
+ * Answers every client waiting on a completed slot and caches reads.
+ */
+static void finish_slot(T_PETIT_GATEWAY *Gw, pu8_t Slot)
+{
+	T_PETITGW_SLOT *slot = &Gw->Slots[Slot];
+	pu8_t i;
+
+	for (i = 0; i < PETITGW_WAITERS; i++)
+	{
+		if (Gw->Waiters[i].Used && Gw->Waiters[i].Slot == Slot)
+		{
+			Gw->Waiters[i].Used = false;
+			send_result(Gw, &Gw->Waiters[i], slot);
+		}
+	}
+	if (PETITGW_CACHE_TTL > 0 && slot->Shared
+			&& slot->Req.Status == PETITMASTER_OK)
+	{
+		slot->Stamp = Gw->Now;
+		slot->State = E_PETITGW_CACHED;
+	}
+	else
+	{
+		slot->State = E_PETITGW_FREE;
+	}
+}
+
+/**
+ * @fn PETIT_GATEWAY_Process
+ * Gateway main core!  Call this function into main instead of
+ * PETIT_MASTER_Process.
+ */
+void PETIT_GATEWAY_Process(T_PETIT_GATEWAY *Gw)
+{
+	pu8_t next = PETITGW_SLOTS;
+	pb_t busy = false;
+	pu8_t i;
+
+	PETIT_MASTER_Process(Gw->Master);
+
+	for (i = 0; i < PETITGW_SLOTS; i++)
+	{
+		T_PETITGW_SLOT *slot = &Gw->Slots[i];
+		switch (slot->State)
+		{
+		case E_PETITGW_DONE:
+			finish_slot(Gw, i);
+			break;
+		case E_PETITGW_CACHED:
+			// +1 so that a TTL of 0 does not compare an unsigned with 0
+			if ((pu16_t) (Gw->Now - slot->Stamp) + 1U > PETITGW_CACHE_TTL)
+				slot->State = E_PETITGW_FREE;
+			break;
+		case E_PETITGW_BUSY:
+			busy = true;
+			break;
+		case E_PETITGW_QUEUED:
+			// round robin, the unit right after the last one served wins
+			if (next == PETITGW_SLOTS
+					|| (pu8_t) (slot->Req.Slave - Gw->Last_Unit - 1U)
+					< (pu8_t) (Gw->Slots[next].Req.Slave - Gw->Last_Unit - 1U))
+			{
+				next = i;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!busy && next != PETITGW_SLOTS)
+	{
+		T_PETITGW_SLOT *slot = &Gw->Slots[next];
+		if (PETIT_MASTER_Request(Gw->Master, &slot->Req))
+		{
+			Gw->Stats.Transactions++;
+			Gw->Last_Unit = slot->Req.Slave;
+			slot->State = E_PETITGW_BUSY;
+		}
+		else
+		{
+			slot->Req.Status = PETIT_ERROR_CODE_03;
+			slot->State = E_PETITGW_DONE;
+		}
+	}
+}
+
+#endif /* PETITMODBUS_GATEWAY_ENABLED */
@@ -0,0 +1,169 @@
+/******************************************************************************
+ * @file PetitHeat.c
+ *
+ * This file contains the access heatmap of PetitModbus.
+ *
+ * Each table is a difference array one entry longer than the table, so the
+ * entry after the last register or block has room for the decrement.  The
+ * sum of the entries up to a register is its count, modulo the width of
+ * T_PETIT_HEAT_CNT.
+ *****************************************************************************/
+
+#include <string.h>
+#include "PetitHeat.h"
+
+#if defined(PETIT_HEAT) && PETIT_HEAT > 0
+
+static T_PETIT_HEAT_CNT heat_reg_read[NUMBER_OF_PETITREGISTERS + 1U];
+static T_PETIT_HEAT_CNT heat_reg_write[NUMBER_OF_PETITREGISTERS + 1U];
+static T_PETIT_HEAT_CNT heat_input_read[NUMBER_OF_INPUT_PETITREGISTERS + 1U];
+static T_PETIT_HEAT_CNT heat_coil_read[PETIT_HEAT_COIL_BLOCKS + 1U];
+static T_PETIT_HEAT_CNT heat_coil_write[PETIT_HEAT_COIL_BLOCKS + 1U];
+static T_PETIT_HEAT_CNT heat_discrete_read[PETIT_HEAT_DISCRETE_BLOCKS + 1U];
+
+// in the order of the PETIT_HEAT_xx tables
+static T_PETIT_HEAT_CNT *const heat_diff[PETIT_HEAT_TABLES] =
+{
+	heat_reg_read,
+	heat_reg_write,
+	heat_input_read,
+	heat_coil_read,
+	heat_coil_write,
+	heat_discrete_read
+};
+
+static const pu16_t heat_len[PETIT_HEAT_TABLES] =
+{
+	NUMBER_OF_PETITREGISTERS,
+	NUMBER_OF_PETITREGISTERS,
+	NUMBER_OF_INPUT_PETITREGISTERS,
+	PETIT_HEAT_COIL_BLOCKS,
+	PETIT_HEAT_COIL_BLOCKS,
+	PETIT_HEAT_DISCRETE_BLOCKS
+};
+
+/**
+ * Counts one access to a range, as the function handlers do once per
+ * request.  The application may count its own accesses too.
+ * @param[in] Table PETIT_HEAT_REG_READ, PETIT_HEAT_COIL_WRITE and so on
+ * @param[in] Start the first register, coil or discrete input
+ * @param[in] Cnt the number of registers, coils or discrete inputs
+ */
+void PETIT_HEAT_Count(pu8_t Table, pu16_t Start, pu16_t Cnt)
+{
+	T_PETIT_HEAT_CNT *diff;
+	pu16_t end;
+
+	if (Table >= PETIT_HEAT_TABLES || Cnt == 0)
+	{
+		return;
+	}
+	end = Start + Cnt;
+	if (Table >= PETIT_HEAT_COIL_READ)
+	{
+		// every block the range touches
+		Start /= PETIT_HEAT_BLOCK;
+		end = (end - 1U) / PETIT_HEAT_BLOCK + 1U;
+	}
+	if (end <= Start || end > heat_len[Table])
+	{
+		return;
+	}
+	diff = heat_diff[Table];
+	PETIT_ENTER_CRITICAL();
+	diff[Start]++;
+	diff[end]--;
+	PETIT_EXIT_CRITICAL();
+}
+
+/**
+ * @fn heat_sum
+ * Sums the difference array of a table up into counts, in one pass with
+ * interrupts off, so a request counted half way never shows up as a wrapped
+ * count.  Clearing the entries taken in the same pass loses no request in
+ * between; if Max cuts the table short, what was taken is carried over to
+ * the first entry left, so the counts of the rest stay as they were.
+ */
+static pu16_t heat_sum(pu8_t Table, T_PETIT_HEAT_CNT *Counts, pu16_t Max,
+		pb_t Clear)
+{
+	T_PETIT_HEAT_CNT *diff;
+	T_PETIT_HEAT_CNT sum = 0;
+	pu16_t len;
+	pu16_t i;
+
+	if (Table >= PETIT_HEAT_TABLES)
+	{
+		return 0;
+	}
+	len = heat_len[Table];
+	if (Counts == 0)
+	{
+		return len;
+	}
+	if (len > Max)
+	{
+		len = Max;
+	}
+	diff = heat_diff[Table];
+	PETIT_ENTER_CRITICAL();
+	for (i = 0; i < len; i++)
+	{
+		sum += diff[i];
+		Counts[i] = sum;
+	}
+	if (Clear)
+	{
+		memset(diff, 0, (size_t) len * sizeof(T_PETIT_HEAT_CNT));
+		diff[len] += sum;
+	}
+	PETIT_EXIT_CRITICAL();
+	return len;
+}
+
+/**
+ * Gives the accesses counted since the last reset.
+ *
+ * Interrupts stay off while the table is summed, for one addition and one
+ * store per register or block, which adds that much to the latency of the
+ * RX interrupt.
+ * @param[in] Table PETIT_HEAT_REG_READ, PETIT_HEAT_COIL_WRITE and so on
+ * @param[out] Counts the count of every register or block, from the first
+ *   on, or 0 to only get the size of the table
+ * @param[in] Max the room in Counts
+ * @return the counts given, or the size of the table if Counts is 0
+ */
+pu16_t PETIT_HEAT_Snapshot(pu8_t Table, T_PETIT_HEAT_CNT *Counts, pu16_t Max)
+{
+	return heat_sum(Table, Counts, Max, false);
+}
+
+/**
+ * Gives the accesses counted since the last reset or clear, as
+ * PETIT_HEAT_Snapshot does, and clears them in the same pass, so no request
+ * counted between a snapshot and a reset is lost.  Interrupts stay off a
+ * little longer, for the clear of the entries taken.
+ */
+pu16_t PETIT_HEAT_Snapshot_Clear(pu8_t Table, T_PETIT_HEAT_CNT *Counts,
+		pu16_t Max)
+{
+	return heat_sum(Table, Counts, Max, true);
+}
+
+/**
+ * Clears every table.
+ */
+void PETIT_HEAT_Reset(void)
+{
+	pu8_t t;
+
+	PETIT_ENTER_CRITICAL();
+	for (t = 0; t < PETIT_HEAT_TABLES; t++)
+	{
+		memset(heat_diff[t], 0,
+				((size_t) heat_len[t] + 1U) * sizeof(T_PETIT_HEAT_CNT));
+	}
+	PETIT_EXIT_CRITICAL();
+}
+
+#endif /* PETIT_HEAT */
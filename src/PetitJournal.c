@@ -0,0 +1,396 @@
+/******************************************************************************
+ * @file PetitJournal.c
+ *
+ * This file contains the persistence journal of PetitModbus.
+ *
+ * Writes only mark registers dirty, in a bitmap, so they are cheap enough for
+ * the RX interrupt and a register written many times between two calls of
+ * PETIT_JOURNAL_Poll costs one record.  PETIT_JOURNAL_Poll clears the mark
+ * and reads the value in one critical section, so a write that comes after
+ * marks the register again.
+ *****************************************************************************/
+
+#include "PetitJournal.h"
+#include "PetitShm.h"
+
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+
+#if PETIT_REG != PETIT_INTERNAL && PETIT_REG != PETIT_BOTH
+#error "PETIT_JOURNAL needs PetitRegisters, PETIT_REG PETIT_INTERNAL or PETIT_BOTH."
+#endif
+
+// start of the records in a sector
+#define C_PETIT_JOURNAL_LOG (PETIT_JOURNAL_HDR + 2UL * NUMBER_OF_PETITREGISTERS)
+// registers copied per flash access, checkpoints and boot alike
+#define C_PETIT_JOURNAL_CHUNK (16U)
+
+#if C_PETIT_JOURNAL_LOG + PETIT_JOURNAL_REC > PETIT_JOURNAL_SECTOR
+#error "PETIT_JOURNAL_SECTOR is too small for a checkpoint and a record."
+#endif
+
+typedef enum
+{
+	// appending records to the current sector
+	E_PETIT_JOURNAL_APPEND = 0,
+	// compacting into the other sector
+	E_PETIT_JOURNAL_ERASE,
+	E_PETIT_JOURNAL_COPY,
+	E_PETIT_JOURNAL_HEADER
+} T_PETIT_JOURNAL_STATE;
+
+static struct
+{
+	pu8_t Dirty[(NUMBER_OF_PETITREGISTERS + 7) >> 3];
+	// a register may be marked
+	volatile pb_t Any;
+	T_PETIT_JOURNAL_STATE State;
+	// current sector and its sequence number
+	pu8_t Sector;
+	pu16_t Seq;
+	// next record in the current sector
+	pu32_t Pos;
+	// next register to look at for a mark
+	pu16_t Cursor;
+	// registers in the checkpoint being written
+	pu16_t Copied;
+} journal;
+
+/******************************************************************************/
+
+/**
+ * @fn journal_base
+ * @return the flash offset of a sector
+ */
+static pu32_t journal_base(pu8_t Sector)
+{
+	return Sector ? PETIT_JOURNAL_SECTOR : 0;
+}
+
+static void journal_put16(pu8_t *Out, pu16_t Value)
+{
+	Out[0] = (pu8_t) (Value >> 8U);
+	Out[1] = (pu8_t) (Value & 0xFFU);
+}
+
+static pu16_t journal_get16(const pu8_t *In)
+{
+	return (pu16_t) ((pu16_t) In[0] << 8U | In[1]);
+}
+
+/**
+ * @fn journal_header
+ * Reads the header of a sector.
+ * @param[out] Seq its sequence number
+ * @return 1 if the sector holds a complete checkpoint of these registers
+ */
+static pb_t journal_header(pu8_t Sector, pu16_t *Seq)
+{
+	pu8_t h[PETIT_JOURNAL_HDR];
+	pu16_t magic;
+	pu16_t regs;
+
+	if (!PetitPortFlashRead(journal_base(Sector), h, sizeof(h)))
+	{
+		return 0;
+	}
+	magic = journal_get16(&h[0]);
+	*Seq = journal_get16(&h[2]);
+	regs = journal_get16(&h[4]);
+	return magic == PETIT_JOURNAL_MAGIC && regs == NUMBER_OF_PETITREGISTERS
+			&& journal_get16(&h[6]) == (pu16_t) ~(magic ^ *Seq ^ regs);
+}
+
+/**
+ * @fn journal_replay
+ * Loads the checkpoint of the current sector into PetitRegisters and applies
+ * the records after it, up to the first one that is not valid.
+ * @return 1 if the log ends in erased flash, so records can follow
+ */
+static pb_t journal_replay(void)
+{
+	pu8_t buf[C_PETIT_JOURNAL_CHUNK * PETIT_JOURNAL_REC];
+	pu32_t base = journal_base(journal.Sector);
+	pu16_t i;
+	pu16_t n;
+	pu16_t addr;
+	pu16_t value;
+
+	for (i = 0; i < NUMBER_OF_PETITREGISTERS; i += n)
+	{
+		n = NUMBER_OF_PETITREGISTERS - i;
+		if (n > C_PETIT_JOURNAL_CHUNK)
+		{
+			n = C_PETIT_JOURNAL_CHUNK;
+		}
+		if (!PetitPortFlashRead(base + PETIT_JOURNAL_HDR + 2UL * i, buf,
+				2U * n))
+		{
+			return 0;
+		}
+		PetitRegsFromWire(&PetitRegisters[i], buf, n);
+	}
+
+	journal.Pos = C_PETIT_JOURNAL_LOG;
+	for (;;)
+	{
+		// whole records in what is left of the sector, a chunk at a time
+		n = (pu16_t) ((PETIT_JOURNAL_SECTOR - journal.Pos) / PETIT_JOURNAL_REC);
+		if (n == 0)
+		{
+			return 1;
+		}
+		if (n > C_PETIT_JOURNAL_CHUNK)
+		{
+			n = C_PETIT_JOURNAL_CHUNK;
+		}
+		if (!PetitPortFlashRead(base + journal.Pos, buf,
+				n * PETIT_JOURNAL_REC))
+		{
+			return 0;
+		}
+		for (i = 0; i < n; i++)
+		{
+			const pu8_t *rec = &buf[i * PETIT_JOURNAL_REC];
+			addr = journal_get16(&rec[0]);
+			value = journal_get16(&rec[2]);
+			if (addr >= NUMBER_OF_PETITREGISTERS || journal_get16(&rec[4])
+					!= (pu16_t) (addr ^ value ^ PETIT_JOURNAL_KEY))
+			{
+				// the end of the log, unless a record was cut short
+				return rec[0] == 0xFFU && rec[1] == 0xFFU && rec[2] == 0xFFU
+						&& rec[3] == 0xFFU && rec[4] == 0xFFU
+						&& rec[5] == 0xFFU;
+			}
+			PETIT_REG_STORE(PetitRegisters[addr], value);
+			journal.Pos += PETIT_JOURNAL_REC;
+		}
+	}
+}
+
+/**
+ * @fn journal_next
+ * Takes the next marked register, and its value, from the cursor on.
+ * @return 1 with a register in Addr and its value in Value, 0 if none is
+ *   marked
+ */
+static pb_t journal_next(pu16_t *Addr, pu16_t *Value)
+{
+	pu16_t i = journal.Cursor;
+	pu16_t n;
+	pu16_t step;
+	pu8_t bit;
+
+	for (n = 0; n < NUMBER_OF_PETITREGISTERS; n += step)
+	{
+		bit = (pu8_t) (1U << (i & 7U));
+		step = 1U;
+		if ((i & 7U) == 0 && journal.Dirty[i >> 3] == 0)
+		{
+			// a whole byte without marks
+			step = (pu16_t) (NUMBER_OF_PETITREGISTERS - i);
+			if (step > 8U)
+			{
+				step = 8U;
+			}
+		}
+		else if (journal.Dirty[i >> 3] & bit)
+		{
+			PETIT_ENTER_CRITICAL();
+			journal.Dirty[i >> 3] &= (pu8_t) ~bit;
+			*Value = PETIT_REG_LOAD(PetitRegisters[i]);
+			PETIT_EXIT_CRITICAL();
+			*Addr = i;
+			journal.Cursor = i + 1U < NUMBER_OF_PETITREGISTERS ? i + 1U : 0;
+			return 1;
+		}
+		i += step;
+		if (i >= NUMBER_OF_PETITREGISTERS)
+		{
+			i = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @fn journal_compact
+ * Takes one step of writing a checkpoint into the other sector.
+ */
+static void journal_compact(void)
+{
+	pu8_t buf[2U * C_PETIT_JOURNAL_CHUNK];
+	pu8_t other = journal.Sector ^ 1U;
+	pu32_t base = journal_base(other);
+	pu16_t n;
+
+	switch (journal.State)
+	{
+	case E_PETIT_JOURNAL_ERASE:
+		if (PetitPortFlashErase(base))
+		{
+			journal.Copied = 0;
+			journal.State = E_PETIT_JOURNAL_COPY;
+		}
+		break;
+	case E_PETIT_JOURNAL_COPY:
+		n = NUMBER_OF_PETITREGISTERS - journal.Copied;
+		if (n > C_PETIT_JOURNAL_CHUNK)
+		{
+			n = C_PETIT_JOURNAL_CHUNK;
+		}
+		PetitRegsToWire(buf, &PetitRegisters[journal.Copied], n);
+		if (!PetitPortFlashWrite(base + PETIT_JOURNAL_HDR
+				+ 2UL * journal.Copied, buf, 2U * n))
+		{
+			// start over on freshly erased flash
+			journal.State = E_PETIT_JOURNAL_ERASE;
+			break;
+		}
+		journal.Copied += n;
+		if (journal.Copied == NUMBER_OF_PETITREGISTERS)
+		{
+			journal.State = E_PETIT_JOURNAL_HEADER;
+		}
+		break;
+	default:
+		journal_put16(&buf[0], PETIT_JOURNAL_MAGIC);
+		journal_put16(&buf[2], journal.Seq + 1U);
+		journal_put16(&buf[4], NUMBER_OF_PETITREGISTERS);
+		journal_put16(&buf[6], (pu16_t) ~(PETIT_JOURNAL_MAGIC
+				^ (pu16_t) (journal.Seq + 1U) ^ NUMBER_OF_PETITREGISTERS));
+		if (!PetitPortFlashWrite(base, buf, PETIT_JOURNAL_HDR))
+		{
+			journal.State = E_PETIT_JOURNAL_ERASE;
+			break;
+		}
+		// the checkpoint is complete, the other sector takes over
+		journal.Sector = other;
+		journal.Seq++;
+		journal.Pos = C_PETIT_JOURNAL_LOG;
+		journal.State = E_PETIT_JOURNAL_APPEND;
+		break;
+	}
+}
+
+/**
+ * Rebuilds PetitRegisters from the journal at boot.  Call it once the
+ * registers hold their defaults and before the slave starts.
+ *
+ * Without a journal in flash, or one for another number of registers, the
+ * defaults are kept and become the first checkpoint.
+ * @return 1 if the registers were restored, 0 if they kept their defaults
+ */
+pb_t PETIT_JOURNAL_Init(void)
+{
+	pu16_t seq[2];
+	pb_t valid[2];
+	pb_t restored = 0;
+	pu16_t i;
+
+	for (i = 0; i < sizeof(journal.Dirty); i++)
+	{
+		journal.Dirty[i] = 0;
+	}
+	journal.Any = 0;
+	journal.Cursor = 0;
+
+	valid[0] = journal_header(0, &seq[0]);
+	valid[1] = journal_header(1U, &seq[1]);
+	if (valid[0] || valid[1])
+	{
+		// the newer sector, sequence numbers wrap
+		journal.Sector = !valid[0] || (valid[1]
+				&& (pu16_t) (seq[1] - seq[0]) < 0x8000U) ? 1U : 0;
+		journal.Seq = seq[journal.Sector];
+		restored = 1;
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		journal.State = journal_replay() ? E_PETIT_JOURNAL_APPEND
+				: E_PETIT_JOURNAL_ERASE;
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+	}
+	else
+	{
+		// the first checkpoint goes to sector 0
+		journal.Sector = 1U;
+		journal.Seq = 0;
+		journal.State = E_PETIT_JOURNAL_ERASE;
+	}
+	// a fresh checkpoint makes the log usable right away
+	while (journal.State != E_PETIT_JOURNAL_APPEND)
+	{
+		journal_compact();
+	}
+	return restored;
+}
+
+/**
+ * Persists marked registers and compacts the journal, a few flash accesses at
+ * a time.  Call it from the main loop.
+ * @return 1 if there is more to do, 0 if everything marked is in flash
+ */
+pb_t PETIT_JOURNAL_Poll(void)
+{
+	pu8_t rec[PETIT_JOURNAL_REC];
+	pu16_t addr;
+	pu16_t value;
+	pu8_t n;
+
+	if (journal.State != E_PETIT_JOURNAL_APPEND)
+	{
+		journal_compact();
+		return 1;
+	}
+	if (!journal.Any)
+	{
+		return 0;
+	}
+	journal.Any = 0;
+	for (n = 0; n < PETIT_JOURNAL_BURST; n++)
+	{
+		if (journal.Pos + PETIT_JOURNAL_REC > PETIT_JOURNAL_SECTOR)
+		{
+			// full, the marks stay until the other sector takes over
+			journal.Any = 1;
+			journal.State = E_PETIT_JOURNAL_ERASE;
+			return 1;
+		}
+		if (!journal_next(&addr, &value))
+		{
+			return 0;
+		}
+		journal_put16(&rec[0], addr);
+		journal_put16(&rec[2], value);
+		journal_put16(&rec[4], (pu16_t) (addr ^ value ^ PETIT_JOURNAL_KEY));
+		if (!PetitPortFlashWrite(journal_base(journal.Sector) + journal.Pos,
+				rec, sizeof(rec)))
+		{
+			// the record may be half written, move on to the other sector
+			PETIT_JOURNAL_Mark(addr, 1U);
+			journal.State = E_PETIT_JOURNAL_ERASE;
+			return 1;
+		}
+		journal.Pos += PETIT_JOURNAL_REC;
+	}
+	journal.Any = 1;
+	return 1;
+}
+
+/**
+ * Marks registers to be persisted, for registers the application writes
+ * itself.  Functions 6 and 16 mark theirs.
+ * @param[in] Addr the first register
+ * @param[in] Cnt the number of registers
+ */
+void PETIT_JOURNAL_Mark(pu16_t Addr, pu16_t Cnt)
+{
+	PETIT_ENTER_CRITICAL();
+	while (Cnt-- != 0 && Addr < NUMBER_OF_PETITREGISTERS)
+	{
+		journal.Dirty[Addr >> 3] |= (pu8_t) (1U << (Addr & 7U));
+		Addr++;
+	}
+	journal.Any = 1;
+	PETIT_EXIT_CRITICAL();
+}
+
+#endif /* PETIT_JOURNAL */
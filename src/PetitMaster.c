@@ -0,0 +1,460 @@
+/******************************************************************************
+ * @file PetitMaster.c
+ *
+ * This file contains the asynchronous RTU master of PetitModbus.
+ *
+ * The port feeds received bytes to PetitMasterRxBufferInsert, sends with
+ * PetitTxBufferPop on Link just like the slave, and calls PETIT_MASTER_Tick
+ * from a periodic timer.  The main loop calls PETIT_MASTER_Process for every
+ * serial line; it never blocks.
+ *****************************************************************************/
+
+#include "PetitMaster.h"
+
+#if defined(PETITMODBUS_MASTER_ENABLED) && PETITMODBUS_MASTER_ENABLED > 0
+
+// the most coils a read fits in the buffer, capped by the modbus PDU
+#define C_PETITMASTER_MAX_COILS \
+	((C_PETITMODBUS_RXTX_BUFFER_SIZE - 5U) * 8U > 2000U ? 2000U : \
+			(C_PETITMODBUS_RXTX_BUFFER_SIZE - 5U) * 8U)
+
+/******************************************************************************/
+void PETIT_MASTER_Init(T_PETIT_MASTER *Master)
+{
+	PETIT_MODBUS_Init(&Master->Link);
+	Master->Head = 0;
+	Master->Cnt = 0;
+	Master->Active = 0;
+	Master->Timer = 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @fn request_len
+ * Works out the length of the request ADU without its CRC.
+ * @param[in] Size the size of the link buffer
+ * @return the length, 0 if the request is not supported or does not fit
+ */
+static pu16_t request_len(const T_PETIT_MASTER_REQ *Req, pu16_t Size)
+{
+	switch (Req->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		if (Req->Count == 0 || Req->Count > C_PETITMASTER_MAX_COILS ||
+				((Req->Count + 7U) >> 3) + 5U > Size)
+			return 0;
+		return 6U;
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		if (Req->Count == 0 || Req->Count > C_PETITMASTER_MAX_REGS ||
+				2U * Req->Count + 5U > Size)
+			return 0;
+		return 6U;
+	case C_FCODE_WRITE_SINGLE_COIL:
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		return 6U;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		if (Req->Count == 0 ||
+				((Req->Count + 7U) >> 3) + 9U > Size)
+			return 0;
+		return ((Req->Count + 7U) >> 3) + 7U;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		if (Req->Count == 0 || Req->Count > 123U ||
+				2U * Req->Count + 9U > Size)
+			return 0;
+		return 2U * Req->Count + 7U;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Queues a request on the serial line.  Must not be called from an interrupt.
+ * @return true if queued, false if the queue is full, the request is already
+ *   pending or it can not be sent
+ */
+pb_t PETIT_MASTER_Request(T_PETIT_MASTER *Master, T_PETIT_MASTER_REQ *Req)
+{
+	if (Master->Cnt >= PETITMASTER_QUEUE_SIZE || Req->Pending
+			|| request_len(Req, PETIT_BUF_SIZE_M(&Master->Link)) == 0)
+	{
+		return false;
+	}
+	Req->Pending = true;
+	Master->Queue[(Master->Head + Master->Cnt) % PETITMASTER_QUEUE_SIZE] = Req;
+	Master->Cnt++;
+	return true;
+}
+
+/**
+ * @fn start_request
+ * Builds the request ADU in the link buffer and sends its first byte.
+ * The rest of the request goes out through PetitTxBufferPop.
+ */
+static void start_request(T_PETIT_MASTER *Master, T_PETIT_MASTER_REQ *Req)
+{
+	T_PETIT_MODBUS *Link = &Master->Link;
+	pu8_t *Buf = Link->Buffer;
+	pu16_t len = request_len(Req, PETIT_BUF_SIZE_M(Link));
+	pu16_t i;
+
+	Buf[0] = Req->Slave;
+	Buf[1] = Req->Function;
+	Buf[2] = Req->Address >> 8U;
+	Buf[3] = Req->Address;
+	Buf[4] = Req->Count >> 8U;
+	Buf[5] = Req->Count;
+	// +1 slave address; +1 function; +2 address; +2 value; +2 CRC16
+	Link->Expected_RX_Cnt = 8U;
+
+	switch (Req->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		// +1 slave address; +1 function; +1 byte count; +2 CRC16
+		Link->Expected_RX_Cnt = ((Req->Count + 7U) >> 3) + 5U;
+		break;
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		Link->Expected_RX_Cnt = 2U * Req->Count + 5U;
+		break;
+	case C_FCODE_WRITE_SINGLE_COIL:
+		Buf[4] = (Req->Data[0] & 1U) ? 0xFFU : 0;
+		Buf[5] = 0;
+		break;
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		Buf[4] = Req->Data[0] >> 8U;
+		Buf[5] = Req->Data[0];
+		break;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+		Buf[6] = len - 7U;
+		for (i = 0; i < Buf[6]; i++)
+		{
+			Buf[7U + i] = 0;
+		}
+		for (i = 0; i < Req->Count; i++)
+		{
+			if (Req->Data[i >> 4] & 1U << (i & 15U))
+			{
+				Buf[7U + (i >> 3)] |= 1U << (i & 7U);
+			}
+		}
+		break;
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		Buf[6] = len - 7U;
+		for (i = 0; i < Req->Count; i++)
+		{
+			Buf[2U*i + 7U] = Req->Data[i] >> 8U;
+			Buf[2U*i + 8U] = Req->Data[i];
+		}
+		break;
+	}
+
+	PetitCRC16(Link, Buf, len);
+	Buf[len++] = Link->CRC16;
+	Buf[len++] = Link->CRC16 >> 8U;
+
+	Master->Active = Req;
+	Master->Timer = Req->Timeout;
+	Link->Ptr = Buf;
+	Link->BufI = len;
+	Link->Xmit_State = E_PETIT_RXTX_TX;
+	// print first character to start UART peripheral
+	Link->BufI--;
+	Link->Tx_Begin(*Link->Ptr++);
+}
+
+/******************************************************************************/
+
+/**
+ * @fn put_value
+ * Stores one register or coil value at Idx of a destination array.
+ */
+static void put_value(pu16_t *Data, pu8_t Function, pu16_t Idx, pu16_t Value)
+{
+	if (Function <= C_FCODE_READ_DISCRETES)
+	{
+		if (Value)
+			Data[Idx >> 4] |= 1U << (Idx & 15U);
+		else
+			Data[Idx >> 4] &= ~(1U << (Idx & 15U));
+	}
+	else
+	{
+		Data[Idx] = Value;
+	}
+}
+
+/**
+ * @fn store_value
+ * Stores one value read by the request, Idx being relative to its start
+ * address.  Planned requests scatter into every poll entry covering it.
+ */
+static void store_value(T_PETIT_MASTER_REQ *Req, pu16_t Idx, pu16_t Value)
+{
+	pu16_t address = Req->Address + Idx;
+	pu8_t i;
+
+	if (Req->Poll == 0)
+	{
+		put_value(Req->Data, Req->Function, Idx, Value);
+		return;
+	}
+	for (i = 0; i < Req->Poll_Cnt; i++)
+	{
+		T_PETIT_MASTER_POLL *poll = &Req->Poll[i];
+		if (address >= poll->Address && address - poll->Address < poll->Count)
+		{
+			put_value(poll->Data, Req->Function, address - poll->Address,
+					Value);
+		}
+	}
+}
+
+/**
+ * @fn decode_response
+ * Validates the received response and stores what it carries.
+ * @return the completion status of the active request
+ */
+static pu8_t decode_response(T_PETIT_MASTER *Master)
+{
+	T_PETIT_MODBUS *Link = &Master->Link;
+	T_PETIT_MASTER_REQ *Req = Master->Active;
+	pu8_t *Buf = Link->Buffer;
+	pu16_t len = Link->BufI;
+	pu16_t i;
+
+	if (len < 5U)
+		return PETITMASTER_BAD_FRAME;
+	if (PetitCRC16(Link, Buf, len - 2U) !=
+			((pu16_t) Buf[len - 2U] | (pu16_t) Buf[len - 1U] << 8U))
+		return PETITMASTER_BAD_CRC;
+	if (Buf[0] != Req->Slave || (Buf[1] & 0x7FU) != Req->Function)
+		return PETITMASTER_BAD_FRAME;
+	if (Buf[1] & 0x80U)
+		return Buf[2];
+
+	switch (Req->Function)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+		if (Buf[2] != len - 5U)
+			return PETITMASTER_BAD_FRAME;
+		for (i = 0; i < Req->Count; i++)
+		{
+			store_value(Req, i, (Buf[3U + (i >> 3)] >> (i & 7U)) & 1U);
+		}
+		break;
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		if (Buf[2] != len - 5U)
+			return PETITMASTER_BAD_FRAME;
+		for (i = 0; i < Req->Count; i++)
+		{
+			store_value(Req, i, (pu16_t) Buf[2U*i + 3U] << 8U
+					| Buf[2U*i + 4U]);
+		}
+		break;
+	default:
+		// writes echo the address they were given
+		if (len != 8U || ((pu16_t) Buf[2] << 8U | Buf[3]) != Req->Address)
+			return PETITMASTER_BAD_FRAME;
+		break;
+	}
+	return PETITMASTER_OK;
+}
+
+/**
+ * Inserts a byte of the response on device receive.
+ * @param[in] rcvd the byte to insert into the buffer
+ * @return bytes "left" to insert into buffer (1 if byte insertion failed)
+ */
+pb_t PetitMasterRxBufferInsert(T_PETIT_MASTER *Master, pu8_t rcvd)
+{
+	T_PETIT_MODBUS *Link = &Master->Link;
+
+	if (Master->Active != 0 && Link->Xmit_State == E_PETIT_RXTX_RX
+			&& Link->BufI < PETIT_BUF_SIZE_M(Link))
+	{
+		*Link->Ptr++ = rcvd;
+		Link->BufI++;
+		// exceptions are always five bytes long
+		if (Link->BufI == 2U && (rcvd & 0x80U))
+		{
+			Link->Expected_RX_Cnt = 5U;
+		}
+		if (Link->BufI >= Link->Expected_RX_Cnt)
+		{
+			Link->Xmit_State = E_PETIT_RXTX_PROCESS;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Counts down the response timeout and the idle time between transactions.
+ * Call this from a periodic timer interrupt.
+ */
+void PETIT_MASTER_Tick(T_PETIT_MASTER *Master)
+{
+	if (Master->Timer != 0 && Master->Link.Xmit_State != E_PETIT_RXTX_TX)
+	{
+		Master->Timer--;
+	}
+}
+
+/**
+ * @fn PETIT_MASTER_Process
+ * Master main core!  Call this function into main for every serial line.
+ *
+ * Completes the request on the bus once its response is in, it timed out or,
+ * for broadcasts, once it has been sent.  The next queued request starts as
+ * soon as the bus has been idle for PETITMASTER_TURNAROUND ticks.
+ */
+void PETIT_MASTER_Process(T_PETIT_MASTER *Master)
+{
+	T_PETIT_MASTER_REQ *Req = Master->Active;
+
+	if (Req != 0)
+	{
+		if (Master->Link.Xmit_State == E_PETIT_RXTX_PROCESS)
+			Req->Status = decode_response(Master);
+		else if (Master->Link.Xmit_State == E_PETIT_RXTX_TX)
+			return;
+		else if (Req->Slave == 0)
+			Req->Status = PETITMASTER_OK;
+		else if (Master->Timer == 0)
+			Req->Status = PETITMASTER_TIMEOUT;
+		else
+			return;
+
+		Master->Active = 0;
+		Master->Timer = PETITMASTER_TURNAROUND;
+		Master->Link.Xmit_State = E_PETIT_RXTX_RX;
+		PetitRxBufferReset(&Master->Link);
+		// cleared first so that the callback can queue the request again
+		Req->Pending = false;
+		if (Req->Done != 0)
+		{
+			Req->Done(Req);
+		}
+	}
+
+	if (Master->Active == 0 && Master->Timer == 0 && Master->Cnt != 0)
+	{
+		Req = Master->Queue[Master->Head];
+		Master->Head = (Master->Head + 1U) % PETITMASTER_QUEUE_SIZE;
+		Master->Cnt--;
+		start_request(Master, Req);
+	}
+}
+
+/******************************************************************************/
+
+/**
+ * @fn poll_before
+ * Orders poll entries by slave, function and address.
+ */
+static pb_t poll_before(const T_PETIT_MASTER_POLL *A,
+		const T_PETIT_MASTER_POLL *B)
+{
+	if (A->Slave != B->Slave)
+		return A->Slave < B->Slave;
+	if (A->Function != B->Function)
+		return A->Function < B->Function;
+	return A->Address < B->Address;
+}
+
+/**
+ * Merges polled ranges into the fewest read requests the PDU allows.
+ *
+ * Polls are sorted in place and each request covers a run of adjacent or
+ * overlapping ranges of one slave and function code.  The requests keep
+ * pointers into Polls, which must not be moved while they are in use.
+ * @param[in,out] Polls the ranges to poll, with function codes 1 to 4
+ * @param[out] Reqs the requests to build
+ * @param[in] Req_Max the number of requests Reqs can hold
+ * @return the number of requests built
+ */
+pu8_t PETIT_MASTER_Plan(T_PETIT_MASTER_POLL *Polls, pu8_t Poll_Cnt,
+		T_PETIT_MASTER_REQ *Reqs, pu8_t Req_Max)
+{
+	pu8_t i;
+	pu8_t j;
+	pu8_t n = 0;
+
+	// insertion sort, the poll list is short and mostly sorted already
+	for (i = 1; i < Poll_Cnt; i++)
+	{
+		T_PETIT_MASTER_POLL poll = Polls[i];
+		for (j = i; j > 0 && poll_before(&poll, &Polls[j - 1U]); j--)
+		{
+			Polls[j] = Polls[j - 1U];
+		}
+		Polls[j] = poll;
+	}
+
+	for (i = 0; i < Poll_Cnt && n < Req_Max; i = j)
+	{
+		T_PETIT_MASTER_REQ *req = &Reqs[n++];
+		pu16_t max = Polls[i].Function <= C_FCODE_READ_DISCRETES ?
+				C_PETITMASTER_MAX_COILS : C_PETITMASTER_MAX_REGS;
+		pu16_t end = Polls[i].Address + Polls[i].Count;
+		pu16_t timeout = Polls[i].Timeout;
+
+		for (j = i + 1U; j < Poll_Cnt
+				&& Polls[j].Slave == Polls[i].Slave
+				&& Polls[j].Function == Polls[i].Function
+				&& Polls[j].Address <= end; j++)
+		{
+			pu16_t next = Polls[j].Address + Polls[j].Count;
+			if (next > end)
+			{
+				if (next - Polls[i].Address > max)
+					break;
+				end = next;
+			}
+			if (Polls[j].Timeout > timeout)
+				timeout = Polls[j].Timeout;
+		}
+
+		req->Slave = Polls[i].Slave;
+		req->Function = Polls[i].Function;
+		req->Address = Polls[i].Address;
+		req->Count = end - Polls[i].Address;
+		req->Timeout = timeout;
+		req->Data = 0;
+		req->Poll = &Polls[i];
+		req->Poll_Cnt = j - i;
+		req->Status = PETITMASTER_OK;
+		req->Pending = false;
+		req->Done = 0;
+	}
+	return n;
+}
+
+/**
+ * Queues every request of a poll plan that is not already pending.
+ * Calling this on every pass of the main loop keeps the line fully busy.
+ * @return the number of requests queued
+ */
+pu8_t PETIT_MASTER_Cycle(T_PETIT_MASTER *Master, T_PETIT_MASTER_REQ *Reqs,
+		pu8_t Cnt)
+{
+	pu8_t i;
+	pu8_t queued = 0;
+
+	for (i = 0; i < Cnt && Master->Cnt < PETITMASTER_QUEUE_SIZE; i++)
+	{
+		if (PETIT_MASTER_Request(Master, &Reqs[i]))
+		{
+			queued++;
+		}
+	}
+	return queued;
+}
+
+#endif /* PETITMODBUS_MASTER_ENABLED */
@@ -4,22 +4,14 @@
  * This file contains the core of PetitModbus.
  *****************************************************************************/
 
+#include <string.h>
 #include "PetitModbus.h"
-
-/*******************************ModBus Functions*******************************/
-#define C_FCODE_READ_COILS                  (1U)
-#define C_FCODE_READ_DISCRETES              (2U)
-#define C_FCODE_READ_HOLDING_REGISTERS      (3U)
-#define C_FCODE_READ_INPUT_REGISTERS        (4U)
-#define C_FCODE_WRITE_SINGLE_COIL           (5U)
-#define C_FCODE_WRITE_SINGLE_REGISTER       (6U)
-#define C_FCODE_WRITE_MULTIPLE_COILS        (15U)
-#define C_FCODE_WRITE_MULTIPLE_REGISTERS    (16U)
-/****************************End of ModBus Functions***************************/
-#define PETIT_ERROR_CODE_01                     (0x01U)                            // Function code is not supported
-#define PETIT_ERROR_CODE_02                     (0x02U)                            // Register address is not allowed or write-protected
-#define PETIT_ERROR_CODE_03						(0X03U)                            // Third field incorrect
-#define PETIT_ERROR_CODE_04						(0x04U)                            // Fourth or subsequent field incorrect
+#include "PetitSniff.h"
+#include "PetitRxRing.h"
+#include "PetitJournal.h"
+#include "PetitShm.h"
+#include "PetitHeat.h"
+#include "PetitDelta.h"
 
 #define C_IBUF_FN_CODE 					(1U)
 #define C_IBUF_BYTE_CNT                    (6U)
@@ -30,6 +22,95 @@
 #define PETIT_BUF_DAT_M(Idx) (((pu16_t)(Petit->Buffer[2U*(Idx) + 2U]) << 8U) \
 			| (pu16_t) (Petit->Buffer[2U*(Idx) + 3U]))
 
+/**
+ * The most registers functions 3 and 4 read at once.  Streamed responses are
+ * only limited by the modbus PDU, and jumbo frames by what was negotiated.
+ */
+#if PETIT_STREAM > 0
+#define PETIT_STD_READ_REGS_M(Petit) (125U)
+#else
+#define PETIT_STD_READ_REGS_M(Petit) (PETIT_BUF_REGS_M(Petit) < 125U ? \
+			PETIT_BUF_REGS_M(Petit) : 125U)
+#endif
+#if PETIT_JUMBO > 0
+#define PETIT_READ_REGS_M(Petit) ((Petit)->Jumbo_Regs != 0 ? \
+			(Petit)->Jumbo_Regs : PETIT_STD_READ_REGS_M(Petit))
+#else
+#define PETIT_READ_REGS_M(Petit) PETIT_STD_READ_REGS_M(Petit)
+#endif
+
+/**
+ * The first data byte of a read register response, after a byte count that
+ * is 16 bits wide in a jumbo frame
+ */
+#if PETIT_JUMBO > 0
+#define PETIT_RSP_DATA_M(Petit) (3U + ((Petit)->Jumbo_Regs != 0 ? 1U : 0U))
+#else
+#define PETIT_RSP_DATA_M(Petit) (3U)
+#endif
+
+/**
+ * Typed points are stored inside a critical section, and the block copy of
+ * functions 3 and 4 takes one too, so that it never holds half of a point.
+ */
+#if defined(PETITMODBUS_POINTS_ENABLED) && PETITMODBUS_POINTS_ENABLED > 0
+#define PETIT_POINT_READ_BEGIN() PETIT_ENTER_CRITICAL()
+#define PETIT_POINT_READ_END() PETIT_EXIT_CRITICAL()
+#else
+#define PETIT_POINT_READ_BEGIN()
+#define PETIT_POINT_READ_END()
+#endif
+
+#if PETIT_SHADOW > 0
+/**
+ * The shadow bank holds the data of a write of functions 15 or 16 as it was
+ * received, big enough for the largest write the configuration accepts.  It
+ * is shared by all instances and held by one request at a time.
+ */
+#define C_PETIT_SHADOW_REG_SIZE (2U * (NUMBER_OF_PETITREGISTERS < 123U ? \
+			NUMBER_OF_PETITREGISTERS : 123U))
+#define C_PETIT_SHADOW_COIL_SIZE ((NUMBER_OF_PETITCOILS < 1968U ? \
+			NUMBER_OF_PETITCOILS + 7U : 1968U + 7U) / 8U)
+#define C_PETIT_SHADOW_SIZE \
+	(C_PETIT_SHADOW_REG_SIZE > C_PETIT_SHADOW_COIL_SIZE ? \
+			C_PETIT_SHADOW_REG_SIZE : C_PETIT_SHADOW_COIL_SIZE)
+
+static pu8_t PetitShadow[C_PETIT_SHADOW_SIZE];
+// the instance the shadow bank belongs to, 0 if it is free
+static T_PETIT_MODBUS *PetitShadowOwner;
+#endif
+
+/**
+ * This macro moves the instance to another T_PETIT_XMIT_STATE, tracing the
+ * transition if PETIT_TRACE is enabled
+ */
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+#define PETIT_SET_STATE_M(State) do { Petit->Xmit_State = (State); \
+			trace_event(Petit, (State)); } while (0)
+#else
+#define PETIT_SET_STATE_M(State) (Petit->Xmit_State = (State))
+#endif
+
+static const T_PETIT_FUNCTION *find_function(const T_PETIT_MODBUS *Petit,
+		pu8_t Code);
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+static void trace_event(T_PETIT_MODBUS *Petit, pu8_t Event);
+#endif
+#if PETIT_STREAM > 0
+static pu8_t stream_byte(T_PETIT_MODBUS *Petit);
+#endif
+#if PETIT_SHADOW > 0
+static pb_t stage_start(T_PETIT_MODBUS *Petit);
+static void stage_byte(T_PETIT_MODBUS *Petit, pu8_t Rx);
+static void stage_release(T_PETIT_MODBUS *Petit);
+#endif
+#if PETITMODBUS_PROCESS_POSITION >= 2
+static void rx_rtu(T_PETIT_MODBUS *Petit);
+static void response_process(T_PETIT_MODBUS *Petit);
+static void tx_rtu(T_PETIT_MODBUS *Petit);
+static void tx_delay(T_PETIT_MODBUS *Petit);
+#endif
+
 /*************************************************k****************************/
 void PETIT_MODBUS_Init(T_PETIT_MODBUS *Petit)
 {
@@ -44,10 +125,205 @@ void PETIT_MODBUS_Init(T_PETIT_MODBUS *Petit)
 	Petit->Ptr = Petit->Buffer;
 	Petit->Tx_Ctr = 0;
 	Petit->Expected_RX_Cnt = 0;
+	Petit->Function = 0;
+	Petit->User_Functions = 0;
+	Petit->User_Function_Cnt = 0;
+#if PETIT_STREAM > 0
+	Petit->Stream_Cnt = 0;
+#endif
+#if PETIT_SHADOW > 0
+	Petit->Stage_Cnt = 0;
+#endif
+#if PETIT_SNIFF > 0
+	Petit->Sniff = 0;
+#endif
+#if PETIT_JUMBO > 0
+	Petit->Jumbo_Regs = 0;
+#endif
+#if PETIT_RXRING > 0
+	Petit->Rx_Ring = 0;
+#endif
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	Petit->Buffer = 0;
+	Petit->Buffer_Size = 0;
+	Petit->Pool = 0;
+	Petit->Ptr = 0;
+#endif
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+	PETIT_MODBUS_Trace_Reset(Petit);
+#endif
+}
+
+/**
+ * Registers additional function codes at init.
+ *
+ * The table is searched before the built-in one, so it can also replace the
+ * handling of a standard function code.  It is not copied and must outlive
+ * the instance.
+ * @param[in] Functions the table of function code entries
+ * @param[in] Cnt the number of entries in the table
+ */
+void PETIT_MODBUS_Register_Functions(T_PETIT_MODBUS *Petit,
+		const T_PETIT_FUNCTION *Functions, pu8_t Cnt)
+{
+	Petit->User_Functions = Functions;
+	Petit->User_Function_Cnt = Cnt;
+	// the kept entry may be replaced now
+	Petit->Function = 0;
+}
+
+#if PETIT_SNIFF > 0
+/**
+ * Turns the instance into a bus monitor capturing into Sniff, or back into a
+ * slave.  Call it while the instance is idle.
+ * @param[in] Sniff the capture ring, set up with PETIT_SNIFF_Init, or 0
+ */
+void PETIT_MODBUS_Set_Monitor(T_PETIT_MODBUS *Petit, T_PETIT_SNIFF *Sniff)
+{
+	Petit->Sniff = Sniff;
+	Petit->BufI = 0;
+	Petit->Expected_RX_Cnt = 0;
+	if (Sniff != 0)
+	{
+		Sniff->Len = 0;
+	}
+}
+#endif
+
+#if PETIT_RXRING > 0
+/**
+ * Lets the instance take its bytes from a receive ring, or again straight
+ * from PetitRxBufferInsert.  Call it while the instance is idle.
+ * @param[in] Ring the ring the RX interrupt pushes into, set up with
+ *   PETIT_RXRING_Init, or 0
+ */
+void PETIT_MODBUS_Set_RxRing(T_PETIT_MODBUS *Petit, T_PETIT_RXRING *Ring)
+{
+	Petit->Rx_Ring = Ring;
+	Petit->BufI = 0;
+	Petit->Expected_RX_Cnt = 0;
+}
+#endif
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+/**
+ * Gives the instance a buffer of its own.  Call it after PETIT_MODBUS_Init.
+ * @param[in] Buffer the frame buffer, which must outlive the instance
+ * @param[in] Size the size of Buffer, at least 9 bytes
+ */
+void PETIT_MODBUS_Set_Buffer(T_PETIT_MODBUS *Petit, pu8_t *Buffer,
+		pu16_t Size)
+{
+	Petit->Buffer = Buffer;
+	Petit->Buffer_Size = Size;
+	Petit->Ptr = Buffer;
+	Petit->Pool = 0;
+}
+
+/**
+ * Lets the instance borrow its buffer from a pool for every frame addressed
+ * to it.  Call it after PETIT_MODBUS_Init.
+ */
+void PETIT_MODBUS_Set_Pool(T_PETIT_MODBUS *Petit, T_PETIT_POOL *Pool)
+{
+	Petit->Buffer = 0;
+	Petit->Buffer_Size = 0;
+	Petit->Ptr = 0;
+	Petit->Pool = Pool;
+}
+
+/**
+ * Sets up a pool of buffers.
+ * @param[in] Data Cnt buffers of Size bytes back to back
+ * @param[in] Size the size of every buffer, at least 9 bytes
+ * @param[in] Cnt the number of buffers, less than PETIT_POOL_END
+ */
+void PETIT_POOL_Init(T_PETIT_POOL *Pool, pu8_t *Data, pu16_t Size,
+		pu8_t Cnt)
+{
+	pu8_t i;
+
+	Pool->Data = Data;
+	Pool->Size = Size;
+	Pool->Cnt = Cnt;
+	Pool->In_Use = 0;
+	Pool->Peak = 0;
+	Pool->Misses = 0;
+	for (i = 0; i < Cnt; i++)
+	{
+		Data[(pu16_t) i * Size] = i + 1U < Cnt ? i + 1U : PETIT_POOL_END;
+	}
+	Pool->Free = Cnt ? 0 : PETIT_POOL_END;
+}
+
+/**
+ * @fn buffer_borrow
+ * Takes a buffer from the pool of the instance, if there is one free.
+ */
+static void buffer_borrow(T_PETIT_MODBUS *Petit)
+{
+	T_PETIT_POOL *pool = Petit->Pool;
+	pu8_t i;
+
+	if (pool == 0)
+	{
+		return;
+	}
+	PETIT_ENTER_CRITICAL();
+	i = pool->Free;
+	if (i != PETIT_POOL_END)
+	{
+		Petit->Buffer = &pool->Data[(pu16_t) i * pool->Size];
+		pool->Free = Petit->Buffer[0];
+		if (++pool->In_Use > pool->Peak)
+		{
+			pool->Peak = pool->In_Use;
+		}
+	}
+	else
+	{
+		pool->Misses++;
+	}
+	PETIT_EXIT_CRITICAL();
+	Petit->Buffer_Size = pool->Size;
+	Petit->Ptr = Petit->Buffer;
+}
+
+/**
+ * @fn buffer_release
+ * Gives a borrowed buffer back to the pool.
+ */
+static void buffer_release(T_PETIT_MODBUS *Petit)
+{
+	T_PETIT_POOL *pool = Petit->Pool;
+
+	if (pool == 0 || Petit->Buffer == 0)
+	{
+		return;
+	}
+	PETIT_ENTER_CRITICAL();
+	Petit->Buffer[0] = pool->Free;
+	pool->Free = (pu8_t) ((pu16_t) (Petit->Buffer - pool->Data) / pool->Size);
+	pool->In_Use--;
+	PETIT_EXIT_CRITICAL();
+	Petit->Buffer = 0;
+	Petit->Ptr = 0;
 }
+#endif
 
 /******************************************************************************/
 
+/**
+ * @fn rx_reset
+ * Gets ready for the next frame, keeping the buffer.
+ */
+static void rx_reset(T_PETIT_MODBUS *Petit)
+{
+	Petit->BufI = 0;
+	Petit->Ptr = Petit->Buffer;
+	Petit->Expected_RX_Cnt = 0;
+}
+
 /**
  * Reset the modbus buffer.
  *
@@ -58,9 +334,24 @@ void PETIT_MODBUS_Init(T_PETIT_MODBUS *Petit)
  */
 void PetitRxBufferReset(T_PETIT_MODBUS *Petit)
 {
-	Petit->BufI = 0;
-	Petit->Ptr = Petit->Buffer;
-	Petit->Expected_RX_Cnt = 0;
+#if PETIT_SNIFF > 0
+	if (Petit->Sniff != 0)
+	{
+		PetitSniffEnd(Petit);
+		return;
+	}
+#endif
+	rx_reset(Petit);
+	// a frame that was dropped gives its buffer and shadow bank back
+	if (Petit->Xmit_State == E_PETIT_RXTX_RX)
+	{
+#if PETIT_SHADOW > 0
+		stage_release(Petit);
+#endif
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		buffer_release(Petit);
+#endif
+	}
 	return;
 }
 
@@ -75,31 +366,48 @@ void PetitRxBufferReset(T_PETIT_MODBUS *Petit)
  */
 static T_PETIT_BUFFER_STATUS check_buffer_complete(T_PETIT_MODBUS *const Petit)
 {
+	pu16_t expected;
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	if (Petit->Buffer == 0)
+	{
+		return E_PETIT_FALSE_SLAVE_ADDRESS;
+	}
+#endif
 	if (Petit->BufI > 0 && Petit->Buffer[0] != PETITMODBUS_SLAVE_ADDRESS)
 	{
 		return E_PETIT_FALSE_SLAVE_ADDRESS;
 	}
 
-	if (Petit->BufI > 6 && Petit->Expected_RX_Cnt == 0)
+	if (Petit->BufI > C_IBUF_FN_CODE && Petit->Expected_RX_Cnt == 0)
 	{
-		if (Petit->Buffer[C_IBUF_FN_CODE] >= 0x01U
-				&& Petit->Buffer[C_IBUF_FN_CODE] <= 0x06U)  // RHR
-		{
-			Petit->Expected_RX_Cnt = 8U;
-		}
-		else if (Petit->Buffer[C_IBUF_FN_CODE] == 0x0FU
-				|| Petit->Buffer[C_IBUF_FN_CODE] == 0x10U)
+		// the entry of the last function code is kept, so the bytes up to
+		// the byte count of functions 15 and 16 do not search the tables
+		if (Petit->Function == 0
+				|| Petit->Function->Code != Petit->Buffer[C_IBUF_FN_CODE])
 		{
-			Petit->Expected_RX_Cnt = Petit->Buffer[C_IBUF_BYTE_CNT] + 9U;
-			if (Petit->Expected_RX_Cnt > C_PETITMODBUS_RXTX_BUFFER_SIZE)
+			Petit->Function = find_function(Petit,
+					Petit->Buffer[C_IBUF_FN_CODE]);
+			if (Petit->Function == 0)
 			{
 				return E_PETIT_FALSE_FUNCTION;
 			}
 		}
-		else
+		expected = Petit->Function->Length(Petit);
+#if PETIT_SHADOW > 0
+		// only the header and the CRC of a staged write go to the buffer
+		if (expected != 0 && stage_start(Petit))
+		{
+			expected = C_IBUF_BYTE_CNT + 3U;
+		}
+#endif
+		// a frame too long for the buffer is never expected, so nothing
+		// copies it in past the end
+		if (expected > PETIT_BUF_SIZE_M(Petit))
 		{
 			return E_PETIT_FALSE_FUNCTION;
 		}
+		Petit->Expected_RX_Cnt = expected;
 	}
 
 	if (Petit->Expected_RX_Cnt && Petit->BufI >= Petit->Expected_RX_Cnt)
@@ -110,6 +418,31 @@ static T_PETIT_BUFFER_STATUS check_buffer_complete(T_PETIT_MODBUS *const Petit)
 	return E_PETIT_DATA_NOT_READY;
 }
 
+/**
+ * Length predictor for requests made of the function code and two 16-bit
+ * fields, such as functions 1 to 6.
+ * @return the length of the request ADU
+ */
+pu16_t PetitFnLenFixed(const T_PETIT_MODBUS *Petit)
+{
+	(void) Petit;
+	return 8U;
+}
+
+/**
+ * Length predictor for requests made of the function code, two 16-bit fields
+ * and a byte count followed by that many bytes, such as functions 15 and 16.
+ * @return the length of the request ADU, 0 until the byte count has arrived
+ */
+pu16_t PetitFnLenByteCnt(const T_PETIT_MODBUS *Petit)
+{
+	if (Petit->BufI > C_IBUF_BYTE_CNT)
+	{
+		return Petit->Buffer[C_IBUF_BYTE_CNT] + 9U;
+	}
+	return 0;
+}
+
 /**
  * Inserts bits into the buffer on device receive.
  * @param[in] rcvd the byte to insert into the buffer
@@ -117,7 +450,41 @@ static T_PETIT_BUFFER_STATUS check_buffer_complete(T_PETIT_MODBUS *const Petit)
  */
 pb_t PetitRxBufferInsert(T_PETIT_MODBUS *Petit, pu8_t rcvd)
 {
-	if (Petit->BufI < C_PETITMODBUS_RXTX_BUFFER_SIZE
+#if PETIT_SNIFF > 0
+	// a monitor takes every frame on the wire and never answers
+	if (Petit->Sniff != 0)
+	{
+		PetitSniffByte(Petit, rcvd);
+		Petit->Timer_Start();
+		return 0;
+	}
+#endif
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	if (Petit->Buffer == 0 && Petit->Xmit_State == E_PETIT_RXTX_RX)
+	{
+		// only frames addressed to us take a buffer from the pool
+		if (Petit->BufI == 0 && rcvd == PETITMODBUS_SLAVE_ADDRESS)
+		{
+			buffer_borrow(Petit);
+		}
+		if (Petit->Buffer == 0)
+		{
+			// skip the rest of the frame until the timer resets it
+			Petit->BufI = 1;
+			Petit->Timer_Start();
+			return 0;
+		}
+	}
+#endif
+#if PETIT_SHADOW > 0
+	if (Petit->Stage_Cnt != 0 && Petit->Xmit_State == E_PETIT_RXTX_RX)
+	{
+		stage_byte(Petit, rcvd);
+		Petit->Timer_Start();
+		return 0;
+	}
+#endif
+	if (Petit->BufI < PETIT_BUF_SIZE_M(Petit)
 			&& Petit->Xmit_State == E_PETIT_RXTX_RX)
 	{
 		*Petit->Ptr++ = rcvd;
@@ -125,13 +492,102 @@ pb_t PetitRxBufferInsert(T_PETIT_MODBUS *Petit, pu8_t rcvd)
 		Petit->Timer_Start();
 		if (check_buffer_complete(Petit) == E_PETIT_DATA_READY)
 		{
+#if defined(PETITMODBUS_TURNAROUND) || defined(PETITMODBUS_TURNAROUND_TIMER)
+			// the turnaround starts now, before the port arms its timer
+			if (Petit->BufI == Petit->Expected_RX_Cnt)
+			{
+#if defined(PETITMODBUS_TURNAROUND)
+				Petit->Rx_Stamp = PetitPortClock();
+#endif
+				Petit->Tx_Due = 0;
+			}
+#endif
 			Petit->Timer_Stop();
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
+			if (Petit->BufI == Petit->Expected_RX_Cnt)
+			{
+				trace_event(Petit, PETIT_TRACE_RX_DONE);
+			}
+#endif
+#if PETITMODBUS_PROCESS_POSITION >= 2
+			// position 2 answers right here in the RX interrupt, up to the
+			// turnaround if it is not over yet
+			if (Petit->BufI == Petit->Expected_RX_Cnt)
+			{
+				rx_rtu(Petit);
+				if (Petit->Xmit_State == E_PETIT_RXTX_PROCESS)
+				{
+					response_process(Petit);
+					tx_rtu(Petit);
+					tx_delay(Petit);
+				}
+			}
+#endif
 		}
 		return 0;
 	}
 	return 1;
 }
 
+#if PETIT_RXRING > 0
+/**
+ * Inserts a run of bytes received without a gap between them, as that many
+ * calls of PetitRxBufferInsert would.  The bytes the request length says are
+ * still to come are copied at once, all but the last, which completes the
+ * frame through PetitRxBufferInsert.
+ * @param[in] Data the bytes, in the order received
+ * @return the bytes taken, fewer than Len if a frame is complete and waits to
+ *   be checked by PETIT_MODBUS_Process
+ */
+pu16_t PetitRxBufferInsertRun(T_PETIT_MODBUS *Petit, const pu8_t *Data,
+		pu16_t Len)
+{
+	pu16_t n = 0;
+	pu16_t k;
+
+	while (n < Len)
+	{
+		if (Petit->Xmit_State == E_PETIT_RXTX_RX && Petit->Expected_RX_Cnt != 0
+				&& Petit->BufI >= Petit->Expected_RX_Cnt)
+		{
+			break;
+		}
+		// a frame longer than the buffer is left to PetitRxBufferInsert
+		if (Petit->Xmit_State == E_PETIT_RXTX_RX && Petit->Expected_RX_Cnt != 0
+				&& Petit->Expected_RX_Cnt <= PETIT_BUF_SIZE_M(Petit)
+				&& Petit->BufI + 1U < Petit->Expected_RX_Cnt
+#if PETIT_SNIFF > 0
+				&& Petit->Sniff == 0
+#endif
+#if PETIT_SHADOW > 0
+				&& Petit->Stage_Cnt == 0
+#endif
+#if PETIT_BUFFER == PETIT_EXTERNAL
+				&& Petit->Buffer != 0
+#endif
+				)
+		{
+			k = Petit->Expected_RX_Cnt - Petit->BufI - 1U;
+			if (k > PETIT_BUF_SIZE_M(Petit) - Petit->BufI)
+			{
+				k = PETIT_BUF_SIZE_M(Petit) - Petit->BufI;
+			}
+			if (k > Len - n)
+			{
+				k = Len - n;
+			}
+			memcpy(Petit->Ptr, &Data[n], k);
+			Petit->Ptr += k;
+			Petit->BufI += k;
+			n += k;
+			continue;
+		}
+		PetitRxBufferInsert(Petit, Data[n++]);
+	}
+	return n;
+}
+#endif
+
 /**
  * This function removes a byte from the buffer and places it on "tx" to be
  * sent over rs485.
@@ -148,91 +604,346 @@ pb_t PetitTxBufferPop(T_PETIT_MODBUS *Petit, pu8_t* tx)
 			Petit->BufI--;
 			return 1;
 		}
+#if PETIT_STREAM > 0
+		else if (Petit->Stream_Cnt != 0)
+		{
+			*tx = stream_byte(Petit);
+			if (Petit->Stream_Cnt == 0)
+			{
+				// the CRC follows the last data byte
+				Petit->Buffer[0] = Petit->CRC16;
+				Petit->Buffer[1] = Petit->CRC16 >> 8U;
+				Petit->Ptr = Petit->Buffer;
+				Petit->BufI = 2U;
+			}
+			return 1;
+		}
+#endif
 		else
 		{
 			// transmission complete.  return to receive mode.
 			// the direction pin is handled by the porting code
-			Petit->Xmit_State = E_PETIT_RXTX_RX;
+			PETIT_SET_STATE_M(E_PETIT_RXTX_RX);
 			Petit->Ptr = Petit->Buffer;
 			// PetitBufI is already set at 0 at this point
 			PetitLedOff();
+#if PETIT_BUFFER == PETIT_EXTERNAL
+			buffer_release(Petit);
+#endif
 			return 0;
 		}
 	}
 	return 0;
 }
 
+#if defined(PETIT_TRACE) && PETIT_TRACE > 0
 /**
- * @fn CRC16_Calc
- * This function does the CRC16 calculation for modbus.  Specifically, modbus
- * calls for CRC16 using the CRC-16-IBM polynomial.
- * @param[in] Data
- * @note initialize Petit_CRC16 to 0xFFFF beforehand
+ * @fn trace_hist
+ * Counts one latency in the histogram of the current function code.
+ * @param[in] Dt the latency in PetitPortClock ticks
  */
-#if C_PETIT_CRC == PETIT_CRC_TABULAR
-static void CRC16_calc(T_PETIT_MODBUS *Petit, const pu16_t Data)
-{
-	Petit->CRC16 = (Petit->CRC16 >> 8) ^
-			PetitCRCtable[(Petit->CRC16 ^ (Data)) & 0xFF];
-	return;
-}
-#elif C_PETIT_CRC == PETIT_CRC_BITWISE
-static void CRC16_calc(T_PETIT_MODBUS *Petit, const pu16_t Data)
+static void trace_hist(T_PETIT_MODBUS *Petit, T_PETIT_TRACE_INTERVAL Interval,
+		pu16_t Dt)
 {
-	pu8_t i;
+	pu8_t code = Petit->Trace_Code & 0x7FU;
+	pu8_t bin = 0;
+	pu16_t *cnt;
 
-    Petit->CRC16 = Petit->CRC16 ^(pu16_t) Data;
-    for (i = 8U; i > 0; i--)
-    {
-        if (Petit->CRC16 & 0x0001U)
-            Petit->CRC16 = (Petit->CRC16 >> 1U) ^ 0xA001U;
-        else
-            Petit->CRC16 >>= 1U;
-    }
+	Dt >>= PETIT_TRACE_BIN_SHIFT;
+	while (Dt != 0 && bin < PETIT_TRACE_BINS - 1U)
+	{
+		Dt >>= 1U;
+		bin++;
+	}
+	if (code >= PETIT_TRACE_CODES)
+	{
+		code = 0;
+	}
+	cnt = &Petit->Trace_Hist[code][Interval][bin];
+	if (*cnt != 0xFFFFU)
+	{
+		(*cnt)++;
+	}
 }
-#elif C_PETIT_CRC == PETIT_CRC_EXTERNAL
-#define Petit_CRC16_Calc(Data) PetitPortCRC16Calc((Data), &Petit->CRC16)
-#else
-#error "No Valid CRC Algorithm!"
-#endif
 
 /**
- * @fn PetitSendMessage
- * This function starts to send messages.
- * @return always returns true
+ * @fn trace_event
+ * Stamps a state transition into the trace ring and the histograms.
+ * Runs in interrupt context for RX_DONE and the end of transmission.
+ * @param[in] Event the state entered or PETIT_TRACE_RX_DONE
  */
-static pb_t prepare_tx(T_PETIT_MODBUS *Petit)
+static void trace_event(T_PETIT_MODBUS *Petit, pu8_t Event)
 {
-	Petit->BufI = 0;
-	Petit->Xmit_State = E_PETIT_RXTX_TX_DATABUF;
+	pu16_t now = PetitPortClock();
+	T_PETIT_TRACE_REC *rec;
 
-	return true;
-}
+	switch (Event)
+	{
+	case PETIT_TRACE_RX_DONE:
+		Petit->Trace_Code = Petit->Buffer[C_IBUF_FN_CODE];
+		Petit->Trace_Stamp[E_PETIT_TRACE_RX_PROCESS] = now;
+		break;
+	case E_PETIT_RXTX_PROCESS:
+		trace_hist(Petit, E_PETIT_TRACE_RX_PROCESS,
+				now - Petit->Trace_Stamp[E_PETIT_TRACE_RX_PROCESS]);
+		Petit->Trace_Stamp[E_PETIT_TRACE_PROCESS_TX] = now;
+		break;
+	case E_PETIT_RXTX_TX:
+		trace_hist(Petit, E_PETIT_TRACE_PROCESS_TX,
+				now - Petit->Trace_Stamp[E_PETIT_TRACE_PROCESS_TX]);
+		Petit->Trace_Stamp[E_PETIT_TRACE_TX] = now;
+		break;
+	case E_PETIT_RXTX_RX:
+		if (Petit->Trace_Last == E_PETIT_RXTX_TX)
+		{
+			trace_hist(Petit, E_PETIT_TRACE_TX,
+					now - Petit->Trace_Stamp[E_PETIT_TRACE_TX]);
+		}
+		break;
+	default:
+		break;
+	}
+	Petit->Trace_Last = Event;
 
-/******************************************************************************/
+	rec = &Petit->Trace[Petit->Trace_Head & (PETIT_TRACE_SIZE - 1U)];
+	rec->Time = now;
+	rec->Event = Event;
+	rec->Code = Petit->Trace_Code;
+	Petit->Trace_Head++;
+}
 
 /**
- * @fn HandlePetitModbusError
- * This function transmits generated errors to Modbus Master.
- * @param[in] ErrorCode contains the modbus error code to be sent back.
+ * Copies the trace records not read yet, oldest first.  Records the ring
+ * overwrote before they were read are lost.
+ * @param[out] Recs where to copy the records
+ * @param[in] Max the number of records Recs can hold
+ * @return the number of records copied
  */
-static void handle_error(T_PETIT_MODBUS *Petit, pu8_t ErrorCode)
+pu16_t PETIT_MODBUS_Trace_Read(T_PETIT_MODBUS *Petit, T_PETIT_TRACE_REC *Recs,
+		pu16_t Max)
+{
+	pu16_t n = 0;
+
+	if ((pu16_t) (Petit->Trace_Head - Petit->Trace_Tail) > PETIT_TRACE_SIZE)
+	{
+		Petit->Trace_Tail = Petit->Trace_Head - PETIT_TRACE_SIZE;
+	}
+	while (n < Max && Petit->Trace_Tail != Petit->Trace_Head)
+	{
+		Recs[n++] = Petit->Trace[Petit->Trace_Tail & (PETIT_TRACE_SIZE - 1U)];
+		Petit->Trace_Tail++;
+	}
+	return n;
+}
+
+/**
+ * Gives the latency histogram of a function code.  Bin 0 counts latencies
+ * below 2^PETIT_TRACE_BIN_SHIFT ticks, every following bin twice as wide a
+ * range and the last bin everything above.  Counts saturate.
+ * @param[in] Code the function code, codes from PETIT_TRACE_CODES up share 0
+ * @return PETIT_TRACE_BINS counters
+ */
+const pu16_t *PETIT_MODBUS_Trace_Histogram(const T_PETIT_MODBUS *Petit,
+		pu8_t Code, T_PETIT_TRACE_INTERVAL Interval)
+{
+	if (Code >= PETIT_TRACE_CODES)
+	{
+		Code = 0;
+	}
+	return Petit->Trace_Hist[Code][Interval];
+}
+
+/**
+ * Empties the trace ring and clears the histograms.
+ */
+void PETIT_MODBUS_Trace_Reset(T_PETIT_MODBUS *Petit)
+{
+	pu8_t i;
+	pu8_t j;
+	pu8_t k;
+
+	Petit->Trace_Head = 0;
+	Petit->Trace_Tail = 0;
+	Petit->Trace_Code = 0;
+	Petit->Trace_Last = E_PETIT_RXTX_RX;
+	for (i = 0; i < PETIT_TRACE_CODES; i++)
+		for (j = 0; j < E_PETIT_TRACE_INTERVALS; j++)
+			for (k = 0; k < PETIT_TRACE_BINS; k++)
+				Petit->Trace_Hist[i][j][k] = 0;
+}
+#endif /* PETIT_TRACE */
+
+/**
+ * @fn CRC16_Calc
+ * This function does the CRC16 calculation for modbus.  Specifically, modbus
+ * calls for CRC16 using the CRC-16-IBM polynomial.
+ * @param[in] Data
+ * @note initialize Petit_CRC16 to 0xFFFF beforehand
+ */
+#if PETIT_CRC == PETIT_CRC_TABULAR
+static void CRC16_calc(T_PETIT_MODBUS *Petit, const pu16_t Data)
+{
+	Petit->CRC16 = (Petit->CRC16 >> 8) ^
+			PetitCRCtable[(Petit->CRC16 ^ (Data)) & 0xFF];
+	return;
+}
+#elif PETIT_CRC == PETIT_CRC_BITWISE
+static void CRC16_calc(T_PETIT_MODBUS *Petit, const pu16_t Data)
+{
+	pu8_t i;
+
+    Petit->CRC16 = Petit->CRC16 ^(pu16_t) Data;
+    for (i = 8U; i > 0; i--)
+    {
+        if (Petit->CRC16 & 0x0001U)
+            Petit->CRC16 = (Petit->CRC16 >> 1U) ^ 0xA001U;
+        else
+            Petit->CRC16 >>= 1U;
+    }
+}
+#elif PETIT_CRC == PETIT_CRC_EXTERNAL
+#define CRC16_calc(Petit, Data) PetitPortCRC16Calc((Data), &(Petit)->CRC16)
+#else
+#error "No Valid CRC Algorithm!"
+#endif
+
+/**
+ * @fn PetitCRC16
+ * Calculates the modbus CRC16 of a block of bytes into Petit->CRC16.
+ * @param[in] Data the bytes to calculate the CRC over
+ * @param[in] Len the number of bytes
+ * @return the CRC, which goes on the wire low byte first
+ */
+pu16_t PetitCRC16(T_PETIT_MODBUS *Petit, const pu8_t *Data, pu16_t Len)
+{
+	Petit->CRC16 = 0xFFFF;
+	while (Len--)
+	{
+		CRC16_calc(Petit, *Data++);
+	}
+	return Petit->CRC16;
+}
+
+/**
+ * @fn PetitCRC16Add
+ * Adds one byte to the CRC in Petit->CRC16, for CRCs kept up as bytes arrive.
+ * @note initialize Petit->CRC16 to 0xFFFF beforehand
+ */
+void PetitCRC16Add(T_PETIT_MODBUS *Petit, pu8_t Data)
+{
+	CRC16_calc(Petit, Data);
+}
+
+#if PETIT_STREAM > 0
+/**
+ * @fn stream_start
+ * Leaves the data of the response to PetitTxBufferPop, which reads Cnt
+ * registers from Addr on with Read as it sends them.
+ */
+static void stream_start(T_PETIT_MODBUS *Petit,
+		pb_t (*Read)(pu16_t Addr, pu16_t *Data), pu16_t Addr, pu16_t Cnt)
+{
+	Petit->Stream_Read = Read;
+	Petit->Stream_Addr = Addr;
+	Petit->Stream_Cnt = 2U * Cnt;
+}
+
+/**
+ * @fn stream_byte
+ * Produces the next data byte of a streamed response and adds it to the CRC.
+ * A register that can not be read is sent as 0 with a CRC that does not
+ * match, so the master drops the response and asks again.
+ */
+static pu8_t stream_byte(T_PETIT_MODBUS *Petit)
+{
+	pu8_t byte;
+
+	if ((Petit->Stream_Cnt & 1U) == 0)
+	{
+		if (!Petit->Stream_Read(Petit->Stream_Addr++, &Petit->Stream_Word))
+		{
+			Petit->Stream_Word = 0;
+			Petit->CRC16 ^= 0xFFFFU;
+		}
+		byte = (pu8_t) (Petit->Stream_Word >> 8U);
+	}
+	else
+	{
+		byte = (pu8_t) (Petit->Stream_Word & 0xFFU);
+	}
+	Petit->Stream_Cnt--;
+	CRC16_calc(Petit, byte);
+	return byte;
+}
+#endif
+
+/**
+ * @fn PetitSendMessage
+ * This function starts to send messages.
+ * @return always returns true
+ */
+static pb_t prepare_tx(T_PETIT_MODBUS *Petit)
+{
+	Petit->BufI = 0;
+	PETIT_SET_STATE_M(E_PETIT_RXTX_TX_DATABUF);
+
+	return true;
+}
+
+/******************************************************************************/
+
+/**
+ * @fn error_response
+ * Turns the request in the buffer into an exception response.
+ */
+static void error_response(T_PETIT_MODBUS *Petit, pu8_t ErrorCode)
 {
 	// Initialise the output buffer. The first byte in the buffer says how many registers we have read
 	Petit->Buffer[C_IBUF_FN_CODE] |= 0x80U;
 	Petit->Buffer[2U] = ErrorCode;
 	Petit->BufJ = 3U;
+}
+
+/**
+ * @fn HandlePetitModbusError
+ * This function transmits generated errors to Modbus Master.
+ * @param[in] ErrorCode contains the modbus error code to be sent back.
+ */
+static void handle_error(T_PETIT_MODBUS *Petit, pu8_t ErrorCode)
+{
+	error_response(Petit, ErrorCode);
 	PetitLedErrFail();
 	prepare_tx(Petit);
 }
 
+#if PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED != 0 || \
+	PETITMODBUS_READ_INPUT_REGISTERS_ENABLED != 0
+/**
+ * @fn response_byte_cnt
+ * Writes the byte count of a read register response, 16 bits wide and
+ * high byte first in a jumbo frame.
+ */
+static void response_byte_cnt(T_PETIT_MODBUS *Petit, pu16_t Cnt)
+{
+#if PETIT_JUMBO > 0
+	if (Petit->Jumbo_Regs != 0)
+	{
+		Petit->Buffer[2U] = (pu8_t) (Cnt >> 8U);
+		Petit->Buffer[3U] = (pu8_t) (Cnt & 0xFFU);
+		return;
+	}
+#endif
+	Petit->Buffer[2U] = (pu8_t) Cnt;
+}
+#endif
+
 /******************************************************************************/
 /**
  * @fn HandlePetitModbusReadCoils
  * Modbus function 01 - Read Coils
  */
 #if PETITMODBUS_READ_COILS_ENABLED != 0
-static void read_coils(T_PETIT_MODBUS *Petit)
+static pu8_t read_coils(T_PETIT_MODBUS *Petit)
 {
 	pu16_t start_coil = 0;
 	pu16_t number_of_coils = 0;
@@ -252,10 +963,10 @@ static void read_coils(T_PETIT_MODBUS *Petit)
 	// register in modbus is 16 bits
 	if ((start_coil + number_of_coils)
 			> NUMBER_OF_PETITCOILS ||
-			(number_of_coils + 7) >> 3 > NUMBER_OF_REGISTERS_IN_BUFFER * 2 ||
-			number_of_coils == 0)
+			(number_of_coils + 7U) >> 3 > PETIT_BUF_REGS_M(Petit) * 2 ||
+			number_of_coils > 2000U || number_of_coils == 0)
 	{
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+		return PETIT_ERROR_CODE_02;
 	}
 	else
 	{
@@ -286,17 +997,16 @@ static void read_coils(T_PETIT_MODBUS *Petit)
 	(PETIT_COIL == PETIT_EXTERNAL || PETIT_COIL == PETIT_BOTH)
 			if (!PetitPortCoilRead(start_coil + i, &bit))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				return PETIT_ERROR_CODE_04;
 			}
 			data |= (pu8_t) (bit != 0) << (i & 7U);
 #endif
 		}
 		Petit->Buffer[Petit->BufJ++] = data;
 		Petit->Buffer[2U] = Petit->BufJ - 3U;
-		PetitLedSuc();
-		prepare_tx(Petit);
+		PETIT_HEAT_COUNT(PETIT_HEAT_COIL_READ, start_coil, number_of_coils);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_READ_COILS_ENABLED */
 
@@ -306,7 +1016,7 @@ static void read_coils(T_PETIT_MODBUS *Petit)
  * Modbus function 02 - Read Discrete
  */
 #if PETITMODBUS_READ_DISCRETES_ENABLED != 0
-static void read_discretes(T_PETIT_MODBUS *Petit)
+static pu8_t read_discretes(T_PETIT_MODBUS *Petit)
 {
 	pu16_t start_discrete = 0;
 	pu16_t number_of_discretes = 0;
@@ -326,10 +1036,10 @@ static void read_discretes(T_PETIT_MODBUS *Petit)
 	// register in modbus is 16 bits
 	if ((start_discrete + number_of_discretes)
 			> NUMBER_OF_PETITDISCRETES ||
-			(number_of_discretes + 7) >> 3 > NUMBER_OF_REGISTERS_IN_BUFFER * 2 ||
-			number_of_discretes == 0)
+			(number_of_discretes + 7U) >> 3 > PETIT_BUF_REGS_M(Petit) * 2 ||
+			number_of_discretes > 2000U || number_of_discretes == 0)
 	{
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+		return PETIT_ERROR_CODE_02;
 	}
 	else
 	{
@@ -360,64 +1070,121 @@ static void read_discretes(T_PETIT_MODBUS *Petit)
 	(PETIT_DISCRETE == PETIT_EXTERNAL || PETIT_DISCRETE == PETIT_BOTH)
 			if (!PetitPortDiscreteRead(start_discrete + i, &bit))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				return PETIT_ERROR_CODE_04;
 			}
 			data |= (pu8_t) (bit != 0) << (i & 7U);
 #endif
 		}
 		Petit->Buffer[Petit->BufJ++] = data;
 		Petit->Buffer[2U] = Petit->BufJ - 3U;
-		PetitLedSuc();
-		prepare_tx(Petit);
+		PETIT_HEAT_COUNT(PETIT_HEAT_DISCRETE_READ, start_discrete,
+				number_of_discretes);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_READ_DISCRETES_ENABLED */
 
+#if PETIT_STREAM > 0 && PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED != 0
+/**
+ * @fn stream_holding
+ * Reads a holding register for a streamed response.
+ */
+static pb_t stream_holding(pu16_t Addr, pu16_t *Data)
+{
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
+	*Data = PETIT_REG_LOAD(PetitRegisters[Addr]);
+#endif
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH)
+	return PetitPortRegRead(Addr, Data);
+#else
+	return true;
+#endif
+}
+#endif
+
 /**
  * @fn HandlePetitModbusReadHoldingRegisters
  * Modbus function 03 - Read holding registers
  */
 #if PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED != 0
-static void read_holding_registers(T_PETIT_MODBUS *Petit)
+static pu8_t read_holding_registers(T_PETIT_MODBUS *Petit)
 {
 	// Holding registers are effectively numerical outputs that can be written to by the host.
 	// They can be control registers or analogue outputs.
 	// We potentially have one - the pwm output value
 	pu16_t start_address = 0;
 	pu16_t number_of_registers = 0;
+#if PETIT_REG != PETIT_INTERNAL && PETIT_STREAM == 0
 	pu16_t i = 0;
+#endif
 
 	// The message contains the requested start address and number of registers
 	start_address = PETIT_BUF_DAT_M(0);
 	number_of_registers = PETIT_BUF_DAT_M(1);
 
+#ifdef NUMBER_OF_CONST_PETITREGISTERS
+	// read-only registers, copied straight out of code memory
+	if (start_address >= PETIT_CONST_REG_BASE &&
+			(pu16_t) (start_address - PETIT_CONST_REG_BASE)
+			<= NUMBER_OF_CONST_PETITREGISTERS - number_of_registers &&
+			number_of_registers <= NUMBER_OF_CONST_PETITREGISTERS &&
+			number_of_registers <= PETIT_BUF_REGS_M(Petit) &&
+			number_of_registers <= PETIT_READ_REGS_M(Petit))
+	{
+		pu16_t i;
+
+		start_address -= PETIT_CONST_REG_BASE;
+		Petit->BufJ = PETIT_RSP_DATA_M(Petit);
+		for (i = 0; i < number_of_registers; i++)
+		{
+			pu16_t data = PetitConstRegisters[start_address + i];
+			Petit->Buffer[Petit->BufJ] = (pu8_t) (data >> 8U);
+			Petit->Buffer[Petit->BufJ + 1U] = (pu8_t) (data & 0xFFU);
+			Petit->BufJ += 2U;
+		}
+		response_byte_cnt(Petit, 2U * number_of_registers);
+		return 0;
+	}
+#endif
+
 	// If it is bigger than RegisterNumber return error to Modbus Master
 	if ((start_address + number_of_registers)
 			> NUMBER_OF_PETITREGISTERS ||
-			number_of_registers > NUMBER_OF_REGISTERS_IN_BUFFER)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+			number_of_registers > PETIT_READ_REGS_M(Petit))
+		return PETIT_ERROR_CODE_02;
 	else
 	{
 		// Initialise the output buffer.
 		// The first byte in the PDU says how many registers we have read
-		Petit->BufJ = 3U;
+		Petit->BufJ = PETIT_RSP_DATA_M(Petit);
 		Petit->Buffer[2U] = 0;
 
+#if PETIT_STREAM > 0
+		// only the header goes in the buffer
+		stream_start(Petit, stream_holding, start_address,
+				number_of_registers);
+#elif PETIT_REG == PETIT_INTERNAL
+		// the whole block at once, see PETIT_SWAP
+		PETIT_POINT_READ_BEGIN();
+		PetitRegsToWire(&Petit->Buffer[Petit->BufJ],
+				&PetitRegisters[start_address], number_of_registers);
+		PETIT_POINT_READ_END();
+		Petit->BufJ += 2U * number_of_registers;
+#else
 		for (i = 0; i < number_of_registers; i++)
 		{
 			pu16_t Petit_CurrentData;
-#if defined(PETIT_REG) && \
-	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
-			Petit_CurrentData = PetitRegisters[start_address
-					+ i];
+#if defined(PETIT_REG) && PETIT_REG == PETIT_BOTH
+			Petit_CurrentData =
+					PETIT_REG_LOAD(PetitRegisters[start_address + i]);
 #endif
 #if defined(PETIT_REG) && \
 	(PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH)
 			if (!PetitPortRegRead(start_address + i, &Petit_CurrentData))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				return PETIT_ERROR_CODE_04;
 			}
 #endif
 			Petit->Buffer[Petit->BufJ] =
@@ -426,13 +1193,35 @@ static void read_holding_registers(T_PETIT_MODBUS *Petit)
 					(pu8_t) (Petit_CurrentData & 0xFFU);
 			Petit->BufJ += 2U;
 		}
-		Petit->Buffer[2U] = Petit->BufJ - 3U;
-		PetitLedSuc();
-		prepare_tx(Petit);
+#endif
+		response_byte_cnt(Petit, 2U * number_of_registers);
+		PETIT_HEAT_COUNT(PETIT_HEAT_REG_READ, start_address,
+				number_of_registers);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED */
 
+#if PETIT_STREAM > 0 && PETITMODBUS_READ_INPUT_REGISTERS_ENABLED != 0
+/**
+ * @fn stream_input
+ * Reads an input register for a streamed response.
+ */
+static pb_t stream_input(pu16_t Addr, pu16_t *Data)
+{
+#if defined(PETIT_INPUT_REG) && \
+	(PETIT_INPUT_REG == PETIT_INTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
+	*Data = PETIT_REG_LOAD(PetitInputRegisters[Addr]);
+#endif
+#if defined(PETIT_INPUT_REG) && \
+	(PETIT_INPUT_REG == PETIT_EXTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
+	return PetitPortInputRegRead(Addr, Data);
+#else
+	return true;
+#endif
+}
+#endif
+
 /**
  * @fn HandlePetitModbusReadInputRegisters
  * Modbus function 04 - Read input registers
@@ -441,42 +1230,78 @@ static void read_holding_registers(T_PETIT_MODBUS *Petit)
  * to using another function code.
  */
 #if PETITMODBUS_READ_INPUT_REGISTERS_ENABLED != 0
-static void read_input_registers(T_PETIT_MODBUS *Petit)
+static pu8_t read_input_registers(T_PETIT_MODBUS *Petit)
 {
 	pu16_t start_address = 0;
 	pu16_t number_of_registers = 0;
+#if PETIT_INPUT_REG != PETIT_INTERNAL && PETIT_STREAM == 0
 	pu16_t i = 0;
+#endif
 
 	// The message contains the requested start address and number of registers
 	start_address = PETIT_BUF_DAT_M(0);
 	number_of_registers = PETIT_BUF_DAT_M(1);
 
+#ifdef NUMBER_OF_CONST_INPUT_PETITREGISTERS
+	// read-only registers, copied straight out of code memory
+	if (start_address >= PETIT_CONST_INPUT_REG_BASE &&
+			(pu16_t) (start_address - PETIT_CONST_INPUT_REG_BASE)
+			<= NUMBER_OF_CONST_INPUT_PETITREGISTERS - number_of_registers &&
+			number_of_registers <= NUMBER_OF_CONST_INPUT_PETITREGISTERS &&
+			number_of_registers <= PETIT_BUF_REGS_M(Petit) &&
+			number_of_registers <= PETIT_READ_REGS_M(Petit))
+	{
+		pu16_t i;
+
+		start_address -= PETIT_CONST_INPUT_REG_BASE;
+		Petit->BufJ = PETIT_RSP_DATA_M(Petit);
+		for (i = 0; i < number_of_registers; i++)
+		{
+			pu16_t data = PetitConstInputRegisters[start_address + i];
+			Petit->Buffer[Petit->BufJ] = (pu8_t) (data >> 8U);
+			Petit->Buffer[Petit->BufJ + 1U] = (pu8_t) (data & 0xFFU);
+			Petit->BufJ += 2U;
+		}
+		response_byte_cnt(Petit, 2U * number_of_registers);
+		return 0;
+	}
+#endif
+
 	// If it is bigger than RegisterNumber return error to Modbus Master
 	if ((start_address + number_of_registers)
 			> NUMBER_OF_INPUT_PETITREGISTERS ||
-			number_of_registers > NUMBER_OF_REGISTERS_IN_BUFFER)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+			number_of_registers > PETIT_READ_REGS_M(Petit))
+		return PETIT_ERROR_CODE_02;
 	else
 	{
 		// Initialise the output buffer.
 		// The first byte in the PDU says how many registers we have read
-		Petit->BufJ = 3U;
+		Petit->BufJ = PETIT_RSP_DATA_M(Petit);
 		Petit->Buffer[2U] = 0;
 
+#if PETIT_STREAM > 0
+		// only the header goes in the buffer
+		stream_start(Petit, stream_input, start_address,
+				number_of_registers);
+#elif PETIT_INPUT_REG == PETIT_INTERNAL
+		// the whole block at once, see PETIT_SWAP
+		PETIT_POINT_READ_BEGIN();
+		PetitRegsToWire(&Petit->Buffer[Petit->BufJ],
+				&PetitInputRegisters[start_address], number_of_registers);
+		PETIT_POINT_READ_END();
+		Petit->BufJ += 2U * number_of_registers;
+#else
 		for (i = 0; i < number_of_registers; i++)
 		{
 			pu16_t data;
-#if defined(PETIT_INPUT_REG) && \
-	(PETIT_INPUT_REG == PETIT_INTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
-			data = PetitInputRegisters[start_address
-					+ i];
+#if defined(PETIT_INPUT_REG) && PETIT_INPUT_REG == PETIT_BOTH
+			data = PETIT_REG_LOAD(PetitInputRegisters[start_address + i]);
 #endif
 #if defined(PETIT_INPUT_REG) && \
 	(PETIT_INPUT_REG == PETIT_EXTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
 			if (!PetitPortInputRegRead(start_address + i, &data))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				return PETIT_ERROR_CODE_04;
 			}
 #endif
 			Petit->Buffer[Petit->BufJ] =
@@ -485,10 +1310,12 @@ static void read_input_registers(T_PETIT_MODBUS *Petit)
 					(pu8_t) (data & 0xFFU);
 			Petit->BufJ += 2U;
 		}
-		Petit->Buffer[2U] = Petit->BufJ - 3U;
-		PetitLedSuc();
-		prepare_tx(Petit);
+#endif
+		response_byte_cnt(Petit, 2U * number_of_registers);
+		PETIT_HEAT_COUNT(PETIT_HEAT_INPUT_READ, start_address,
+				number_of_registers);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_READ_INPUT_REGISTERS_ENABLED */
 
@@ -497,7 +1324,7 @@ static void read_input_registers(T_PETIT_MODBUS *Petit)
  * Modbus function 06 - Write single register
  */
 #if PETITMODBUS_WRITE_SINGLE_COIL_ENABLED != 0
-static void write_single_coil(T_PETIT_MODBUS *Petit)
+static pu8_t write_single_coil(T_PETIT_MODBUS *Petit)
 {
 	// Write single numerical output
 	pu16_t address = 0;
@@ -511,31 +1338,31 @@ static void write_single_coil(T_PETIT_MODBUS *Petit)
 	Petit->BufJ = 6U;
 
 	if (address >= NUMBER_OF_PETITCOILS)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+		return PETIT_ERROR_CODE_02;
 	else if (value != 0x0000 && value != 0xFF00)
-		handle_error(Petit, PETIT_ERROR_CODE_03);
+		return PETIT_ERROR_CODE_03;
 	else
 	{
 #if defined(PETIT_COIL) && \
 		(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
+		PETIT_SHM_BEGIN(PETIT_SHM_COILS);
 		if (value)
 			PetitCoils[address >> 3] |= 1 << (address & 7u);
 		else
 			PetitCoils[address >> 3] &= ~(1 << (address & 7u));
+		PETIT_SHM_END(PETIT_SHM_COILS);
 #endif
 #if defined(PETIT_COIL) && \
 	(PETIT_COIL == PETIT_EXTERNAL || PETIT_COIL == PETIT_BOTH)
 		if(!PetitPortCoilWrite(address, value))
 		{
-			handle_error(Petit, PETIT_ERROR_CODE_04);
-			return;
+			return PETIT_ERROR_CODE_04;
 		}
 #endif
+		PETIT_HEAT_COUNT(PETIT_HEAT_COIL_WRITE, address, 1U);
 		// Output data buffer is exact copy of input buffer
 	}
-	PetitLedSuc();
-	prepare_tx(Petit);
-
+	return 0;
 }
 #endif /* PETITMODBUS_WRITE_SINGLE_COIL_ENABLED */
 
@@ -544,7 +1371,7 @@ static void write_single_coil(T_PETIT_MODBUS *Petit)
  * Modbus function 06 - Write single register
  */
 #if PETITMODBUS_WRITE_SINGLE_REGISTER_ENABLED != 0
-static void write_single_register(T_PETIT_MODBUS *Petit)
+static pu8_t write_single_register(T_PETIT_MODBUS *Petit)
 {
 	// Write single numerical output
 	pu16_t address = 0;
@@ -558,26 +1385,33 @@ static void write_single_register(T_PETIT_MODBUS *Petit)
 	Petit->BufJ = 6U;
 
 	if (address >= NUMBER_OF_PETITREGISTERS)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+		return PETIT_ERROR_CODE_02;
 	else
 	{
 		PetitRegChange = 1;
 #if defined(PETIT_REG) && \
 	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
-		PetitRegisters[address] = value;
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		PETIT_REG_STORE(PetitRegisters[address], value);
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+		PETIT_JOURNAL_Mark(address, 1U);
+#endif
 #endif
 #if defined(PETIT_REG) && \
 	(PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH)
 		if(!PetitPortRegWrite(address, value))
 		{
-			handle_error(Petit, PETIT_ERROR_CODE_04);
-			return;
+			// it may have changed all the same
+			PETIT_DELTA_MARK(address, 1U);
+			return PETIT_ERROR_CODE_04;
 		}
 #endif
+		PETIT_HEAT_COUNT(PETIT_HEAT_REG_WRITE, address, 1U);
+		PETIT_DELTA_MARK(address, 1U);
 		// Output data buffer is exact copy of input buffer
 	}
-	PetitLedSuc();
-	prepare_tx(Petit);
+	return 0;
 }
 #endif /* PETITMODBUS_WRITE_SINGLE_REGISTER_ENABLED */
 
@@ -587,7 +1421,7 @@ static void write_single_register(T_PETIT_MODBUS *Petit)
  * Modbus function 15 - Write multiple coils
  */
 #if PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED != 0
-static void write_multiple_coils(T_PETIT_MODBUS *Petit)
+static pu8_t write_multiple_coils(T_PETIT_MODBUS *Petit)
 {
 	// Write single numerical output
 	pu16_t start_coil = 0;
@@ -595,51 +1429,71 @@ static void write_multiple_coils(T_PETIT_MODBUS *Petit)
 	pu16_t number_of_coils = 0;
 	pu16_t i = 0;
 	pu8_t current_bit = 0;
+	// 7 is the index beyond the header for the function
+	const pu8_t *data = &Petit->Buffer[7U];
 
 	// The message contains the requested start address and number of registers
 	start_coil = PETIT_BUF_DAT_M(0);
 	number_of_coils = PETIT_BUF_DAT_M(1);
 	byte_count = Petit->Buffer[C_IBUF_BYTE_CNT];
+#if PETIT_SHADOW > 0
+	if (PetitShadowOwner == Petit)
+	{
+		data = PetitShadow;
+	}
+#endif
 
 	// If it is bigger than RegisterNumber return error to Modbus Master
 	if ((start_coil + number_of_coils)
 			> NUMBER_OF_PETITCOILS)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
-	else if (number_of_coils > (255U - 9U) * 8U || number_of_coils == 0)
-		handle_error(Petit, PETIT_ERROR_CODE_03);
+		return PETIT_ERROR_CODE_02;
+	else if (number_of_coils > (255U - 9U) * 8U || number_of_coils == 0
+			|| byte_count < (number_of_coils + 7U) >> 3U)
+		return PETIT_ERROR_CODE_03;
 	else
 	{
 		// Initialise the output buffer. The first byte in the buffer says how many outputs we have set
 		Petit->BufJ = 6U;
 
 		// Output data buffer is exact copy of input buffer
+#if PETIT_COIL == PETIT_INTERNAL
+		PETIT_ENTER_CRITICAL();
+		PETIT_SHM_BEGIN(PETIT_SHM_COILS);
+#endif
 		for (i = 0; i < number_of_coils; i++)
 		{
-			// 7 is the index beyond the header for the function
-			current_bit = (Petit->Buffer[(i >> 3U) + 7U]
-					& 1U << (i & 7U))
-							!= 0;
+			current_bit = (data[i >> 3U] & 1U << (i & 7U)) != 0;
 #if defined(PETIT_COIL) && \
 		(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
+#if PETIT_COIL == PETIT_BOTH
+			// not across the callback below
+			PETIT_SHM_BEGIN(PETIT_SHM_COILS);
+#endif
 			if (current_bit)
 				PetitCoils[(start_coil + i) >> 3U] |=
 						1U << ((start_coil + i) & 7U);
 			else
 				PetitCoils[(start_coil + i) >> 3U] &=
 						~(1U << ((start_coil + i) & 7U));
+#if PETIT_COIL == PETIT_BOTH
+			PETIT_SHM_END(PETIT_SHM_COILS);
+#endif
 #endif
 #if defined(PETIT_COIL) && \
 		( PETIT_COIL == PETIT_EXTERNAL || PETIT_COIL == PETIT_BOTH)
 			if (!PetitPortCoilWrite(start_coil + i, current_bit))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				return PETIT_ERROR_CODE_04;
 			}
 #endif
 		}
-		PetitLedSuc();
-		prepare_tx(Petit);
+#if PETIT_COIL == PETIT_INTERNAL
+		PETIT_SHM_END(PETIT_SHM_COILS);
+		PETIT_EXIT_CRITICAL();
+#endif
+		PETIT_HEAT_COUNT(PETIT_HEAT_COIL_WRITE, start_coil, number_of_coils);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED */
 
@@ -648,24 +1502,53 @@ static void write_multiple_coils(T_PETIT_MODBUS *Petit)
  * Modbus function 16 - Write multiple registers
  */
 #if PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED != 0
-static void write_multiple_registers(T_PETIT_MODBUS *Petit)
+static pu8_t write_multiple_registers(T_PETIT_MODBUS *Petit)
 {
 	// Write single numerical output
 	pu16_t start_address = 0;
-	pu8_t byte_count = 0;
+	pu16_t byte_count = 0;
 	pu16_t num_registers = 0;
-	pu8_t i = 0;
+#if PETIT_REG != PETIT_INTERNAL
+	pu16_t i = 0;
 	pu16_t value = 0;
+#endif
+	// 7 is the index beyond the header for the function
+	const pu8_t *data = &Petit->Buffer[7U];
 
 	// The message contains the requested start address and number of registers
 	start_address = PETIT_BUF_DAT_M(0);
 	num_registers = PETIT_BUF_DAT_M(1);
 	byte_count = Petit->Buffer[C_IBUF_BYTE_CNT];
+#if PETIT_JUMBO > 0
+	// a jumbo frame has a 16-bit byte count, and its data one byte later
+	if (Petit->Jumbo_Regs != 0)
+	{
+		byte_count = (pu16_t) (byte_count << 8U)
+				| Petit->Buffer[C_IBUF_BYTE_CNT + 1U];
+		data = &Petit->Buffer[8U];
+	}
+#endif
+#if PETIT_SHADOW > 0
+	if (PetitShadowOwner == Petit)
+	{
+		data = PetitShadow;
+	}
+#endif
 
+	// a jumbo frame carries as many registers as were negotiated
+#if PETIT_JUMBO > 0
+	if (num_registers == 0 || num_registers > (Petit->Jumbo_Regs != 0
+			? Petit->Jumbo_Regs : 123U))
+#else
+	if (num_registers == 0 || num_registers > 123U)
+#endif
+		return PETIT_ERROR_CODE_03;
 	// If it is bigger than RegisterNumber return error to Modbus Master
-	if ((start_address + num_registers)
+	else if ((start_address + num_registers)
 			> NUMBER_OF_PETITREGISTERS)
-		handle_error(Petit, PETIT_ERROR_CODE_02);
+		return PETIT_ERROR_CODE_02;
+	else if (byte_count < 2U * num_registers)
+		return PETIT_ERROR_CODE_03;
 	else
 	{
 		// Initialise the output buffer. The first byte in the buffer says how many outputs we have set
@@ -673,30 +1556,201 @@ static void write_multiple_registers(T_PETIT_MODBUS *Petit)
 		PetitRegChange = 1U;
 
 		// Output data buffer is exact copy of input buffer
+#if PETIT_REG == PETIT_INTERNAL
+		// the whole block at once, see PETIT_SWAP
+		PETIT_ENTER_CRITICAL();
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+		PetitRegsFromWire(&PetitRegisters[start_address], data,
+				num_registers);
+		PETIT_SHM_END(PETIT_SHM_REGISTERS);
+		PETIT_EXIT_CRITICAL();
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+		PETIT_JOURNAL_Mark(start_address, num_registers);
+#endif
+#else
 		for (i = 0; i < num_registers; i++)
 		{
-			// 7 is the index beyond the header for the function
-			value = (Petit->Buffer[2U*i + 7U] << 8U)
-					| (Petit->Buffer[2U*i + 8U]);
-#if defined(PETIT_REG) && \
-		(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
-			PetitRegisters[start_address + i] = value;
+			value = (data[2U*i] << 8U) | (data[2U*i + 1U]);
+#if defined(PETIT_REG) && PETIT_REG == PETIT_BOTH
+			PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS);
+			PETIT_REG_STORE(PetitRegisters[start_address + i], value);
+			PETIT_SHM_END(PETIT_SHM_REGISTERS);
+#if defined(PETIT_JOURNAL) && PETIT_JOURNAL > 0
+			PETIT_JOURNAL_Mark(start_address + i, 1U);
+#endif
 #endif
 #if defined(PETIT_REG) && \
 		( PETIT_REG == PETIT_EXTERNAL || PETIT_REG == PETIT_BOTH)
 			if (!PetitPortRegWrite(start_address + i, value))
 			{
-				handle_error(Petit, PETIT_ERROR_CODE_04);
-				return;
+				// the ones before, and maybe this one, have changed
+				PETIT_DELTA_MARK(start_address, i + 1U);
+				return PETIT_ERROR_CODE_04;
 			}
 #endif
 		}
-		PetitLedSuc();
-		prepare_tx(Petit);
+#endif
+		PETIT_HEAT_COUNT(PETIT_HEAT_REG_WRITE, start_address, num_registers);
+		PETIT_DELTA_MARK(start_address, num_registers);
 	}
+	return 0;
 }
 #endif /* PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED */
 
+#if PETIT_JUMBO > 0
+/**
+ * @fn jumbo_len
+ * Length predictor of C_FCODE_JUMBO: the function code, the registers asked
+ * for and the CRC.
+ */
+static pu16_t jumbo_len(const T_PETIT_MODBUS *Petit)
+{
+	(void) Petit;
+	return 6U;
+}
+
+/**
+ * @fn write_registers_len
+ * Length predictor of function 16, whose byte count is 16 bits wide in a
+ * jumbo frame.
+ */
+static pu16_t write_registers_len(const T_PETIT_MODBUS *Petit)
+{
+	pu16_t cnt;
+
+	if (Petit->Jumbo_Regs == 0)
+	{
+		return PetitFnLenByteCnt(Petit);
+	}
+	if (Petit->BufI > C_IBUF_BYTE_CNT + 1U)
+	{
+		cnt = ((pu16_t) Petit->Buffer[C_IBUF_BYTE_CNT] << 8U)
+				| Petit->Buffer[C_IBUF_BYTE_CNT + 1U];
+		// too long for any buffer, rather than wrapping around
+		return cnt > 0xFFFFU - 10U ? 0xFFFFU : cnt + 10U;
+	}
+	return 0;
+}
+
+/**
+ * @fn jumbo_mode
+ * Vendor function C_FCODE_JUMBO - switch to jumbo frames
+ *
+ * The request asks for the registers one frame should carry, 0 to go back to
+ * standard frames.  The response grants as many as the buffer holds, and
+ * from then on functions 3, 4 and 16 take and give 16-bit byte counts.  The
+ * instance stays in that mode until asked again or initialised, so a master
+ * that is not sure of the mode, after a timeout for example, asks again.
+ */
+static pu8_t jumbo_mode(T_PETIT_MODBUS *Petit)
+{
+	pu16_t regs = PETIT_BUF_DAT_M(0);
+	pu16_t room = 0;
+
+	// a write of that many registers in the buffer, CRC included
+	if (PETIT_BUF_SIZE_M(Petit) > 10U)
+	{
+		room = (PETIT_BUF_SIZE_M(Petit) - 10U) / 2U;
+	}
+	if (regs > room)
+	{
+		regs = room;
+	}
+	Petit->Jumbo_Regs = regs;
+	Petit->Buffer[2U] = (pu8_t) (regs >> 8U);
+	Petit->Buffer[3U] = (pu8_t) (regs & 0xFFU);
+	Petit->BufJ = 4U;
+	return 0;
+}
+#define C_PETIT_WRITE_REGS_LEN write_registers_len
+#else
+#define C_PETIT_WRITE_REGS_LEN PetitFnLenByteCnt
+#endif /* PETIT_JUMBO */
+
+#if PETIT_SHADOW > 0
+/**
+ * @fn stage_start
+ * Takes the shadow bank for the data of a write of functions 15 or 16 whose
+ * header has just arrived, and starts its CRC.
+ * @return 1 if the data is to be staged, 0 to receive it in the buffer
+ */
+static pb_t stage_start(T_PETIT_MODBUS *Petit)
+{
+	pb_t taken = 0;
+
+	// a replaced handler expects the data in the buffer
+#if PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED != 0 && \
+	PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED != 0
+	if (Petit->Function->Handler != write_multiple_coils
+			&& Petit->Function->Handler != write_multiple_registers)
+#elif PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED != 0
+	if (Petit->Function->Handler != write_multiple_coils)
+#elif PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED != 0
+	if (Petit->Function->Handler != write_multiple_registers)
+#endif
+	{
+		return 0;
+	}
+	// more data than the bank holds goes to the buffer, for the handler to
+	// refuse
+	if (Petit->Buffer[C_IBUF_BYTE_CNT] > C_PETIT_SHADOW_SIZE)
+	{
+		return 0;
+	}
+#if PETIT_JUMBO > 0
+	// the data of a jumbo write stays in the buffer, as big as it is
+	if (Petit->Jumbo_Regs != 0
+			&& Petit->Buffer[C_IBUF_FN_CODE] == C_FCODE_WRITE_MULTIPLE_REGISTERS)
+	{
+		return 0;
+	}
+#endif
+	PETIT_ENTER_CRITICAL();
+	if (PetitShadowOwner == 0)
+	{
+		PetitShadowOwner = Petit;
+		taken = 1;
+	}
+	PETIT_EXIT_CRITICAL();
+	if (taken)
+	{
+		Petit->Stage_Cnt = Petit->Buffer[C_IBUF_BYTE_CNT];
+		PetitCRC16(Petit, Petit->Buffer, C_IBUF_BYTE_CNT + 1U);
+	}
+	return taken;
+}
+
+/**
+ * @fn stage_byte
+ * Stages one data byte of a write and adds it to the CRC.  Bytes beyond what
+ * any valid write carries are only counted.
+ */
+static void stage_byte(T_PETIT_MODBUS *Petit, pu8_t Rx)
+{
+	pu16_t i = Petit->Buffer[C_IBUF_BYTE_CNT] - Petit->Stage_Cnt;
+
+	if (i < C_PETIT_SHADOW_SIZE)
+	{
+		PetitShadow[i] = Rx;
+	}
+	Petit->Stage_Cnt--;
+	CRC16_calc(Petit, Rx);
+}
+
+/**
+ * @fn stage_release
+ * Gives the shadow bank back, once its data is committed or dropped.
+ */
+static void stage_release(T_PETIT_MODBUS *Petit)
+{
+	Petit->Stage_Cnt = 0;
+	if (PetitShadowOwner == Petit)
+	{
+		PetitShadowOwner = 0;
+	}
+}
+#endif
+
 /******************************************************************************/
 
 /**
@@ -705,36 +1759,40 @@ static void write_multiple_registers(T_PETIT_MODBUS *Petit)
  */
 static void rx_rtu(T_PETIT_MODBUS *Petit)
 {
-	pu8_t i;
 	T_PETIT_BUFFER_STATUS buf_stat = E_PETIT_FALSE_FUNCTION;
 	buf_stat = check_buffer_complete(Petit);
 
 	if (buf_stat == E_PETIT_DATA_READY)
 	{
-		// disable timeout
-		PetitPortTimerStop();
+		// the timeout was disabled by PetitRxBufferInsert already
 
 		// CRC calculate
-		Petit->CRC16 = 0xFFFF;
 		// subtract two to skip the CRC in the ADU
 		Petit->BufJ = Petit->Expected_RX_Cnt - 2U;
-		for (i = 0; i < Petit->BufJ; ++i)
-		{
-			CRC16_calc(Petit, Petit->Buffer[i]);
-		}
+#if PETIT_SHADOW > 0
+		// the CRC of a staged write was kept up as it arrived
+		if (PetitShadowOwner != Petit)
+#endif
+		PetitCRC16(Petit, Petit->Buffer, Petit->BufJ);
 
-		PetitRxBufferReset(Petit);
+		rx_reset(Petit);
 		if (((pu16_t) Petit->Buffer[Petit->BufJ]
 				+ ((pu16_t) Petit->Buffer[Petit->BufJ
 						+ 1U] << 8U)) == Petit->CRC16)
 		{
 			// Valid message!
-			Petit->Xmit_State = E_PETIT_RXTX_PROCESS;
+			PETIT_SET_STATE_M(E_PETIT_RXTX_PROCESS);
 		}
 		else
 		{
 			PetitLedCrcFail();
-			Petit->Xmit_State = E_PETIT_RXTX_RX;
+			PETIT_SET_STATE_M(E_PETIT_RXTX_RX);
+#if PETIT_SHADOW > 0
+			stage_release(Petit);
+#endif
+#if PETIT_BUFFER == PETIT_EXTERNAL
+			buffer_release(Petit);
+#endif
 		}
 	}
 }
@@ -747,112 +1805,313 @@ static void rx_rtu(T_PETIT_MODBUS *Petit)
  */
 static void tx_rtu(T_PETIT_MODBUS *Petit)
 {
-	Petit->CRC16 = 0xFFFF;
-	for (Petit->BufI = 0; Petit->BufI < Petit->BufJ;
-			Petit->BufI++)
+	PetitCRC16(Petit, Petit->Buffer, Petit->BufJ);
+	Petit->BufI = Petit->BufJ;
+
+#if PETIT_STREAM > 0
+	// a streamed response gets its CRC after the last data byte
+	if (Petit->Stream_Cnt == 0)
+#endif
 	{
-		CRC16_calc(Petit, Petit->Buffer[Petit->BufI]);
+		Petit->Buffer[Petit->BufI++] = Petit->CRC16;
+		Petit->Buffer[Petit->BufI++] = Petit->CRC16 >> 8U;
 	}
 
-	Petit->Buffer[Petit->BufI++] = Petit->CRC16;
-	Petit->Buffer[Petit->BufI++] = Petit->CRC16 >> 8U;
-
 	Petit->Ptr = Petit->Buffer;
 
 	Petit->Tx_Ctr = 0;
-	Petit->Xmit_State = E_PETIT_RXTX_TX_DLY;
+	PETIT_SET_STATE_M(E_PETIT_RXTX_TX_DLY);
 }
 
 /**
- * @fn Petit_ResponseProcess
- * This function processes the modbus response once it has been determined that
- * the message is for this node and the length is correct.
- * @note Only use this function if rx is clear for processing
+ * @fn tx_begin
+ * Prints the first character to start the UART peripheral.
  */
-static void response_process(T_PETIT_MODBUS *Petit)
+static void tx_begin(T_PETIT_MODBUS *Petit)
 {
-	// Data is for us but which function?
-	switch (Petit->Buffer[C_IBUF_FN_CODE])
+	PETIT_SET_STATE_M(E_PETIT_RXTX_TX);
+	Petit->Tx_Begin(*Petit->Ptr++);
+	Petit->BufI--;
+}
+
+#if defined(PETITMODBUS_TURNAROUND) && \
+	!(defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0)
+/**
+ * @fn turnaround_left
+ * The end of the turnaround is latched in Tx_Due the first time it is seen,
+ * so a wrap of the 16-bit PetitPortClock can not bring the wait back later.
+ * A stall of more than a whole wrap before it is seen can still make the
+ * response wait up to one turnaround longer, never go out early.
+ * @return the clock ticks left of the turnaround, 0 once it is over
+ */
+static pu16_t turnaround_left(T_PETIT_MODBUS *Petit)
+{
+	pu16_t elapsed;
+
+	if (Petit->Tx_Due)
+	{
+		return 0;
+	}
+	elapsed = PetitPortClock() - Petit->Rx_Stamp;
+	if (elapsed >= (pu16_t) (PETITMODBUS_TURNAROUND))
 	{
+		Petit->Tx_Due = 1;
+		return 0;
+	}
+	return (pu16_t) (PETITMODBUS_TURNAROUND) - elapsed;
+}
+#endif
+
+/**
+ * @fn tx_delay
+ * Starts the response once the turnaround is over.
+ */
+static void tx_delay(T_PETIT_MODBUS *Petit)
+{
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+	// PetitTxTurnaround sends it if the turnaround is not over yet
+	if (Petit->Tx_Due)
+	{
+		tx_begin(Petit);
+	}
+#elif defined(PETITMODBUS_TURNAROUND)
+	if (turnaround_left(Petit) == 0)
+	{
+		tx_begin(Petit);
+	}
+#else
+	if (Petit->Tx_Ctr < PETITMODBUS_DLY_TOP)
+	{
+		Petit->Tx_Ctr++;
+	}
+	else
+	{
+		tx_begin(Petit);
+	}
+#endif
+}
+
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+/**
+ * Ends the turnaround.  Called by the porting code from a one-shot timer armed
+ * in Timer_Stop, which the slave calls once the request is complete.
+ *
+ * A response that is ready goes out right here, at the end of the turnaround
+ * and without waiting for the main loop.  Otherwise PETIT_MODBUS_Process sends
+ * it as soon as it is ready.
+ */
+void PetitTxTurnaround(T_PETIT_MODBUS *Petit)
+{
+	if (Petit->Xmit_State == E_PETIT_RXTX_TX_DLY)
+	{
+		tx_begin(Petit);
+	}
+	else
+	{
+		Petit->Tx_Due = 1;
+	}
+}
+#endif
+
+/**
+ * The built-in function code table.
+ *
+ * Disabled function codes keep their entry so the request can still be
+ * framed, but have no handler and are answered with an exception.
+ * Further entries may be appended at compile time by defining
+ * PETIT_USER_FUNCTIONS in PetitModbusUserPort.h.
+ */
+static PETIT_CODE const T_PETIT_FUNCTION PetitFunctions[] PETIT_FLASH_ATTR =
+{
 #if PETITMODBUS_READ_COILS_ENABLED > 0
-	case C_FCODE_READ_COILS:
-		read_coils(Petit);
-		break;
+	{ C_FCODE_READ_COILS, PetitFnLenFixed, read_coils },
+#else
+	{ C_FCODE_READ_COILS, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_READ_DISCRETES_ENABLED > 0
-	case C_FCODE_READ_DISCRETES:
-		read_discretes(Petit);
-		break;
+	{ C_FCODE_READ_DISCRETES, PetitFnLenFixed, read_discretes },
+#else
+	{ C_FCODE_READ_DISCRETES, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_READ_HOLDING_REGISTERS_ENABLED > 0
-	case C_FCODE_READ_HOLDING_REGISTERS:
-		read_holding_registers(Petit);
-		break;
+	{ C_FCODE_READ_HOLDING_REGISTERS, PetitFnLenFixed, read_holding_registers },
+#else
+	{ C_FCODE_READ_HOLDING_REGISTERS, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_READ_INPUT_REGISTERS_ENABLED > 0
-	case C_FCODE_READ_INPUT_REGISTERS:
-		read_input_registers(Petit);
-		break;
+	{ C_FCODE_READ_INPUT_REGISTERS, PetitFnLenFixed, read_input_registers },
+#else
+	{ C_FCODE_READ_INPUT_REGISTERS, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_WRITE_SINGLE_COIL_ENABLED > 0
-	case C_FCODE_WRITE_SINGLE_COIL:
-		write_single_coil(Petit);
-		break;
+	{ C_FCODE_WRITE_SINGLE_COIL, PetitFnLenFixed, write_single_coil },
+#else
+	{ C_FCODE_WRITE_SINGLE_COIL, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_WRITE_SINGLE_REGISTER_ENABLED > 0
-	case C_FCODE_WRITE_SINGLE_REGISTER:
-		write_single_register(Petit);
-		break;
+	{ C_FCODE_WRITE_SINGLE_REGISTER, PetitFnLenFixed, write_single_register },
+#else
+	{ C_FCODE_WRITE_SINGLE_REGISTER, PetitFnLenFixed, 0 },
 #endif
 #if PETITMODBUS_WRITE_MULTIPLE_COILS_ENABLED > 0
-	case C_FCODE_WRITE_MULTIPLE_COILS:
-		write_multiple_coils(Petit);
-		break;
+	{ C_FCODE_WRITE_MULTIPLE_COILS, PetitFnLenByteCnt, write_multiple_coils },
+#else
+	{ C_FCODE_WRITE_MULTIPLE_COILS, PetitFnLenByteCnt, 0 },
 #endif
 #if PETITMODBUS_WRITE_MULTIPLE_REGISTERS_ENABLED > 0
-	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
-		write_multiple_registers(Petit);
-		break;
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, C_PETIT_WRITE_REGS_LEN,
+			write_multiple_registers },
+#else
+	{ C_FCODE_WRITE_MULTIPLE_REGISTERS, C_PETIT_WRITE_REGS_LEN, 0 },
 #endif
-	default:
-		handle_error(Petit, PETIT_ERROR_CODE_01);
-		break;
+#if PETIT_JUMBO > 0
+	{ C_FCODE_JUMBO, jumbo_len, jumbo_mode },
+#endif
+#if defined(PETIT_DELTA) && PETIT_DELTA > 0
+	{ C_FCODE_DELTA, PetitFnLenFixed, PetitDeltaRead },
+#endif
+#if defined(PETIT_USER_FUNCTIONS)
+	PETIT_USER_FUNCTIONS
+#endif
+};
+
+#define C_PETIT_FUNCTION_CNT (sizeof(PetitFunctions) / sizeof(PetitFunctions[0]))
+
+/**
+ * @fn find_function
+ * Looks up the table entry of a function code.  The table registered at init
+ * is searched first, then the built-in table.
+ * @return the entry, or 0 if the function code is unknown
+ */
+static const T_PETIT_FUNCTION *find_function(const T_PETIT_MODBUS *Petit,
+		pu8_t Code)
+{
+	pu8_t i;
+
+	for (i = 0; i < Petit->User_Function_Cnt; i++)
+	{
+		if (Petit->User_Functions[i].Code == Code)
+		{
+			return &Petit->User_Functions[i];
+		}
+	}
+	for (i = 0; i < C_PETIT_FUNCTION_CNT; i++)
+	{
+		if (PetitFunctions[i].Code == Code)
+		{
+			return &PetitFunctions[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * @fn Petit_ResponseProcess
+ * This function processes the modbus response once it has been determined that
+ * the message is for this node and the length is correct.
+ * @note Only use this function if rx is clear for processing
+ */
+static void response_process(T_PETIT_MODBUS *Petit)
+{
+	pu8_t error = PETIT_ERROR_CODE_01;
+
+	// Data is for us, the function was looked up while it was received
+	if (Petit->Function != 0 && Petit->Function->Handler != 0)
+	{
+		error = Petit->Function->Handler(Petit);
+	}
+#if PETIT_SHADOW > 0
+	stage_release(Petit);
+#endif
+
+	if (error != 0)
+	{
+		handle_error(Petit, error);
+	}
+	else
+	{
+		PetitLedSuc();
+		prepare_tx(Petit);
 	}
 	return;
 }
 
 /******************************************************************************/
 
+/**
+ * @fn next_deadline
+ * @return when PETIT_MODBUS_Process has to be called next
+ */
+static pu16_t next_deadline(T_PETIT_MODBUS *Petit)
+{
+	switch (Petit->Xmit_State)
+	{
+	case E_PETIT_RXTX_TX_DLY:
+#if defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0
+		return PETIT_PROCESS_IDLE;
+#elif defined(PETITMODBUS_TURNAROUND)
+		return turnaround_left(Petit);
+#else
+		// the loop counter only moves when called
+		return 0;
+#endif
+	case E_PETIT_RXTX_PROCESS:
+	case E_PETIT_RXTX_TX_DATABUF:
+#if defined(PETITMODBUS_TURNAROUND) && \
+	!(defined(PETITMODBUS_TURNAROUND_TIMER) && PETITMODBUS_TURNAROUND_TIMER > 0)
+		// between the steps of a response too
+		(void) turnaround_left(Petit);
+#endif
+		return 0;
+#if PETITMODBUS_PROCESS_POSITION <= 1
+	case E_PETIT_RXTX_RX:
+		// a frame completed while this call was running
+		if (Petit->Expected_RX_Cnt != 0
+				&& Petit->BufI >= Petit->Expected_RX_Cnt)
+		{
+			return 0;
+		}
+		return PETIT_PROCESS_IDLE;
+#endif
+	default:
+		// waiting on the RX or TX interrupt
+		return PETIT_PROCESS_IDLE;
+	}
+}
+
 /**
  * @fn ProcessPetitModbus
  * ModBus main core! Call this function into main!
  * @mermaid{ProcessPetitModbus}
+ * @return 0 to be called again right away, the number of PetitPortClock ticks
+ * it may sleep, or PETIT_PROCESS_IDLE to sleep until the next RX or TX
+ * interrupt or the turnaround timer
  */
-void PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit)
+pu16_t PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit)
 {
+#if PETIT_RXRING > 0
+	if (Petit->Rx_Ring != 0)
+	{
+		PETIT_RXRING_Drain(Petit);
+	}
+#endif
 	switch (Petit->Xmit_State)
 	{
+	// position 2 gets as far as the TX delay in PetitRxBufferInsert
+#if PETITMODBUS_PROCESS_POSITION <= 1
 #if PETITMODBUS_PROCESS_POSITION >= 1
 	case E_PETIT_RXTX_PROCESS:
 		response_process(Petit);
 		// no break here.  Position 1 blends processing with TxRTU.
 #endif
+		// fall through
 	case E_PETIT_RXTX_TX_DATABUF: // if the answer is ready, send it
 		tx_rtu(Petit);
+#endif
 		// fall through
 	case E_PETIT_RXTX_TX_DLY:
 		// process the TX delay
-		if (Petit->Tx_Ctr < PETITMODBUS_DLY_TOP)
-		{
-			Petit->Tx_Ctr++;
-		}
-		else
-		{
-			// print first character to start UART peripheral
-			Petit->Xmit_State = E_PETIT_RXTX_TX;
-			Petit->Tx_Begin(*Petit->Ptr++);
-			Petit->BufI--;
-		}
+		tx_delay(Petit);
 		break;
 	case E_PETIT_RXTX_TX:
 		// no work is done here.  wait until transmission completes.
@@ -864,10 +2123,143 @@ void PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit)
 		break;
 #endif
 	default:
+#if PETITMODBUS_PROCESS_POSITION <= 1
 		rx_rtu(Petit);
+#endif
 		break;
 	}
+#if PETIT_RXRING > 0
+	if (Petit->Rx_Ring != 0)
+	{
+		// and no later than the end of the frame being received
+		return PetitRxRingWait(Petit, next_deadline(Petit));
+	}
+#endif
+	return next_deadline(Petit);
+}
+
+#if defined(PETIT_BATCH) && PETIT_BATCH > 0
+/**
+ * Answers complete request ADUs without the byte by byte state machine, for
+ * gateways and replay tools that receive frames already delimited.
+ *
+ * Responses are packed into Arena in the order of the requests.  A request
+ * the slave would not answer on the serial line, because of its address, its
+ * CRC, an unknown function code or a wrong length, gets no response.  The
+ * instance must be idle, and its buffer is not used with PETIT_EXTERNAL.
+ * @param Adus the requests, the responses are filled in
+ * @param Arena the responses, a frame buffer or more in size
+ * @return the number of requests processed, less than Cnt once Arena has no
+ *   room for another frame buffer
+ */
+pu16_t PETIT_MODBUS_ProcessBatch(T_PETIT_MODBUS *Petit, T_PETIT_ADU *Adus,
+		pu16_t Cnt, pu8_t *Arena, pu16_t Arena_Size)
+{
+	const T_PETIT_FUNCTION *function = 0;
+	pu16_t slot = C_PETITMODBUS_RXTX_BUFFER_SIZE;
+	pu16_t room;
+	pu16_t used = 0;
+	pu16_t n;
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	pu8_t *buffer = Petit->Buffer;
+	pu16_t buffer_size = Petit->Buffer_Size;
+
+	// frames as big as the serial line takes
+	if (buffer != 0)
+	{
+		slot = buffer_size;
+	}
+	else if (Petit->Pool != 0)
+	{
+		slot = Petit->Pool->Size;
+	}
+#endif
+	room = slot;
+#if PETIT_STREAM > 0
+	// and room for a streamed read of 125 registers
+	if (room < 5U + 2U * 125U)
+	{
+		room = 5U + 2U * 125U;
+	}
+#endif
+
+	if (Petit->Xmit_State != E_PETIT_RXTX_RX || Petit->BufI != 0)
+	{
+		return 0;
+	}
+
+	for (n = 0; n < Cnt && Arena_Size - used >= room; n++)
+	{
+		T_PETIT_ADU *adu = &Adus[n];
+		pu8_t error = PETIT_ERROR_CODE_01;
+
+		adu->Rsp = 0;
+		adu->Rsp_Len = 0;
+		if (adu->Req_Len < 4U || adu->Req_Len > slot
+				|| adu->Req[0] != PETITMODBUS_SLAVE_ADDRESS)
+		{
+			continue;
+		}
+		// the CRC of a frame with its CRC appended is 0
+		if (PetitCRC16(Petit, adu->Req, adu->Req_Len) != 0)
+		{
+			PetitLedCrcFail();
+			continue;
+		}
+
+		// the response is built in place over a copy of the request,
+		// straight in the arena if the buffer can be pointed there
+#if PETIT_BUFFER == PETIT_EXTERNAL
+		Petit->Buffer = &Arena[used];
+		Petit->Buffer_Size = slot;
+#endif
+		memcpy(Petit->Buffer, adu->Req, adu->Req_Len);
+		Petit->BufI = adu->Req_Len;
+
+		// requests in a batch mostly share their function code
+		if (function == 0 || function->Code != adu->Req[C_IBUF_FN_CODE])
+		{
+			function = find_function(Petit, adu->Req[C_IBUF_FN_CODE]);
+		}
+		if (function == 0 || function->Length(Petit) != adu->Req_Len)
+		{
+			continue;
+		}
+		Petit->Function = function;
+		if (function->Handler != 0)
+		{
+			error = function->Handler(Petit);
+		}
+		if (error != 0)
+		{
+			error_response(Petit, error);
+		}
+
+		PetitCRC16(Petit, Petit->Buffer, Petit->BufJ);
+#if PETIT_BUFFER != PETIT_EXTERNAL
+		memcpy(&Arena[used], Petit->Buffer, Petit->BufJ);
+#endif
+		adu->Rsp = &Arena[used];
+		adu->Rsp_Len = Petit->BufJ;
+#if PETIT_STREAM > 0
+		while (Petit->Stream_Cnt != 0)
+		{
+			adu->Rsp[adu->Rsp_Len++] = stream_byte(Petit);
+		}
+#endif
+		adu->Rsp[adu->Rsp_Len++] = Petit->CRC16;
+		adu->Rsp[adu->Rsp_Len++] = Petit->CRC16 >> 8U;
+		used += adu->Rsp_Len;
+	}
+
+#if PETIT_BUFFER == PETIT_EXTERNAL
+	Petit->Buffer = buffer;
+	Petit->Buffer_Size = buffer_size;
+#endif
+	rx_reset(Petit);
+	return n;
 }
+#endif /* PETIT_BATCH */
 
 
 #if !defined(PETIT_COIL) || (PETIT_COIL != PETIT_INTERNAL && \
@@ -876,7 +2268,7 @@ void PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit)
 #endif
 
 #if !defined(PETIT_DISCRETE) || (PETIT_DISCRETE != PETIT_INTERNAL && \
-		PETIT_DISCRETE != PETIT_BOTH && PETIT_COIL != PETIT_EXTERNAL)
+		PETIT_DISCRETE != PETIT_BOTH && PETIT_DISCRETE != PETIT_EXTERNAL)
 #error "PETIT_DISCRETE not defined or not valid."
 #endif
 
@@ -887,5 +2279,5 @@ void PETIT_MODBUS_Process(T_PETIT_MODBUS *Petit)
 
 #if !defined(PETIT_INPUT_REG) || (PETIT_INPUT_REG != PETIT_INTERNAL && \
 		PETIT_INPUT_REG != PETIT_BOTH && PETIT_INPUT_REG != PETIT_EXTERNAL)
-#error "PETTI_INPUT_REG not defined or not valid."
+#error "PETIT_INPUT_REG not defined or not valid."
 #endif
@@ -0,0 +1,205 @@
+/******************************************************************************
+ * @file PetitPoint.c
+ *
+ * This file contains the typed points of PetitModbus.
+ *
+ * The application keeps its process values in T_PETIT_VALUE and calls
+ * PETIT_POINT_Write after updating them, or PETIT_POINT_Read after the master
+ * wrote the registers.  The conversion happens outside the critical section,
+ * which only covers the two or four register stores of a point.
+ *****************************************************************************/
+
+#include "PetitPoint.h"
+#include "PetitShm.h"
+
+#if defined(PETITMODBUS_POINTS_ENABLED) && PETITMODBUS_POINTS_ENABLED > 0
+
+// registers in the widest point
+#define C_PETIT_POINT_MAX_WORDS (4U)
+
+// the conversions take pu32_t and ps32_t for exactly 32 bits
+typedef char T_PETIT_POINT_U32_CHECK[sizeof(pu32_t) == 4U ? 1 : -1];
+typedef char T_PETIT_POINT_I32_CHECK[sizeof(ps32_t) == 4U ? 1 : -1];
+
+/******************************************************************************/
+
+/**
+ * @fn point_words
+ * @return the registers a point of Type takes, 0 if it is not supported
+ */
+static pu8_t point_words(pu8_t Type)
+{
+	switch (Type)
+	{
+	case E_PETIT_POINT_U32:
+	case E_PETIT_POINT_I32:
+	case E_PETIT_POINT_F32:
+		return 2U;
+#if PETIT_POINT_F64 > 0
+	case E_PETIT_POINT_F64:
+		return 4U;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @fn point_regs
+ * @return the first register of a point, 0 if it does not fit its bank or the
+ *   bank is not kept internally
+ */
+static pu16_t *point_regs(const T_PETIT_POINT *Point, pu8_t Words)
+{
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
+	if (Point->Bank == PETIT_POINT_HOLDING
+			&& Point->Address < NUMBER_OF_PETITREGISTERS
+			&& NUMBER_OF_PETITREGISTERS - Point->Address >= Words)
+	{
+		return &PetitRegisters[Point->Address];
+	}
+#endif
+#if defined(PETIT_INPUT_REG) && \
+	(PETIT_INPUT_REG == PETIT_INTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
+	if (Point->Bank == PETIT_POINT_INPUT
+			&& Point->Address < NUMBER_OF_INPUT_PETITREGISTERS
+			&& NUMBER_OF_INPUT_PETITREGISTERS - Point->Address >= Words)
+	{
+		return &PetitInputRegisters[Point->Address];
+	}
+#endif
+	(void) Point;
+	(void) Words;
+	return 0;
+}
+
+/**
+ * @fn order_words
+ * Turns words holding a value most significant byte first into the order of
+ * a point, or back again.
+ */
+static void order_words(pu8_t Order, pu16_t *Words, pu8_t Cnt)
+{
+	pu8_t i;
+
+	if (Order & PETIT_POINT_BYTE_SWAP)
+	{
+		for (i = 0; i < Cnt; i++)
+		{
+			Words[i] = (pu16_t) ((Words[i] << 8U) | (Words[i] >> 8U));
+		}
+	}
+	if (Order & PETIT_POINT_WORD_SWAP)
+	{
+		for (i = 0; i < Cnt / 2U; i++)
+		{
+			pu16_t word = Words[i];
+			Words[i] = Words[Cnt - 1U - i];
+			Words[Cnt - 1U - i] = word;
+		}
+	}
+}
+
+/******************************************************************************/
+
+/**
+ * Stores Cnt values into the registers of their points.
+ * @return false if a point was skipped because its type is not supported or
+ *   it does not fit its bank
+ */
+pb_t PETIT_POINT_Write(const T_PETIT_POINT *Points,
+		const T_PETIT_VALUE *Values, pu16_t Cnt)
+{
+	pb_t ok = true;
+	pu16_t n;
+
+	for (n = 0; n < Cnt; n++)
+	{
+		pu16_t words[C_PETIT_POINT_MAX_WORDS];
+		pu8_t cnt = point_words(Points[n].Type);
+		pu16_t *regs = cnt ? point_regs(&Points[n], cnt) : 0;
+		pu8_t i;
+
+		if (regs == 0)
+		{
+			ok = false;
+			continue;
+		}
+#if PETIT_POINT_F64 > 0
+		if (cnt == 4U)
+		{
+			pu64_t value = Values[n].U64;
+			words[0] = (pu16_t) (value >> 48U);
+			words[1] = (pu16_t) (value >> 32U);
+			words[2] = (pu16_t) (value >> 16U);
+			words[3] = (pu16_t) value;
+		}
+		else
+#endif
+		{
+			words[0] = (pu16_t) (Values[n].U32 >> 16U);
+			words[1] = (pu16_t) Values[n].U32;
+		}
+		order_words(Points[n].Order, words, cnt);
+
+		PETIT_ENTER_CRITICAL();
+		PETIT_SHM_BEGIN(PETIT_SHM_REGISTERS + Points[n].Bank);
+		for (i = 0; i < cnt; i++)
+		{
+			PETIT_REG_STORE(regs[i], words[i]);
+		}
+		PETIT_SHM_END(PETIT_SHM_REGISTERS + Points[n].Bank);
+		PETIT_EXIT_CRITICAL();
+	}
+	return ok;
+}
+
+/**
+ * Loads Cnt values from the registers of their points.
+ * @return false if a point was skipped because its type is not supported or
+ *   it does not fit its bank
+ */
+pb_t PETIT_POINT_Read(const T_PETIT_POINT *Points, T_PETIT_VALUE *Values,
+		pu16_t Cnt)
+{
+	pb_t ok = true;
+	pu16_t n;
+
+	for (n = 0; n < Cnt; n++)
+	{
+		pu16_t words[C_PETIT_POINT_MAX_WORDS];
+		pu8_t cnt = point_words(Points[n].Type);
+		pu16_t *regs = cnt ? point_regs(&Points[n], cnt) : 0;
+		pu8_t i;
+
+		if (regs == 0)
+		{
+			ok = false;
+			continue;
+		}
+		PETIT_ENTER_CRITICAL();
+		for (i = 0; i < cnt; i++)
+		{
+			words[i] = PETIT_REG_LOAD(regs[i]);
+		}
+		PETIT_EXIT_CRITICAL();
+
+		order_words(Points[n].Order, words, cnt);
+#if PETIT_POINT_F64 > 0
+		if (cnt == 4U)
+		{
+			Values[n].U64 = ((pu64_t) words[0] << 48U)
+					| ((pu64_t) words[1] << 32U)
+					| ((pu64_t) words[2] << 16U) | words[3];
+		}
+		else
+#endif
+		{
+			Values[n].U32 = ((pu32_t) words[0] << 16U) | words[1];
+		}
+	}
+	return ok;
+}
+
+#endif /* PETITMODBUS_POINTS_ENABLED */
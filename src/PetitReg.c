@@ -9,15 +9,17 @@
 #include "PetitModbusPort.h"
 
 /***********************Input/Output Coils and Registers***********************/
+// with PETIT_SHM the tables are defined in PetitShm.c
+#if !defined(PETIT_SHM) || PETIT_SHM == 0
 #if defined(NUMBER_OF_PETITCOILS) && NUMBER_OF_PETITCOILS > 0
 #if defined(PETIT_COIL) && \
-	(PETIT_COIL == PETIT_INTERNAL || PETTI_COIL == PETIT_BOTH)
+	(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
 pu8_t PetitCoils           [(NUMBER_OF_PETITCOILS + 7) >> 3];
 #endif
 #endif
 #if defined(NUMBER_OF_PETITDISCRETES) && NUMBER_OF_PETITDISCRETES > 0
 #if defined(PETIT_DISCRETE) && \
-	(PETIT_DISCRETE == PETIT_INTERNAL || PETTI_DISCRETE == PETIT_BOTH)
+	(PETIT_DISCRETE == PETIT_INTERNAL || PETIT_DISCRETE == PETIT_BOTH)
 pu8_t PetitDiscretes           [(NUMBER_OF_PETITDISCRETES + 7) >> 3];
 #endif
 #endif
@@ -36,6 +38,7 @@ pu16_t  PetitRegisters     [NUMBER_OF_PETITREGISTERS];
 pu16_t PetitInputRegisters [NUMBER_OF_INPUT_PETITREGISTERS];
 #endif
 #endif
+#endif /* PETIT_SHM */
 
 #if !defined(NUMBER_OF_PETITCOILS) || !defined(PETIT_COIL)
 #error "Could not determine number of coils."
@@ -53,4 +56,14 @@ pu16_t PetitInputRegisters [NUMBER_OF_INPUT_PETITREGISTERS];
 #error "Could not determine number of input registers."
 #endif
 
+#if defined(NUMBER_OF_CONST_PETITREGISTERS) && \
+	PETIT_CONST_REG_BASE < NUMBER_OF_PETITREGISTERS
+#error "Constant holding registers overlap the writable ones."
+#endif
+
+#if defined(NUMBER_OF_CONST_INPUT_PETITREGISTERS) && \
+	PETIT_CONST_INPUT_REG_BASE < NUMBER_OF_INPUT_PETITREGISTERS
+#error "Constant input registers overlap the other ones."
+#endif
+
 pu8_t PetitRegChange = 0;
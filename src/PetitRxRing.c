@@ -0,0 +1,150 @@
+/******************************************************************************
+ * @file PetitRxRing.c
+ *
+ * This file contains the receive ring of PetitModbus.
+ *
+ * The drain cuts the ring into runs of bytes without a gap between them and
+ * hands each run to PetitRxBufferInsertRun, which copies what the request
+ * length says is still to come in one go.  Slots are freed run by run.  The
+ * drain stops at a complete frame until the main loop has checked it, and
+ * bytes that come while the slave processes or answers are dropped, as they
+ * are without the ring.  Gaps are measured between the stamps of two bytes,
+ * or between the last stamp and the clock once the ring is empty.
+ *****************************************************************************/
+
+#include "PetitRxRing.h"
+
+#if PETIT_RXRING > 0
+
+#define C_PETIT_RXRING_MASK (PETIT_RXRING_SIZE - 1U)
+
+#if (PETIT_RXRING_SIZE & C_PETIT_RXRING_MASK) != 0 || PETIT_RXRING_SIZE > 128U
+#error "PETIT_RXRING_SIZE must be a power of two up to 128."
+#endif
+
+/**
+ * Empties the ring.
+ * @param[in] Gap the inter-frame gap in PetitPortClock ticks, for example
+ *   PETIT_T35_US(baud) for a microsecond clock
+ */
+void PETIT_RXRING_Init(T_PETIT_RXRING *Ring, pu16_t Gap)
+{
+	Ring->Head = 0;
+	Ring->Tail = 0;
+	Ring->Gap = Gap;
+	Ring->Last = 0;
+	Ring->Open = 0;
+	Ring->Overruns = 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @fn rxring_done
+ * @return 1 if a complete frame waits in the buffer to be checked
+ */
+static pb_t rxring_done(const T_PETIT_MODBUS *Petit)
+{
+	return Petit->Xmit_State == E_PETIT_RXTX_RX
+			&& Petit->Expected_RX_Cnt != 0
+			&& Petit->BufI >= Petit->Expected_RX_Cnt;
+}
+
+/**
+ * @fn rxring_gap
+ * Ends the open frame as the inter-frame timer would.  A complete frame and a
+ * response on its way are left alone, as the timer is stopped for them.
+ */
+static void rxring_gap(T_PETIT_MODBUS *Petit)
+{
+	Petit->Rx_Ring->Open = 0;
+	if (Petit->Xmit_State == E_PETIT_RXTX_RX && !rxring_done(Petit))
+	{
+		PetitRxBufferReset(Petit);
+	}
+}
+
+/**
+ * Feeds the bytes received since the last call to the instance.
+ * PETIT_MODBUS_Process calls it first thing; call it from elsewhere only in
+ * the same context.
+ */
+void PETIT_RXRING_Drain(T_PETIT_MODBUS *Petit)
+{
+	T_PETIT_RXRING *ring = Petit->Rx_Ring;
+	pu8_t tail = ring->Tail;
+	pu8_t head = ring->Head;
+	pu16_t now;
+	pu8_t i;
+	pu8_t n;
+	pu8_t end;
+
+	while (tail != head)
+	{
+		i = tail & C_PETIT_RXRING_MASK;
+		if (ring->Open && (pu16_t) (ring->Stamp[i] - ring->Last) >= ring->Gap)
+		{
+			rxring_gap(Petit);
+		}
+		// the run goes on up to a gap, the newest byte or the end of the ring
+		end = (pu8_t) (head - tail);
+		if (end > PETIT_RXRING_SIZE - i)
+		{
+			end = PETIT_RXRING_SIZE - i;
+		}
+		for (n = 1; n < end; n++)
+		{
+			if ((pu16_t) (ring->Stamp[i + n] - ring->Stamp[i + n - 1U])
+					>= ring->Gap)
+			{
+				break;
+			}
+		}
+		n = (pu8_t) PetitRxBufferInsertRun(Petit, &ring->Data[i], n);
+		if (n == 0)
+		{
+			// a complete frame waits to be checked
+			break;
+		}
+		ring->Last = ring->Stamp[i + n - 1U];
+		ring->Open = 1;
+		tail += n;
+		ring->Tail = tail;
+	}
+
+	// the clock is read first, so a byte it missed is in the ring
+	now = PetitPortClock();
+	if (ring->Open && tail == ring->Head
+			&& (pu16_t) (now - ring->Last) >= ring->Gap)
+	{
+		rxring_gap(Petit);
+	}
+}
+
+/**
+ * @param[in] Wait when PETIT_MODBUS_Process has to be called next otherwise
+ * @return Wait, or sooner if the open frame has to be ended
+ */
+pu16_t PetitRxRingWait(const T_PETIT_MODBUS *Petit, pu16_t Wait)
+{
+	const T_PETIT_RXRING *ring = Petit->Rx_Ring;
+	pu16_t left;
+
+	if (!ring->Open || Petit->Xmit_State != E_PETIT_RXTX_RX)
+	{
+		return Wait;
+	}
+	if (ring->Tail != ring->Head)
+	{
+		return 0;
+	}
+	left = (pu16_t) (PetitPortClock() - ring->Last);
+	if (left >= ring->Gap)
+	{
+		return 0;
+	}
+	left = ring->Gap - left;
+	return Wait < left ? Wait : left;
+}
+
+#endif /* PETIT_RXRING */
@@ -0,0 +1,283 @@
+/******************************************************************************
+ * @file PetitShm.c
+ *
+ * This file contains the shared register file of PetitModbus, for POSIX
+ * hosts.
+ *
+ * Until PETIT_SHM_Create the tables live in a segment in the process, so the
+ * slave runs the same with or without a shared one.  The sequence locks need
+ * no lock in the reader: it retries a copy that a write overlapped, and the
+ * writer never waits for a reader.
+ *****************************************************************************/
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200112L
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "PetitShm.h"
+
+#if defined(PETIT_SHM) && PETIT_SHM > 0
+
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static T_PETIT_SHM petit_shm_local;
+T_PETIT_SHM *PetitShm = &petit_shm_local;
+T_PETIT_SHM_TABLES *PetitShmTables = &petit_shm_local.Tables;
+
+/******************************************************************************/
+
+/**
+ * @fn shm_block
+ * Describes one table in the header of a segment.
+ */
+static void shm_block(T_PETIT_SHM *Shm, pu8_t Block, pu32_t Offset,
+		pu32_t Count, pu32_t Bytes)
+{
+	Shm->Block[Block].Seq = 0;
+	Shm->Block[Block].Offset = Offset;
+	Shm->Block[Block].Count = Count;
+	Shm->Block[Block].Bytes = Bytes;
+}
+
+/**
+ * @fn shm_header
+ * Fills in the header of a segment, all but its magic.
+ */
+static void shm_header(T_PETIT_SHM *Shm)
+{
+	Shm->Version = PETIT_SHM_VERSION;
+#if PETIT_REG_ORDER == PETIT_REG_WIRE
+	Shm->Flags = PETIT_SHM_WIRE;
+#else
+	Shm->Flags = 0;
+#endif
+	Shm->Size = sizeof(T_PETIT_SHM);
+	Shm->Pid = (pu32_t) getpid();
+	shm_block(Shm, PETIT_SHM_COILS, 0, 0, 0);
+	shm_block(Shm, PETIT_SHM_DISCRETES, 0, 0, 0);
+	shm_block(Shm, PETIT_SHM_REGISTERS, 0, 0, 0);
+	shm_block(Shm, PETIT_SHM_INPUT_REGISTERS, 0, 0, 0);
+#if defined(PETIT_COIL) && \
+	(PETIT_COIL == PETIT_INTERNAL || PETIT_COIL == PETIT_BOTH)
+	shm_block(Shm, PETIT_SHM_COILS, offsetof(T_PETIT_SHM, Tables.Coils),
+			NUMBER_OF_PETITCOILS, sizeof(Shm->Tables.Coils));
+#endif
+#if defined(PETIT_DISCRETE) && \
+	(PETIT_DISCRETE == PETIT_INTERNAL || PETIT_DISCRETE == PETIT_BOTH)
+	shm_block(Shm, PETIT_SHM_DISCRETES,
+			offsetof(T_PETIT_SHM, Tables.Discretes),
+			NUMBER_OF_PETITDISCRETES, sizeof(Shm->Tables.Discretes));
+#endif
+#if defined(PETIT_REG) && \
+	(PETIT_REG == PETIT_INTERNAL || PETIT_REG == PETIT_BOTH)
+	shm_block(Shm, PETIT_SHM_REGISTERS,
+			offsetof(T_PETIT_SHM, Tables.Registers),
+			NUMBER_OF_PETITREGISTERS, sizeof(Shm->Tables.Registers));
+#endif
+#if defined(PETIT_INPUT_REG) && \
+	(PETIT_INPUT_REG == PETIT_INTERNAL || PETIT_INPUT_REG == PETIT_BOTH)
+	shm_block(Shm, PETIT_SHM_INPUT_REGISTERS,
+			offsetof(T_PETIT_SHM, Tables.InputRegisters),
+			NUMBER_OF_INPUT_PETITREGISTERS,
+			sizeof(Shm->Tables.InputRegisters));
+#endif
+}
+
+/**
+ * Moves the tables into a new shared-memory segment.  Call it before the
+ * slave starts; what the tables hold is kept.
+ * @param[in] Name the name of the segment, "/petit" for example.  A segment
+ *   left by a writer that did not destroy it is replaced.
+ * @return 1 on success, 0 if the tables stay in the process
+ */
+pb_t PETIT_SHM_Create(const char *Name)
+{
+	T_PETIT_SHM *shm;
+	int fd;
+
+	shm_unlink(Name);
+	fd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	if (ftruncate(fd, sizeof(T_PETIT_SHM)) != 0)
+	{
+		close(fd);
+		shm_unlink(Name);
+		return 0;
+	}
+	shm = (T_PETIT_SHM *) mmap(NULL, sizeof(T_PETIT_SHM),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		shm_unlink(Name);
+		return 0;
+	}
+
+	PETIT_ENTER_CRITICAL();
+	shm_header(shm);
+	memcpy(&shm->Tables, PetitShmTables, sizeof(T_PETIT_SHM_TABLES));
+	PetitShm = shm;
+	PetitShmTables = &shm->Tables;
+	PETIT_EXIT_CRITICAL();
+	// readers may use the segment once its magic is there
+	__atomic_store_n(&shm->Magic, PETIT_SHM_MAGIC, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ * Moves the tables back into the process and removes the segment.  Readers
+ * that still have it mapped see its magic cleared.
+ */
+void PETIT_SHM_Destroy(const char *Name)
+{
+	T_PETIT_SHM *shm = PetitShm;
+
+	if (shm == &petit_shm_local)
+	{
+		return;
+	}
+	PETIT_ENTER_CRITICAL();
+	memcpy(&petit_shm_local.Tables, &shm->Tables, sizeof(T_PETIT_SHM_TABLES));
+	PetitShm = &petit_shm_local;
+	PetitShmTables = &petit_shm_local.Tables;
+	PETIT_EXIT_CRITICAL();
+	__atomic_store_n(&shm->Magic, 0, __ATOMIC_RELEASE);
+	munmap(shm, sizeof(T_PETIT_SHM));
+	shm_unlink(Name);
+}
+
+/**
+ * Starts a write to a table.  The writes that follow, up to PETIT_SHM_End,
+ * are seen by readers all at once.
+ * @param[in] Block PETIT_SHM_COILS, PETIT_SHM_REGISTERS and so on
+ */
+void PETIT_SHM_Begin(pu8_t Block)
+{
+	T_PETIT_SHM_BLOCK *block = &PetitShm->Block[Block];
+
+	__atomic_store_n(&block->Seq, block->Seq + 1U, __ATOMIC_RELAXED);
+	// the odd sequence is seen before any of the writes
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Ends a write to a table started by PETIT_SHM_Begin.
+ */
+void PETIT_SHM_End(pu8_t Block)
+{
+	T_PETIT_SHM_BLOCK *block = &PetitShm->Block[Block];
+
+	__atomic_store_n(&block->Seq, block->Seq + 1U, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+
+/**
+ * Maps a segment for reading.
+ * @return the segment, NULL if there is none or it is not complete
+ */
+const T_PETIT_SHM *PETIT_SHM_Open(const char *Name)
+{
+	const T_PETIT_SHM *shm;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(Name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(T_PETIT_SHM))
+	{
+		close(fd);
+		return NULL;
+	}
+	shm = (const T_PETIT_SHM *) mmap(NULL, (size_t) st.st_size, PROT_READ,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		return NULL;
+	}
+	if (__atomic_load_n(&shm->Magic, __ATOMIC_ACQUIRE) != PETIT_SHM_MAGIC
+			|| shm->Version != PETIT_SHM_VERSION
+			|| shm->Size != (pu32_t) st.st_size)
+	{
+		munmap((void *) shm, (size_t) st.st_size);
+		return NULL;
+	}
+	return shm;
+}
+
+/**
+ * Unmaps a segment mapped by PETIT_SHM_Open.
+ */
+void PETIT_SHM_Close(const T_PETIT_SHM *Shm)
+{
+	munmap((void *) Shm, Shm->Size);
+}
+
+/**
+ * Copies a consistent range of a table.
+ * @param[in] Start the first register, or the first byte of eight coils or
+ *   discrete inputs
+ * @param[in] Cnt registers or bytes to copy
+ * @param[out] Data the copy, as stored in the segment
+ * @return 1 on success, 0 if the range is out of the table, the segment was
+ *   retired or a write did not end in PETIT_SHM_TRIES tries
+ */
+pb_t PETIT_SHM_Read(const T_PETIT_SHM *Shm, pu8_t Block, pu16_t Start,
+		pu16_t Cnt, void *Data)
+{
+	const T_PETIT_SHM_BLOCK *block;
+	pu32_t width;
+	pu32_t seq;
+	unsigned long tries;
+
+	if (Block >= PETIT_SHM_BLOCKS)
+	{
+		return 0;
+	}
+	block = &Shm->Block[Block];
+	width = Block >= PETIT_SHM_REGISTERS ? 2U : 1U;
+	if (block->Offset == 0
+			|| ((pu32_t) Start + Cnt) * width > block->Bytes)
+	{
+		return 0;
+	}
+	for (tries = 0; tries < PETIT_SHM_TRIES; tries++)
+	{
+		if (__atomic_load_n(&Shm->Magic, __ATOMIC_RELAXED) != PETIT_SHM_MAGIC)
+		{
+			return 0;
+		}
+		seq = __atomic_load_n(&block->Seq, __ATOMIC_ACQUIRE);
+		if (seq & 1U)
+		{
+			// let a writer on the same core finish
+			sched_yield();
+			continue;
+		}
+		memcpy(Data, (const pu8_t *) Shm + block->Offset + Start * width,
+				Cnt * width);
+		// the copy is done before the sequence is read again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&block->Seq, __ATOMIC_RELAXED) == seq)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#endif /* PETIT_SHM */
@@ -0,0 +1,255 @@
+/******************************************************************************
+ * @file PetitSniff.c
+ *
+ * This file contains the bus monitor of PetitModbus.
+ *
+ * Every byte goes from the RX interrupt straight to its place in the capture
+ * ring, behind room left for the record header, and the CRC is kept up as it
+ * arrives.  When the inter-frame timer ends the frame the header is filled in
+ * and Head moves past the record, which publishes it to the reader.  A frame
+ * also ends as soon as its CRC is right at the length its function code
+ * gives, since a slave that answers too early leaves no gap to time.
+ *****************************************************************************/
+
+#include "PetitSniff.h"
+
+#if PETIT_SNIFF > 0
+
+#define C_PETIT_SNIFF_MASK (PETIT_SNIFF_SIZE - 1U)
+// the most bytes of a frame a record stores
+#define C_PETIT_SNIFF_LEN_MAX (255U)
+
+#if (PETIT_SNIFF_SIZE & C_PETIT_SNIFF_MASK) != 0 || PETIT_SNIFF_SIZE > 32768U
+#error "PETIT_SNIFF_SIZE must be a power of two up to 32768."
+#endif
+
+/**
+ * Empties the capture ring and forgets the bus.
+ */
+void PETIT_SNIFF_Init(T_PETIT_SNIFF *Sniff)
+{
+	Sniff->Head = 0;
+	Sniff->Tail = 0;
+	Sniff->Len = 0;
+	Sniff->Stamp = 0;
+	Sniff->Drop = 0;
+	Sniff->Lost = 0;
+	Sniff->Req_Open = 0;
+	Sniff->Req_Addr = 0;
+	Sniff->Req_Code = 0;
+	Sniff->Frames = 0;
+	Sniff->Crc_Errors = 0;
+	Sniff->Drops = 0;
+}
+
+/**
+ * Gives the captured records in place, without copying them.
+ * @param[out] Data the oldest byte not consumed yet
+ * @return the bytes from Data on up to the newest record or the end of the
+ *   ring, 0 if there is nothing new
+ */
+pu16_t PETIT_SNIFF_Peek(const T_PETIT_SNIFF *Sniff, const pu8_t **Data)
+{
+	pu16_t tail = Sniff->Tail;
+	pu16_t len = (pu16_t) (Sniff->Head - tail);
+	pu16_t end = PETIT_SNIFF_SIZE - (tail & C_PETIT_SNIFF_MASK);
+
+	*Data = &Sniff->Ring[tail & C_PETIT_SNIFF_MASK];
+	return len < end ? len : end;
+}
+
+/**
+ * Frees bytes given by PETIT_SNIFF_Peek once they have been sent or stored.
+ * @param[in] Len the bytes to free, at most what PETIT_SNIFF_Peek returned
+ */
+void PETIT_SNIFF_Consume(T_PETIT_SNIFF *Sniff, pu16_t Len)
+{
+	Sniff->Tail = (pu16_t) (Sniff->Tail + Len);
+}
+
+/******************************************************************************/
+
+/**
+ * @fn sniff_at
+ * @return the byte at offset I of the record being received
+ */
+static pu8_t *sniff_at(T_PETIT_SNIFF *Sniff, pu16_t I)
+{
+	return &Sniff->Ring[(pu16_t) (Sniff->Head + I) & C_PETIT_SNIFF_MASK];
+}
+
+/**
+ * @fn sniff_complete
+ * @return 1 if the frame being received has the length of a request or a
+ *   response of its function code
+ */
+static pb_t sniff_complete(T_PETIT_SNIFF *Sniff)
+{
+	pu16_t len = Sniff->Len;
+	pu8_t code;
+
+	if (len < 5U || Sniff->Drop || len > C_PETIT_SNIFF_LEN_MAX)
+	{
+		return 0;
+	}
+	code = *sniff_at(Sniff, PETIT_SNIFF_HDR + 1U);
+	if (code & 0x80U)
+	{
+		return len == 5U;
+	}
+	switch (code)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		return len == 8U || len == *sniff_at(Sniff, PETIT_SNIFF_HDR + 2U) + 5U;
+	case C_FCODE_WRITE_SINGLE_COIL:
+	case C_FCODE_WRITE_SINGLE_REGISTER:
+		return len == 8U;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		return len == 8U || (len > 9U
+				&& len == *sniff_at(Sniff, PETIT_SNIFF_HDR + 6U) + 9U);
+	default:
+		// only the timer ends frames of other functions
+		return 0;
+	}
+}
+
+/**
+ * Stores one byte of the frame on the wire.  Called from the RX interrupt.
+ */
+void PetitSniffByte(T_PETIT_MODBUS *Petit, pu8_t Rx)
+{
+	T_PETIT_SNIFF *sniff = Petit->Sniff;
+	pu16_t used;
+
+	if (sniff->Len == 0)
+	{
+		sniff->Stamp = PetitPortClock();
+		sniff->Drop = 0;
+		Petit->CRC16 = 0xFFFF;
+	}
+	PetitCRC16Add(Petit, Rx);
+	if (sniff->Len < C_PETIT_SNIFF_LEN_MAX && !sniff->Drop)
+	{
+		// the record with this byte must fit beside what is not read yet
+		used = (pu16_t) (sniff->Head - sniff->Tail);
+		if (used + PETIT_SNIFF_HDR + sniff->Len + 1U > PETIT_SNIFF_SIZE)
+		{
+			sniff->Drop = 1;
+		}
+		else
+		{
+			*sniff_at(sniff, PETIT_SNIFF_HDR + sniff->Len) = Rx;
+		}
+	}
+	if (sniff->Len < 0xFFFFU)
+	{
+		sniff->Len++;
+	}
+	if (Petit->CRC16 == 0 && sniff_complete(sniff))
+	{
+		PetitSniffEnd(Petit);
+	}
+}
+
+/**
+ * @fn sniff_answers
+ * @return 1 if a frame with a right CRC is the response to the open request
+ */
+static pb_t sniff_answers(T_PETIT_SNIFF *Sniff, pu16_t Len)
+{
+	pu8_t addr = *sniff_at(Sniff, PETIT_SNIFF_HDR);
+	pu8_t code = *sniff_at(Sniff, PETIT_SNIFF_HDR + 1U);
+
+	if (!Sniff->Req_Open || Len < 4U || addr != Sniff->Req_Addr
+			|| (code & 0x7FU) != Sniff->Req_Code)
+	{
+		return 0;
+	}
+	if (code & 0x80U)
+	{
+		return Len == 5U;
+	}
+	// a request of the same function to the same slave may follow an
+	// unanswered one, tell them apart by length where it differs
+	switch (code)
+	{
+	case C_FCODE_READ_COILS:
+	case C_FCODE_READ_DISCRETES:
+	case C_FCODE_READ_HOLDING_REGISTERS:
+	case C_FCODE_READ_INPUT_REGISTERS:
+		return Len == *sniff_at(Sniff, PETIT_SNIFF_HDR + 2U) + 5U;
+	case C_FCODE_WRITE_MULTIPLE_COILS:
+	case C_FCODE_WRITE_MULTIPLE_REGISTERS:
+		return Len == 8U;
+	default:
+		return 1;
+	}
+}
+
+/**
+ * Ends the frame on the wire and publishes its record.  Called when the
+ * inter-frame timer expires, and once the frame is complete.
+ */
+void PetitSniffEnd(T_PETIT_MODBUS *Petit)
+{
+	T_PETIT_SNIFF *sniff = Petit->Sniff;
+	pu16_t len = sniff->Len;
+	pu16_t stored = len < C_PETIT_SNIFF_LEN_MAX ? len : C_PETIT_SNIFF_LEN_MAX;
+	pu8_t flags = 0;
+
+	if (len == 0)
+	{
+		return;
+	}
+	sniff->Len = 0;
+	sniff->Frames++;
+	if (sniff->Drop)
+	{
+		sniff->Drops++;
+		sniff->Lost = 1;
+		sniff->Req_Open = 0;
+		return;
+	}
+
+	if (len > C_PETIT_SNIFF_LEN_MAX)
+	{
+		flags |= PETIT_SNIFF_TRUNCATED;
+	}
+	if (sniff->Lost)
+	{
+		flags |= PETIT_SNIFF_LOST;
+		sniff->Lost = 0;
+	}
+	// the CRC of a frame with its CRC appended is 0
+	if (len < 4U || Petit->CRC16 != 0)
+	{
+		sniff->Crc_Errors++;
+		sniff->Req_Open = 0;
+	}
+	else if (sniff_answers(sniff, len))
+	{
+		flags |= PETIT_SNIFF_CRC_OK | PETIT_SNIFF_RESPONSE;
+		sniff->Req_Open = 0;
+	}
+	else
+	{
+		flags |= PETIT_SNIFF_CRC_OK;
+		// nobody answers a broadcast
+		sniff->Req_Addr = *sniff_at(sniff, PETIT_SNIFF_HDR);
+		sniff->Req_Code = *sniff_at(sniff, PETIT_SNIFF_HDR + 1U) & 0x7FU;
+		sniff->Req_Open = sniff->Req_Addr != 0;
+	}
+
+	*sniff_at(sniff, 0) = flags;
+	*sniff_at(sniff, 1U) = (pu8_t) stored;
+	*sniff_at(sniff, 2U) = (pu8_t) (sniff->Stamp & 0xFFU);
+	*sniff_at(sniff, 3U) = (pu8_t) (sniff->Stamp >> 8U);
+	// publishes the record
+	sniff->Head = (pu16_t) (sniff->Head + PETIT_SNIFF_HDR + stored);
+}
+
+#endif /* PETIT_SNIFF */
@@ -0,0 +1,79 @@
+/******************************************************************************
+ * @file PetitSwap.c
+ *
+ * This file converts blocks of registers between the byte order they are
+ * stored in and the big-endian order of a frame.  PETIT_SWAP selects how,
+ * see PetitModbus.h.
+ *****************************************************************************/
+
+#include <string.h>
+#include "PetitModbus.h"
+
+#if PETIT_SWAP == PETIT_SWAP_SSE2
+#include <emmintrin.h>
+#elif PETIT_SWAP == PETIT_SWAP_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Writes Cnt registers to a frame, high byte first.
+ * @param Wire the frame, any alignment
+ * @param Regs the registers
+ * @param Cnt the number of registers
+ */
+void PetitRegsToWire(pu8_t *Wire, const pu16_t *Regs, pu16_t Cnt)
+{
+#if PETIT_SWAP == PETIT_SWAP_COPY
+	memcpy(Wire, Regs, 2U * Cnt);
+#else
+#if PETIT_SWAP == PETIT_SWAP_SSE2
+	for (; Cnt >= 8U; Cnt -= 8U, Regs += 8U, Wire += 16U)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) Regs);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) Wire, v);
+	}
+#elif PETIT_SWAP == PETIT_SWAP_NEON
+	for (; Cnt >= 8U; Cnt -= 8U, Regs += 8U, Wire += 16U)
+	{
+		vst1q_u8(Wire, vrev16q_u8(vld1q_u8((const uint8_t *) Regs)));
+	}
+#endif
+	for (; Cnt > 0U; Cnt--, Regs++, Wire += 2U)
+	{
+		Wire[0] = (pu8_t) (*Regs >> 8U);
+		Wire[1] = (pu8_t) (*Regs & 0xFFU);
+	}
+#endif
+}
+
+/**
+ * Reads Cnt registers from a frame, high byte first.
+ * @param Regs the registers
+ * @param Wire the frame, any alignment
+ * @param Cnt the number of registers
+ */
+void PetitRegsFromWire(pu16_t *Regs, const pu8_t *Wire, pu16_t Cnt)
+{
+#if PETIT_SWAP == PETIT_SWAP_COPY
+	memcpy(Regs, Wire, 2U * Cnt);
+#else
+#if PETIT_SWAP == PETIT_SWAP_SSE2
+	for (; Cnt >= 8U; Cnt -= 8U, Regs += 8U, Wire += 16U)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) Wire);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) Regs, v);
+	}
+#elif PETIT_SWAP == PETIT_SWAP_NEON
+	for (; Cnt >= 8U; Cnt -= 8U, Regs += 8U, Wire += 16U)
+	{
+		vst1q_u8((uint8_t *) Regs, vrev16q_u8(vld1q_u8(Wire)));
+	}
+#endif
+	for (; Cnt > 0U; Cnt--, Regs++, Wire += 2U)
+	{
+		*Regs = (pu16_t) (((pu16_t) Wire[0] << 8U) | Wire[1]);
+	}
+#endif
+}